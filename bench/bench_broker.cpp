@@ -0,0 +1,640 @@
+// Copyright Takatoshi Kondo 2024
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Broker in process without network.
+// The broker runs on one io_context with null_strand, and each client is an endpoint on
+// bench_socket. bench_socket receives the packets that the benchmark gives and doesn't
+// decode the written packets but counts them by the control packet type, so the results
+// are the cost of the broker and the endpoints only, without the kernel and the clients.
+// All clients use MQTT v5 and QoS0.
+//
+// - fanout: a PUBLISH to N subscribers of the same topic. ns/op is per delivery.
+// - filters: 10,000 subscribers have one filter each, and each PUBLISH matches one of them.
+//   The exact filters are compared with the wildcard ones. ns/op is per PUBLISH.
+// - shared: a PUBLISH to a shared subscription group of N members. ns/op is per PUBLISH.
+// - retained: SUBSCRIBE that matches N retained messages, and UNSUBSCRIBE.
+//   ns/op is per SUBSCRIBE.
+// - churn: CONNECT and DISCONNECT with N idle clients connected. ns/op is per connection.
+//
+// usage: bench_broker [max_subscribers] [smoke]
+// smoke runs all cases with 1/1000 of the operations to check that they work.
+
+#include "bench_common.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/experimental/channel.hpp>
+
+#include <async_mqtt/endpoint.hpp>
+#include <async_mqtt/null_strand.hpp>
+#include <async_mqtt/packet/packet_iterator.hpp>
+#include <async_mqtt/util/variable_bytes.hpp>
+#include <broker/endpoint_variant.hpp>
+#include <broker/broker.hpp>
+
+namespace async_mqtt {
+
+namespace as = boost::asio;
+
+/**
+ * @brief the number of written packets for each control packet type
+ */
+struct packet_counter {
+    std::size_t get(control_packet_type type) const {
+        return counts[static_cast<std::uint8_t>(type) >> 4];
+    }
+
+    std::array<std::size_t, 16> counts{};
+    std::size_t closed = 0;
+};
+
+/**
+ * @brief network-free socket for the broker benchmark
+ * The packets given by emulate_recv() are read by the endpoint.
+ * The written packets are counted by packet_counter and discarded.
+ */
+struct bench_socket {
+    using this_type = bench_socket;
+    using executor_type = as::any_io_executor;
+
+    bench_socket(
+        packet_counter& counter,
+        as::any_io_executor exe
+    )
+        :counter_{counter},
+         exe_{force_move(exe)}
+    {}
+
+    void emulate_recv(std::string packet) {
+        if (!ch_recv_.try_send(error_code{}, force_move(packet))) {
+            throw std::runtime_error("bench_socket: receive queue is full");
+        }
+    }
+
+    void emulate_close() {
+        ch_recv_.try_send(errc::make_error_code(errc::connection_reset), std::string{});
+    }
+
+    as::any_io_executor get_executor() const {
+        return exe_;
+    }
+
+    bool is_open() const {
+        return open_;
+    }
+
+    void close(error_code&) {
+        if (!open_) return;
+        open_ = false;
+        ++counter_.closed;
+        ch_recv_.close();
+    }
+
+    template <typename MutableBufferSequence, typename CompletionToken>
+    auto async_read_some(
+        MutableBufferSequence const& mb,
+        CompletionToken&& token
+    ) {
+        return as::async_compose<
+            CompletionToken,
+            void(error_code const& ec, std::size_t)
+        > (
+            read_impl{*this, mb, false},
+            token,
+            get_executor()
+        );
+    }
+
+    template <typename MutableBufferSequence, typename CompletionToken>
+    auto async_read(
+        MutableBufferSequence const& mb,
+        CompletionToken&& token
+    ) {
+        return as::async_compose<
+            CompletionToken,
+            void(error_code const& ec, std::size_t)
+        > (
+            read_impl{*this, mb, true},
+            token,
+            get_executor()
+        );
+    }
+
+    template <typename ConstBufferSequence, typename CompletionToken>
+    auto async_write_some(
+        ConstBufferSequence const& buffers,
+        CompletionToken&& token
+    ) {
+        error_code ec;
+        std::size_t size = 0;
+        if (open_) {
+            size = count(buffers);
+        }
+        else {
+            ec = errc::make_error_code(errc::connection_reset);
+        }
+        return as::async_compose<
+            CompletionToken,
+            void(error_code const& ec, std::size_t)
+        > (
+            [ec, size](auto& self) {
+                self.complete(ec, size);
+            },
+            token,
+            get_executor()
+        );
+    }
+
+private:
+    // the endpoint reads one packet by some reads to the single buffer
+    struct read_impl {
+        this_type& socket;
+        as::mutable_buffer mb;
+        bool all;
+        std::size_t transferred = 0;
+
+        template <typename Self>
+        void operator()(
+            Self& self
+        ) {
+            auto& a_socket{socket};
+            auto copied = as::buffer_copy(mb, as::buffer(a_socket.packet_) + a_socket.pos_);
+            a_socket.pos_ += copied;
+            mb += copied;
+            transferred += copied;
+            if (mb.size() == 0 || (!all && transferred != 0)) {
+                self.complete(error_code{}, transferred);
+                return;
+            }
+            a_socket.ch_recv_.async_receive(
+                force_move(self)
+            );
+        }
+
+        template <typename Self>
+        void operator()(
+            Self& self,
+            error_code const& ec,
+            std::string packet
+        ) {
+            if (ec) {
+                self.complete(ec, transferred);
+                return;
+            }
+            socket.packet_ = force_move(packet);
+            socket.pos_ = 0;
+            (*this)(self);
+        }
+    };
+
+    template <typename ConstBufferSequence>
+    std::size_t count(ConstBufferSequence const& buffers) {
+        auto it = as::buffers_iterator<ConstBufferSequence>::begin(buffers);
+        auto end = as::buffers_iterator<ConstBufferSequence>::end(buffers);
+        auto size = static_cast<std::size_t>(std::distance(it, end));
+        while (it != end) {
+            ++counter_.counts[static_cast<std::uint8_t>(*it) >> 4];
+            ++it; // it points to the first byte of remaining length
+            auto remlen_opt = variable_bytes_to_val(it, end);
+            BOOST_ASSERT(remlen_opt);
+            std::advance(it, static_cast<std::ptrdiff_t>(*remlen_opt));
+        }
+        return size;
+    }
+
+    using channel_t = as::experimental::channel<void(error_code, std::string)>;
+    packet_counter& counter_;
+    as::any_io_executor exe_;
+    channel_t ch_recv_{exe_, 16};
+    std::string packet_;
+    std::size_t pos_ = 0;
+    bool open_ = true;
+};
+
+template <>
+struct layer_customize<bench_socket> {
+    template <
+        typename MutableBufferSequence,
+        typename CompletionToken
+    >
+    static auto
+    async_read(
+        bench_socket& stream,
+        MutableBufferSequence const& mbs,
+        CompletionToken&& token
+    ) {
+        return stream.async_read(mbs, std::forward<CompletionToken>(token));
+    }
+
+    template <
+        typename MutableBufferSequence,
+        typename CompletionToken
+    >
+    static auto
+    async_read_some(
+        bench_socket& stream,
+        MutableBufferSequence const& mbs,
+        CompletionToken&& token
+    ) {
+        return stream.async_read_some(mbs, std::forward<CompletionToken>(token));
+    }
+
+    template <
+        typename ConstBufferSequence,
+        typename CompletionToken
+    >
+    static auto
+    async_write(
+        bench_socket& stream,
+        ConstBufferSequence const& cbs,
+        CompletionToken&& token
+    ) {
+        // bench_socket always writes all buffers
+        return stream.async_write_some(cbs, std::forward<CompletionToken>(token));
+    }
+
+    template <
+        typename CompletionToken
+    >
+    static auto
+    async_close(
+        bench_socket& stream,
+        CompletionToken&& token
+    ) {
+        return as::async_compose<
+            CompletionToken,
+            void(error_code const& ec)
+        > (
+            [&stream](auto& self) {
+                error_code ec;
+                stream.close(ec);
+                self.complete(ec);
+            },
+            token,
+            stream.get_executor()
+        );
+    }
+};
+
+} // namespace async_mqtt
+
+namespace am = async_mqtt;
+namespace as = boost::asio;
+
+namespace {
+
+using ep_t = am::endpoint<am::role::server, am::bench_socket>;
+using epv_t = am::endpoint_variant<am::role::server, am::bench_socket>;
+using cpt = am::control_packet_type;
+
+constexpr std::size_t payload_size = 64;
+
+template <typename Packet>
+std::string serialize(Packet const& packet) {
+    return am::to_string(packet.const_buffer_sequence());
+}
+
+std::string publish_packet(std::string topic, bool retain = false) {
+    auto opts = am::pub::opts{am::qos::at_most_once};
+    if (retain) opts = opts | am::pub::retain::yes;
+    return serialize(
+        am::v5::publish_packet{
+            force_move(topic),
+            std::string(payload_size, 'x'),
+            opts
+        }
+    );
+}
+
+// The broker and its clients on one io_context.
+// Each step gives the packets to the clients, and then runs the handlers until the
+// expected packets are written by the broker.
+class harness {
+public:
+    harness()
+        :brk_{ioc_}
+    {}
+
+    ~harness() {
+        // close all connections in order to release the endpoints that wait for reading
+        std::size_t open = 0;
+        for (auto& ep : eps_) {
+            if (ep->next_layer().is_open()) {
+                ep->next_layer().emulate_close();
+                ++open;
+            }
+        }
+        auto closed = counter_.closed + open;
+        try {
+            run_until([&] { return counter_.closed == closed; });
+        }
+        catch (std::exception const& e) {
+            std::cout << e.what() << std::endl;
+        }
+    }
+
+    /**
+     * @brief run the handlers until done() returns true
+     * The broker and the clients are in this process, so no ready handler before done()
+     * means that the expected packet is never written.
+     */
+    template <typename Done>
+    void run_until(Done&& done) {
+        while (!done()) {
+            if (ioc_.stopped()) ioc_.restart();
+            if (ioc_.poll_one() == 0) {
+                throw std::runtime_error("harness: stalled");
+            }
+        }
+    }
+
+    ep_t& accept() {
+        auto ep = ep_t::create(
+            am::protocol_version::undetermined,
+            // for bench_socket args
+            counter_,
+            am::make_null_strand(ioc_.get_executor())
+        );
+        brk_.handle_accept(epv_t{ep});
+        eps_.push_back(ep);
+        return *ep;
+    }
+
+    /**
+     * @brief connect count clients named prefix + index
+     */
+    std::vector<ep_t*> connect(std::string const& prefix, std::size_t count) {
+        std::vector<ep_t*> eps;
+        eps.reserve(count);
+        auto connack = counter_.get(cpt::connack) + count;
+        for (std::size_t i = 0; i != count; ++i) {
+            auto& ep = accept();
+            ep.next_layer().emulate_recv(
+                serialize(
+                    am::v5::connect_packet{
+                        true,   // clean_start
+                        0,      // keep_alive
+                        prefix + std::to_string(i)
+                    }
+                )
+            );
+            eps.push_back(&ep);
+        }
+        run_until([&] { return counter_.get(cpt::connack) == connack; });
+        return eps;
+    }
+
+    void subscribe(std::vector<ep_t*> const& eps, std::vector<std::string> const& filters) {
+        BOOST_ASSERT(eps.size() == filters.size());
+        auto suback = counter_.get(cpt::suback) + eps.size();
+        for (std::size_t i = 0; i != eps.size(); ++i) {
+            eps[i]->next_layer().emulate_recv(
+                serialize(
+                    am::v5::subscribe_packet{
+                        1, // packet_id
+                        { {filters[i], am::qos::at_most_once} }
+                    }
+                )
+            );
+        }
+        run_until([&] { return counter_.get(cpt::suback) == suback; });
+    }
+
+    /**
+     * @brief ep sends the packet, and then wait until the broker writes count PUBLISH packets
+     */
+    void publish(ep_t& ep, std::string const& packet, std::size_t count) {
+        auto expected = counter_.get(cpt::publish) + count;
+        ep.next_layer().emulate_recv(packet);
+        run_until([&] { return counter_.get(cpt::publish) == expected; });
+    }
+
+    /**
+     * @brief ep sends the packet, and then wait until the broker writes the response
+     */
+    void request(ep_t& ep, std::string const& packet, cpt response) {
+        auto expected = counter_.get(response) + 1;
+        ep.next_layer().emulate_recv(packet);
+        run_until([&] { return counter_.get(response) == expected; });
+    }
+
+    /**
+     * @brief ep sends DISCONNECT, and then wait until the broker closes the connection
+     */
+    void disconnect(ep_t& ep) {
+        auto expected = counter_.closed + 1;
+        ep.next_layer().emulate_recv(serialize(am::v5::disconnect_packet{}));
+        run_until([&] { return counter_.closed == expected; });
+    }
+
+    /**
+     * @brief drop the disconnected clients
+     */
+    void release_closed() {
+        eps_.erase(
+            std::remove_if(
+                eps_.begin(),
+                eps_.end(),
+                [](auto const& ep) { return !ep->next_layer().is_open(); }
+            ),
+            eps_.end()
+        );
+    }
+
+private:
+    as::io_context ioc_{BOOST_ASIO_CONCURRENCY_HINT_UNSAFE_IO};
+    am::packet_counter counter_;
+    am::broker<epv_t> brk_;
+    std::vector<std::shared_ptr<ep_t>> eps_;
+};
+
+// divisor of the numbers of operations. It is set by the smoke mode.
+std::size_t ops_divisor = 1;
+
+std::size_t ops(std::size_t n) {
+    return std::max(n / ops_divisor, std::size_t(1));
+}
+
+// The numbers of subscribers are 1, 10, 100, ... up to max_subscribers
+std::vector<std::size_t> sizes(std::size_t max_subscribers, std::size_t limit) {
+    std::vector<std::size_t> ns;
+    for (std::size_t n = 1; n <= std::min(max_subscribers, limit); n *= 10) {
+        ns.push_back(n);
+    }
+    return ns;
+}
+
+void fanout(std::size_t max_subscribers) {
+    auto const deliveries = ops(1'000'000);
+    for (auto n : sizes(max_subscribers, 100'000)) {
+        harness h;
+        auto& pub = *h.connect("pub", 1).front();
+        auto subs = h.connect("sub", n);
+        h.subscribe(subs, std::vector<std::string>(n, "bench/fanout"));
+        auto packet = publish_packet("bench/fanout");
+        auto publishes = std::max(deliveries / n, std::size_t(1));
+        bench::run_batch(
+            "fanout " + std::to_string(n) + " subscribers",
+            publishes * n,
+            [&] {
+                for (std::size_t i = 0; i != publishes; ++i) {
+                    h.publish(pub, packet, n);
+                }
+            }
+        );
+    }
+}
+
+void filters(std::size_t max_subscribers) {
+    auto const publishes = ops(100'000);
+    auto n = std::min(max_subscribers, std::size_t(10'000));
+    struct kind {
+        char const* name;
+        std::string (*filter)(std::size_t);
+    };
+    kind const kinds[] = {
+        {"exact",           [](std::size_t i) { return "dev/" + std::to_string(i) + "/temp"; }},
+        {"dev/<n>/+",       [](std::size_t i) { return "dev/" + std::to_string(i) + "/+"; }},
+        {"dev/<n>/#",       [](std::size_t i) { return "dev/" + std::to_string(i) + "/#"; }},
+        {"+/<n>/temp",      [](std::size_t i) { return "+/" + std::to_string(i) + "/temp"; }},
+    };
+    std::vector<std::string> packets;
+    for (std::size_t i = 0; i != 64; ++i) {
+        packets.push_back(publish_packet("dev/" + std::to_string(i * 7919 % n) + "/temp"));
+    }
+    for (auto const& k : kinds) {
+        harness h;
+        auto& pub = *h.connect("pub", 1).front();
+        auto subs = h.connect("sub", n);
+        std::vector<std::string> fs;
+        fs.reserve(n);
+        for (std::size_t i = 0; i != n; ++i) fs.push_back(k.filter(i));
+        h.subscribe(subs, fs);
+        bench::run_batch(
+            "filters " + std::to_string(n) + " " + k.name,
+            publishes,
+            [&] {
+                for (std::size_t i = 0; i != publishes; ++i) {
+                    h.publish(pub, packets[i % packets.size()], 1);
+                }
+            }
+        );
+    }
+}
+
+void shared(std::size_t max_subscribers) {
+    auto const publishes = ops(100'000);
+    for (auto n : sizes(max_subscribers, 1'000)) {
+        harness h;
+        auto& pub = *h.connect("pub", 1).front();
+        auto subs = h.connect("sub", n);
+        h.subscribe(subs, std::vector<std::string>(n, "$share/bench/bench/shared"));
+        auto packet = publish_packet("bench/shared");
+        bench::run_batch(
+            "shared " + std::to_string(n) + " members",
+            publishes,
+            [&] {
+                for (std::size_t i = 0; i != publishes; ++i) {
+                    h.publish(pub, packet, 1);
+                }
+            }
+        );
+    }
+}
+
+void retained() {
+    auto subscribe = serialize(
+        am::v5::subscribe_packet{
+            1, // packet_id
+            { {"retained/#", am::qos::at_most_once} }
+        }
+    );
+    auto unsubscribe = serialize(
+        am::v5::unsubscribe_packet{
+            1, // packet_id
+            { "retained/#" }
+        }
+    );
+    for (std::size_t n : {1, 100, 10'000}) {
+        harness h;
+        auto& pub = *h.connect("pub", 1).front();
+        auto& sub = *h.connect("sub", 1).front();
+        // QoS1 in order to wait for PUBACK. The retained messages are delivered as QoS0.
+        for (std::size_t i = 0; i != n; ++i) {
+            h.request(
+                pub,
+                serialize(
+                    am::v5::publish_packet{
+                        1, // packet_id
+                        "retained/" + std::to_string(i),
+                        std::string(payload_size, 'x'),
+                        am::qos::at_least_once | am::pub::retain::yes
+                    }
+                ),
+                cpt::puback
+            );
+        }
+        auto subscribes = ops(std::max(std::size_t(100'000) / n, std::size_t(10)));
+        bench::run_batch(
+            "retained " + std::to_string(n) + " messages on subscribe",
+            subscribes,
+            [&] {
+                for (std::size_t i = 0; i != subscribes; ++i) {
+                    h.publish(sub, subscribe, n);
+                    h.request(sub, unsubscribe, cpt::unsuback);
+                }
+            }
+        );
+    }
+}
+
+void churn(std::size_t max_subscribers) {
+    auto const connections = ops(100'000);
+    auto connect = serialize(
+        am::v5::connect_packet{
+            true,   // clean_start
+            0,      // keep_alive
+            "churn"
+        }
+    );
+    for (auto idle : {std::size_t(0), std::min(max_subscribers, std::size_t(10'000))}) {
+        harness h;
+        h.connect("idle", idle);
+        bench::run_batch(
+            "churn " + std::to_string(idle) + " idle clients",
+            connections,
+            [&] {
+                for (std::size_t i = 0; i != connections; ++i) {
+                    auto& ep = h.accept();
+                    h.request(ep, connect, cpt::connack);
+                    h.disconnect(ep);
+                    if (i % 1024 == 1023) h.release_closed();
+                }
+            }
+        );
+    }
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    std::size_t max_subscribers = 100'000;
+    if (argc > 1) max_subscribers = std::strtoul(argv[1], nullptr, 10);
+    if (argc > 2 && std::string_view{argv[2]} == "smoke") ops_divisor = 1'000;
+    fanout(max_subscribers);
+    filters(max_subscribers);
+    shared(max_subscribers);
+    retained();
+    churn(max_subscribers);
+}
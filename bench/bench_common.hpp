@@ -0,0 +1,180 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_BENCH_COMMON_HPP)
+#define ASYNC_MQTT_BENCH_COMMON_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <new>
+#include <string_view>
+
+// Each benchmark is a single translation unit executable, so the global allocation
+// functions are replaced here in order to count allocations and allocated bytes.
+// Each allocation has a header that keeps its size, so the live bytes (allocated
+// minus freed) and their peak are also tracked.
+
+namespace bench {
+
+inline std::atomic<std::size_t> alloc_count{0};
+inline std::atomic<std::size_t> alloc_bytes{0};
+inline std::atomic<std::size_t> live_bytes{0};
+inline std::atomic<std::size_t> peak_bytes{0};
+
+/**
+ * @brief get the bytes that are allocated and not freed yet
+ */
+inline std::size_t heap_live() {
+    return live_bytes.load();
+}
+
+/**
+ * @brief get the peak of heap_live() since the last reset_heap_peak()
+ */
+inline std::size_t heap_peak() {
+    return peak_bytes.load();
+}
+
+inline void reset_heap_peak() {
+    peak_bytes.store(live_bytes.load());
+}
+
+struct alloc_snapshot {
+    std::size_t count;
+    std::size_t bytes;
+};
+
+inline alloc_snapshot alloc_now() {
+    return {alloc_count.load(), alloc_bytes.load()};
+}
+
+inline alloc_snapshot alloc_since(alloc_snapshot const& s) {
+    auto n = alloc_now();
+    return {n.count - s.count, n.bytes - s.bytes};
+}
+
+/**
+ * @brief run f() iterations times and report ns/op and allocations/op
+ * @param name label of the result line
+ * @param iterations number of calls
+ * @param f benchmark body. called with the iteration index
+ */
+template <typename F>
+inline void run(std::string_view name, std::size_t iterations, F&& f) {
+    auto as = alloc_now();
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i != iterations; ++i) {
+        f(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto ad = alloc_since(as);
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    std::cout
+        << std::left << std::setw(48) << name
+        << std::right
+        << std::setw(12) << std::fixed << std::setprecision(1)
+        << double(ns) / double(iterations) << " ns/op"
+        << std::setw(10) << std::setprecision(2)
+        << double(ad.count) / double(iterations) << " allocs/op"
+        << std::setw(12) << std::setprecision(1)
+        << double(ad.bytes) / double(iterations) << " bytes/op"
+        << std::endl;
+}
+
+/**
+ * @brief call f() once that performs ops operations and report ns/op and allocations/op
+ * It is for asynchronous operations that are chained in f().
+ * @param name label of the result line
+ * @param ops number of operations that f() performs
+ * @param f benchmark body
+ */
+template <typename F>
+inline void run_batch(std::string_view name, std::size_t ops, F&& f) {
+    auto as = alloc_now();
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    auto ad = alloc_since(as);
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    std::cout
+        << std::left << std::setw(48) << name
+        << std::right
+        << std::setw(12) << std::fixed << std::setprecision(1)
+        << double(ns) / double(ops) << " ns/op"
+        << std::setw(10) << std::setprecision(2)
+        << double(ad.count) / double(ops) << " allocs/op"
+        << std::setw(12) << std::setprecision(1)
+        << double(ad.bytes) / double(ops) << " bytes/op"
+        << std::endl;
+}
+
+/**
+ * @brief report heap usage of constructing count objects by f()
+ */
+template <typename F>
+inline void footprint(std::string_view name, std::size_t sizeof_value, F&& f) {
+    auto as = alloc_now();
+    f();
+    auto ad = alloc_since(as);
+    std::cout
+        << std::left << std::setw(48) << name
+        << std::right
+        << " sizeof:" << std::setw(8) << sizeof_value
+        << " heap:" << std::setw(8) << ad.bytes
+        << " allocs:" << std::setw(4) << ad.count
+        << std::endl;
+}
+
+template <typename T>
+inline void do_not_optimize(T const& v) {
+#if defined(_MSC_VER)
+    static volatile char const* sink;
+    sink = reinterpret_cast<char const volatile*>(&v);
+#else  // defined(_MSC_VER)
+    asm volatile("" : : "r,m"(v) : "memory");
+#endif // defined(_MSC_VER)
+}
+
+} // namespace bench
+
+namespace bench {
+
+// keeps the alignment of the returned pointer
+static constexpr std::size_t alloc_header_size = alignof(std::max_align_t);
+
+} // namespace bench
+
+void* operator new(std::size_t size) {
+    bench::alloc_count.fetch_add(1, std::memory_order_relaxed);
+    bench::alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    auto live = bench::live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    auto peak = bench::peak_bytes.load(std::memory_order_relaxed);
+    while (live > peak &&
+           !bench::peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+    if (auto p = static_cast<char*>(std::malloc(size + bench::alloc_header_size))) {
+        *reinterpret_cast<std::size_t*>(p) = size;
+        return p + bench::alloc_header_size;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept {
+    if (!p) return;
+    auto h = static_cast<char*>(p) - bench::alloc_header_size;
+    bench::live_bytes.fetch_sub(*reinterpret_cast<std::size_t*>(h), std::memory_order_relaxed);
+    std::free(h);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    operator delete(p);
+}
+
+#endif // ASYNC_MQTT_BENCH_COMMON_HPP
@@ -0,0 +1,104 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Allocations to emit the buffers of a packet for a write.
+// const_buffer_sequence() returns a new vector (and a vector per property).
+// append_const_buffer_sequence() appends to the vector that the stream reuses,
+// as the stream does for a single write and for a bulk write batch.
+
+#include "bench_common.hpp"
+
+#include <string>
+#include <vector>
+
+#include <async_mqtt/packet/packet_variant.hpp>
+
+namespace am = async_mqtt;
+namespace as = boost::asio;
+
+namespace {
+
+template <typename Packet>
+void compare(std::string_view name, Packet const& packet, std::size_t iterations) {
+    std::size_t sum = 0;
+    bench::run(
+        std::string{name} + " const_buffer_sequence",
+        iterations,
+        [&](std::size_t) {
+            auto cbs = packet.const_buffer_sequence();
+            sum += cbs.size();
+        }
+    );
+    std::vector<as::const_buffer> cbs;
+    bench::run(
+        std::string{name} + " append_const_buffer_sequence",
+        iterations,
+        [&](std::size_t) {
+            cbs.clear();
+            packet.append_const_buffer_sequence(cbs);
+            sum += cbs.size();
+        }
+    );
+    bench::do_not_optimize(sum);
+}
+
+} // anonymous namespace
+
+int main() {
+    std::size_t const iterations = 1'000'000;
+    std::string topic = "building/floor12/room34/sensor/temperature";
+    std::vector<am::buffer> payload{am::buffer{std::string(256, 'x')}};
+    am::properties props{
+        am::property::content_type{"application/json"},
+        am::property::message_expiry_interval{60},
+        am::property::user_property{"key", "value"}
+    };
+
+    compare(
+        "v3.1.1 publish",
+        am::v3_1_1::publish_packet{1, topic, payload, am::qos::at_least_once},
+        iterations
+    );
+    compare(
+        "v5 publish 3 props",
+        am::v5::publish_packet{1, topic, payload, am::qos::at_least_once, props},
+        iterations
+    );
+    compare(
+        "v5 puback",
+        am::v5::puback_packet{1, am::puback_reason_code::success},
+        iterations
+    );
+
+    // bulk write batch of 16 PUBLISH packets
+    am::v5::publish_packet packet{1, topic, payload, am::qos::at_least_once, props};
+    std::vector<as::const_buffer> batch;
+    std::size_t sum = 0;
+    bench::run(
+        "v5 publish x16 batch (old: insert per packet)",
+        iterations / 16,
+        [&](std::size_t) {
+            batch.clear();
+            for (int i = 0; i != 16; ++i) {
+                auto cbs = packet.const_buffer_sequence();
+                batch.insert(batch.end(), cbs.begin(), cbs.end());
+            }
+            sum += batch.size();
+        }
+    );
+    bench::run(
+        "v5 publish x16 batch (append)",
+        iterations / 16,
+        [&](std::size_t) {
+            batch.clear();
+            for (int i = 0; i != 16; ++i) {
+                packet.append_const_buffer_sequence(batch);
+            }
+            sum += batch.size();
+        }
+    );
+    bench::do_not_optimize(sum);
+}
@@ -0,0 +1,205 @@
+// Copyright Takatoshi Kondo 2024
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Cost of the broker metrics.
+// Each primitive is measured, and then a publish-like workload (parse a received
+// v5 PUBLISH, match the topic against 2,008 subscriptions and build the outgoing
+// packets for about 10 subscribers) is compared with the instrumentation that
+// broker does per PUBLISH. The target overhead is under 1%.
+// The workload doesn't include the socket writes, so the overhead on the broker
+// is smaller than the result.
+// Finally, counting from several threads is compared with a shared atomic counter.
+//
+// usage: bench_metrics [max_threads]
+
+#include "bench_common.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <async_mqtt/packet/v5_publish.hpp>
+#include <async_mqtt/packet/packet_variant.hpp>
+#include <async_mqtt/impl/buffer_to_packet_variant.ipp>
+
+#include <broker/metrics.hpp>
+#include <broker/publish_fanout.hpp>
+#include <broker/subscription_map.hpp>
+
+namespace am = async_mqtt;
+
+namespace {
+
+using metrics = am::broker_metrics;
+using map_t = am::multiple_subscription_map<std::string, std::size_t>;
+
+constexpr std::size_t ops = 1'000'000;
+constexpr std::size_t publishes = 200'000;
+constexpr std::size_t subscriptions = 1'000;
+
+am::buffer make_packet(std::size_t n) {
+    am::v5::publish_packet packet{
+        1,
+        "dev/" + std::to_string(n) + "/temp",
+        std::string(128, 'x'),
+        am::qos::at_least_once,
+        am::properties{am::property::content_type{"application/json"}}
+    };
+    return am::buffer{am::to_string(packet.const_buffer_sequence())};
+}
+
+// The same calls as broker::publish_handler() and broker::do_publish_local()
+void instrument_publish(metrics& m, std::size_t bytes, std::size_t deliveries) {
+    std::optional<std::chrono::steady_clock::time_point> start;
+    if (m.sample_latency()) start.emplace(std::chrono::steady_clock::now());
+    m.add(metrics::counter::publish_received);
+    m.add(metrics::counter::publish_received_bytes, bytes);
+    m.add(metrics::counter::publish_sent, deliveries);
+    m.record(metrics::histogram::publish_fanout, deliveries);
+    if (start) m.record_since(metrics::histogram::publish_handler_ns, *start);
+}
+
+std::size_t handle_publish(map_t const& map, am::buffer const& buf) {
+    std::size_t sum = 0;
+    am::error_code ec;
+    auto pv = am::buffer_to_packet_variant(buf, am::protocol_version::v5, ec);
+    auto p = pv.get_if<am::v5::publish_packet>();
+    am::publish_fanout fanout{p->topic_as_buffer(), p->payload_as_buffer(), p->props_as_block()};
+    map.find(
+        p->topic(),
+        [&](std::string const&, std::size_t) {
+            auto packet = fanout.v5_packet(p->opts(), std::nullopt);
+            packet.set_packet_id(1);
+            sum += packet.size();
+        }
+    );
+    return sum;
+}
+
+double contended(std::size_t threads, bool shared_atomic) {
+    metrics m;
+    std::atomic<std::uint64_t> counter{0};
+    std::atomic<bool> start{false};
+    std::vector<std::thread> ths;
+    for (std::size_t t = 0; t != threads; ++t) {
+        ths.emplace_back(
+            [&] {
+                while (!start.load()) std::this_thread::yield();
+                for (std::size_t i = 0; i != ops; ++i) {
+                    if (shared_atomic) {
+                        counter.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    else {
+                        m.add(metrics::counter::publish_received);
+                    }
+                }
+            }
+        );
+    }
+    auto begin = std::chrono::steady_clock::now();
+    start.store(true);
+    for (auto& th : ths) th.join();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - begin
+    ).count();
+    return double(ns) / double(ops * threads);
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    std::size_t max_threads = 4;
+    if (argc > 1) max_threads = std::strtoul(argv[1], nullptr, 10);
+
+    metrics m;
+    std::uint64_t sum = 0;
+
+    bench::run(
+        "counter add",
+        ops,
+        [&](std::size_t i) {
+            m.add(metrics::counter::publish_sent, i & 3);
+        }
+    );
+    bench::run(
+        "histogram record",
+        ops,
+        [&](std::size_t i) {
+            m.record(metrics::histogram::publish_fanout, i & 0xfff);
+        }
+    );
+    bench::run(
+        "steady_clock::now() + record_since",
+        ops,
+        [&](std::size_t) {
+            m.record_since(metrics::histogram::publish_handler_ns, std::chrono::steady_clock::now());
+        }
+    );
+    bench::run(
+        "collect",
+        1000,
+        [&](std::size_t) {
+            sum += m.collect().get(metrics::counter::publish_sent);
+        }
+    );
+
+    map_t map;
+    // Each message is delivered to about 10 subscribers.
+    for (std::size_t i = 0; i != subscriptions; ++i) {
+        auto cid = "cid" + std::to_string(i);
+        map.insert_or_assign("dev/" + std::to_string(i) + "/temp", cid, i);
+        map.insert_or_assign("dev/" + std::to_string(i) + "/+", cid, i);
+        if (i < 8) map.insert_or_assign("dev/+/temp", cid, i);
+    }
+    std::vector<am::buffer> packets;
+    for (std::size_t i = 0; i != 64; ++i) packets.push_back(make_packet(i * 7));
+
+    // The instrumentation is measured separately because its cost is smaller than
+    // the run-to-run variance of the workload.
+    auto per_op =
+        [&](auto f) {
+            auto begin = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i != publishes; ++i) f(i);
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - begin
+            ).count();
+            return double(ns) / double(publishes);
+        };
+    auto workload = per_op(
+        [&](std::size_t i) {
+            sum += handle_publish(map, packets[i % packets.size()]);
+        }
+    );
+    auto instrumentation = per_op(
+        [&](std::size_t i) {
+            instrument_publish(m, 128, 8 + i % 4);
+        }
+    );
+    std::cout
+        << std::left << std::setw(48) << "publish workload"
+        << std::right << std::setw(12) << std::fixed << std::setprecision(1)
+        << workload << " ns/op" << std::endl;
+    std::cout
+        << std::left << std::setw(48) << "metrics per publish"
+        << std::right << std::setw(12) << std::fixed << std::setprecision(1)
+        << instrumentation << " ns/op"
+        << std::setw(10) << std::setprecision(2)
+        << instrumentation / workload * 100.0 << " % of workload" << std::endl;
+
+    for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+        std::cout
+            << std::left << std::setw(48) << ("counter " + std::to_string(threads) + " threads")
+            << std::right << std::setw(12) << std::fixed << std::setprecision(1)
+            << contended(threads, false) << " ns/op"
+            << "  shared atomic:" << std::setw(8) << contended(threads, true) << " ns/op"
+            << std::endl;
+    }
+    bench::do_not_optimize(sum);
+}
@@ -0,0 +1,151 @@
+// Copyright Takatoshi Kondo 2024
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Send and receive 100,000 QoS0 PUBLISH packets on one thread through an endpoint on
+// the stub socket. Compare the endpoint on boost::asio::strand with the one on
+// null_strand, and the one on the io_context executor as the baseline.
+// The difference is the per-packet cost of the strand. The next operation is posted to
+// the executor in order not to grow the stack, so each packet also pays one post.
+
+#include "bench_common.hpp"
+
+#include <functional>
+#include <string>
+
+#include <boost/asio.hpp>
+
+#include <async_mqtt/endpoint.hpp>
+#include <async_mqtt/null_strand.hpp>
+
+#include "stub_socket.hpp"
+
+namespace am = async_mqtt;
+namespace as = boost::asio;
+
+namespace {
+
+constexpr std::size_t packets = 100'000;
+constexpr auto version = am::protocol_version::v3_1_1;
+
+auto connect_packet() {
+    return am::v3_1_1::connect_packet{
+        true,   // clean_session
+        0x0, // keep_alive
+        "cid1",
+        std::nullopt, // will
+        std::nullopt, // user_name
+        std::nullopt  // password
+    };
+}
+
+auto publish_packet() {
+    return am::v3_1_1::publish_packet{
+        "building/floor12/room34/sensor/temperature",
+        std::string(64, 'x'),
+        am::qos::at_most_once
+    };
+}
+
+template <typename Executor>
+void send(std::string const& name, as::io_context& ioc, Executor exe) {
+    auto ep = am::endpoint<am::role::client, am::stub_socket>::create(
+        version,
+        // for stub_socket args
+        version,
+        exe
+    );
+    ep->next_layer().set_recv_packets(
+        {
+            {am::v3_1_1::connack_packet{false, am::connect_return_code::accepted}}
+        }
+    );
+    ep->async_send(connect_packet(), [](am::error_code const&) {});
+    ep->async_recv([](am::error_code const&, am::packet_variant) {});
+    ioc.run();
+    ioc.restart();
+
+    auto packet = publish_packet();
+    std::size_t rest = packets;
+    std::function<void()> send_one =
+        [&] {
+            ep->async_send(
+                packet,
+                [&](am::error_code const& ec) {
+                    if (ec) {
+                        std::cout << "send error:" << ec.message() << std::endl;
+                        return;
+                    }
+                    if (--rest != 0) as::post(exe, [&] { send_one(); });
+                }
+            );
+        };
+    bench::run_batch(
+        name + " send",
+        packets,
+        [&] {
+            as::post(exe, [&] { send_one(); });
+            ioc.run();
+        }
+    );
+    ioc.restart();
+}
+
+template <typename Executor>
+void recv(std::string const& name, as::io_context& ioc, Executor exe) {
+    auto ep = am::endpoint<am::role::client, am::stub_socket>::create(
+        version,
+        // for stub_socket args
+        version,
+        exe
+    );
+    am::stub_socket::packet_queue_t recv_packets;
+    recv_packets.emplace_back(am::v3_1_1::connack_packet{false, am::connect_return_code::accepted});
+    auto packet = publish_packet();
+    for (std::size_t i = 0; i != packets; ++i) {
+        recv_packets.emplace_back(packet);
+    }
+    ep->next_layer().set_recv_packets(am::force_move(recv_packets));
+    ep->async_send(connect_packet(), [](am::error_code const&) {});
+    ep->async_recv([](am::error_code const&, am::packet_variant) {});
+    ioc.run();
+    ioc.restart();
+
+    std::size_t rest = packets;
+    std::function<void()> recv_one =
+        [&] {
+            ep->async_recv(
+                [&](am::error_code const& ec, am::packet_variant pv) {
+                    if (ec) {
+                        std::cout << "recv error:" << ec.message() << std::endl;
+                        return;
+                    }
+                    bench::do_not_optimize(pv);
+                    if (--rest != 0) as::post(exe, [&] { recv_one(); });
+                }
+            );
+        };
+    bench::run_batch(
+        name + " recv",
+        packets,
+        [&] {
+            as::post(exe, [&] { recv_one(); });
+            ioc.run();
+        }
+    );
+    ioc.restart();
+}
+
+} // anonymous namespace
+
+int main() {
+    as::io_context ioc{BOOST_ASIO_CONCURRENCY_HINT_UNSAFE_IO};
+    send("io_context executor", ioc, ioc.get_executor());
+    send("strand", ioc, as::make_strand(ioc.get_executor()));
+    send("null_strand", ioc, am::make_null_strand(ioc.get_executor()));
+    recv("io_context executor", ioc, ioc.get_executor());
+    recv("strand", ioc, as::make_strand(ioc.get_executor()));
+    recv("null_strand", ioc, am::make_null_strand(ioc.get_executor()));
+}
@@ -0,0 +1,168 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Compare ioc_queue (io_context based) and op_queue (intrusive FIFO)
+// that serialize read/write operations of async_mqtt::stream.
+
+#include "bench_common.hpp"
+
+#include <memory>
+#include <vector>
+#include <array>
+
+#include <boost/asio.hpp>
+
+#include <async_mqtt/util/ioc_queue.hpp>
+#include <async_mqtt/util/op_queue.hpp>
+#include <async_mqtt/util/stream.hpp>
+#include <async_mqtt/packet/packet_variant.hpp>
+
+#include "stub_socket.hpp"
+
+namespace am = async_mqtt;
+namespace as = boost::asio;
+
+namespace {
+
+// Roughly the same size as a composed operation of stream
+template <typename Queue>
+struct op {
+    Queue& q;
+    std::shared_ptr<int> life_keeper;
+    std::array<char, 32> state{};
+    std::size_t& count;
+    void operator()() {
+        ++count;
+        q.start_work();
+    }
+};
+
+// The pattern of each stream::async_write_packet() / async_read_packet() call
+// when no other operation is in progress.
+template <typename Queue>
+void uncontended(std::string_view name, std::size_t iterations) {
+    Queue q;
+    auto sp = std::make_shared<int>(0);
+    std::size_t count = 0;
+    bench::run(
+        name,
+        iterations,
+        [&](std::size_t) {
+            q.post(op<Queue>{q, sp, {}, count});
+            q.stop_work();
+            q.poll_one();
+        }
+    );
+    bench::do_not_optimize(count);
+}
+
+// The pattern of continuous sending. Operations are queued while the previous
+// operation is in progress.
+template <typename Queue>
+void contended(std::string_view name, std::size_t iterations, std::size_t depth) {
+    Queue q;
+    auto sp = std::make_shared<int>(0);
+    std::size_t count = 0;
+    q.start_work();
+    bench::run(
+        name,
+        iterations,
+        [&](std::size_t) {
+            for (std::size_t i = 0; i != depth; ++i) {
+                q.post(op<Queue>{q, sp, {}, count});
+            }
+            for (std::size_t i = 0; i != depth; ++i) {
+                q.stop_work();
+                q.poll_one();
+            }
+        }
+    );
+    bench::do_not_optimize(count);
+}
+
+template <typename Queue>
+void footprint(std::string_view name, std::size_t num) {
+    std::vector<std::unique_ptr<Queue>> qs;
+    qs.reserve(num);
+    bench::footprint(
+        name,
+        sizeof(Queue),
+        [&] {
+            for (std::size_t i = 0; i != num; ++i) {
+                qs.push_back(std::make_unique<Queue>());
+            }
+        }
+    );
+}
+
+void stream_write(std::size_t iterations) {
+    as::io_context ioc;
+    using strm_t = am::stream<am::stub_socket>;
+    auto s = strm_t::create(am::protocol_version::v3_1_1, ioc.get_executor());
+    auto p = am::v3_1_1::pingreq_packet();
+    std::size_t count = 0;
+    bench::run(
+        "stream::async_write_packet (pingreq)",
+        iterations,
+        [&](std::size_t) {
+            s->async_write_packet(p, [&](am::error_code const&, std::size_t){ ++count; });
+            ioc.poll();
+            ioc.restart();
+        }
+    );
+    bench::do_not_optimize(count);
+}
+
+void stream_read(std::size_t iterations) {
+    as::io_context ioc;
+    using strm_t = am::stream<am::stub_socket>;
+    auto s = strm_t::create(am::protocol_version::v3_1_1, ioc.get_executor());
+    am::stub_socket::packet_queue_t packets;
+    for (std::size_t i = 0; i != iterations; ++i) {
+        packets.emplace_back(
+            am::packet_variant{
+                am::v3_1_1::publish_packet{
+                    "topic1",
+                    am::allocate_buffer("payload1"),
+                    am::qos::at_most_once
+                }
+            }
+        );
+    }
+    s->next_layer().set_recv_packets(am::force_move(packets));
+    std::size_t count = 0;
+    bench::run(
+        "stream::async_read_packet (publish)",
+        iterations,
+        [&](std::size_t) {
+            s->async_read_packet([&](am::error_code const&, am::buffer){ ++count; });
+            ioc.poll();
+            ioc.restart();
+        }
+    );
+    bench::do_not_optimize(count);
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    std::size_t iterations = 1'000'000;
+    if (argc >= 2) iterations = std::stoul(argv[1]);
+
+    std::cout << "== per operation cost" << std::endl;
+    uncontended<am::ioc_queue>("ioc_queue uncontended", iterations);
+    uncontended<am::op_queue>("op_queue  uncontended", iterations);
+    contended<am::ioc_queue>("ioc_queue contended (depth 16)", iterations / 16, 16);
+    contended<am::op_queue>("op_queue  contended (depth 16)", iterations / 16, 16);
+
+    std::cout << "== per connection footprint (x3 queues, 1000 connections)" << std::endl;
+    footprint<am::ioc_queue>("ioc_queue", 3000);
+    footprint<am::op_queue>("op_queue", 3000);
+
+    std::cout << "== per packet cost on stream<stub_socket>" << std::endl;
+    stream_write(iterations / 10);
+    stream_read(iterations / 10);
+}
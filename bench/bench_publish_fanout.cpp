@@ -0,0 +1,92 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Build the outgoing PUBLISH packets of one message for 10,000 subscribers.
+// Compare building a packet per subscriber with copying the packet that
+// publish_fanout builds once per delivery shape and setting the packet id.
+
+#include "bench_common.hpp"
+
+#include <string>
+#include <vector>
+
+#include <broker/publish_fanout.hpp>
+
+namespace am = async_mqtt;
+
+namespace {
+
+constexpr std::size_t subscribers = 10'000;
+
+} // anonymous namespace
+
+int main() {
+    std::string topic = "building/floor12/room34/sensor/temperature";
+    std::vector<am::buffer> payload{am::buffer{std::string(256, 'x')}};
+    am::properties props{
+        am::property::content_type{"application/json"},
+        am::property::user_property{"key", "value"}
+    };
+    auto opts = am::qos::at_least_once | am::pub::retain::no;
+
+    std::size_t sum = 0;
+    bench::run(
+        "v5 publish_packet per subscriber",
+        10,
+        [&](std::size_t) {
+            for (std::size_t i = 0; i != subscribers; ++i) {
+                am::v5::publish_packet packet{
+                    am::packet_id_type(i % 0xffff + 1),
+                    topic,
+                    payload,
+                    opts,
+                    props
+                };
+                sum += packet.size();
+            }
+        }
+    );
+    bench::run(
+        "v5 publish_fanout copy + set_packet_id",
+        10,
+        [&](std::size_t) {
+            am::publish_fanout fanout{am::buffer{topic}, payload, props};
+            for (std::size_t i = 0; i != subscribers; ++i) {
+                auto packet = fanout.v5_packet(opts, std::nullopt);
+                packet.set_packet_id(am::packet_id_type(i % 0xffff + 1));
+                sum += packet.size();
+            }
+        }
+    );
+    bench::run(
+        "v3.1.1 publish_packet per subscriber",
+        10,
+        [&](std::size_t) {
+            for (std::size_t i = 0; i != subscribers; ++i) {
+                am::v3_1_1::publish_packet packet{
+                    am::packet_id_type(i % 0xffff + 1),
+                    topic,
+                    payload,
+                    opts
+                };
+                sum += packet.size();
+            }
+        }
+    );
+    bench::run(
+        "v3.1.1 publish_fanout copy + set_packet_id",
+        10,
+        [&](std::size_t) {
+            am::publish_fanout fanout{am::buffer{topic}, payload, props};
+            for (std::size_t i = 0; i != subscribers; ++i) {
+                auto packet = fanout.v3_1_1_packet(opts);
+                packet.set_packet_id(am::packet_id_type(i % 0xffff + 1));
+                sum += packet.size();
+            }
+        }
+    );
+    bench::do_not_optimize(sum);
+}
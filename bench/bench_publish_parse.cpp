@@ -0,0 +1,101 @@
+// Copyright Takatoshi Kondo 2024
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Parse 100,000 received v5 PUBLISH packets that have 0, 4, and 16 UserProperties.
+// Compare eager property decoding with lazy one, and lazy one that forwards the
+// properties without accessing them, as the broker does.
+
+#include "bench_common.hpp"
+
+#include <string>
+#include <vector>
+
+#include <async_mqtt/packet/v5_publish.hpp>
+#include <async_mqtt/packet/packet_variant.hpp>
+#include <async_mqtt/impl/buffer_to_packet_variant.ipp>
+
+namespace am = async_mqtt;
+
+namespace {
+
+constexpr std::size_t packets = 100'000;
+
+am::buffer make_packet(std::size_t num_of_user_properties) {
+    am::properties props{
+        am::property::content_type{"application/json"},
+        am::property::message_expiry_interval{60}
+    };
+    for (std::size_t i = 0; i != num_of_user_properties; ++i) {
+        props.emplace_back(
+            am::property::user_property{"key" + std::to_string(i), "value" + std::to_string(i)}
+        );
+    }
+    am::v5::publish_packet packet{
+        1,
+        "building/floor12/room34/sensor/temperature",
+        std::string(256, 'x'),
+        am::qos::at_least_once,
+        props
+    };
+    return am::buffer{am::to_string(packet.const_buffer_sequence())};
+}
+
+} // anonymous namespace
+
+int main() {
+    std::size_t sum = 0;
+    for (std::size_t num : {0, 4, 16}) {
+        auto buf = make_packet(num);
+        auto title = [&](char const* mode) {
+            return std::to_string(num) + " user properties " + mode;
+        };
+        bench::run(
+            title("eager"),
+            10,
+            [&](std::size_t) {
+                for (std::size_t i = 0; i != packets; ++i) {
+                    am::error_code ec;
+                    auto pv = am::buffer_to_packet_variant(buf, am::protocol_version::v5, ec);
+                    sum += pv.get<am::v5::publish_packet>().props().size();
+                }
+            }
+        );
+        bench::run(
+            title("lazy + props()"),
+            10,
+            [&](std::size_t) {
+                for (std::size_t i = 0; i != packets; ++i) {
+                    am::error_code ec;
+                    auto pv = am::buffer_to_packet_variant(
+                        buf,
+                        am::protocol_version::v5,
+                        am::property_decoding::lazy,
+                        ec
+                    );
+                    sum += pv.get<am::v5::publish_packet>().props().size();
+                }
+            }
+        );
+        bench::run(
+            title("lazy + forward"),
+            10,
+            [&](std::size_t) {
+                for (std::size_t i = 0; i != packets; ++i) {
+                    am::error_code ec;
+                    auto pv = am::buffer_to_packet_variant(
+                        buf,
+                        am::protocol_version::v5,
+                        am::property_decoding::lazy,
+                        ec
+                    );
+                    auto const& p = pv.get<am::v5::publish_packet>();
+                    sum += p.props_as_block().size() + *p.message_expiry_interval();
+                }
+            }
+        );
+    }
+    bench::do_not_optimize(sum);
+}
@@ -0,0 +1,91 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Warm start of the retained messages.
+// Rebuilding the in-memory map costs per message, opening the snapshot costs
+// only the header, and the subscriptions read the mapped pages on demand.
+
+#include "bench_common.hpp"
+
+#include <filesystem>
+#include <string>
+
+#include <broker/retained_messages.hpp>
+
+namespace am = async_mqtt;
+
+namespace {
+
+std::string const payload(64, 'x');
+
+std::string topic_of(std::size_t i) {
+    return "site" + std::to_string(i % 100) + "/device" + std::to_string(i) + "/status";
+}
+
+} // anonymous namespace
+
+int main() {
+    std::size_t const num = 1'000'000;
+    auto path = (std::filesystem::temp_directory_path() / "bench_retained_snapshot").string();
+
+    {
+        am::retained_messages m;
+        bench::run(
+            "rebuild in-memory map",
+            num,
+            [&](std::size_t i) {
+                auto topic = topic_of(i);
+                m.insert_or_assign(
+                    topic,
+                    am::retain_type{
+                        am::buffer{topic},
+                        std::vector<am::buffer>{am::buffer{payload}},
+                        am::properties{},
+                        am::qos::at_least_once
+                    }
+                );
+            }
+        );
+        bench::run(
+            "write snapshot",
+            1,
+            [&](std::size_t) {
+                am::retained_snapshot_writer writer;
+                m.collect(writer);
+                writer.write(path);
+            }
+        );
+    }
+    std::cout << "  file size:" << std::filesystem::file_size(path) << std::endl;
+
+    std::shared_ptr<am::retained_snapshot const> snapshot;
+    bench::run(
+        "open snapshot",
+        1,
+        [&](std::size_t) {
+            snapshot = am::retained_snapshot::open(path);
+        }
+    );
+    am::retained_messages m;
+    m.set_snapshot(snapshot);
+    std::size_t found = 0;
+    bench::run(
+        "find exact on snapshot",
+        num / 10,
+        [&](std::size_t i) {
+            m.find(topic_of(i * 7 % num), [&](am::retain_type const&) { ++found; });
+        }
+    );
+    bench::run(
+        "find wildcard on snapshot",
+        100,
+        [&](std::size_t i) {
+            m.find("site" + std::to_string(i) + "/+/status", [&](am::retain_type const&) { ++found; });
+        }
+    );
+    bench::do_not_optimize(found);
+    std::filesystem::remove(path);
+}
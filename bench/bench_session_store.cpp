@@ -0,0 +1,79 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Cost of persisting offline messages on the publisher's path and of the recovery.
+// append() of wal_session_store only frames the record into the pending buffer,
+// the group commit is done by the writer thread.
+
+#include "bench_common.hpp"
+
+#include <filesystem>
+#include <string>
+
+#include <broker/wal_session_store.hpp>
+
+namespace am = async_mqtt;
+namespace rec = am::session_record;
+
+namespace {
+
+std::string const payload(256, 'x');
+
+void append(std::string_view name, std::size_t iterations, am::session_store* store) {
+    std::string r;
+    bench::run(
+        name,
+        iterations,
+        [&](std::size_t i) {
+            r.clear();
+            rec::offline_push(r, "user1", "cid" + std::to_string(i % 1000), i, 0, payload);
+            if (store) store->append(r);
+            bench::do_not_optimize(r);
+        }
+    );
+}
+
+void wal(std::string_view name, std::size_t iterations, bool fsync) {
+    auto dir = (std::filesystem::temp_directory_path() / "bench_session_store").string();
+    std::filesystem::remove_all(dir);
+    {
+        am::wal_session_store_config config{dir};
+        config.fsync = fsync;
+        am::wal_session_store store{config};
+        for (std::size_t i = 0; i != 1000; ++i) {
+            std::string r;
+            rec::session(r, "user1", "cid" + std::to_string(i), am::protocol_version::v5, 3600, 0);
+            store.append(r);
+        }
+        append(name, iterations, &store);
+        auto start = std::chrono::steady_clock::now();
+        store.flush();
+        auto end = std::chrono::steady_clock::now();
+        std::cout
+            << "  drain:" << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms"
+            << " commits:" << store.num_of_commits()
+            << std::endl;
+    }
+    am::wal_session_store store{am::wal_session_store_config{dir}};
+    am::session_images images;
+    bench::run(
+        "  recover",
+        1,
+        [&](std::size_t) {
+            store.load(images);
+        }
+    );
+    std::filesystem::remove_all(dir);
+}
+
+} // anonymous namespace
+
+int main() {
+    std::size_t const iterations = 200'000;
+    append("offline_push no store", iterations, nullptr);
+    wal("offline_push wal fsync=false", iterations, false);
+    wal("offline_push wal fsync=true", iterations, true);
+}
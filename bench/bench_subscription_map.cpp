@@ -0,0 +1,148 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Subscription matching under contention.
+// N publisher threads match topics against the subscription map while one
+// thread churns (subscribe/unsubscribe) subscriptions.
+// Compare the shared lock mode and the RCU snapshot mode of sub_con_map.
+//
+// usage: bench_subscription_map [subscriptions] [duration_ms] [max_publishers]
+
+#include "bench_common.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <broker/rcu_subscription_map.hpp>
+
+namespace am = async_mqtt;
+
+namespace {
+
+using map_t = am::rcu_subscription_map<am::multiple_subscription_map<std::string, std::size_t>>;
+using mutex = std::shared_timed_mutex;
+
+std::string topic_filter(std::size_t i) {
+    switch (i % 4) {
+    case 0:  return "dev/" + std::to_string(i) + "/temp";
+    case 1:  return "dev/" + std::to_string(i) + "/+";
+    case 2:  return "dev/+/" + std::to_string(i);
+    default: return "site/" + std::to_string(i % 100) + "/#";
+    }
+}
+
+struct result {
+    double matches_per_sec;
+    double churns_per_sec;
+};
+
+result run(bool snapshot, std::size_t subscriptions, std::size_t publishers, std::chrono::milliseconds duration) {
+    mutex mtx;
+    map_t map;
+    for (std::size_t i = 0; i != subscriptions; ++i) {
+        map.insert_or_assign(topic_filter(i), "cid" + std::to_string(i), i);
+    }
+    if (snapshot) map.enable_snapshot(mtx);
+
+    std::atomic<bool> start{false};
+    std::atomic<bool> finish{false};
+    std::vector<std::size_t> matches(publishers);
+    std::vector<std::thread> ths;
+    for (std::size_t p = 0; p != publishers; ++p) {
+        ths.emplace_back(
+            [&, p] {
+                std::vector<std::string> topics;
+                for (std::size_t i = 0; i != 64; ++i) {
+                    auto n = (i * 7919 + p) % subscriptions;
+                    topics.push_back("dev/" + std::to_string(n) + "/temp");
+                }
+                std::size_t count = 0;
+                std::size_t sum = 0;
+                while (!start.load()) std::this_thread::yield();
+                for (std::size_t i = 0; !finish.load(std::memory_order_relaxed); ++i) {
+                    auto const& topic = topics[i % topics.size()];
+                    std::shared_lock<mutex> g{mtx, std::defer_lock};
+                    if (!map.snapshot_enabled()) g.lock();
+                    map.find(topic, [&](std::string const&, std::size_t v) { sum += v; });
+                    ++count;
+                }
+                bench::do_not_optimize(sum);
+                matches[p] = count;
+            }
+        );
+    }
+
+    std::size_t churns = 0;
+    std::thread churner{
+        [&] {
+            while (!start.load()) std::this_thread::yield();
+            for (std::size_t i = 0; !finish.load(std::memory_order_relaxed); ++i) {
+                auto n = subscriptions + i % 1000;
+                auto tf = topic_filter(n);
+                auto cid = "churn" + std::to_string(n);
+                {
+                    std::lock_guard<mutex> g{mtx};
+                    map.insert_or_assign(tf, cid, n);
+                }
+                map.publish(mtx);
+                {
+                    std::lock_guard<mutex> g{mtx};
+                    map.erase(tf, cid);
+                }
+                map.publish(mtx);
+                churns += 2;
+            }
+        }
+    };
+
+    start.store(true);
+    std::this_thread::sleep_for(duration);
+    finish.store(true);
+    for (auto& th : ths) th.join();
+    churner.join();
+
+    std::size_t total = 0;
+    for (auto m : matches) total += m;
+    double sec = std::chrono::duration<double>(duration).count();
+    return { double(total) / sec, double(churns) / sec };
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    std::size_t subscriptions = 10'000;
+    std::size_t duration_ms = 1000;
+    std::size_t max_publishers = std::max(1u, std::thread::hardware_concurrency());
+    if (argc >= 2) subscriptions = std::stoul(argv[1]);
+    if (argc >= 3) duration_ms = std::stoul(argv[2]);
+    if (argc >= 4) max_publishers = std::stoul(argv[3]);
+
+    std::cout << "== " << subscriptions << " subscriptions, 1 churn thread" << std::endl;
+    std::cout
+        << std::left << std::setw(12) << "mode"
+        << std::right
+        << std::setw(12) << "publishers"
+        << std::setw(16) << "matches/s"
+        << std::setw(16) << "churns/s"
+        << std::endl;
+    for (std::size_t n = 1; n <= max_publishers; n *= 2) {
+        for (bool snapshot : {false, true}) {
+            auto r = run(snapshot, subscriptions, n, std::chrono::milliseconds(duration_ms));
+            std::cout
+                << std::left << std::setw(12) << (snapshot ? "snapshot" : "lock")
+                << std::right
+                << std::setw(12) << n
+                << std::setw(16) << std::fixed << std::setprecision(0) << r.matches_per_sec
+                << std::setw(16) << r.churns_per_sec
+                << std::endl;
+        }
+    }
+}
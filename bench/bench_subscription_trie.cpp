@@ -0,0 +1,100 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Memory footprint and match throughput of multiple_subscription_map and
+// multiple_subscription_trie.
+// The filters look like device telemetry subscriptions. Most of them are
+// exact filters, some have '+' or '#'.
+// The memory is the live heap of the map after inserting (allocated minus freed),
+// and the peak is the largest live heap while inserting (including reallocations).
+//
+// usage: bench_subscription_trie [filters...]
+// default: 1000000 5000000 10000000
+
+#include "bench_common.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <broker/subscription_map.hpp>
+#include <broker/subscription_trie.hpp>
+
+namespace am = async_mqtt;
+
+namespace {
+
+std::string topic_filter(std::size_t i) {
+    auto site = std::to_string(i % 1000);
+    auto dev = std::to_string(i / 8);
+    switch (i % 8) {
+    case 0:  return "site/" + site + "/dev/" + dev + "/temp";
+    case 1:  return "site/" + site + "/dev/" + dev + "/humidity";
+    case 2:  return "site/" + site + "/dev/" + dev + "/+";
+    case 3:  return "site/" + site + "/dev/+/alarm/" + dev;
+    case 4:  return "site/" + site + "/dev/" + dev + "/#";
+    case 5:  return "cmd/" + dev + "/reboot";
+    case 6:  return "cmd/" + dev + "/config";
+    default: return "$SYS/brokers/" + site + "/" + dev;
+    }
+}
+
+std::string topic(std::size_t i) {
+    return "site/" + std::to_string(i % 1000) + "/dev/" + std::to_string(i / 8) + "/temp";
+}
+
+template <typename Map>
+void measure(std::string_view name, std::size_t filters) {
+    auto live_before = bench::heap_live();
+    bench::reset_heap_peak();
+    auto start = std::chrono::steady_clock::now();
+    auto map = std::make_unique<Map>();
+    for (std::size_t i = 0; i != filters; ++i) {
+        map->insert_or_assign(topic_filter(i), "cid" + std::to_string(i % 64), i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto live = bench::heap_live() - live_before;
+    auto peak = bench::heap_peak() - live_before;
+    std::cout
+        << std::left << std::setw(48) << std::string(name) + " insert"
+        << std::right
+        << std::setw(12) << std::fixed << std::setprecision(1)
+        << double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()) / double(filters)
+        << " ns/op"
+        << std::setw(12) << std::setprecision(1)
+        << double(live) / double(filters) << " bytes/filter"
+        << std::setw(10) << live / (1024 * 1024) << " MiB"
+        << " peak:" << std::setw(6) << peak / (1024 * 1024) << " MiB"
+        << std::endl;
+
+    std::vector<std::string> topics;
+    for (std::size_t i = 0; i != 4096; ++i) {
+        topics.push_back(topic((i * 7919) % filters));
+    }
+    std::size_t sum = 0;
+    bench::run(
+        std::string(name) + " find",
+        1'000'000,
+        [&](std::size_t i) {
+            map->find(topics[i % topics.size()], [&](std::string const&, std::size_t v) { sum += v; });
+        }
+    );
+    bench::do_not_optimize(sum);
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    std::vector<std::size_t> sizes;
+    for (int i = 1; i < argc; ++i) sizes.push_back(std::stoul(argv[i]));
+    if (sizes.empty()) sizes = {1'000'000, 5'000'000, 10'000'000};
+
+    for (auto n : sizes) {
+        std::cout << "== " << n << " filters" << std::endl;
+        measure<am::multiple_subscription_map<std::string, std::size_t>>("multiple_subscription_map", n);
+        measure<am::multiple_subscription_trie<std::string, std::size_t>>("multiple_subscription_trie", n);
+    }
+}
@@ -0,0 +1,132 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Topic tokenization and matching.
+// Topics have 4-12 levels and each level is 8-40 bytes.
+// Compare the scalar tokenizer (std::find), topic_filter_tokenizer, and
+// topic_levels that is computed once and reused by the lookups.
+
+#include "bench_common.hpp"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <broker/topic_filter.hpp>
+#include <broker/subscription_map.hpp>
+#include <broker/subscription_trie.hpp>
+
+namespace am = async_mqtt;
+
+namespace {
+
+std::vector<std::string> make_topics(std::size_t min_levels, std::size_t max_levels) {
+    std::mt19937 rng{1};
+    std::vector<std::string> topics;
+    for (std::size_t i = 0; i != 1024; ++i) {
+        std::string topic;
+        auto levels = min_levels + rng() % (max_levels - min_levels + 1);
+        for (std::size_t l = 0; l != levels; ++l) {
+            if (l != 0) topic += '/';
+            auto size = 8 + rng() % 33;
+            for (std::size_t c = 0; c != size; ++c) {
+                topic += static_cast<char>('a' + rng() % 26);
+            }
+        }
+        topics.push_back(topic);
+    }
+    return topics;
+}
+
+// The tokenizer without the vectorized separator scan
+std::size_t scalar_tokenizer(std::string_view topic) {
+    std::size_t sum = 0;
+    auto first = topic.data();
+    auto last = topic.data() + topic.size();
+    while (true) {
+        auto pos = std::find(first, last, am::topic_filter_separator);
+        sum += std::size_t(pos - first);
+        if (pos == last) break;
+        first = pos + 1;
+    }
+    return sum;
+}
+
+template <typename Map>
+void bench_find(std::string_view name, std::vector<std::string> const& topics) {
+    Map map;
+    // Subscribe the topics themselves and some wildcards of them
+    for (std::size_t i = 0; i != topics.size(); ++i) {
+        std::string_view t = topics[i];
+        map.insert_or_assign(t, "exact", i);
+        map.insert_or_assign(std::string(t.substr(0, t.find('/'))) + "/#", "hash", i);
+        map.insert_or_assign("+" + std::string(t.substr(t.find('/'))), "plus", i);
+    }
+    std::size_t sum = 0;
+    bench::run(
+        std::string(name) + " find(string_view)",
+        100'000,
+        [&](std::size_t i) {
+            map.find(topics[i % topics.size()], [&](std::string const&, std::size_t v) { sum += v; });
+        }
+    );
+    bench::run(
+        std::string(name) + " find(topic_levels)",
+        100'000,
+        [&](std::size_t i) {
+            am::topic_levels levels{topics[i % topics.size()]};
+            map.find(levels, [&](std::string const&, std::size_t v) { sum += v; });
+        }
+    );
+    bench::do_not_optimize(sum);
+}
+
+} // anonymous namespace
+
+int main() {
+#if defined(ASYNC_MQTT_TOPIC_FILTER_USE_AVX2)
+    std::cout << "separator scan: AVX2" << std::endl;
+#elif defined(ASYNC_MQTT_TOPIC_FILTER_USE_SSE2)
+    std::cout << "separator scan: SSE2" << std::endl;
+#else
+    std::cout << "separator scan: scalar" << std::endl;
+#endif
+
+    for (auto [min, max] : {std::make_pair(4, 4), std::make_pair(8, 8), std::make_pair(12, 12), std::make_pair(4, 12)}) {
+        auto topics = make_topics(std::size_t(min), std::size_t(max));
+        std::cout << "== " << min << "-" << max << " levels" << std::endl;
+
+        std::size_t sum = 0;
+        bench::run(
+            "scalar tokenizer",
+            1'000'000,
+            [&](std::size_t i) { sum += scalar_tokenizer(topics[i % topics.size()]); }
+        );
+        bench::run(
+            "topic_filter_tokenizer",
+            1'000'000,
+            [&](std::size_t i) {
+                am::topic_filter_tokenizer(
+                    topics[i % topics.size()],
+                    [&](std::string_view t) { sum += t.size(); return true; }
+                );
+            }
+        );
+        bench::run(
+            "topic_levels",
+            1'000'000,
+            [&](std::size_t i) {
+                am::topic_levels levels{topics[i % topics.size()]};
+                sum += levels.hash(levels.size() - 1);
+            }
+        );
+        bench::do_not_optimize(sum);
+
+        bench_find<am::multiple_subscription_map<std::string, std::size_t>>("subscription_map", topics);
+        bench_find<am::multiple_subscription_trie<std::string, std::size_t>>("subscription_trie", topics);
+    }
+}
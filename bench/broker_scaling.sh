@@ -0,0 +1,130 @@
+#!/bin/bash
+# Copyright Takatoshi Kondo 2023
+#
+# Distributed under the Boost Software License, Version 1.0.
+# (See accompanying file LICENSE_1_0.txt or copy at
+# http://www.boost.org/LICENSE_1_0.txt)
+
+# Measure how the broker scales with the number of io_contexts using tool/bench.
+#
+# For each N in IOCS, the broker is launched with --iocs=N --shards=N
+# (--shards=0 if SHARDED=0), and the bench publishes from CLIENTS_PER_IOC * N
+# clients. The offered load grows linearly with N, so if the broker scales
+# linearly, the average RTT stays flat and the elapsed time stays the same.
+#
+# usage: broker_scaling.sh path/to/broker path/to/bench
+#
+# Environment variables (default):
+#   IOCS            list of iocs ("1 2 4 8 16 32 64")
+#   SHARDED         1: --shards=N, 0: non sharded broker for comparison (1)
+#   CLIENTS_PER_IOC number of bench clients per ioc (100)
+#   TIMES           number of publishes for each client (1000)
+#   INTERVAL_MS     publish interval for each client (10)
+#   PAYLOAD_SIZE    payload size (32)
+#   QOS             QoS of publish (0)
+#   PORT            broker port (21883)
+#   BENCH_IOCS      iocs of the bench. 0 means the same as N (0)
+#   RESULT          CSV file that the results are written to
+#                   (broker_scaling_<date>.csv)
+#
+# The CSV file starts with the environment of the run (host, cpus, kernel,
+# git revision and parameters) so that the results are comparable later.
+#
+# Run the broker and the bench on the different machines (or at least pin them on
+# the different cores by taskset) for the meaningful result.
+# Set BROKER_HOST and launch the broker on the host by yourself, in that case,
+# this script only runs the bench and BROKER is not used.
+
+set -e
+
+BROKER=$1
+BENCH=$2
+if [ -z "${BENCH}" ]; then
+    echo "usage: $0 path/to/broker path/to/bench"
+    exit 1
+fi
+
+IOCS=${IOCS:-"1 2 4 8 16 32 64"}
+SHARDED=${SHARDED:-1}
+CLIENTS_PER_IOC=${CLIENTS_PER_IOC:-100}
+TIMES=${TIMES:-1000}
+INTERVAL_MS=${INTERVAL_MS:-10}
+PAYLOAD_SIZE=${PAYLOAD_SIZE:-32}
+QOS=${QOS:-0}
+PORT=${PORT:-21883}
+BENCH_IOCS=${BENCH_IOCS:-0}
+RESULT=${RESULT:-broker_scaling_$(date +%Y%m%d%H%M%S).csv}
+
+{
+    echo "# host: $(uname -n)"
+    echo "# cpus: $(getconf _NPROCESSORS_ONLN)"
+    echo "# kernel: $(uname -sr)"
+    echo "# revision: $(git -C "$(dirname "$0")" rev-parse --short HEAD 2> /dev/null || echo unknown)"
+    echo "# sharded: ${SHARDED} clients_per_ioc: ${CLIENTS_PER_IOC} times: ${TIMES} interval_ms: ${INTERVAL_MS} payload_size: ${PAYLOAD_SIZE} qos: ${QOS}"
+    echo "iocs,shards,clients,offered_per_s,elapsed_s,maxavg_rtt_us"
+} > "${RESULT}"
+
+printf "%6s %6s %8s %12s %10s %14s\n" iocs shards clients "offered/s" "elapsed_s" "maxavg_rtt_us"
+
+for N in ${IOCS}; do
+    SHARDS=0
+    if [ "${SHARDED}" != "0" ]; then
+        SHARDS=${N}
+    fi
+    CLIENTS=$((CLIENTS_PER_IOC * N))
+    BIOCS=${BENCH_IOCS}
+    if [ "${BIOCS}" = "0" ]; then
+        BIOCS=${N}
+    fi
+
+    BROKER_PID=
+    if [ -z "${BROKER_HOST}" ]; then
+        "${BROKER}" \
+            --cfg "" \
+            --silent true \
+            --verbose 1 \
+            --iocs ${N} \
+            --threads_per_ioc 1 \
+            --shards ${SHARDS} \
+            --tcp.port ${PORT} \
+            > /dev/null 2>&1 &
+        BROKER_PID=$!
+        sleep 1
+    fi
+
+    START=$(date +%s.%N)
+    RESULT=$(
+        "${BENCH}" \
+            --cfg "" \
+            --target ${BROKER_HOST:-localhost}:${PORT} \
+            --iocs ${BIOCS} \
+            --threads_per_ioc 1 \
+            --clients ${CLIENTS} \
+            --times ${TIMES} \
+            --pub_interval_ms ${INTERVAL_MS} \
+            --payload_size ${PAYLOAD_SIZE} \
+            --qos ${QOS} \
+            --con_interval_ms 1 \
+            --sub_interval_ms 1 \
+            --sub_delay_ms 1000 \
+            --pub_delay_ms 1000 \
+            --pub_after_idle_delay_ms 1000 \
+            --limit_ms 1000000 \
+            --verbose 1 \
+            2>&1 | grep "maxavg:" || true
+    )
+    END=$(date +%s.%N)
+
+    if [ -n "${BROKER_PID}" ]; then
+        kill ${BROKER_PID}
+        wait ${BROKER_PID} 2> /dev/null || true
+    fi
+
+    MAXAVG=$(echo "${RESULT}" | sed -e 's/maxavg: *\([+0-9]*\) us.*/\1/')
+    OFFERED=$((CLIENTS * 1000 / INTERVAL_MS))
+    ELAPSED=$(awk "BEGIN { print ${END} - ${START} }")
+    printf "%6d %6d %8d %12d %10.2f %14s\n" ${N} ${SHARDS} ${CLIENTS} ${OFFERED} ${ELAPSED} "${MAXAVG:-N/A}"
+    echo "${N},${SHARDS},${CLIENTS},${OFFERED},${ELAPSED},${MAXAVG}" >> "${RESULT}"
+done
+
+echo "results are written to ${RESULT}"
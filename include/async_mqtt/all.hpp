@@ -12,6 +12,7 @@
 #include <async_mqtt/endpoint.hpp>
 #include <async_mqtt/endpoint_fwd.hpp>
 #include <async_mqtt/error.hpp>
+#include <async_mqtt/null_strand.hpp>
 #include <async_mqtt/protocol_version.hpp>
 #include <async_mqtt/role.hpp>
 #include <async_mqtt/setup_log.hpp>
@@ -26,6 +27,8 @@
 #include <async_mqtt/packet/property.hpp>
 #include <async_mqtt/packet/property_id.hpp>
 #include <async_mqtt/packet/property_variant.hpp>
+#include <async_mqtt/packet/property_block.hpp>
+#include <async_mqtt/packet/property_decoding.hpp>
 #include <async_mqtt/packet/pubopts.hpp>
 #include <async_mqtt/packet/qos.hpp>
 #include <async_mqtt/packet/qos_util.hpp>
@@ -74,6 +77,7 @@
 #include <async_mqtt/util/log.hpp>
 #include <async_mqtt/util/make_shared_helper.hpp>
 #include <async_mqtt/util/move.hpp>
+#include <async_mqtt/util/op_queue.hpp>
 #include <async_mqtt/util/overload.hpp>
 #include <async_mqtt/util/packet_id_manager.hpp>
 #include <async_mqtt/util/scope_guard.hpp>
@@ -10,6 +10,7 @@
 #include <async_mqtt/error.hpp>
 #include <async_mqtt/protocol_version.hpp>
 #include <async_mqtt/packet/packet_variant_fwd.hpp>
+#include <async_mqtt/packet/property_decoding.hpp>
 #include <async_mqtt/util/buffer.hpp>
 
 namespace async_mqtt {
@@ -25,6 +26,23 @@ namespace async_mqtt {
 template <std::size_t PacketIdBytes>
 basic_packet_variant<PacketIdBytes> buffer_to_basic_packet_variant(buffer buf, protocol_version ver, error_code& ec);
 
+/**
+ * @ingroup packet_variant
+ * @brief create basic_packet_variant from the buffer
+ * @param buf      buffer contains packet bytes
+ * @param ver      protocol version to create packet
+ * @param decoding when the properties are decoded
+ * @param ec       error_code for reporting error
+ * @return created basic_packet_variant
+ */
+template <std::size_t PacketIdBytes>
+basic_packet_variant<PacketIdBytes> buffer_to_basic_packet_variant(
+    buffer buf,
+    protocol_version ver,
+    property_decoding decoding,
+    error_code& ec
+);
+
 /**
  * @ingroup packet_variant
  * @brief create packet_variant from the buffer
@@ -35,6 +53,22 @@ basic_packet_variant<PacketIdBytes> buffer_to_basic_packet_variant(buffer buf, p
  */
 packet_variant buffer_to_packet_variant(buffer buf, protocol_version ver, error_code& ec);
 
+/**
+ * @ingroup packet_variant
+ * @brief create packet_variant from the buffer
+ * @param buf      buffer contains packet bytes
+ * @param ver      protocol version to create packet
+ * @param decoding when the properties are decoded
+ * @param ec       error_code for reporting error
+ * @return created packet_variant
+ */
+packet_variant buffer_to_packet_variant(
+    buffer buf,
+    protocol_version ver,
+    property_decoding decoding,
+    error_code& ec
+);
+
 } // namespace async_mqtt
 
 #endif // ASYNC_MQTT_BUFFER_TO_PACKET_VARIANT_HPP
@@ -560,6 +560,10 @@ public:
      * @brief Set bulk write mode.
      * If true, then concatenate multiple packets' const buffer sequence
      * when send() is called before the previous send() is not completed.
+     * The concatenated packets are limited by set_bulk_write_limits().
+     * While packets are concatenated, a packet that is sent on the idle connection
+     * is deferred to the next loop turn to wait for the following packets. It stops
+     * as soon as a write has only one packet, so sparse traffic is not delayed.
      * Otherwise, send packet one by one.
      * \n This function should be called before send() call.
      * @note By default bulk write mode is false (disabled)
@@ -567,13 +571,30 @@ public:
      */
     void set_bulk_write(bool val);
 
+    /**
+     * @brief Set the limits of one concatenated write of bulk write.
+     * @note By default max_bytes is default_bulk_write_max_bytes (65536) and
+     *       max_iovecs is default_bulk_write_max_iovecs (64).
+     * @param max_bytes  maximum bytes
+     * @param max_iovecs maximum number of buffers. It is capped by IOV_MAX.
+     */
+    void set_bulk_write_limits(std::size_t max_bytes, std::size_t max_iovecs);
+
+    /**
+     * @brief Get the statistics of packet writing.
+     * write_stats::packets_per_write() shows how well bulk write concatenates packets.
+     * @return statistics
+     */
+    write_stats get_write_stats() const;
+
     /**
      * @brief Set the bulk read buffer size.
      * If bulk read is enabled, the `val` parameter specifies the size of the internal
-     * `async_read_some()` buffer.
-     * Enabling bulk read can improve throughput but may increase latency.
-     * Disabling bulk read can reduce latency but may lower throughput.
-     * By default, bulk read is disabled.
+     * reference counted read buffer (slab) that is passed to `async_read_some()`.
+     * Received packets alias the slab, so no copy is required except packets that
+     * straddle slabs.
+     * Disabling bulk read reads each packet by exact size `async_read()` calls.
+     * By default, bulk read is enabled and the size is default_bulk_read_buffer_size (4096).
      *
      * @param val If set to 0, bulk read is disabled. Otherwise, it specifies the buffer size.
      */
@@ -9,11 +9,13 @@
 
 #include <set>
 #include <deque>
+#include <functional>
 
 #include <async_mqtt/error.hpp>
 #include <async_mqtt/packet/packet_variant.hpp>
 #include <async_mqtt/util/value_allocator.hpp>
 #include <async_mqtt/util/make_shared_helper.hpp>
+#include <async_mqtt/util/move.hpp>
 #include <async_mqtt/util/stream.hpp>
 #include <async_mqtt/util/store.hpp>
 #include <async_mqtt/role.hpp>
@@ -23,6 +25,7 @@
 #include <async_mqtt/util/packet_id_manager.hpp>
 #include <async_mqtt/protocol_version.hpp>
 #include <async_mqtt/packet/packet_traits.hpp>
+#include <async_mqtt/packet/property_decoding.hpp>
 
 /**
  * @defgroup connection MQTT connection
@@ -225,6 +228,23 @@ public:
         auto_replace_topic_alias_send_ = val;
     }
 
+    /**
+     * @brief Set when the properties of the received PUBLISH packet are decoded.
+     * If property_decoding::lazy, the properties are validated on receive but
+     * kept as the received bytes. They are decoded on the first props() call, and
+     * forwarded as they are if props() is never called.
+     * It is effective only for MQTT v5.0 PUBLISH packet.
+     * \n This function should be called before recv() call.
+     * @note By default property_decoding::eager.
+     * @param val property_decoding
+     */
+    void set_property_decoding(property_decoding val) {
+        ASYNC_MQTT_LOG("mqtt_api", info)
+            << ASYNC_MQTT_ADD_VALUE(address, this)
+            << "set_property_decoding val:" << val;
+        property_decoding_ = val;
+    }
+
     /**
      * @brief Set timeout for receiving PINGRESP packet after PINGREQ packet is sent.
      * If the timer is fired, then the underlying layer is closed from the client side.
@@ -247,6 +267,10 @@ public:
      * @brief Set bulk write mode.
      * If true, then concatenate multiple packets' const buffer sequence
      * when send() is called before the previous send() is not completed.
+     * The concatenated packets are limited by set_bulk_write_limits().
+     * While packets are concatenated, a packet that is sent on the idle connection
+     * is deferred to the next loop turn to wait for the following packets. It stops
+     * as soon as a write has only one packet, so sparse traffic is not delayed.
      * Otherwise, send packet one by one.
      * \n This function should be called before send() call.
      * @note By default bulk write mode is false (disabled)
@@ -256,13 +280,34 @@ public:
         stream_->set_bulk_write(val);
     }
 
+    /**
+     * @brief Set the limits of one concatenated write of bulk write.
+     * @note By default max_bytes is default_bulk_write_max_bytes (65536) and
+     *       max_iovecs is default_bulk_write_max_iovecs (64).
+     * @param max_bytes  maximum bytes
+     * @param max_iovecs maximum number of buffers. It is capped by IOV_MAX.
+     */
+    void set_bulk_write_limits(std::size_t max_bytes, std::size_t max_iovecs) {
+        stream_->set_bulk_write_limits(max_bytes, max_iovecs);
+    }
+
+    /**
+     * @brief Get the statistics of packet writing.
+     * write_stats::packets_per_write() shows how well bulk write concatenates packets.
+     * @return statistics
+     */
+    write_stats get_write_stats() const {
+        return stream_->get_write_stats();
+    }
+
     /**
      * @brief Set the bulk read buffer size.
      * If bulk read is enabled, the `val` parameter specifies the size of the internal
-     * `async_read_some()` buffer.
-     * Enabling bulk read can improve throughput but may increase latency.
-     * Disabling bulk read can reduce latency but may lower throughput.
-     * By default, bulk read is disabled.
+     * reference counted read buffer (slab) that is passed to `async_read_some()`.
+     * Received packets alias the slab, so no copy is required except packets that
+     * straddle slabs.
+     * Disabling bulk read reads each packet by exact size `async_read()` calls.
+     * By default, bulk read is enabled and the size is default_bulk_read_buffer_size (4096).
      *
      * @param val If set to 0, bulk read is disabled. Otherwise, it specifies the buffer size.
      */
@@ -270,6 +315,18 @@ public:
         stream_->set_bulk_read_buffer_size(val);
     }
 
+    /**
+     * @brief Set the handler that is called when the endpoint is destroyed.
+     * The in-progress operations keep the endpoint alive, so the handler is called
+     * after all of them finish even if the user has released it. It is called on the
+     * thread that releases the last reference.
+     * \n This function should be called before send() call.
+     * @param handler handler
+     */
+    void set_destroy_handler(std::function<void()> handler) {
+        h_destroy_ = force_move(handler);
+    }
+
 
     // async functions
 
@@ -843,6 +900,7 @@ private:
 
     bool auto_map_topic_alias_send_ = false;
     bool auto_replace_topic_alias_send_ = false;
+    property_decoding property_decoding_ = property_decoding::eager;
     std::optional<topic_alias_send> topic_alias_send_;
     std::optional<topic_alias_recv> topic_alias_recv_;
 
@@ -853,7 +911,7 @@ private:
     std::set<typename basic_packet_id_type<PacketIdBytes>::type> publish_recv_;
     std::deque<v5::basic_publish_packet<PacketIdBytes>> publish_queue_;
 
-    ioc_queue close_queue_;
+    op_queue close_queue_;
 
     std::uint32_t maximum_packet_size_send_{packet_size_no_limit};
     std::uint32_t maximum_packet_size_recv_{packet_size_no_limit};
@@ -875,6 +933,7 @@ private:
     struct tim_cancelled;
     std::deque<tim_cancelled> tim_retry_acq_pid_queue_;
     bool packet_id_released_ = false;
+    std::function<void()> h_destroy_;
 };
 
 /**
@@ -235,11 +235,38 @@ basic_packet_variant<PacketIdBytes> buffer_to_basic_packet_variant(
     return basic_packet_variant<PacketIdBytes>{};
 }
 
+template <std::size_t PacketIdBytes>
+ASYNC_MQTT_HEADER_ONLY_INLINE
+basic_packet_variant<PacketIdBytes> buffer_to_basic_packet_variant(
+    buffer buf,
+    protocol_version ver,
+    property_decoding decoding,
+    error_code& ec
+) {
+    if (decoding == property_decoding::lazy &&
+        ver == protocol_version::v5 &&
+        buf.size() >= 2 &&
+        get_control_packet_type(std::uint8_t(buf[0])) == control_packet_type::publish) {
+        return v5::basic_publish_packet<PacketIdBytes>(force_move(buf), property_decoding::lazy, ec);
+    }
+    return buffer_to_basic_packet_variant<PacketIdBytes>(force_move(buf), ver, ec);
+}
+
 ASYNC_MQTT_HEADER_ONLY_INLINE
 packet_variant buffer_to_packet_variant(buffer buf, protocol_version ver, error_code& ec) {
     return buffer_to_basic_packet_variant<2>(force_move(buf), ver, ec);
 }
 
+ASYNC_MQTT_HEADER_ONLY_INLINE
+packet_variant buffer_to_packet_variant(
+    buffer buf,
+    protocol_version ver,
+    property_decoding decoding,
+    error_code& ec
+) {
+    return buffer_to_basic_packet_variant<2>(force_move(buf), ver, decoding, ec);
+}
+
 } // namespace async_mqtt
 
 #if defined(ASYNC_MQTT_SEPARATE_COMPILATION)
@@ -254,6 +281,13 @@ basic_packet_variant<a_size> buffer_to_basic_packet_variant<a_size>( \
     protocol_version, \
     error_code& \
 ); \
+template \
+basic_packet_variant<a_size> buffer_to_basic_packet_variant<a_size>( \
+    buffer, \
+    protocol_version, \
+    property_decoding, \
+    error_code& \
+); \
 } // namespace async_mqtt
 
 #define ASYNC_MQTT_PP_GENERATE(r, product) \
@@ -182,6 +182,20 @@ client<Version, NextLayer>::set_bulk_write(bool val) {
     ep_->set_bulk_write(val);
 }
 
+template <protocol_version Version, typename NextLayer>
+inline
+void
+client<Version, NextLayer>::set_bulk_write_limits(std::size_t max_bytes, std::size_t max_iovecs) {
+    ep_->set_bulk_write_limits(max_bytes, max_iovecs);
+}
+
+template <protocol_version Version, typename NextLayer>
+inline
+write_stats
+client<Version, NextLayer>::get_write_stats() const {
+    return ep_->get_write_stats();
+}
+
 template <protocol_version Version, typename NextLayer>
 inline
 void
@@ -22,6 +22,7 @@ basic_endpoint<Role, PacketIdBytes, NextLayer>::~basic_endpoint() {
     ASYNC_MQTT_LOG("mqtt_impl", trace)
         << ASYNC_MQTT_ADD_VALUE(address, this)
         << "destroy";
+    if (h_destroy_) h_destroy_();
 }
 
 
@@ -82,7 +82,12 @@ recv_op {
 
             bool call_complete = true;
             error_code ec = error_code{};
-            auto v = buffer_to_basic_packet_variant<PacketIdBytes>(buf, ep.protocol_version_, ec);
+            auto v = buffer_to_basic_packet_variant<PacketIdBytes>(
+                buf,
+                ep.protocol_version_,
+                ep.property_decoding_,
+                ec
+            );
             if (ec) {
                 decided_error.emplace(ec);
                 if (ep.protocol_version_ == protocol_version::v5) {
@@ -226,7 +231,7 @@ recv_op {
                             }
 
                             if (p.topic().empty()) {
-                                if (auto ta_opt = get_topic_alias(p.props())) {
+                                if (auto ta_opt = p.topic_alias()) {
                                     // extract topic from topic_alias
                                     if (*ta_opt == 0 ||
                                         !ep.topic_alias_recv_ || // topic_alias_maximum is 0
@@ -295,7 +300,7 @@ recv_op {
                                 }
                             }
                             else {
-                                if (auto ta_opt = get_topic_alias(p.props())) {
+                                if (auto ta_opt = p.topic_alias()) {
                                     if (*ta_opt == 0 ||
                                         !ep.topic_alias_recv_ || // topic_alias_maximum is 0
                                         *ta_opt > ep.topic_alias_recv_->max()) {
@@ -80,7 +80,7 @@ basic_endpoint<Role, PacketIdBytes, NextLayer>::regulate_for_store(
         << ASYNC_MQTT_ADD_VALUE(address, this)
         << "regulate_for_store:" << packet;
     if (packet.topic().empty()) {
-        if (auto ta_opt = get_topic_alias(packet.props())) {
+        if (auto ta_opt = packet.topic_alias()) {
             auto topic = topic_alias_send_->find_without_touch(*ta_opt);
             if (topic.empty()) {
                 ec = make_error_code(
@@ -311,7 +311,7 @@ send_op {
                 release_pid_opt.emplace(packet_id);
                 if (ep.need_store_) {
                     if constexpr(is_instance_of<v5::basic_publish_packet, std::decay_t<ActualPacket>>::value) {
-                        auto ta_opt = get_topic_alias(actual_packet.props());
+                        auto ta_opt = actual_packet.topic_alias();
                         if (actual_packet.topic().empty()) {
                             auto topic_opt = validate_topic_alias(ta_opt);
                             if (!topic_opt) {
@@ -364,24 +364,9 @@ send_op {
                             release_pid_opt.reset();
                         }
                         else {
-                            auto props = actual_packet.props();
-                            auto it = props.cbegin();
-                            auto end = props.cend();
-                            for (; it != end; ++it) {
-                                if (it->id() == property::id::topic_alias) {
-                                    props.erase(it);
-                                    break;
-                                }
-                            }
-
-                            auto store_packet =
-                                ActualPacket(
-                                    packet_id,
-                                    actual_packet.topic(),
-                                    actual_packet.payload_as_buffer(),
-                                    actual_packet.opts(),
-                                    force_move(props)
-                                );
+                            // the encoded properties are shared if they have no topic_alias
+                            auto store_packet = actual_packet;
+                            store_packet.remove_topic_alias();
                             if (!validate_maximum_packet_size(store_packet.size())) {
                                 self.complete(
                                     make_error_code(
@@ -432,7 +417,7 @@ send_op {
 
         if constexpr(is_instance_of<v5::basic_publish_packet, std::decay_t<ActualPacket>>::value) {
             // apply topic_alias
-            auto ta_opt = get_topic_alias(actual_packet.props());
+            auto ta_opt = actual_packet.topic_alias();
             if (actual_packet.topic().empty()) {
                 if (!topic_alias_validated &&
                     !validate_topic_alias(ta_opt)) {
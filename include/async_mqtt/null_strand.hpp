@@ -0,0 +1,215 @@
+// Copyright Takatoshi Kondo 2024
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_NULL_STRAND_HPP)
+#define ASYNC_MQTT_NULL_STRAND_HPP
+
+#include <type_traits>
+#include <utility>
+
+#include <boost/asio/execution.hpp>
+#include <boost/asio/is_executor.hpp>
+#include <boost/asio/query.hpp>
+#include <boost/asio/require.hpp>
+#include <boost/asio/prefer.hpp>
+
+/**
+ * @defgroup null_strand null strand executor
+ * @ingroup connection
+ */
+
+namespace async_mqtt {
+
+namespace as = boost::asio;
+
+/**
+ * @ingroup null_strand
+ * @brief executor adaptor that has the same interface as boost::asio::strand but doesn't serialize
+ *
+ * The function objects are passed to the inner executor as they are, so no strand queue is
+ * locked and no strand operation is allocated per handler.
+ * It can be used as the executor of endpoint and client instead of boost::asio::strand only if
+ * the inner executor runs on one thread, e.g. the executor of io_context that is run() by only
+ * one thread. In this case the handlers are serialized by the thread.
+ * @code
+ * as::io_context ioc{BOOST_ASIO_CONCURRENCY_HINT_UNSAFE_IO};
+ * auto ep = am::endpoint<am::role::client, am::protocol::mqtt>::create(
+ *     am::protocol_version::v5,
+ *     am::make_null_strand(ioc.get_executor())
+ * );
+ * ioc.run(); // only on this thread
+ * @endcode
+ * #### Thread Safety
+ *    - Distinct objects: Safe
+ *    - Shared objects: Safe
+ *
+ * @tparam Executor inner executor type
+ */
+template <typename Executor>
+class null_strand {
+public:
+    /// @brief The type of the inner executor.
+    using inner_executor_type = Executor;
+
+    /**
+     * @brief constructor
+     * @param exe inner executor
+     */
+    template <
+        typename Executor1,
+        std::enable_if_t<
+            !std::is_same_v<std::decay_t<Executor1>, null_strand> &&
+            std::is_convertible_v<Executor1 const&, Executor>
+        >* = nullptr
+    >
+    explicit null_strand(Executor1 const& exe)
+        :exe_{exe}
+    {
+    }
+
+    /**
+     * @brief converting constructor
+     * @param other the null_strand that has the convertible inner executor
+     */
+    template <
+        typename OtherExecutor,
+        std::enable_if_t<
+            std::is_convertible_v<OtherExecutor const&, Executor>
+        >* = nullptr
+    >
+    null_strand(null_strand<OtherExecutor> const& other) noexcept
+        :exe_{other.get_inner_executor()}
+    {
+    }
+
+    /**
+     * @brief Get the inner executor
+     * @return inner executor
+     */
+    inner_executor_type get_inner_executor() const noexcept {
+        return exe_;
+    }
+
+    /**
+     * @brief Forward a query to the inner executor
+     * @param p property
+     * @return the result of the query
+     */
+    template <typename Property>
+    std::enable_if_t<
+        as::can_query<Executor const&, Property>::value,
+        typename as::query_result<Executor const&, Property>::type
+    >
+    query(Property const& p) const
+        noexcept(as::is_nothrow_query<Executor const&, Property>::value) {
+        return as::query(exe_, p);
+    }
+
+    /**
+     * @brief Forward a requirement to the inner executor
+     * @param p property
+     * @return null_strand that has the inner executor with the property
+     */
+    template <typename Property>
+    std::enable_if_t<
+        as::can_require<Executor const&, Property>::value,
+        null_strand<std::decay_t<typename as::require_result<Executor const&, Property>::type>>
+    >
+    require(Property const& p) const
+        noexcept(as::is_nothrow_require<Executor const&, Property>::value) {
+        return null_strand<
+            std::decay_t<typename as::require_result<Executor const&, Property>::type>
+        >{as::require(exe_, p)};
+    }
+
+    /**
+     * @brief Forward a preference to the inner executor
+     * @param p property
+     * @return null_strand that has the inner executor with the property if supported
+     */
+    template <typename Property>
+    std::enable_if_t<
+        as::can_prefer<Executor const&, Property>::value,
+        null_strand<std::decay_t<typename as::prefer_result<Executor const&, Property>::type>>
+    >
+    prefer(Property const& p) const
+        noexcept(as::is_nothrow_prefer<Executor const&, Property>::value) {
+        return null_strand<
+            std::decay_t<typename as::prefer_result<Executor const&, Property>::type>
+        >{as::prefer(exe_, p)};
+    }
+
+    /**
+     * @brief Execute the function object on the inner executor
+     * @param f function object
+     */
+    template <typename Function>
+    auto execute(Function&& f) const
+        -> decltype(std::declval<Executor const&>().execute(std::forward<Function>(f))) {
+        return exe_.execute(std::forward<Function>(f));
+    }
+
+    /**
+     * @brief equal operator
+     * @param lhs compare target
+     * @param rhs compare target
+     * @return true if the inner executors are equal, otherwise false
+     */
+    friend bool operator==(null_strand const& lhs, null_strand const& rhs) noexcept {
+        return lhs.exe_ == rhs.exe_;
+    }
+
+    /**
+     * @brief not equal operator
+     * @param lhs compare target
+     * @param rhs compare target
+     * @return true if the inner executors are not equal, otherwise false
+     */
+    friend bool operator!=(null_strand const& lhs, null_strand const& rhs) noexcept {
+        return !(lhs == rhs);
+    }
+
+private:
+    Executor exe_;
+};
+
+/**
+ * @ingroup null_strand
+ * @brief Create a null_strand object for the executor
+ * @param exe inner executor
+ * @return null_strand
+ */
+template <
+    typename Executor,
+    std::enable_if_t<
+        as::execution::is_executor<Executor>::value ||
+        as::is_executor<Executor>::value
+    >* = nullptr
+>
+inline null_strand<Executor> make_null_strand(Executor const& exe) {
+    return null_strand<Executor>{exe};
+}
+
+/**
+ * @ingroup null_strand
+ * @brief Create a null_strand object for the execution context
+ * @param ctx execution context. e.g. io_context
+ * @return null_strand
+ */
+template <
+    typename ExecutionContext,
+    std::enable_if_t<
+        std::is_convertible_v<ExecutionContext&, as::execution_context&>
+    >* = nullptr
+>
+inline null_strand<typename ExecutionContext::executor_type>
+make_null_strand(ExecutionContext& ctx) {
+    return null_strand<typename ExecutionContext::executor_type>{ctx.get_executor()};
+}
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_NULL_STRAND_HPP
@@ -67,11 +67,19 @@ struct n_bytes_property : private boost::totally_ordered<n_bytes_property<N>> {
     std::vector<as::const_buffer> const_buffer_sequence() const {
         std::vector<as::const_buffer> v;
         v.reserve(num_of_const_buffer_sequence());
-        v.emplace_back(as::buffer(&id_, 1));
-        v.emplace_back(as::buffer(buf_.data(), buf_.size()));
+        append_const_buffer_sequence(v);
         return v;
     }
 
+    /**
+     * @brief Append const buffer sequence to the given vector.
+     * @param cbs the buffers are appended to it
+     */
+    void append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const {
+        cbs.emplace_back(as::buffer(&id_, 1));
+        cbs.emplace_back(as::buffer(buf_.data(), buf_.size()));
+    }
+
     /**
      * @brief Get property::id
      * @return id
@@ -141,12 +149,20 @@ struct binary_property : private boost::totally_ordered<binary_property> {
     std::vector<as::const_buffer> const_buffer_sequence() const {
         std::vector<as::const_buffer> v;
         v.reserve(num_of_const_buffer_sequence());
-        v.emplace_back(as::buffer(&id_, 1));
-        v.emplace_back(as::buffer(length_.data(), length_.size()));
-        v.emplace_back(as::buffer(buf_.data(), buf_.size()));
+        append_const_buffer_sequence(v);
         return v;
     }
 
+    /**
+     * @brief Append const buffer sequence to the given vector.
+     * @param cbs the buffers are appended to it
+     */
+    void append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const {
+        cbs.emplace_back(as::buffer(&id_, 1));
+        cbs.emplace_back(as::buffer(length_.data(), length_.size()));
+        cbs.emplace_back(as::buffer(buf_.data(), buf_.size()));
+    }
+
     /**
      * @brief Get property::id
      * @return id
@@ -272,11 +288,19 @@ struct variable_property : private boost::totally_ordered<variable_property> {
     std::vector<as::const_buffer> const_buffer_sequence() const {
         std::vector<as::const_buffer> v;
         v.reserve(num_of_const_buffer_sequence());
-        v.emplace_back(as::buffer(&id_, 1));
-        v.emplace_back(as::buffer(value_.data(), value_.size()));
+        append_const_buffer_sequence(v);
         return v;
     }
 
+    /**
+     * @brief Append const buffer sequence to the given vector.
+     * @param cbs the buffers are appended to it
+     */
+    void append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const {
+        cbs.emplace_back(as::buffer(&id_, 1));
+        cbs.emplace_back(as::buffer(value_.data(), value_.size()));
+    }
+
     /**
      * @brief Get property::id
      * @return id
@@ -46,6 +46,19 @@ std::vector<as::const_buffer> basic_packet_variant<PacketIdBytes>::const_buffer_
     );
 }
 
+template <std::size_t PacketIdBytes>
+ASYNC_MQTT_HEADER_ONLY_INLINE
+void basic_packet_variant<PacketIdBytes>::append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const {
+    visit(
+        overload {
+            [&] (auto const& p) {
+                p.append_const_buffer_sequence(cbs);
+            },
+            [] (std::monostate const&) {}
+        }
+    );
+}
+
 template <std::size_t PacketIdBytes>
 ASYNC_MQTT_HEADER_ONLY_INLINE
 basic_packet_variant<PacketIdBytes>::operator bool() const {
@@ -428,14 +428,19 @@ inline
 std::vector<as::const_buffer> user_property::const_buffer_sequence() const {
     std::vector<as::const_buffer> v;
     v.reserve(num_of_const_buffer_sequence());
-    v.emplace_back(as::buffer(&id_, 1));
-    v.emplace_back(as::buffer(key_.len.data(), key_.len.size()));
-    v.emplace_back(as::buffer(key_.buf));
-    v.emplace_back(as::buffer(val_.len.data(), val_.len.size()));
-    v.emplace_back(as::buffer(val_.buf));
+    append_const_buffer_sequence(v);
     return v;
 }
 
+inline
+void user_property::append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const {
+    cbs.emplace_back(as::buffer(&id_, 1));
+    cbs.emplace_back(as::buffer(key_.len.data(), key_.len.size()));
+    cbs.emplace_back(as::buffer(key_.buf));
+    cbs.emplace_back(as::buffer(val_.len.data(), val_.len.size()));
+    cbs.emplace_back(as::buffer(val_.buf));
+}
+
 inline
 property::id user_property::id() const {
     return id_;
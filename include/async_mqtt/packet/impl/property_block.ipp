@@ -0,0 +1,370 @@
+// Copyright Takatoshi Kondo 2024
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_PACKET_IMPL_PROPERTY_BLOCK_IPP)
+#define ASYNC_MQTT_PACKET_IMPL_PROPERTY_BLOCK_IPP
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+
+#include <async_mqtt/error.hpp>
+#include <async_mqtt/util/inline.hpp>
+#include <async_mqtt/util/endian_convert.hpp>
+#include <async_mqtt/util/overload.hpp>
+#include <async_mqtt/util/utf8validate.hpp>
+#include <async_mqtt/util/variable_bytes.hpp>
+#include <async_mqtt/packet/property_block.hpp>
+
+namespace async_mqtt {
+
+struct property_block::rep {
+    // owns the bytes that are encoded by the constructor
+    std::string storage;
+    buffer bytes;
+    // offset + 1 of the first occurrence of each property id. 0 means not contained.
+    std::array<std::uint32_t, std::size_t(property::id::shared_subscription_available) + 1> index{};
+};
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+property_block::property_block(properties const& props, property_location loc)
+    :loc_{loc}
+{
+    if (props.empty()) return;
+    auto r = std::make_shared<rep>();
+    r->storage.reserve(async_mqtt::size(props));
+    std::vector<as::const_buffer> cbs;
+    for (auto const& prop : props) {
+        auto id = prop.id();
+        if (!validate_property(loc, id)) {
+            throw system_error(
+                make_error_code(
+                    disconnect_reason_code::malformed_packet
+                )
+            );
+        }
+        auto& offset = r->index[std::size_t(id)];
+        if (offset == 0) offset = static_cast<std::uint32_t>(r->storage.size() + 1);
+        cbs.clear();
+        prop.append_const_buffer_sequence(cbs);
+        for (auto const& cb : cbs) {
+            r->storage.append(static_cast<char const*>(cb.data()), cb.size());
+        }
+    }
+    r->bytes = buffer{std::string_view{r->storage}};
+    rep_ = force_move(r);
+}
+
+namespace detail {
+
+// Validate the encoded properties in a single pass and index them.
+// The checks are the same as make_property_variant() but no property is created.
+template <std::size_t N>
+ASYNC_MQTT_HEADER_ONLY_INLINE
+bool index_properties(
+    std::string_view bytes,
+    property_location loc,
+    std::array<std::uint32_t, N>& index
+) {
+    std::size_t pos = 0;
+    auto fixed = [&](std::size_t len) {
+        if (bytes.size() - pos < len) return false;
+        pos += len;
+        return true;
+    };
+    auto binary = [&](bool utf8) {
+        if (bytes.size() - pos < 2) return false;
+        std::size_t len = endian_load<std::uint16_t>(bytes.data() + pos);
+        pos += 2;
+        if (bytes.size() - pos < len) return false;
+        if (utf8 && !utf8string_check(bytes.substr(pos, len))) return false;
+        pos += len;
+        return true;
+    };
+    auto nonzero = [&](std::size_t len) {
+        if (bytes.size() - pos < len) return false;
+        auto zero = std::all_of(
+            bytes.data() + pos,
+            bytes.data() + pos + len,
+            [](char c) { return c == 0; }
+        );
+        pos += len;
+        return !zero;
+    };
+    auto zero_or_one = [&] {
+        if (bytes.size() - pos < 1) return false;
+        auto val = std::uint8_t(bytes[pos++]);
+        return val == 0 || val == 1;
+    };
+
+    while (pos != bytes.size()) {
+        auto first = pos;
+        auto id = static_cast<property::id>(bytes[pos++]);
+        if (!validate_property(loc, id)) return false;
+        bool valid = false;
+        switch (id) {
+        case property::id::payload_format_indicator:
+        case property::id::maximum_qos:
+            valid = zero_or_one();
+            break;
+        case property::id::request_problem_information:
+        case property::id::request_response_information:
+        case property::id::retain_available:
+        case property::id::wildcard_subscription_available:
+        case property::id::subscription_identifier_available:
+        case property::id::shared_subscription_available:
+            valid = fixed(1);
+            break;
+        case property::id::server_keep_alive:
+        case property::id::topic_alias_maximum:
+        case property::id::topic_alias:
+            valid = fixed(2);
+            break;
+        case property::id::receive_maximum:
+            valid = nonzero(2);
+            break;
+        case property::id::message_expiry_interval:
+        case property::id::session_expiry_interval:
+        case property::id::will_delay_interval:
+            valid = fixed(4);
+            break;
+        case property::id::maximum_packet_size:
+            valid = nonzero(4);
+            break;
+        case property::id::subscription_identifier: {
+            auto it = bytes.begin() + std::ptrdiff_t(pos);
+            auto val = variable_bytes_to_val(it, bytes.end());
+            pos = std::size_t(std::distance(bytes.begin(), it));
+            valid = val && *val != 0;
+        } break;
+        case property::id::content_type:
+        case property::id::response_topic:
+        case property::id::assigned_client_identifier:
+        case property::id::authentication_method:
+        case property::id::response_information:
+        case property::id::server_reference:
+        case property::id::reason_string:
+            valid = binary(true);
+            break;
+        case property::id::correlation_data:
+        case property::id::authentication_data:
+            valid = binary(false);
+            break;
+        case property::id::user_property:
+            // make_property_variant() checks only the lengths
+            valid = binary(false) && binary(false);
+            break;
+        default:
+            break;
+        }
+        if (!valid) return false;
+        auto& offset = index[std::size_t(id)];
+        if (offset == 0) offset = static_cast<std::uint32_t>(first + 1);
+    }
+    return true;
+}
+
+} // namespace detail
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+property_block::property_block(buffer buf, property_location loc, error_code& ec)
+    :loc_{loc}
+{
+    ec = error_code{};
+    if (buf.empty()) return;
+    auto r = std::make_shared<rep>();
+    if (!detail::index_properties(std::string_view{buf}, loc, r->index)) {
+        // decode to report the same error as the eager decoding
+        make_properties(force_move(buf), loc, ec);
+        if (!ec) {
+            ec = make_error_code(
+                disconnect_reason_code::malformed_packet
+            );
+        }
+        return;
+    }
+    r->bytes = force_move(buf);
+    rep_ = force_move(r);
+}
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+std::size_t property_block::size() const {
+    return
+        base_size() +
+        ((mei_ && !offset(property::id::message_expiry_interval)) ? message_expiry_interval_size : 0) +
+        (sid_ ? sid_->size() : 0);
+}
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+bool property_block::empty() const {
+    return base_size() == 0 && !mei_ && !sid_;
+}
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+std::size_t property_block::num_of_const_buffer_sequence() const {
+    auto base = base_size();
+    std::size_t num = 0;
+    if (mei_) {
+        if (auto o = offset(property::id::message_expiry_interval)) {
+            if (*o != 0) ++num;
+            if (*o + message_expiry_interval_size != base) ++num;
+        }
+        else if (base != 0) {
+            ++num;
+        }
+        num += property::message_expiry_interval::num_of_const_buffer_sequence();
+    }
+    else if (base != 0) {
+        ++num;
+    }
+    if (sid_) num += property::subscription_identifier::num_of_const_buffer_sequence();
+    return num;
+}
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+void property_block::append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const {
+    auto base = base_size();
+    if (mei_) {
+        if (auto o = offset(property::id::message_expiry_interval)) {
+            // replace the encoded property by the overlay
+            if (*o != 0) cbs.emplace_back(bytes(0, *o));
+            mei_->append_const_buffer_sequence(cbs);
+            auto rest = *o + message_expiry_interval_size;
+            if (rest != base) cbs.emplace_back(bytes(rest, base));
+        }
+        else {
+            if (base != 0) cbs.emplace_back(bytes(0, base));
+            mei_->append_const_buffer_sequence(cbs);
+        }
+    }
+    else if (base != 0) {
+        cbs.emplace_back(bytes(0, base));
+    }
+    if (sid_) sid_->append_const_buffer_sequence(cbs);
+}
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+std::vector<as::const_buffer> property_block::const_buffer_sequence() const {
+    std::vector<as::const_buffer> ret;
+    ret.reserve(num_of_const_buffer_sequence());
+    append_const_buffer_sequence(ret);
+    return ret;
+}
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+bool property_block::contains(property::id id) const {
+    if (mei_ && id == property::id::message_expiry_interval) return true;
+    if (sid_ && id == property::id::subscription_identifier) return true;
+    return offset(id).has_value();
+}
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+property_location property_block::location() const {
+    return loc_;
+}
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+std::optional<std::uint32_t> property_block::message_expiry_interval() const {
+    if (mei_) return mei_->val();
+    if (auto o = offset(property::id::message_expiry_interval)) {
+        return endian_load<std::uint32_t>(rep_->bytes.data() + *o + 1);
+    }
+    return std::nullopt;
+}
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+std::optional<topic_alias_type> property_block::topic_alias() const {
+    if (auto o = offset(property::id::topic_alias)) {
+        return endian_load<topic_alias_type>(rep_->bytes.data() + *o + 1);
+    }
+    return std::nullopt;
+}
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+property_block property_block::with_subscription_identifier(std::uint32_t val) const {
+    auto ret = *this;
+    ret.sid_.emplace(val);
+    return ret;
+}
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+property_block property_block::with_message_expiry_interval(std::uint32_t val) const {
+    auto ret = *this;
+    ret.mei_.emplace(val);
+    return ret;
+}
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+properties property_block::to_properties() const {
+    properties props;
+    if (rep_) {
+        error_code ec;
+        props = make_properties(
+            buffer{
+                std::string_view{rep_->bytes},
+                std::const_pointer_cast<rep>(rep_)
+            },
+            loc_,
+            ec
+        );
+        if (ec) throw system_error(ec);
+    }
+    if (mei_) {
+        bool replaced = false;
+        for (auto& prop : props) {
+            prop.visit(
+                overload {
+                    [&](property::message_expiry_interval& p) {
+                        p = *mei_;
+                        replaced = true;
+                    },
+                    [](auto&) {}
+                }
+            );
+            if (replaced) break;
+        }
+        if (!replaced) props.emplace_back(*mei_);
+    }
+    if (sid_) props.emplace_back(*sid_);
+    return props;
+}
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+as::const_buffer property_block::bytes(std::size_t first, std::size_t last) const {
+    return as::buffer(rep_->bytes.data() + first, last - first);
+}
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+std::size_t property_block::base_size() const {
+    return rep_ ? rep_->bytes.size() : 0;
+}
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+std::optional<std::size_t> property_block::offset(property::id id) const {
+    if (!rep_) return std::nullopt;
+    auto i = std::size_t(id);
+    if (i >= rep_->index.size() || rep_->index[i] == 0) return std::nullopt;
+    return rep_->index[i] - 1;
+}
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+void append_const_buffer_sequence(std::vector<as::const_buffer>& cbs, property_block const& props) {
+    props.append_const_buffer_sequence(cbs);
+}
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+std::size_t size(property_block const& props) {
+    return props.size();
+}
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+std::size_t num_of_const_buffer_sequence(property_block const& props) {
+    return props.num_of_const_buffer_sequence();
+}
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_PACKET_IMPL_PROPERTY_BLOCK_IPP
@@ -89,6 +89,7 @@ property_variant::operator bool() {
 property_variant make_property_variant(buffer& buf, property_location loc, error_code& ec);
 properties make_properties(buffer buf, property_location loc, error_code& ec);
 std::vector<as::const_buffer> const_buffer_sequence(properties const& props);
+void append_const_buffer_sequence(std::vector<as::const_buffer>& cbs, properties const& props);
 std::size_t size(properties const& props);
 std::size_t num_of_const_buffer_sequence(properties const& props);
 
@@ -64,6 +64,20 @@ std::vector<as::const_buffer> property_variant::const_buffer_sequence() const {
     );
 }
 
+ASYNC_MQTT_HEADER_ONLY_INLINE
+void property_variant::append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const {
+    visit(
+        overload {
+            [&] (auto const& p) {
+                p.append_const_buffer_sequence(cbs);
+            },
+            [] (std::monostate const&) {
+                BOOST_ASSERT(false);
+            }
+        }
+    );
+}
+
 ASYNC_MQTT_HEADER_ONLY_INLINE
 std::size_t property_variant::size() const {
     return visit(
@@ -552,11 +566,16 @@ properties make_properties(buffer buf, property_location loc, error_code& ec) {
 ASYNC_MQTT_HEADER_ONLY_INLINE
 std::vector<as::const_buffer> const_buffer_sequence(properties const& props) {
     std::vector<as::const_buffer> v;
+    v.reserve(num_of_const_buffer_sequence(props));
+    append_const_buffer_sequence(v, props);
+    return v;
+}
+
+ASYNC_MQTT_HEADER_ONLY_INLINE
+void append_const_buffer_sequence(std::vector<as::const_buffer>& cbs, properties const& props) {
     for (auto const& p : props) {
-        auto cbs = p.const_buffer_sequence();
-        std::move(cbs.begin(), cbs.end(), std::back_inserter(v));
+        p.append_const_buffer_sequence(cbs);
     }
-    return v;
 }
 
 ASYNC_MQTT_HEADER_ONLY_INLINE
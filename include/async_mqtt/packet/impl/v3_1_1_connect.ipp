@@ -143,34 +143,37 @@ ASYNC_MQTT_HEADER_ONLY_INLINE
 std::vector<as::const_buffer> connect_packet::const_buffer_sequence() const {
     std::vector<as::const_buffer> ret;
     ret.reserve(num_of_const_buffer_sequence());
+    append_const_buffer_sequence(ret);
+    return ret;
+}
 
-    ret.emplace_back(as::buffer(&fixed_header_, 1));
-    ret.emplace_back(as::buffer(remaining_length_buf_.data(), remaining_length_buf_.size()));
-    ret.emplace_back(as::buffer(protocol_name_and_level_.data(), protocol_name_and_level_.size()));
-    ret.emplace_back(as::buffer(&connect_flags_, 1));
-    ret.emplace_back(as::buffer(keep_alive_buf_.data(), keep_alive_buf_.size()));
+ASYNC_MQTT_HEADER_ONLY_INLINE
+void connect_packet::append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const {
+    cbs.emplace_back(as::buffer(&fixed_header_, 1));
+    cbs.emplace_back(as::buffer(remaining_length_buf_.data(), remaining_length_buf_.size()));
+    cbs.emplace_back(as::buffer(protocol_name_and_level_.data(), protocol_name_and_level_.size()));
+    cbs.emplace_back(as::buffer(&connect_flags_, 1));
+    cbs.emplace_back(as::buffer(keep_alive_buf_.data(), keep_alive_buf_.size()));
 
-    ret.emplace_back(as::buffer(client_id_length_buf_.data(), client_id_length_buf_.size()));
-    ret.emplace_back(as::buffer(client_id_));
+    cbs.emplace_back(as::buffer(client_id_length_buf_.data(), client_id_length_buf_.size()));
+    cbs.emplace_back(as::buffer(client_id_));
 
     if (connect_flags::has_will_flag(connect_flags_)) {
-        ret.emplace_back(as::buffer(will_topic_length_buf_.data(), will_topic_length_buf_.size()));
-        ret.emplace_back(as::buffer(will_topic_));
-        ret.emplace_back(as::buffer(will_message_length_buf_.data(), will_message_length_buf_.size()));
-        ret.emplace_back(as::buffer(will_message_));
+        cbs.emplace_back(as::buffer(will_topic_length_buf_.data(), will_topic_length_buf_.size()));
+        cbs.emplace_back(as::buffer(will_topic_));
+        cbs.emplace_back(as::buffer(will_message_length_buf_.data(), will_message_length_buf_.size()));
+        cbs.emplace_back(as::buffer(will_message_));
     }
 
     if (connect_flags::has_user_name_flag(connect_flags_)) {
-        ret.emplace_back(as::buffer(user_name_length_buf_.data(), user_name_length_buf_.size()));
-        ret.emplace_back(as::buffer(user_name_));
+        cbs.emplace_back(as::buffer(user_name_length_buf_.data(), user_name_length_buf_.size()));
+        cbs.emplace_back(as::buffer(user_name_));
     }
 
     if (connect_flags::has_password_flag(connect_flags_)) {
-        ret.emplace_back(as::buffer(password_length_buf_.data(), password_length_buf_.size()));
-        ret.emplace_back(as::buffer(password_));
+        cbs.emplace_back(as::buffer(password_length_buf_.data(), password_length_buf_.size()));
+        cbs.emplace_back(as::buffer(password_));
     }
-
-    return ret;
 }
 
 ASYNC_MQTT_HEADER_ONLY_INLINE
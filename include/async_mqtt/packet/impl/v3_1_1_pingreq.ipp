@@ -36,11 +36,16 @@ pingreq_packet::pingreq_packet()
 ASYNC_MQTT_HEADER_ONLY_INLINE
 std::vector<as::const_buffer> pingreq_packet::const_buffer_sequence() const {
     std::vector<as::const_buffer> ret;
-
-    ret.emplace_back(as::buffer(all_.data(), all_.size()));
+    ret.reserve(num_of_const_buffer_sequence());
+    append_const_buffer_sequence(ret);
     return ret;
 }
 
+ASYNC_MQTT_HEADER_ONLY_INLINE
+void pingreq_packet::append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const {
+    cbs.emplace_back(as::buffer(all_.data(), all_.size()));
+}
+
 ASYNC_MQTT_HEADER_ONLY_INLINE
 std::size_t pingreq_packet::size() const {
     return all_.size();
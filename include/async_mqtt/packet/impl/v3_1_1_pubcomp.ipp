@@ -48,11 +48,17 @@ template <std::size_t PacketIdBytes>
 ASYNC_MQTT_HEADER_ONLY_INLINE
 std::vector<as::const_buffer> basic_pubcomp_packet<PacketIdBytes>::const_buffer_sequence() const {
     std::vector<as::const_buffer> ret;
-
-    ret.emplace_back(as::buffer(all_.data(), all_.size()));
+    ret.reserve(num_of_const_buffer_sequence());
+    append_const_buffer_sequence(ret);
     return ret;
 }
 
+template <std::size_t PacketIdBytes>
+ASYNC_MQTT_HEADER_ONLY_INLINE
+void basic_pubcomp_packet<PacketIdBytes>::append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const {
+    cbs.emplace_back(as::buffer(all_.data(), all_.size()));
+}
+
 template <std::size_t PacketIdBytes>
 ASYNC_MQTT_HEADER_ONLY_INLINE
 std::size_t basic_pubcomp_packet<PacketIdBytes>::size() const {
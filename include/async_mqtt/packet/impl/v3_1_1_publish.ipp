@@ -153,17 +153,23 @@ ASYNC_MQTT_HEADER_ONLY_INLINE
 std::vector<as::const_buffer> basic_publish_packet<PacketIdBytes>::const_buffer_sequence() const {
     std::vector<as::const_buffer> ret;
     ret.reserve(num_of_const_buffer_sequence());
-    ret.emplace_back(as::buffer(&fixed_header_, 1));
-    ret.emplace_back(as::buffer(remaining_length_buf_.data(), remaining_length_buf_.size()));
-    ret.emplace_back(as::buffer(topic_name_length_buf_.data(), topic_name_length_buf_.size()));
-    ret.emplace_back(as::buffer(topic_name_));
+    append_const_buffer_sequence(ret);
+    return ret;
+}
+
+template <std::size_t PacketIdBytes>
+ASYNC_MQTT_HEADER_ONLY_INLINE
+void basic_publish_packet<PacketIdBytes>::append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const {
+    cbs.emplace_back(as::buffer(&fixed_header_, 1));
+    cbs.emplace_back(as::buffer(remaining_length_buf_.data(), remaining_length_buf_.size()));
+    cbs.emplace_back(as::buffer(topic_name_length_buf_.data(), topic_name_length_buf_.size()));
+    cbs.emplace_back(as::buffer(topic_name_));
     if (packet_id() != 0) {
-        ret.emplace_back(as::buffer(packet_id_.data(), packet_id_.size()));
+        cbs.emplace_back(as::buffer(packet_id_.data(), packet_id_.size()));
     }
     for (auto const& payload : payloads_) {
-        ret.emplace_back(as::buffer(payload));
+        cbs.emplace_back(as::buffer(payload));
     }
-    return ret;
 }
 
 template <std::size_t PacketIdBytes>
@@ -196,6 +202,21 @@ typename basic_packet_id_type<PacketIdBytes>::type basic_publish_packet<PacketId
     return endian_load<typename basic_packet_id_type<PacketIdBytes>::type>(packet_id_.data());
 }
 
+template <std::size_t PacketIdBytes>
+ASYNC_MQTT_HEADER_ONLY_INLINE
+void basic_publish_packet<PacketIdBytes>::set_packet_id(typename basic_packet_id_type<PacketIdBytes>::type packet_id) {
+    auto qos_value = opts().get_qos();
+    if (packet_id == 0 ||
+        (qos_value != qos::at_least_once && qos_value != qos::exactly_once)) {
+        throw system_error(
+            make_error_code(
+                disconnect_reason_code::protocol_error
+            )
+        );
+    }
+    endian_store(packet_id, packet_id_.data());
+}
+
 template <std::size_t PacketIdBytes>
 ASYNC_MQTT_HEADER_ONLY_INLINE
 std::string basic_publish_packet<PacketIdBytes>::topic() const {
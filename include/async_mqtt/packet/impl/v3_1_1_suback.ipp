@@ -52,16 +52,20 @@ ASYNC_MQTT_HEADER_ONLY_INLINE
 std::vector<as::const_buffer> basic_suback_packet<PacketIdBytes>::const_buffer_sequence() const {
     std::vector<as::const_buffer> ret;
     ret.reserve(num_of_const_buffer_sequence());
+    append_const_buffer_sequence(ret);
+    return ret;
+}
 
-    ret.emplace_back(as::buffer(&fixed_header_, 1));
-
-    ret.emplace_back(as::buffer(remaining_length_buf_.data(), remaining_length_buf_.size()));
+template <std::size_t PacketIdBytes>
+ASYNC_MQTT_HEADER_ONLY_INLINE
+void basic_suback_packet<PacketIdBytes>::append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const {
+    cbs.emplace_back(as::buffer(&fixed_header_, 1));
 
-    ret.emplace_back(as::buffer(packet_id_.data(), packet_id_.size()));
+    cbs.emplace_back(as::buffer(remaining_length_buf_.data(), remaining_length_buf_.size()));
 
-    ret.emplace_back(as::buffer(entries_.data(), entries_.size()));
+    cbs.emplace_back(as::buffer(packet_id_.data(), packet_id_.size()));
 
-    return ret;
+    cbs.emplace_back(as::buffer(entries_.data(), entries_.size()));
 }
 
 template <std::size_t PacketIdBytes>
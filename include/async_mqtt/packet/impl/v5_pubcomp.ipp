@@ -77,22 +77,26 @@ ASYNC_MQTT_HEADER_ONLY_INLINE
 std::vector<as::const_buffer> basic_pubcomp_packet<PacketIdBytes>::const_buffer_sequence() const {
     std::vector<as::const_buffer> ret;
     ret.reserve(num_of_const_buffer_sequence());
-    ret.emplace_back(as::buffer(&fixed_header_, 1));
-    ret.emplace_back(as::buffer(remaining_length_buf_.data(), remaining_length_buf_.size()));
+    append_const_buffer_sequence(ret);
+    return ret;
+}
 
-    ret.emplace_back(as::buffer(packet_id_.data(), packet_id_.size()));
+template <std::size_t PacketIdBytes>
+ASYNC_MQTT_HEADER_ONLY_INLINE
+void basic_pubcomp_packet<PacketIdBytes>::append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const {
+    cbs.emplace_back(as::buffer(&fixed_header_, 1));
+    cbs.emplace_back(as::buffer(remaining_length_buf_.data(), remaining_length_buf_.size()));
+
+    cbs.emplace_back(as::buffer(packet_id_.data(), packet_id_.size()));
 
     if (reason_code_) {
-        ret.emplace_back(as::buffer(&*reason_code_, 1));
+        cbs.emplace_back(as::buffer(&*reason_code_, 1));
 
         if (property_length_buf_.size() != 0) {
-            ret.emplace_back(as::buffer(property_length_buf_.data(), property_length_buf_.size()));
-            auto props_cbs = async_mqtt::const_buffer_sequence(props_);
-            std::move(props_cbs.begin(), props_cbs.end(), std::back_inserter(ret));
+            cbs.emplace_back(as::buffer(property_length_buf_.data(), property_length_buf_.size()));
+            async_mqtt::append_const_buffer_sequence(cbs, props_);
         }
     }
-
-    return ret;
 }
 
 template <std::size_t PacketIdBytes>
@@ -34,22 +34,8 @@ basic_publish_packet<PacketIdBytes>::basic_publish_packet(
     properties props
 ):basic_publish_packet{
     packet_id,
-    [&]() -> buffer {
-        if constexpr(std::is_same_v<std::decay_t<StringViewLike>, buffer>) {
-            return topic_name;
-        }
-        else {
-            return buffer{std::string{std::forward<StringViewLike>(topic_name)}};
-        }
-    }(),
-    [&]() -> std::vector<buffer> {
-        if constexpr(std::is_same_v<std::decay_t<Payload>, std::vector<buffer>>) {
-            return payloads;
-        }
-        else {
-            return std::vector<buffer>{buffer{std::string{std::forward<Payload>(payloads)}}};
-        }
-    }(),
+    topic_to_buffer(std::forward<StringViewLike>(topic_name)),
+    payload_to_buffers(std::forward<Payload>(payloads)),
     pubopts,
     force_move(props)
 }
@@ -71,29 +57,90 @@ basic_publish_packet<PacketIdBytes>::basic_publish_packet(
     Payload&& payloads,
     pub::opts pubopts,
     properties props
-) : basic_publish_packet{
+):basic_publish_packet{
+    0,
+    topic_to_buffer(std::forward<StringViewLike>(topic_name)),
+    payload_to_buffers(std::forward<Payload>(payloads)),
+    pubopts,
+    force_move(props)
+}
+{}
+
+template <std::size_t PacketIdBytes>
+template <
+    typename StringViewLike,
+    typename Payload,
+    std::enable_if_t<
+        std::is_convertible_v<std::decay_t<StringViewLike>, std::string_view> &&
+        detail::is_payload<Payload>(),
+        std::nullptr_t
+    >
+>
+inline
+basic_publish_packet<PacketIdBytes>::basic_publish_packet(
+    typename basic_packet_id_type<PacketIdBytes>::type packet_id,
+    StringViewLike&& topic_name,
+    Payload&& payloads,
+    pub::opts pubopts,
+    property_block props
+):basic_publish_packet{
+    packet_id,
+    topic_to_buffer(std::forward<StringViewLike>(topic_name)),
+    payload_to_buffers(std::forward<Payload>(payloads)),
+    pubopts,
+    force_move(props)
+}
+{}
+
+template <std::size_t PacketIdBytes>
+template <
+    typename StringViewLike,
+    typename Payload,
+    std::enable_if_t<
+        std::is_convertible_v<std::decay_t<StringViewLike>, std::string_view> &&
+        detail::is_payload<Payload>(),
+        std::nullptr_t
+    >
+>
+inline
+basic_publish_packet<PacketIdBytes>::basic_publish_packet(
+    StringViewLike&& topic_name,
+    Payload&& payloads,
+    pub::opts pubopts,
+    property_block props
+):basic_publish_packet{
     0,
-    [&]() -> buffer {
-        if constexpr(std::is_same_v<std::decay_t<StringViewLike>, buffer>) {
-            return topic_name;
-        }
-        else {
-            return buffer{std::string{std::forward<StringViewLike>(topic_name)}};
-        }
-    }(),
-    [&]() -> std::vector<buffer> {
-        if constexpr(std::is_same_v<std::decay_t<Payload>, std::vector<buffer>>) {
-            return payloads;
-        }
-        else {
-            return std::vector<buffer>{buffer{std::string{std::forward<Payload>(payloads)}}};
-        }
-    }(),
+    topic_to_buffer(std::forward<StringViewLike>(topic_name)),
+    payload_to_buffers(std::forward<Payload>(payloads)),
     pubopts,
     force_move(props)
 }
 {}
 
+template <std::size_t PacketIdBytes>
+template <typename StringViewLike>
+inline
+buffer basic_publish_packet<PacketIdBytes>::topic_to_buffer(StringViewLike&& topic_name) {
+    if constexpr(std::is_same_v<std::decay_t<StringViewLike>, buffer>) {
+        return topic_name;
+    }
+    else {
+        return buffer{std::string{std::forward<StringViewLike>(topic_name)}};
+    }
+}
+
+template <std::size_t PacketIdBytes>
+template <typename Payload>
+inline
+std::vector<buffer> basic_publish_packet<PacketIdBytes>::payload_to_buffers(Payload&& payloads) {
+    if constexpr(std::is_same_v<std::decay_t<Payload>, std::vector<buffer>>) {
+        return payloads;
+    }
+    else {
+        return std::vector<buffer>{buffer{std::string{std::forward<Payload>(payloads)}}};
+    }
+}
+
 } // namespace async_mqtt::v5
 
 #endif // ASYNC_MQTT_PACKET_IMPL_V5_PUBLISH_HPP
@@ -50,14 +50,54 @@ basic_publish_packet<PacketIdBytes>::basic_publish_packet(
     std::vector<buffer>&& payloads,
     pub::opts pubopts,
     properties props
+)
+    : basic_publish_packet{
+        packet_id,
+        force_move(topic_name),
+        force_move(payloads),
+        pubopts,
+        force_move(props),
+        std::nullopt
+    }
+{}
+
+template <std::size_t PacketIdBytes>
+ASYNC_MQTT_HEADER_ONLY_INLINE
+basic_publish_packet<PacketIdBytes>::basic_publish_packet(
+    typename basic_packet_id_type<PacketIdBytes>::type packet_id,
+    buffer&& topic_name,
+    std::vector<buffer>&& payloads,
+    pub::opts pubopts,
+    property_block props
+)
+    : basic_publish_packet{
+        packet_id,
+        force_move(topic_name),
+        force_move(payloads),
+        pubopts,
+        properties{},
+        force_move(props)
+    }
+{}
+
+template <std::size_t PacketIdBytes>
+ASYNC_MQTT_HEADER_ONLY_INLINE
+basic_publish_packet<PacketIdBytes>::basic_publish_packet(
+    typename basic_packet_id_type<PacketIdBytes>::type packet_id,
+    buffer&& topic_name,
+    std::vector<buffer>&& payloads,
+    pub::opts pubopts,
+    properties props,
+    std::optional<property_block> block
 )
     : fixed_header_(
         detail::make_fixed_header(control_packet_type::publish, 0b0000) | std::uint8_t(pubopts)
     ),
       topic_name_{force_move(topic_name)},
       packet_id_(PacketIdBytes),
-      property_length_(async_mqtt::size(props)),
+      property_length_(block ? block->size() : async_mqtt::size(props)),
       props_(force_move(props)),
+      block_(force_move(block)),
       payloads_{force_move(payloads)},
       remaining_length_(
           2                      // topic name length
@@ -108,6 +148,14 @@ basic_publish_packet<PacketIdBytes>::basic_publish_packet(
             );
         }
     }
+    // the ids of property_block are validated for its location
+    if (block_ && !block_->empty() && block_->location() != property_location::publish) {
+        throw system_error(
+            make_error_code(
+                disconnect_reason_code::malformed_packet
+            )
+        );
+    }
 
     remaining_length_ += property_length_buf_.size() + property_length_;
 
@@ -144,20 +192,30 @@ ASYNC_MQTT_HEADER_ONLY_INLINE
 std::vector<as::const_buffer> basic_publish_packet<PacketIdBytes>::const_buffer_sequence() const {
     std::vector<as::const_buffer> ret;
     ret.reserve(num_of_const_buffer_sequence());
-    ret.emplace_back(as::buffer(&fixed_header_, 1));
-    ret.emplace_back(as::buffer(remaining_length_buf_.data(), remaining_length_buf_.size()));
-    ret.emplace_back(as::buffer(topic_name_length_buf_.data(), topic_name_length_buf_.size()));
-    ret.emplace_back(as::buffer(topic_name_));
+    append_const_buffer_sequence(ret);
+    return ret;
+}
+
+template <std::size_t PacketIdBytes>
+ASYNC_MQTT_HEADER_ONLY_INLINE
+void basic_publish_packet<PacketIdBytes>::append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const {
+    cbs.emplace_back(as::buffer(&fixed_header_, 1));
+    cbs.emplace_back(as::buffer(remaining_length_buf_.data(), remaining_length_buf_.size()));
+    cbs.emplace_back(as::buffer(topic_name_length_buf_.data(), topic_name_length_buf_.size()));
+    cbs.emplace_back(as::buffer(topic_name_));
     if (packet_id() != 0) {
-        ret.emplace_back(as::buffer(packet_id_.data(), packet_id_.size()));
+        cbs.emplace_back(as::buffer(packet_id_.data(), packet_id_.size()));
+    }
+    cbs.emplace_back(as::buffer(property_length_buf_.data(), property_length_buf_.size()));
+    if (block_) {
+        block_->append_const_buffer_sequence(cbs);
+    }
+    else {
+        async_mqtt::append_const_buffer_sequence(cbs, props_);
     }
-    ret.emplace_back(as::buffer(property_length_buf_.data(), property_length_buf_.size()));
-    auto props_cbs = async_mqtt::const_buffer_sequence(props_);
-    std::move(props_cbs.begin(), props_cbs.end(), std::back_inserter(ret));
     for (auto const& payload : payloads_) {
-        ret.emplace_back(as::buffer(payload));
+        cbs.emplace_back(as::buffer(payload));
     }
-    return ret;
 }
 
 template <std::size_t PacketIdBytes>
@@ -181,7 +239,7 @@ std::size_t basic_publish_packet<PacketIdBytes>::num_of_const_buffer_sequence()
             return 1U;
         }() +
         1U +                   // property length
-        async_mqtt::num_of_const_buffer_sequence(props_) +
+        (block_ ? block_->num_of_const_buffer_sequence() : async_mqtt::num_of_const_buffer_sequence(props_)) +
         payloads_.size();
 }
 
@@ -191,6 +249,21 @@ typename basic_packet_id_type<PacketIdBytes>::type basic_publish_packet<PacketId
     return endian_load<typename basic_packet_id_type<PacketIdBytes>::type>(packet_id_.data());
 }
 
+template <std::size_t PacketIdBytes>
+ASYNC_MQTT_HEADER_ONLY_INLINE
+void basic_publish_packet<PacketIdBytes>::set_packet_id(typename basic_packet_id_type<PacketIdBytes>::type packet_id) {
+    auto qos_value = opts().get_qos();
+    if (packet_id == 0 ||
+        (qos_value != qos::at_least_once && qos_value != qos::exactly_once)) {
+        throw system_error(
+            make_error_code(
+                disconnect_reason_code::protocol_error
+            )
+        );
+    }
+    endian_store(packet_id, packet_id_.data());
+}
+
 template <std::size_t PacketIdBytes>
 ASYNC_MQTT_HEADER_ONLY_INLINE
 std::string basic_publish_packet<PacketIdBytes>::topic() const {
@@ -224,12 +297,48 @@ std::vector<buffer> const& basic_publish_packet<PacketIdBytes>::payload_as_buffe
 template <std::size_t PacketIdBytes>
 ASYNC_MQTT_HEADER_ONLY_INLINE
 properties const& basic_publish_packet<PacketIdBytes>::props() const {
+    if (block_) {
+        if (!decoded_props_) decoded_props_.emplace(block_->to_properties());
+        return *decoded_props_;
+    }
     return props_;
 }
 
+template <std::size_t PacketIdBytes>
+ASYNC_MQTT_HEADER_ONLY_INLINE
+property_block basic_publish_packet<PacketIdBytes>::props_as_block() const {
+    if (block_) return *block_;
+    return property_block{props_, property_location::publish};
+}
+
+template <std::size_t PacketIdBytes>
+ASYNC_MQTT_HEADER_ONLY_INLINE
+std::optional<std::uint32_t> basic_publish_packet<PacketIdBytes>::message_expiry_interval() const {
+    if (block_) return block_->message_expiry_interval();
+    for (auto const& prop : props_) {
+        if (auto p = prop.get_if<property::message_expiry_interval>()) {
+            return p->val();
+        }
+    }
+    return std::nullopt;
+}
+
+template <std::size_t PacketIdBytes>
+ASYNC_MQTT_HEADER_ONLY_INLINE
+std::optional<topic_alias_type> basic_publish_packet<PacketIdBytes>::topic_alias() const {
+    if (block_) return block_->topic_alias();
+    for (auto const& prop : props_) {
+        if (auto p = prop.get_if<property::topic_alias>()) {
+            return p->val();
+        }
+    }
+    return std::nullopt;
+}
+
 template <std::size_t PacketIdBytes>
 ASYNC_MQTT_HEADER_ONLY_INLINE
 void basic_publish_packet<PacketIdBytes>::remove_topic_add_topic_alias(topic_alias_type val) {
+    decode_props();
     // add topic_alias property
     auto prop{property::topic_alias{val}};
     auto prop_size = prop.size();
@@ -259,6 +368,7 @@ void basic_publish_packet<PacketIdBytes>::remove_topic_add_topic_alias(topic_ali
 template <std::size_t PacketIdBytes>
 ASYNC_MQTT_HEADER_ONLY_INLINE
 void basic_publish_packet<PacketIdBytes>::add_topic_alias(topic_alias_type val) {
+    decode_props();
     // add topic_alias property
     auto prop{property::topic_alias{val}};
     auto prop_size = prop.size();
@@ -322,6 +432,13 @@ void basic_publish_packet<PacketIdBytes>::remove_topic_alias_add_topic(std::stri
 template <std::size_t PacketIdBytes>
 ASYNC_MQTT_HEADER_ONLY_INLINE
 void basic_publish_packet<PacketIdBytes>::update_message_expiry_interval(std::uint32_t val) {
+    if (block_) {
+        if (block_->message_expiry_interval()) {
+            block_ = block_->with_message_expiry_interval(val);
+            decoded_props_.reset();
+        }
+        return;
+    }
     bool updated = false;
     for (auto& prop : props_) {
         prop.visit(
@@ -363,6 +480,11 @@ std::tuple<std::size_t, std::size_t> basic_publish_packet<PacketIdBytes>::update
 template <std::size_t PacketIdBytes>
 ASYNC_MQTT_HEADER_ONLY_INLINE
 std::size_t basic_publish_packet<PacketIdBytes>::remove_topic_alias_impl() {
+    if (block_) {
+        // keep sharing the encoded properties if possible
+        if (!block_->contains(property::id::topic_alias)) return 0;
+        decode_props();
+    }
     auto it = props_.cbegin();
     std::size_t size = 0;
     while (it != props_.cend()) {
@@ -377,6 +499,16 @@ std::size_t basic_publish_packet<PacketIdBytes>::remove_topic_alias_impl() {
     return size;
 }
 
+template <std::size_t PacketIdBytes>
+ASYNC_MQTT_HEADER_ONLY_INLINE
+void basic_publish_packet<PacketIdBytes>::decode_props() {
+    if (!block_) return;
+    // the encoded size is not changed
+    props_ = decoded_props_ ? force_move(*decoded_props_) : block_->to_properties();
+    block_.reset();
+    decoded_props_.reset();
+}
+
 template <std::size_t PacketIdBytes>
 ASYNC_MQTT_HEADER_ONLY_INLINE
 void basic_publish_packet<PacketIdBytes>::add_topic_impl(std::string topic) {
@@ -393,6 +525,16 @@ void basic_publish_packet<PacketIdBytes>::add_topic_impl(std::string topic) {
 template <std::size_t PacketIdBytes>
 ASYNC_MQTT_HEADER_ONLY_INLINE
 basic_publish_packet<PacketIdBytes>::basic_publish_packet(buffer buf, error_code& ec)
+    : basic_publish_packet(force_move(buf), property_decoding::eager, ec) {
+}
+
+template <std::size_t PacketIdBytes>
+ASYNC_MQTT_HEADER_ONLY_INLINE
+basic_publish_packet<PacketIdBytes>::basic_publish_packet(
+    buffer buf,
+    property_decoding decoding,
+    error_code& ec
+)
     : packet_id_(PacketIdBytes) {
     // fixed_header
     if (buf.empty()) {
@@ -476,8 +618,16 @@ basic_publish_packet<PacketIdBytes>::basic_publish_packet(buffer buf, error_code
             return;
         }
         auto prop_buf = buf.substr(0, property_length_);
-        props_ = make_properties(prop_buf, property_location::publish, ec);
-        if (ec) return;
+        if (decoding == property_decoding::lazy) {
+            // keep the property region, it is decoded by props() on demand
+            property_block block{force_move(prop_buf), property_location::publish, ec};
+            if (ec) return;
+            if (!block.empty()) block_.emplace(force_move(block));
+        }
+        else {
+            props_ = make_properties(prop_buf, property_location::publish, ec);
+            if (ec) return;
+        }
         buf.remove_prefix(property_length_);
     }
     else {
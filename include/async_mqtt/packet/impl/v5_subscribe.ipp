@@ -143,27 +143,30 @@ ASYNC_MQTT_HEADER_ONLY_INLINE
 std::vector<as::const_buffer> basic_subscribe_packet<PacketIdBytes>::const_buffer_sequence() const {
     std::vector<as::const_buffer> ret;
     ret.reserve(num_of_const_buffer_sequence());
+    append_const_buffer_sequence(ret);
+    return ret;
+}
 
-    ret.emplace_back(as::buffer(&fixed_header_, 1));
+template <std::size_t PacketIdBytes>
+ASYNC_MQTT_HEADER_ONLY_INLINE
+void basic_subscribe_packet<PacketIdBytes>::append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const {
+    cbs.emplace_back(as::buffer(&fixed_header_, 1));
 
-    ret.emplace_back(as::buffer(remaining_length_buf_.data(), remaining_length_buf_.size()));
+    cbs.emplace_back(as::buffer(remaining_length_buf_.data(), remaining_length_buf_.size()));
 
-    ret.emplace_back(as::buffer(packet_id_.data(), packet_id_.size()));
+    cbs.emplace_back(as::buffer(packet_id_.data(), packet_id_.size()));
 
-    ret.emplace_back(as::buffer(property_length_buf_.data(), property_length_buf_.size()));
-    auto props_cbs = async_mqtt::const_buffer_sequence(props_);
-    std::move(props_cbs.begin(), props_cbs.end(), std::back_inserter(ret));
+    cbs.emplace_back(as::buffer(property_length_buf_.data(), property_length_buf_.size()));
+    async_mqtt::append_const_buffer_sequence(cbs, props_);
 
         BOOST_ASSERT(entries_.size() == topic_length_buf_entries_.size());
     auto it = topic_length_buf_entries_.begin();
     for (auto const& e : entries_) {
-        ret.emplace_back(as::buffer(it->data(), it->size()));
-        ret.emplace_back(as::buffer(e.all_topic()));
-        ret.emplace_back(as::buffer(&e.opts(), 1));
+        cbs.emplace_back(as::buffer(it->data(), it->size()));
+        cbs.emplace_back(as::buffer(e.all_topic()));
+        cbs.emplace_back(as::buffer(&e.opts(), 1));
         ++it;
     }
-
-    return ret;
 }
 
 template <std::size_t PacketIdBytes>
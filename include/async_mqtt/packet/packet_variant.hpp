@@ -137,6 +137,14 @@ public:
      */
     std::vector<as::const_buffer> const_buffer_sequence() const;
 
+    /**
+     * @brief Append const buffer sequence to the given vector.
+     *        The caller can reuse the vector to avoid allocations.
+     *        The buffers refer to the packet, so the packet must be alive while they are used.
+     * @param cbs the buffers are appended to it
+     */
+    void append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const;
+
     operator bool() const;
 
 private:
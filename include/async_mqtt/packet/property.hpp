@@ -1261,6 +1261,12 @@ public:
      */
     std::vector<as::const_buffer> const_buffer_sequence() const;
 
+    /**
+     * @brief Append const buffer sequence to the given vector.
+     * @param cbs the buffers are appended to it
+     */
+    void append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const;
+
     /**
      * @brief Get property::id
      * @return id
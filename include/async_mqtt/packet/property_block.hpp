@@ -0,0 +1,203 @@
+// Copyright Takatoshi Kondo 2024
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_PACKET_PROPERTY_BLOCK_HPP)
+#define ASYNC_MQTT_PACKET_PROPERTY_BLOCK_HPP
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <boost/asio/buffer.hpp>
+
+#include <async_mqtt/error.hpp>
+#include <async_mqtt/util/buffer.hpp>
+#include <async_mqtt/packet/property.hpp>
+#include <async_mqtt/packet/property_variant.hpp>
+#include <async_mqtt/packet/impl/validate_property.hpp>
+
+namespace async_mqtt {
+
+namespace as = boost::asio;
+
+/**
+ * @ingroup property
+ * @brief immutable wire encoded properties
+ * #### Thread Safety
+ *    - Distinct objects: Safe
+ *    - Shared objects: Unsafe
+ *
+ * The properties are encoded once into a single buffer that is shared by the copies.
+ * The buffer can also be the property region of a received packet. In this case the
+ * properties are validated but decoded only when to_properties() is called.
+ * The offset of the first occurrence of each property id is indexed, so the well-known
+ * properties such as MessageExpiryInterval are found without decoding.
+ * SubscriptionIdentifier and MessageExpiryInterval can be overlaid on a copy without
+ * re-encoding. The overlays are held by the object, so the buffers that are returned by
+ * append_const_buffer_sequence() refer to the object.
+ */
+class property_block {
+public:
+    /**
+     * @brief constructor
+     * Create empty properties.
+     */
+    property_block() = default;
+
+    /**
+     * @brief constructor
+     * @param props properties to encode
+     * @param loc   location of the properties. It is used to validate and decode them.
+     */
+    explicit property_block(
+        properties const& props,
+        property_location loc = property_location::publish
+    );
+
+    /**
+     * @brief constructor
+     * Index the wire encoded properties without decoding them.
+     * The properties are validated as make_properties() does, so the same error is reported.
+     * @param buf property region of the packet. It is shared, not copied.
+     * @param loc location of the properties. It is used to validate and decode them.
+     * @param ec  error_code for reporting error
+     */
+    property_block(
+        buffer buf,
+        property_location loc,
+        error_code& ec
+    );
+
+    /**
+     * @brief Get encoded size including the overlays
+     * @return size
+     */
+    std::size_t size() const;
+
+    /**
+     * @brief Check the properties are empty
+     * @return true if empty, otherwise false
+     */
+    bool empty() const;
+
+    /**
+     * @brief Get number of element of const_buffer_sequence
+     * @return number of element of const_buffer_sequence
+     */
+    std::size_t num_of_const_buffer_sequence() const;
+
+    /**
+     * @brief Append const buffer sequence to the given vector.
+     * @param cbs the buffers are appended to it
+     */
+    void append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const;
+
+    /**
+     * @brief Create const buffer sequence
+     *        it is for boost asio APIs
+     * @return const buffer sequence
+     */
+    std::vector<as::const_buffer> const_buffer_sequence() const;
+
+    /**
+     * @brief Check the property is contained
+     * The overlays are taken into account.
+     * @param id property id
+     * @return true if contained, otherwise false
+     */
+    bool contains(property::id id) const;
+
+    /**
+     * @brief Get the location that the properties are validated for
+     * @return location
+     */
+    property_location location() const;
+
+    /**
+     * @brief Get MessageExpiryInterval
+     * @return the value if the property is contained, otherwise std::nullopt
+     */
+    std::optional<std::uint32_t> message_expiry_interval() const;
+
+    /**
+     * @brief Get TopicAlias
+     * @return the value if the property is contained, otherwise std::nullopt
+     */
+    std::optional<topic_alias_type> topic_alias() const;
+
+    /**
+     * @brief Get a copy with SubscriptionIdentifier
+     * The property is appended at the end. If the copy already has the overlay, it is replaced.
+     * @param val subscription_identifier
+     * @return the copy that shares the encoded properties
+     */
+    property_block with_subscription_identifier(std::uint32_t val) const;
+
+    /**
+     * @brief Get a copy with MessageExpiryInterval
+     * If the property is contained, its value is replaced, otherwise the property is appended.
+     * @param val message_expiry_interval
+     * @return the copy that shares the encoded properties
+     */
+    property_block with_message_expiry_interval(std::uint32_t val) const;
+
+    /**
+     * @brief Decode to properties
+     * The buffers of the decoded properties share the encoded properties.
+     * @return properties
+     */
+    properties to_properties() const;
+
+private:
+    struct rep;
+
+    // The encoded size of MessageExpiryInterval
+    static constexpr std::size_t message_expiry_interval_size = 5;
+
+    // byte range of the shared encoded properties
+    as::const_buffer bytes(std::size_t first, std::size_t last) const;
+    std::size_t base_size() const;
+    std::optional<std::size_t> offset(property::id id) const;
+
+    std::shared_ptr<rep const> rep_;
+    property_location loc_ = property_location::publish;
+    std::optional<property::message_expiry_interval> mei_;
+    std::optional<property::subscription_identifier> sid_;
+};
+
+/**
+ * @related property_block
+ * @brief Append const buffer sequence to the given vector.
+ * @param cbs   the buffers are appended to it
+ * @param props target
+ */
+void append_const_buffer_sequence(std::vector<as::const_buffer>& cbs, property_block const& props);
+
+/**
+ * @related property_block
+ * @brief Get encoded size
+ * @param props target
+ * @return size
+ */
+std::size_t size(property_block const& props);
+
+/**
+ * @related property_block
+ * @brief Get number of element of const_buffer_sequence
+ * @param props target
+ * @return number of element of const_buffer_sequence
+ */
+std::size_t num_of_const_buffer_sequence(property_block const& props);
+
+} // namespace async_mqtt
+
+#if !defined(ASYNC_MQTT_SEPARATE_COMPILATION)
+#include <async_mqtt/packet/impl/property_block.ipp>
+#endif // !defined(ASYNC_MQTT_SEPARATE_COMPILATION)
+
+#endif // ASYNC_MQTT_PACKET_PROPERTY_BLOCK_HPP
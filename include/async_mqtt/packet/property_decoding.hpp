@@ -0,0 +1,53 @@
+// Copyright Takatoshi Kondo 2024
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_PACKET_PROPERTY_DECODING_HPP)
+#define ASYNC_MQTT_PACKET_PROPERTY_DECODING_HPP
+
+#include <ostream>
+
+namespace async_mqtt {
+
+/**
+ * @ingroup property
+ * @brief When the properties of the received packet are decoded
+ */
+enum class property_decoding {
+    eager, ///< decoded on receive
+    lazy,  ///< validated on receive, decoded on the first access. Only for v5 PUBLISH packet.
+};
+
+/**
+ * @ingroup property
+ * @brief stringize property_decoding
+ * @param v target
+ * @return  property_decoding string
+ */
+constexpr char const* property_decoding_to_str(property_decoding v) {
+    switch(v) {
+    case property_decoding::eager: return "eager";
+    case property_decoding::lazy: return "lazy";
+    default: return "unknown_property_decoding";
+    }
+}
+
+/**
+ * @ingroup property
+ * @brief output to the stream property_decoding
+ * @param os  output stream
+ * @param val target
+ * @return output stream
+ */
+inline
+std::ostream& operator<<(std::ostream& os, property_decoding val)
+{
+    os << property_decoding_to_str(val);
+    return os;
+}
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_PACKET_PROPERTY_DECODING_HPP
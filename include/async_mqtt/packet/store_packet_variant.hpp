@@ -160,6 +160,20 @@ public:
         );
     }
 
+    /**
+     * @brief Append const buffer sequence to the given vector.
+     * @param cbs the buffers are appended to it
+     */
+    void append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const {
+        visit(
+            overload {
+                [&] (auto const& p) {
+                    p.append_const_buffer_sequence(cbs);
+                }
+            }
+        );
+    }
+
     /**
      * @brief Get packet id
      * @return packet_id
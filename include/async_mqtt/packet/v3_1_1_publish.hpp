@@ -135,6 +135,14 @@ public:
      */
     std::vector<as::const_buffer> const_buffer_sequence() const;
 
+    /**
+     * @brief Append const buffer sequence to the given vector.
+     *        The caller can reuse the vector to avoid allocations.
+     *        The buffers refer to the packet, so the packet must be alive while they are used.
+     * @param cbs the buffers are appended to it
+     */
+    void append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const;
+
     /**
      * @brief Get packet size.
      * @return packet size
@@ -153,6 +161,14 @@ public:
      */
     typename basic_packet_id_type<PacketIdBytes>::type packet_id() const;
 
+    /**
+     * @brief Set packet id
+     * The packet size doesn't change, so a copy of a prepared packet can be
+     * sent with a different packet id. QoS must be AtLeastOnce or ExactlyOnce.
+     * @param packet_id packet_id. It must not be 0.
+     */
+    void set_packet_id(typename basic_packet_id_type<PacketIdBytes>::type packet_id);
+
     /**
      * @brief Get publish_options
      * @return publish_options.
@@ -14,6 +14,7 @@
 #include <async_mqtt/packet/packet_id_type.hpp>
 #include <async_mqtt/packet/pubopts.hpp>
 #include <async_mqtt/packet/property_variant.hpp>
+#include <async_mqtt/packet/property_block.hpp>
 #include <async_mqtt/packet/detail/is_payload.hpp>
 
 #include <async_mqtt/util/buffer.hpp>
@@ -127,6 +128,61 @@ public:
         properties props = {}
     );
 
+    /**
+     * @brief constructor with encoded properties
+     * The properties are not copied but shared with props. It is for sending the same
+     * properties many times, such as delivering a message to many subscribers.
+     * @tparam StringViewLike Type of the topic. Any type can convert to std::string_view.
+     * @tparam Payload Type of the payload. Any type can convert to std::string_view or its sequence.
+     * @param packet_id  MQTT PacketIdentifier. If QoS0 then it must be 0.
+     * @param topic_name MQTT TopicName
+     * @param payloads   The body message of the packet. It could be a single buffer of multiple buffer sequence.
+     * @param pubopts    Publish Options.
+     * @param props      Publish properties. The location must be property_location::publish.
+     *                   \n See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901109
+     */
+    template <
+        typename StringViewLike,
+        typename Payload,
+        std::enable_if_t<
+            std::is_convertible_v<std::decay_t<StringViewLike>, std::string_view> &&
+            detail::is_payload<Payload>(),
+            std::nullptr_t
+        > = nullptr
+    >
+    explicit basic_publish_packet(
+        typename basic_packet_id_type<PacketIdBytes>::type packet_id,
+        StringViewLike&& topic_name,
+        Payload&& payloads,
+        pub::opts pubopts,
+        property_block props
+    );
+
+    /**
+     * @brief constructor with encoded properties for QoS0
+     * @tparam StringViewLike Type of the topic. Any type can convert to std::string_view.
+     * @tparam Payload Type of the payload. Any type can convert to std::string_view or its sequence.
+     * @param topic_name MQTT TopicName
+     * @param payloads   The body message of the packet. It could be a single buffer of multiple buffer sequence.
+     * @param pubopts    Publish Options.
+     * @param props      Publish properties. The location must be property_location::publish.
+     */
+    template <
+        typename StringViewLike,
+        typename Payload,
+        std::enable_if_t<
+            std::is_convertible_v<std::decay_t<StringViewLike>, std::string_view> &&
+            detail::is_payload<Payload>(),
+            std::nullptr_t
+        > = nullptr
+    >
+    explicit basic_publish_packet(
+        StringViewLike&& topic_name,
+        Payload&& payloads,
+        pub::opts pubopts,
+        property_block props
+    );
+
     /**
      * @brief Get MQTT control packet type
      * @return control packet type
@@ -142,6 +198,14 @@ public:
      */
     std::vector<as::const_buffer> const_buffer_sequence() const;
 
+    /**
+     * @brief Append const buffer sequence to the given vector.
+     *        The caller can reuse the vector to avoid allocations.
+     *        The buffers refer to the packet, so the packet must be alive while they are used.
+     * @param cbs the buffers are appended to it
+     */
+    void append_const_buffer_sequence(std::vector<as::const_buffer>& cbs) const;
+
     /**
      * @brief Get packet size.
      * @return packet size
@@ -160,6 +224,14 @@ public:
      */
     typename basic_packet_id_type<PacketIdBytes>::type packet_id() const;
 
+    /**
+     * @brief Set packet id
+     * The packet size doesn't change, so a copy of a prepared packet can be
+     * sent with a different packet id. QoS must be AtLeastOnce or ExactlyOnce.
+     * @param packet_id packet_id. It must not be 0.
+     */
+    void set_packet_id(typename basic_packet_id_type<PacketIdBytes>::type packet_id);
+
     /**
      * @brief Get publish_options
      * @return publish_options.
@@ -208,10 +280,35 @@ public:
 
     /**
      * @brief Get properties
+     * If the packet is constructed with property_block, or received with
+     * property_decoding::lazy, the properties are decoded at the first call.
      * @return properties
      */
     properties const& props() const;
 
+    /**
+     * @brief Get properties as property_block
+     * If the packet is constructed with property_block, or received with
+     * property_decoding::lazy, the encoded properties are shared without decoding.
+     * Otherwise, the properties are encoded.
+     * @return property_block
+     */
+    property_block props_as_block() const;
+
+    /**
+     * @brief Get MessageExpiryInterval
+     * If the packet is constructed with property_block, the properties are not decoded.
+     * @return the value if the property is contained, otherwise std::nullopt
+     */
+    std::optional<std::uint32_t> message_expiry_interval() const;
+
+    /**
+     * @brief Get TopicAlias
+     * If the packet is constructed with property_block, the properties are not decoded.
+     * @return the value if the property is contained, otherwise std::nullopt
+     */
+    std::optional<topic_alias_type> topic_alias() const;
+
     /**
      * @brief Remove topic and add topic_alias
      * This is for applying topic_alias.
@@ -261,12 +358,30 @@ private:
 
     void add_topic_impl(std::string topic);
 
+    // decode the property_block to modify the properties
+    void decode_props();
+
+    template <typename StringViewLike>
+    static buffer topic_to_buffer(StringViewLike&& topic_name);
+
+    template <typename Payload>
+    static std::vector<buffer> payload_to_buffers(Payload&& payloads);
+
 private:
 
     template <std::size_t PacketIdBytesArg>
     friend basic_packet_variant<PacketIdBytesArg>
     async_mqtt::buffer_to_basic_packet_variant(buffer buf, protocol_version ver, error_code& ec);
 
+    template <std::size_t PacketIdBytesArg>
+    friend basic_packet_variant<PacketIdBytesArg>
+    async_mqtt::buffer_to_basic_packet_variant(
+        buffer buf,
+        protocol_version ver,
+        property_decoding decoding,
+        error_code& ec
+    );
+
 #if defined(ASYNC_MQTT_UNIT_TEST_FOR_PACKET)
     friend struct ::ut_packet::v5_publish;
     friend struct ::ut_packet::v5_publish_qos0;
@@ -279,6 +394,8 @@ private:
     // private constructor for internal use
     explicit basic_publish_packet(buffer buf, error_code& ec);
 
+    explicit basic_publish_packet(buffer buf, property_decoding decoding, error_code& ec);
+
     explicit basic_publish_packet(
         typename basic_packet_id_type<PacketIdBytes>::type packet_id,
         buffer&& topic_name,
@@ -287,6 +404,23 @@ private:
         properties props
     );
 
+    explicit basic_publish_packet(
+        typename basic_packet_id_type<PacketIdBytes>::type packet_id,
+        buffer&& topic_name,
+        std::vector<buffer>&& payloads,
+        pub::opts pubopts,
+        property_block props
+    );
+
+    explicit basic_publish_packet(
+        typename basic_packet_id_type<PacketIdBytes>::type packet_id,
+        buffer&& topic_name,
+        std::vector<buffer>&& payloads,
+        pub::opts pubopts,
+        properties props,
+        std::optional<property_block> block
+    );
+
 private:
     std::uint8_t fixed_header_;
     buffer topic_name_;
@@ -295,6 +429,10 @@ private:
     std::size_t property_length_;
     static_vector<char, 4> property_length_buf_;
     properties props_;
+    // If it is set, it is sent instead of props_
+    std::optional<property_block> block_;
+    // decoded block_ for props()
+    mutable std::optional<properties> decoded_props_;
     std::vector<buffer> payloads_;
     std::size_t remaining_length_;
     static_vector<char, 4> remaining_length_buf_;
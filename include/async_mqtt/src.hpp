@@ -45,6 +45,7 @@
 
 #include <async_mqtt/packet/impl/packet_variant.ipp>
 #include <async_mqtt/packet/impl/property_variant.ipp>
+#include <async_mqtt/packet/impl/property_block.ipp>
 
 #include <async_mqtt/impl/buffer_to_packet_variant.ipp>
 #include <async_mqtt/impl/client_impl.ipp>
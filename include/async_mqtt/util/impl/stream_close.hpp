@@ -44,7 +44,7 @@ struct stream<NextLayer>::stream_close_op {
         }
         else {
             BOOST_ASSERT(state == complete);
-            strm.storing_cbs_.clear();
+            strm.storing_batches_.clear();
             strm.sending_cbs_.clear();
             self.complete(ec);
         }
@@ -25,8 +25,9 @@ struct stream<NextLayer>::stream_read_packet_op {
     std::uint32_t rl = 0;
     std::size_t rl_expected = 2;
     std::shared_ptr<char[]> spca = nullptr;
+    std::size_t large_size = 0;
     stream_type_sp life_keeper = strm.shared_from_this();
-    enum { dispatch, post, work, remaining_length, complete } state = dispatch;
+    enum { dispatch, post, work, remaining_length, complete, slab_read, large_read } state = dispatch;
 
     template <typename Self>
     void operator()(
@@ -76,10 +77,9 @@ struct stream<NextLayer>::stream_read_packet_op {
                 }
             }
             else {
-                // start bulk read
-                a_strm.async_read_some(
-                    force_move(self)
-                );
+                // start slab read
+                state = slab_read;
+                proceed(self);
             }
         } break;
         default:
@@ -88,7 +88,7 @@ struct stream<NextLayer>::stream_read_packet_op {
         }
     }
 
-    // for non bulk read
+    // for async_read() and async_read_some() completion
     template <typename Self>
     void operator()(
         Self& self,
@@ -98,6 +98,8 @@ struct stream<NextLayer>::stream_read_packet_op {
         (void)bytes_transferred; // Ignore unused argument in release build
 
         if (ec) {
+            // discard partially received packet
+            strm.slab_begin_ = strm.slab_end_;
             next();
             self.complete(ec, buffer{});
             return;
@@ -196,21 +198,101 @@ struct stream<NextLayer>::stream_read_packet_op {
             auto ptr = spca.get();
             self.complete(ec, buffer{ptr, ptr + received + rl, force_move(spca)});
         } break;
+        case slab_read:
+            strm.slab_end_ += bytes_transferred;
+            proceed(self);
+            break;
+        case large_read: {
+            next();
+            auto ptr = spca.get();
+            self.complete(ec, buffer{ptr, large_size, force_move(spca)});
+        } break;
         default:
             BOOST_ASSERT(false);
             break;
         }
     }
 
-    // finish bulk read
+    // for slab read
     template <typename Self>
-    void operator()(
-        Self& self,
-        error_code const& ec,
-        buffer packet
-    ) {
-        next();
-        self.complete(ec, force_move(packet));
+    void proceed(Self& self) {
+        error_code ec;
+        auto size = strm.slab_packet_size(ec);
+        if (ec) {
+            strm.slab_begin_ = strm.slab_end_;
+            next();
+            ASYNC_MQTT_LOG("mqtt_impl", warning)
+                << ASYNC_MQTT_ADD_VALUE(address, this)
+                << "out of size remaining length";
+            self.complete(ec, buffer{});
+            return;
+        }
+        if (size != 0 && strm.slab_end_ - strm.slab_begin_ >= size) {
+            // whole packet is in the slab. the packet aliases the slab.
+            auto ptr = &strm.slab_[std::ptrdiff_t(strm.slab_begin_)];
+            strm.slab_begin_ += size;
+            next();
+            self.complete(ec, buffer{ptr, size, strm.slab_});
+            return;
+        }
+
+        BOOST_ASIO_REBIND_ALLOC(
+            typename as::associated_allocator<Self>::type,
+            char
+        )
+        alloc{
+            as::get_associated_allocator(self)
+        };
+        if (size > strm.bulk_read_buffer_size_) {
+            // the packet is larger than the slab.
+            // copy the received part and read the rest into the dedicated buffer.
+            auto part = strm.slab_end_ - strm.slab_begin_;
+            spca = allocate_shared_ptr_char_array(alloc, size);
+            std::copy_n(&strm.slab_[std::ptrdiff_t(strm.slab_begin_)], part, spca.get());
+            strm.slab_begin_ = strm.slab_end_;
+            large_size = size;
+            state = large_read;
+            auto address = &spca[std::ptrdiff_t(part)];
+            auto& a_strm{strm};
+            if constexpr (
+                has_async_read<next_layer_type>::value) {
+                    layer_customize<next_layer_type>::async_read(
+                        a_strm.nl_,
+                        as::buffer(address, size - part),
+                        force_move(self)
+                    );
+                }
+            else {
+                async_read(
+                    a_strm.nl_,
+                    as::buffer(address, size - part),
+                    as::transfer_all(),
+                    force_move(self)
+                );
+            }
+            return;
+        }
+
+        strm.slab_prepare(alloc, size);
+        auto& a_strm{strm};
+        auto mb = as::buffer(
+            &a_strm.slab_[std::ptrdiff_t(a_strm.slab_end_)],
+            a_strm.slab_capacity_ - a_strm.slab_end_
+        );
+        if constexpr (
+            has_async_read_some<next_layer_type>::value) {
+                layer_customize<next_layer_type>::async_read_some(
+                    a_strm.nl_,
+                    mb,
+                    force_move(self)
+                );
+        }
+        else {
+            a_strm.nl_.async_read_some(
+                mb,
+                force_move(self)
+            );
+        }
     }
 
     void next() {
@@ -247,167 +329,58 @@ stream<NextLayer>::async_read_packet(
         );
 }
 
+// returns the size of the packet that begins at slab_begin_.
+// returns 0 if fixed header and remaining length are not received yet.
 template <typename NextLayer>
 inline
-void
-stream<NextLayer>::init_read() {
-    read_state_ = read_state::fixed_header;
-    header_remaining_length_buf_.clear();
-    remaining_length_ = 0;
-    multiplier_ = 1;
-}
-
-
-template <typename NextLayer>
-struct stream<NextLayer>::stream_read_some_op {
-    using stream_type = this_type;
-    using stream_type_sp = std::shared_ptr<stream_type>;
-    using next_layer_type = stream_type::next_layer_type;
-
-    stream_type& strm;
-    stream_type_sp life_keeper = strm.shared_from_this();
-
-    template <typename Self>
-    void operator()(
-        Self& self
-    ) {
-        if (strm.read_packets_.empty()) {
-            auto& a_strm{strm};
-            if constexpr (
-                has_async_read_some<next_layer_type>::value) {
-                    layer_customize<next_layer_type>::async_read_some(
-                        a_strm.nl_,
-                        a_strm.read_buf_.prepare(a_strm.bulk_read_buffer_size_),
-                        force_move(self)
-                    );
-            }
-            else {
-                a_strm.nl_.async_read_some(
-                    a_strm.read_buf_.prepare(a_strm.bulk_read_buffer_size_),
-                    force_move(self)
-                );
-            }
-        }
-        else {
-            auto [ec, packet] = force_move(strm.read_packets_.front());
-            strm.read_packets_.pop_front();
-            self.complete(ec, force_move(packet));
-        }
-    }
-
-    template <typename Self>
-    void operator()(
-        Self& self,
-        error_code const& ec,
-        std::size_t bytes_transferred
-    ) {
-        if (ec) {
-            strm.init_read();
-            strm.read_packets_.emplace_back(ec);
-        }
-        else {
-            strm.read_buf_.commit(bytes_transferred);
-            strm.parse_packet(self);
-            auto& a_strm{strm};
-            as::dispatch(
-                a_strm.get_executor(),
-                force_move(self)
-            );
+std::size_t
+stream<NextLayer>::slab_packet_size(error_code& ec) const {
+    auto received = slab_end_ - slab_begin_;
+    if (received < 2) return 0;
+    auto ptr = &slab_[std::ptrdiff_t(slab_begin_)];
+    std::size_t rl = 0;
+    std::size_t mul = 1;
+    for (std::size_t i = 1; i != 5; ++i) {
+        if (i == received) return 0;
+        auto encoded_byte = static_cast<std::uint8_t>(ptr[i]);
+        rl += (encoded_byte & 0b0111'1111) * mul;
+        if ((encoded_byte & 0b1000'0000) == 0) {
+            return i + 1 + rl;
         }
+        mul *= 128;
     }
-};
-
-template <typename NextLayer>
-template <typename CompletionToken>
-BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(
-    CompletionToken,
-    void(error_code, buffer)
-)
-stream<NextLayer>::async_read_some(
-    CompletionToken&& token
-) {
-    return
-        as::async_compose<
-            CompletionToken,
-            void(error_code, buffer)
-        >(
-            stream_read_some_op{
-                *this
-            },
-            token,
-            get_executor()
-        );
+    ec = make_error_code(disconnect_reason_code::packet_too_large);
+    return 0;
 }
 
+// make room to read the rest of the packet that begins at slab_begin_.
+// packet_size is 0 if it is not determined yet.
+// The slab is append only. The bytes that are passed to the user are never
+// overwritten, so the slab doesn't need to know when the packets are released
+// (the reference count of shared_ptr can't tell it to the other thread safely).
 template <typename NextLayer>
-template <typename Self>
+template <typename Alloc>
 inline
 void
-stream<NextLayer>::parse_packet(Self& self) {
-    while (read_buf_.size() != 0) {
-        switch (read_state_) {
-        case read_state::fixed_header: {
-            if (read_buf_.size() > 0) {
-                std::istream is{&read_buf_};
-                char fixed_header;
-                is.read(&fixed_header, 1);
-                header_remaining_length_buf_.push_back(fixed_header);
-                read_state_ = read_state::remaining_length;
-            }
-        } break;
-        case read_state::remaining_length: {
-            while (read_buf_.size() > 0) {
-                std::istream is{&read_buf_};
-                char encoded_byte;
-                is.read(&encoded_byte, 1);
-                header_remaining_length_buf_.push_back(encoded_byte);
-                remaining_length_ += (std::uint8_t(encoded_byte) & 0b0111'1111) * multiplier_;
-                multiplier_ *= 128;
-                if ((encoded_byte & 0b1000'0000) == 0) {
-                    read_state_ = read_state::payload;
-                    break;
-                }
-                if (multiplier_ == 128 * 128 * 128 * 128) {
-                    read_packets_.emplace_back(make_error_code(disconnect_reason_code::packet_too_large));
-                    init_read();
-                    return;
-                }
-            }
-            if (read_state_ != read_state::payload) {
-                return;
-            }
-        } break;
-        case read_state::payload: {
-            if (read_buf_.size() >= remaining_length_) {
-                BOOST_ASIO_REBIND_ALLOC(
-                    typename as::associated_allocator<Self>::type,
-                    char
-                )
-                alloc{
-                    as::get_associated_allocator(self)
-                };
-                std::size_t total_size = header_remaining_length_buf_.size() + remaining_length_;
-                auto spca = allocate_shared_ptr_char_array(alloc, total_size);
-                std::copy_n(
-                    header_remaining_length_buf_.data(),
-                    header_remaining_length_buf_.size(),
-                    spca.get()
-                );
-                std::istream is{&read_buf_};
-                auto ptr = spca.get();
-                is.read(ptr + header_remaining_length_buf_.size(), static_cast<std::streamsize>(remaining_length_));
-                read_packets_.emplace_back(
-                    buffer{ptr, total_size, force_move(spca)}
-                );
-
-                init_read();
-            }
-            else {
-                return;
-            }
-        } break;
+stream<NextLayer>::slab_prepare(Alloc alloc, std::size_t packet_size) {
+    auto part = slab_end_ - slab_begin_;
+    if (slab_ && slab_capacity_ == bulk_read_buffer_size_) {
+        if (packet_size == 0) {
+            if (slab_end_ != slab_capacity_) return;
+        }
+        else {
+            if (slab_begin_ + packet_size <= slab_capacity_) return;
         }
     }
+    // allocate new slab. the previous one is released when all aliasing packets are released.
+    auto new_slab = allocate_shared_ptr_char_array(alloc, bulk_read_buffer_size_);
+    if (part != 0) {
+        std::copy_n(&slab_[std::ptrdiff_t(slab_begin_)], part, new_slab.get());
+    }
+    slab_ = force_move(new_slab);
+    slab_capacity_ = bulk_read_buffer_size_;
+    slab_begin_ = 0;
+    slab_end_ = part;
 }
 
 } // namespace async_mqtt
@@ -22,7 +22,11 @@ struct stream<NextLayer>::stream_write_packet_op {
     std::shared_ptr<Packet> packet;
     std::size_t size = packet->size();
     stream_type_sp life_keeper = strm.shared_from_this();
-    enum { dispatch, post, write, bulk_write, complete } state = dispatch;
+    enum { dispatch, post, write, cork, bulk_write, complete } state = dispatch;
+    // true if this operation writes the batch that contains the packet
+    bool leader = false;
+    // the batch that contains the packet
+    std::uint64_t batch_id = 0;
 
     template <typename Self>
     void operator()(
@@ -31,6 +35,7 @@ struct stream<NextLayer>::stream_write_packet_op {
         switch (state) {
         case dispatch: {
             state = post;
+            strm.queued_packets_.fetch_add(1, std::memory_order_relaxed);
             auto& a_strm{strm};
             as::dispatch(
                 a_strm.get_executor(),
@@ -40,13 +45,23 @@ struct stream<NextLayer>::stream_write_packet_op {
         case post: {
             auto& a_strm{strm};
             auto& a_packet{*packet};
-            if (!a_strm.bulk_write_ || a_strm.write_queue_.immediate_executable()) {
+            if (!a_strm.bulk_write_) {
                 state = write;
             }
+            else if (a_strm.write_queue_.immediate_executable()) {
+                if (a_strm.cork_) {
+                    state = cork;
+                    leader = a_strm.store_packet(a_packet, size);
+                    batch_id = a_strm.storing_batches_.back().id;
+                }
+                else {
+                    state = write;
+                }
+            }
             else {
                 state = bulk_write;
-                auto cbs = a_packet.const_buffer_sequence();
-                std::copy(cbs.begin(), cbs.end(), std::back_inserter(a_strm.storing_cbs_));
+                leader = a_strm.store_packet(a_packet, size);
+                batch_id = a_strm.storing_batches_.back().id;
             }
             a_strm.write_queue_.post(
                 force_move(self)
@@ -58,18 +73,22 @@ struct stream<NextLayer>::stream_write_packet_op {
                 state = complete;
                 auto& a_strm{strm};
                 auto& a_packet{*packet};
+                a_strm.count_write(1);
+                // sending_cbs_ keeps its capacity, so no allocation happens in the steady state
+                a_strm.sending_cbs_.clear();
+                a_packet.append_const_buffer_sequence(a_strm.sending_cbs_);
                 if constexpr (
                     has_async_write<next_layer_type>::value) {
                     layer_customize<next_layer_type>::async_write(
                         a_strm.nl_,
-                        a_packet.const_buffer_sequence(),
+                        a_strm.sending_view(),
                         force_move(self)
                     );
                 }
                 else {
                     async_write(
                         a_strm.nl_,
-                        a_packet.const_buffer_sequence(),
+                        a_strm.sending_view(),
                         force_move(self)
                     );
                 }
@@ -87,45 +106,49 @@ struct stream<NextLayer>::stream_write_packet_op {
                 );
             }
         } break;
+        case cork: {
+            // The following packets are coalesced until the next loop turn.
+            strm.write_queue_.start_work();
+            state = bulk_write;
+            auto& a_strm{strm};
+            as::post(
+                a_strm.get_executor(),
+                force_move(self)
+            );
+        } break;
         case bulk_write: {
             strm.write_queue_.start_work();
-            if (strm.lowest_layer().is_open()) {
-                state = complete;
-                auto& a_strm{strm};
-                if (a_strm.storing_cbs_.empty()) {
-                    auto& a_strm{strm};
-                    auto& a_size{size};
-                    as::dispatch(
-                        a_strm.get_executor(),
-                        as::append(
-                            force_move(self),
-                            errc::make_error_code(errc::success),
-                            a_size
-                        )
+            state = complete;
+            auto& a_strm{strm};
+            auto* batch = leader ? a_strm.front_batch(batch_id) : nullptr;
+            if (leader && batch && a_strm.lowest_layer().is_open()) {
+                a_strm.sending_cbs_.swap(batch->cbs);
+                // Keep corking while the packets are coalesced.
+                a_strm.cork_ = batch->packets > 1;
+                a_strm.count_write(batch->packets);
+                a_strm.pop_batch();
+                if constexpr (
+                    has_async_write<next_layer_type>::value) {
+                    layer_customize<next_layer_type>::async_write(
+                        a_strm.nl_,
+                        a_strm.sending_view(),
+                        force_move(self)
                     );
                 }
                 else {
-                    a_strm.sending_cbs_ = force_move(a_strm.storing_cbs_);
-                    if constexpr (
-                        has_async_write<next_layer_type>::value) {
-                        layer_customize<next_layer_type>::async_write(
-                            a_strm.nl_,
-                            a_strm.sending_cbs_,
-                            force_move(self)
-                        );
-                    }
-                    else {
-                        async_write(
-                            a_strm.nl_,
-                            a_strm.sending_cbs_,
-                            force_move(self)
-                        );
-                    }
+                    async_write(
+                        a_strm.nl_,
+                        a_strm.sending_view(),
+                        force_move(self)
+                    );
                 }
             }
-            else {
-                state = complete;
-                auto& a_strm{strm};
+            else if (leader) {
+                // The stream is closed, or the batch has been discarded by close.
+                if (batch) {
+                    a_strm.pop_batch();
+                    a_strm.cork_ = false;
+                }
                 as::dispatch(
                     a_strm.get_executor(),
                     as::append(
@@ -135,6 +158,20 @@ struct stream<NextLayer>::stream_write_packet_op {
                     )
                 );
             }
+            else {
+                // The packet has been written by the leader of the batch.
+                // Complete with the result of the write.
+                auto ec = a_strm.batch_result(batch_id);
+                auto& a_size{size};
+                as::dispatch(
+                    a_strm.get_executor(),
+                    as::append(
+                        force_move(self),
+                        ec,
+                        ec ? 0 : a_size
+                    )
+                );
+            }
         } break;
         default:
             BOOST_ASSERT(false);
@@ -148,6 +185,8 @@ struct stream<NextLayer>::stream_write_packet_op {
         error_code ec,
         std::size_t bytes_transferred
     ) {
+        strm.queued_packets_.fetch_sub(1, std::memory_order_relaxed);
+        if (leader) strm.finish_batch(batch_id, ec);
         if (ec) {
             strm.write_queue_.stop_work();
             auto& a_strm{strm};
@@ -0,0 +1,193 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_UTIL_OP_QUEUE_HPP)
+#define ASYNC_MQTT_UTIL_OP_QUEUE_HPP
+
+#include <memory>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+#include <boost/assert.hpp>
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/recycling_allocator.hpp>
+
+#include <async_mqtt/util/move.hpp>
+
+namespace async_mqtt {
+
+namespace as = boost::asio;
+
+/**
+ * @brief FIFO of pending composed operations.
+ *
+ * Drop-in replacement of ioc_queue that doesn't own an io_context.
+ * Serialization semantics are the same as ioc_queue:
+ *   - post() invokes the operation immediately if no operation is working and
+ *     the queue is idle. Otherwise the operation is queued.
+ *   - start_work() is called by the invoked operation to mark the queue busy.
+ *   - stop_work() followed by poll_one()/poll() invokes the next queued operation(s).
+ *
+ * Immediate execution doesn't allocate. Queued operations are stored in an intrusive
+ * singly linked list. Each node is allocated via the associated allocator of the
+ * operation, falling back to as::recycling_allocator, so steady state queuing
+ * doesn't hit the global allocator.
+ * This class is not thread safe. It is expected to be used on the strand of the stream.
+ */
+class op_queue {
+public:
+    op_queue() = default;
+    op_queue(op_queue const&) = delete;
+    op_queue& operator=(op_queue const&) = delete;
+
+    ~op_queue() {
+        while (head_) {
+            auto* n = head_;
+            head_ = head_->next;
+            n->destroy(n);
+        }
+    }
+
+    void start_work() {
+        working_ = true;
+        guard_ = true;
+    }
+
+    void stop_work() {
+        guard_ = false;
+    }
+
+    bool immediate_executable() const {
+        return !working_ && idle_;
+    }
+
+    template <typename Handler>
+    void post(Handler&& h) {
+        if (immediate_executable()) {
+            BOOST_ASSERT(empty());
+            idle_ = false;
+            h();
+            update_idle();
+        }
+        else {
+            push(std::forward<Handler>(h));
+        }
+    }
+
+    bool stopped() const {
+        return idle_;
+    }
+
+    bool empty() const {
+        return head_ == nullptr;
+    }
+
+    std::size_t poll_one() {
+        working_ = false;
+        idle_ = false;
+        std::size_t n = invoke_one();
+        update_idle();
+        return n;
+    }
+
+    std::size_t poll() {
+        working_ = false;
+        idle_ = false;
+        std::size_t n = 0;
+        while (invoke_one() != 0) ++n;
+        update_idle();
+        return n;
+    }
+
+private:
+    struct node_base {
+        node_base* next = nullptr;
+        void (*invoke)(node_base*);
+        void (*destroy)(node_base*);
+    };
+
+    template <typename Handler>
+    struct node : node_base {
+        using allocator_type =
+            typename std::allocator_traits<
+                as::associated_allocator_t<Handler, as::recycling_allocator<void>>
+            >::template rebind_alloc<node>;
+
+        explicit node(Handler&& h)
+            :handler{force_move(h)} {
+            this->invoke = &node::do_invoke;
+            this->destroy = &node::do_destroy;
+        }
+
+        static node* create(Handler&& h) {
+            allocator_type alloc{
+                as::get_associated_allocator(h, as::recycling_allocator<void>())
+            };
+            auto* p = std::allocator_traits<allocator_type>::allocate(alloc, 1);
+            return new (p) node{force_move(h)};
+        }
+
+        static Handler release(node* n) {
+            allocator_type alloc{
+                as::get_associated_allocator(n->handler, as::recycling_allocator<void>())
+            };
+            Handler h{force_move(n->handler)};
+            n->~node();
+            std::allocator_traits<allocator_type>::deallocate(alloc, n, 1);
+            return h;
+        }
+
+        static void do_invoke(node_base* base) {
+            // deallocate the node before the upcall, then the handler can reuse the memory
+            auto h = release(static_cast<node*>(base));
+            h();
+        }
+
+        static void do_destroy(node_base* base) {
+            release(static_cast<node*>(base));
+        }
+
+        Handler handler;
+    };
+
+    template <typename Handler>
+    void push(Handler&& h) {
+        using handler_type = std::decay_t<Handler>;
+        handler_type moved{std::forward<Handler>(h)};
+        node_base* n = node<handler_type>::create(force_move(moved));
+        if (tail_) {
+            tail_->next = n;
+        }
+        else {
+            head_ = n;
+        }
+        tail_ = n;
+    }
+
+    std::size_t invoke_one() {
+        if (!head_) return 0;
+        auto* n = head_;
+        head_ = n->next;
+        if (!head_) tail_ = nullptr;
+        n->invoke(n);
+        return 1;
+    }
+
+    void update_idle() {
+        if (!guard_ && empty()) idle_ = true;
+    }
+
+    node_base* head_ = nullptr;
+    node_base* tail_ = nullptr;
+    bool working_ = false;
+    bool guard_ = false;
+    bool idle_ = true;
+};
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_UTIL_OP_QUEUE_HPP
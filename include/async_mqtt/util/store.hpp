@@ -7,7 +7,6 @@
 #if !defined(ASYNC_MQTT_UTIL_STORE_HPP)
 #define ASYNC_MQTT_UTIL_STORE_HPP
 
-#include <boost/asio/steady_timer.hpp>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/key.hpp>
 #include <boost/multi_index/sequenced_index.hpp>
@@ -15,6 +14,7 @@
 #include <boost/multi_index/hashed_index.hpp>
 
 #include <async_mqtt/util/log.hpp>
+#include <async_mqtt/util/timer_wheel.hpp>
 #include <async_mqtt/packet/store_packet_variant.hpp>
 #include <async_mqtt/packet/packet_traits.hpp>
 
@@ -31,6 +31,14 @@ public:
 
     explicit store(as::any_io_executor exe):exe_{exe}{}
 
+    store(store const&) = delete;
+    store& operator=(store const&) = delete;
+
+    ~store() {
+        // The expiry that is posted before the destruction is ignored.
+        if (expiry_) expiry_->s = nullptr;
+    }
+
     template <typename Packet>
     bool add(Packet const& packet) {
         if constexpr(is_publish<Packet>()) {
@@ -38,43 +46,29 @@ public:
                 packet.opts().get_qos() == qos::exactly_once) {
                 std::uint32_t sec = 0;
                 if constexpr(is_v5<Packet>()) {
-                    bool finish = false;
-                    for (auto const& prop : packet.props()) {
-                        prop.visit(
-                            overload {
-                                [&](property::message_expiry_interval const& p) {
-                                    sec = p.val();
-                                    finish = true;
-                                },
-                                [](auto const&) {
-                                }
-                            }
-                        );
-                        if (finish) break;
-                    }
+                    if (auto mei = packet.message_expiry_interval()) sec = *mei;
                 }
                 if (sec == 0) {
                     return elems_.emplace_back(packet).second;
                 }
                 else {
-                    auto tim = std::make_shared<as::steady_timer>(exe_);
-                    tim->expires_after(std::chrono::seconds(sec));
-                    tim->async_wait(
-                        [this, wp = std::weak_ptr<as::steady_timer>(tim)]
-                        (error_code const& ec) {
-                            if (auto tim = wp.lock()) {
-                                if (!ec) {
-                                    auto& idx = elems_.template get<tag_tim>();
-                                    auto it = idx.find(tim.get());
-                                    if (it == idx.end()) return;
-                                    ASYNC_MQTT_LOG("mqtt_impl", info)
-                                        << "[store] message expired:" << it->packet;
-                                    idx.erase(it);
-                                }
-                            }
+                    auto [it, inserted] = elems_.emplace_back(packet);
+                    if (inserted) {
+                        if (!expiry_) {
+                            // The wheel is shared in the io_context. The expiry is
+                            // posted to exe_ because elems_ is accessed only there.
+                            expiry_ = std::make_shared<expiry_context>(
+                                &use_timer_wheel(exe_), exe_, this
+                            );
                         }
-                    );
-                    return elems_.emplace_back(packet, tim).second;
+                        expiry_->wheel->schedule(
+                            it->tim,
+                            std::chrono::seconds(sec),
+                            expiry_,
+                            &store::on_message_expired
+                        );
+                    }
+                    return inserted;
                 }
             }
         }
@@ -120,10 +114,10 @@ public:
         std::vector<store_packet_type> ret;
         ret.reserve(elems_.size());
         for (auto elem : elems_) {
-            if (elem.tim) {
+            if (auto expiry = elem.tim.expiry()) {
                 auto d =
                     std::chrono::duration_cast<std::chrono::seconds>(
-                        elem.tim->expiry() - std::chrono::steady_clock::now()
+                        *expiry - std::chrono::steady_clock::now()
                     ).count();
                 if (d < 0) d = 0;
                 elem.packet.update_message_expiry_interval(static_cast<std::uint32_t>(d));
@@ -134,11 +128,39 @@ public:
     }
 
 private:
+    // The part of the store that is referred by the expire handler.
+    // The handler is called on the io_context of the wheel, so it doesn't touch the store.
+    struct expiry_context : std::enable_shared_from_this<expiry_context> {
+        expiry_context(timer_wheel* wheel, as::any_io_executor exe, store* s)
+            :wheel{wheel}, exe{force_move(exe)}, s{s}
+        {}
+
+        timer_wheel* wheel;
+        as::any_io_executor exe;
+        store* s; // nullptr after the store is destroyed. Accessed only on exe.
+    };
+
+    // called on the io_context of the wheel
+    static void on_message_expired(void* owner, void*, timer_wheel::handle const* key) {
+        auto& ctx = *static_cast<expiry_context*>(owner);
+        as::post(
+            ctx.exe,
+            [sp = ctx.shared_from_this(), key] {
+                if (!sp->s) return;
+                auto& idx = sp->s->elems_.template get<tag_tim>();
+                auto it = idx.find(key);
+                if (it == idx.end() || !it->tim.expired()) return;
+                ASYNC_MQTT_LOG("mqtt_impl", info)
+                    << "[store] message expired:" << it->packet;
+                idx.erase(it);
+            }
+        );
+    }
+
     struct elem_t {
         elem_t(
-            store_packet_type packet,
-            std::shared_ptr<as::steady_timer> tim = nullptr
-        ): packet{force_move(packet)}, tim{force_move(tim)} {}
+            store_packet_type packet
+        ): packet{force_move(packet)} {}
 
         typename basic_packet_id_type<PacketIdBytes>::type packet_id() const {
             return packet.packet_id();
@@ -148,12 +170,13 @@ private:
             return packet.response_packet_type();
         }
 
-        void const* tim_address() const {
-            return tim.get();
+        timer_wheel::handle const* tim_address() const {
+            return &tim;
         }
 
         store_packet_type packet;
-        std::shared_ptr<as::steady_timer> tim = nullptr;
+        // scheduled only if the packet has MessageExpiryInterval
+        mutable timer_wheel::handle tim;
     };
     struct tag_seq{};
     struct tag_res_id{};
@@ -180,6 +203,7 @@ private:
         >
     >;
 
+    std::shared_ptr<expiry_context> expiry_;
     mi_elem elems_;
     as::any_io_executor exe_;
 };
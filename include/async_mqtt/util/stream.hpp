@@ -9,14 +9,19 @@
 
 #include <utility>
 #include <type_traits>
-#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <vector>
+#include <iterator>
 
 #include <boost/asio/async_result.hpp>
 
 #include <async_mqtt/util/stream_traits.hpp>
 #include <async_mqtt/util/make_shared_helper.hpp>
 #include <async_mqtt/util/static_vector.hpp>
-#include <async_mqtt/util/ioc_queue.hpp>
+#include <async_mqtt/util/op_queue.hpp>
 #include <async_mqtt/util/buffer.hpp>
 #include <async_mqtt/error.hpp>
 #include <async_mqtt/util/log.hpp>
@@ -25,6 +30,39 @@ namespace async_mqtt {
 namespace as = boost::asio;
 namespace sys = boost::system;
 
+/**
+ * @brief default size of the read slab of the stream
+ */
+static constexpr std::size_t default_bulk_read_buffer_size = 4096;
+
+/**
+ * @brief default maximum bytes that are coalesced into one write by bulk write
+ */
+static constexpr std::size_t default_bulk_write_max_bytes = 65536;
+
+/**
+ * @brief default maximum number of buffers that are coalesced into one write by bulk write
+ * Boost.Asio gathers at most 64 buffers per system call.
+ */
+static constexpr std::size_t default_bulk_write_max_iovecs = 64;
+
+/**
+ * @brief statistics of packet writing
+ */
+struct write_stats {
+    std::uint64_t packets = 0; ///< the number of written packets
+    std::uint64_t writes = 0;  ///< the number of write operations of the next layer
+    std::uint64_t queued = 0;  ///< the number of packets that are requested but not written yet
+
+    /**
+     * @brief get the average number of packets per write operation
+     */
+    double packets_per_write() const {
+        if (writes == 0) return 0;
+        return double(packets) / double(writes);
+    }
+};
+
 template <typename NextLayer>
 class stream : public std::enable_shared_from_this<stream<NextLayer>> {
 public:
@@ -117,6 +155,32 @@ public:
         bulk_write_ = val;
     }
 
+    /**
+     * @brief Set the limits of one coalesced write of bulk write.
+     * A packet that exceeds the limits by itself is written alone.
+     * @param max_bytes  maximum bytes
+     * @param max_iovecs maximum number of buffers. It is capped by IOV_MAX.
+     */
+    void set_bulk_write_limits(std::size_t max_bytes, std::size_t max_iovecs) {
+        bulk_write_max_bytes_ = std::max(max_bytes, std::size_t(1));
+#if defined(IOV_MAX)
+        max_iovecs = std::min(max_iovecs, std::size_t(IOV_MAX));
+#endif // defined(IOV_MAX)
+        bulk_write_max_iovecs_ = std::max(max_iovecs, std::size_t(1));
+    }
+
+    /**
+     * @brief Get the statistics of packet writing.
+     * It can be called from any threads.
+     */
+    write_stats get_write_stats() const {
+        return write_stats{
+            written_packets_.load(std::memory_order_relaxed),
+            write_calls_.load(std::memory_order_relaxed),
+            queued_packets_.load(std::memory_order_relaxed)
+        };
+    }
+
     template <typename Executor1>
     struct rebind_executor {
         using other = stream<
@@ -124,8 +188,21 @@ public:
         >;
     };
 
+    /**
+     * @brief Set the read buffer (slab) size.
+     * Received bytes are read into a reference counted slab of this size.
+     * Each received packet is a buffer that aliases the slab, so no copy is required.
+     * Only a packet that straddles slabs is copied into the next slab, or into a
+     * dedicated buffer if the packet is larger than the slab.
+     * A slab is filled only once, and freed when all the packets that alias it are
+     * released. Copy a small packet that is kept long not to keep the whole slab alive.
+     * @param size If set to 0, the slab is not used and each packet is read by exact size
+     *             async_read() calls (fixed header, remaining length, and the rest).
+     *             The default value is default_bulk_read_buffer_size.
+     */
     void set_bulk_read_buffer_size(std::size_t size) {
-        bulk_read_buffer_size_ = size;
+        // at least the maximum size of fixed header and remaining length
+        bulk_read_buffer_size_ = size == 0 ? 0 : std::max(size, std::size_t(5));
     }
 
 private:
@@ -163,55 +240,128 @@ private:
         }
     }
 
-    // POC BEGIN
-    void init_read();
+    std::size_t slab_packet_size(error_code& ec) const;
 
-    template <
-        typename CompletionToken = as::default_completion_token_t<executor_type>
-    >
-    BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(
-        CompletionToken,
-        void(error_code, buffer)
-    )
-    async_read_some(
-        CompletionToken&& token = as::default_completion_token_t<executor_type>{}
-    );
+    // packets that are written by one write operation of bulk write
+    // The id is unique for the stream, so the leader can find its batch after close
+    // has discarded the batches.
+    struct write_batch {
+        std::uint64_t id = 0;
+        std::vector<as::const_buffer> cbs;
+        std::size_t bytes = 0;
+        std::size_t packets = 0;
+    };
+
+    // Non-owning view of a const buffer sequence.
+    // Boost.Asio copies the buffer sequence into the write operation, so passing
+    // the vector itself would allocate on each write.
+    struct const_buffer_view {
+        using value_type = as::const_buffer;
+        using const_iterator = as::const_buffer const*;
+        const_iterator begin() const { return first; }
+        const_iterator end() const { return last; }
+        const_iterator first;
+        const_iterator last;
+    };
+
+    const_buffer_view sending_view() const {
+        return const_buffer_view{sending_cbs_.data(), sending_cbs_.data() + sending_cbs_.size()};
+    }
+
+    // Append the buffers of the packet to the last batch. If it doesn't fit, start a new batch.
+    // Return true if the new batch is started. The caller writes the batch.
+    // The vectors of the batches are recycled, so no allocation happens in the steady state.
+    template <typename Packet>
+    bool store_packet(Packet const& packet, std::size_t size) {
+        auto num = packet.num_of_const_buffer_sequence();
+        bool start =
+            storing_batches_.empty() ||
+            storing_batches_.back().bytes + size > bulk_write_max_bytes_ ||
+            storing_batches_.back().cbs.size() + num > bulk_write_max_iovecs_;
+        if (start) {
+            storing_batches_.emplace_back();
+            storing_batches_.back().id = ++last_batch_id_;
+            if (!spare_cbs_.empty()) {
+                storing_batches_.back().cbs.swap(spare_cbs_.back());
+                storing_batches_.back().cbs.clear();
+                spare_cbs_.pop_back();
+            }
+        }
+        auto& batch = storing_batches_.back();
+        packet.append_const_buffer_sequence(batch.cbs);
+        batch.bytes += size;
+        ++batch.packets;
+        return start;
+    }
+
+    // Return the first batch if it is the batch of the id. Otherwise, the batch has been
+    // discarded by close.
+    write_batch* front_batch(std::uint64_t id) {
+        if (storing_batches_.empty() || storing_batches_.front().id != id) return nullptr;
+        return &storing_batches_.front();
+    }
+
+    // Remove the first batch and keep its vector for the next batch.
+    void pop_batch() {
+        BOOST_ASSERT(!storing_batches_.empty());
+        spare_cbs_.push_back(force_move(storing_batches_.front().cbs));
+        storing_batches_.erase(storing_batches_.begin());
+    }
 
-    template <typename Self>
-    void parse_packet(Self& self);
-    // POC END
+    // Record the result of the batch. The followers of the batch are executed after
+    // the leader is completed, and before the leader of the next batch.
+    void finish_batch(std::uint64_t id, error_code const& ec) {
+        finished_batch_id_ = id;
+        finished_batch_ec_ = ec;
+    }
+
+    // Get the result of the batch of the follower.
+    // If the batch has been discarded by close, connection_reset is returned.
+    error_code batch_result(std::uint64_t id) const {
+        if (finished_batch_id_ != id) return errc::make_error_code(errc::connection_reset);
+        return finished_batch_ec_;
+    }
+
+    void count_write(std::size_t packets) {
+        written_packets_.fetch_add(packets, std::memory_order_relaxed);
+        write_calls_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    template <typename Alloc>
+    void slab_prepare(Alloc alloc, std::size_t packet_size);
 
     // async operations
 
     template <typename Packet>     struct stream_write_packet_op;
     struct stream_read_packet_op;
     struct stream_close_op;
-    struct stream_read_some_op;
 
 private:
-    struct error_packet {
-        error_packet(error_code ec)
-            :ec{ec} {}
-        error_packet(buffer packet)
-            :packet{force_move(packet)} {}
-
-        error_code ec;
-        buffer packet;
-    };
-
     next_layer_type nl_;
-    ioc_queue read_queue_;
-    as::streambuf read_buf_;
-    std::size_t remaining_length_ = 0;
-    std::size_t multiplier_ = 1;
-    std::size_t bulk_read_buffer_size_ = 0;
-    enum class read_state{fixed_header, remaining_length, payload} read_state_ = read_state::fixed_header;
-    ioc_queue write_queue_;
-    std::deque<error_packet> read_packets_;
+    op_queue read_queue_;
+    std::size_t bulk_read_buffer_size_ = default_bulk_read_buffer_size;
+    std::shared_ptr<char[]> slab_;
+    std::size_t slab_capacity_ = 0;
+    std::size_t slab_begin_ = 0;
+    std::size_t slab_end_ = 0;
+    op_queue write_queue_;
     static_vector<char, 5> header_remaining_length_buf_;
-    std::vector<as::const_buffer> storing_cbs_;
+    // a few batches at most, so erasing the front of the vector is cheap
+    std::vector<write_batch> storing_batches_;
+    std::vector<std::vector<as::const_buffer>> spare_cbs_;
     std::vector<as::const_buffer> sending_cbs_;
+    std::uint64_t last_batch_id_ = 0;
+    std::uint64_t finished_batch_id_ = 0;
+    error_code finished_batch_ec_;
     bool bulk_write_ = false;
+    // Defer the write on the idle stream to the next loop turn to coalesce packets.
+    // It is enabled while the previous write coalesced multiple packets.
+    bool cork_ = false;
+    std::size_t bulk_write_max_bytes_ = default_bulk_write_max_bytes;
+    std::size_t bulk_write_max_iovecs_ = default_bulk_write_max_iovecs;
+    std::atomic<std::uint64_t> written_packets_{0};
+    std::atomic<std::uint64_t> write_calls_{0};
+    std::atomic<std::uint64_t> queued_packets_{0};
 };
 
 } // namespace async_mqtt
@@ -0,0 +1,391 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_UTIL_TIMER_WHEEL_HPP)
+#define ASYNC_MQTT_UTIL_TIMER_WHEEL_HPP
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/intrusive/list.hpp>
+
+#include <async_mqtt/util/make_shared_helper.hpp>
+#include <async_mqtt/util/move.hpp>
+
+namespace async_mqtt {
+
+namespace as = boost::asio;
+
+/**
+ * @brief hashed timing wheel for expiry timers
+ *
+ * The expiry times are rounded up to the resolution (1 second by default). It fits
+ * MQTT expiry intervals that are specified in seconds.
+ * A timer is a handle that is embedded in the element that expires (intrusive).
+ * Scheduling and canceling are O(1), and they don't allocate memory.
+ * A single steady_timer drives the wheel. It is armed only while some handles are
+ * scheduled.
+ *
+ * schedule(), cancel(), and the destruction of handles can be called from any threads.
+ * The expire handler is called on the executor of the wheel without the lock of the
+ * wheel, so it can lock the owner's mutex. It is called only if the owner is alive.
+ * Handles must be destroyed or canceled before the wheel is destroyed.
+ */
+class timer_wheel : public std::enable_shared_from_this<timer_wheel> {
+public:
+    using clock_type = std::chrono::steady_clock;
+    class handle;
+
+    /**
+     * @brief expire handler
+     * @param owner   the owner that is passed to schedule(). It is alive while the call.
+     * @param context the context that is passed to schedule()
+     * @param key     the address of the expired handle. It is only for comparison, the
+     *                handle could have been destroyed.
+     */
+    using expire_handler = void (*)(void* owner, void* context, handle const* key);
+
+    /**
+     * @brief timer that is embedded in the element that expires
+     *
+     * The copy is not scheduled, but it has the same expiry.
+     * The move takes over the schedule.
+     */
+    class handle {
+    public:
+        handle() = default;
+
+        handle(handle const& other)
+            :expiry_{other.expiry_}
+        {}
+
+        handle(handle&& other) {
+            if (auto w = other.wheel_.load(std::memory_order_acquire)) {
+                w->take_over(other, *this);
+            }
+            else {
+                expiry_ = other.expiry_;
+                expired_ = other.expired_;
+            }
+        }
+
+        handle& operator=(handle const&) = delete;
+        handle& operator=(handle&&) = delete;
+
+        ~handle() {
+            cancel();
+        }
+
+        /**
+         * @brief cancel the timer
+         * If the timer is not scheduled, do nothing.
+         */
+        void cancel() {
+            if (auto w = wheel_.load(std::memory_order_acquire)) {
+                w->cancel(*this);
+            }
+        }
+
+        /**
+         * @brief get the scheduled expiry
+         * @return the expiry. std::nullopt if the handle has never been scheduled.
+         */
+        std::optional<clock_type::time_point> expiry() const {
+            return expiry_;
+        }
+
+        /**
+         * @brief check whether the handle has expired
+         */
+        bool expired() const {
+            return expired_;
+        }
+
+    private:
+        friend class timer_wheel;
+
+        boost::intrusive::list_member_hook<> hook_;
+        std::atomic<timer_wheel*> wheel_{nullptr}; // not nullptr while scheduled
+        std::optional<clock_type::time_point> expiry_;
+        std::uint64_t tick_ = 0;
+        std::weak_ptr<void> owner_;
+        void* context_ = nullptr;
+        expire_handler on_expire_ = nullptr;
+        bool expired_ = false;
+    };
+
+    template <typename... Args>
+    static std::shared_ptr<timer_wheel> create(Args&&... args) {
+        return make_shared_helper<timer_wheel>::make_shared(std::forward<Args>(args)...);
+    }
+
+    timer_wheel(timer_wheel const&) = delete;
+    timer_wheel& operator=(timer_wheel const&) = delete;
+
+    ~timer_wheel() {
+        std::lock_guard<std::mutex> g{mtx_};
+        for (auto& slot : slots_) {
+            while (!slot.empty()) {
+                auto& h = slot.front();
+                slot.pop_front();
+                h.wheel_.store(nullptr, std::memory_order_release);
+            }
+        }
+    }
+
+    /**
+     * @brief schedule the handle
+     * If the handle has already been scheduled, it is rescheduled.
+     * @param h         handle
+     * @param after     duration until the expiry
+     * @param owner     on_expire is called only if it is alive
+     * @param on_expire expire handler
+     * @param context   passed to on_expire
+     */
+    void schedule(
+        handle& h,
+        clock_type::duration after,
+        std::weak_ptr<void> owner,
+        expire_handler on_expire,
+        void* context = nullptr
+    ) {
+        auto expiry = clock_type::now() + after;
+        std::lock_guard<std::mutex> g{mtx_};
+        if (h.wheel_.load(std::memory_order_relaxed) == this) unlink(h);
+        if (!running_) {
+            // No handle has been scheduled. Skip the idle ticks.
+            current_ = tick_of(clock_type::now());
+        }
+        auto t = (expiry - origin_ + resolution_ - clock_type::duration(1)) / resolution_;
+        auto tick = std::uint64_t(t < 0 ? 0 : t);
+        if (tick <= current_) tick = current_ + 1;
+
+        h.expiry_ = expiry;
+        h.tick_ = tick;
+        h.owner_ = force_move(owner);
+        h.context_ = context;
+        h.on_expire_ = on_expire;
+        h.expired_ = false;
+        slots_[tick % slots_.size()].push_back(h);
+        h.wheel_.store(this, std::memory_order_release);
+        ++size_;
+        if (!running_) {
+            running_ = true;
+            arm();
+        }
+    }
+
+    /**
+     * @brief cancel the handle
+     * If the handle is not scheduled, do nothing.
+     */
+    void cancel(handle& h) {
+        std::lock_guard<std::mutex> g{mtx_};
+        if (h.wheel_.load(std::memory_order_relaxed) == this) unlink(h);
+    }
+
+    /**
+     * @brief get the number of scheduled handles
+     */
+    std::size_t size() const {
+        std::lock_guard<std::mutex> g{mtx_};
+        return size_;
+    }
+
+    clock_type::duration resolution() const {
+        return resolution_;
+    }
+
+private:
+    template <typename T>
+    friend class make_shared_helper;
+
+    /**
+     * @brief constructor
+     * @param exe          executor that calls the expire handlers
+     * @param resolution   resolution of the expiry
+     * @param num_of_slots number of the slots. The handles that expire after
+     *                     resolution * num_of_slots are checked once per round.
+     */
+    explicit timer_wheel(
+        as::any_io_executor exe,
+        clock_type::duration resolution = std::chrono::seconds(1),
+        std::size_t num_of_slots = 512
+    ):tim_{force_move(exe)},
+      resolution_{resolution},
+      origin_{clock_type::now()},
+      slots_(num_of_slots)
+    {}
+
+    using list_type = boost::intrusive::list<
+        handle,
+        boost::intrusive::member_hook<
+            handle,
+            boost::intrusive::list_member_hook<>,
+            &handle::hook_
+        >,
+        boost::intrusive::constant_time_size<false>
+    >;
+
+    struct expired_entry {
+        std::weak_ptr<void> owner;
+        void* context;
+        expire_handler on_expire;
+        handle const* key;
+    };
+
+    std::uint64_t tick_of(clock_type::time_point tp) const {
+        auto t = (tp - origin_) / resolution_;
+        return std::uint64_t(t < 0 ? 0 : t);
+    }
+
+    // called under mtx_
+    void unlink(handle& h) {
+        slots_[h.tick_ % slots_.size()].erase(list_type::s_iterator_to(h));
+        h.wheel_.store(nullptr, std::memory_order_release);
+        --size_;
+    }
+
+    // called by the move constructor of handle
+    void take_over(handle& from, handle& to) {
+        std::lock_guard<std::mutex> g{mtx_};
+        to.expiry_ = from.expiry_;
+        to.expired_ = from.expired_;
+        if (from.wheel_.load(std::memory_order_relaxed) != this) return;
+        auto& slot = slots_[from.tick_ % slots_.size()];
+        to.tick_ = from.tick_;
+        to.owner_ = force_move(from.owner_);
+        to.context_ = from.context_;
+        to.on_expire_ = from.on_expire_;
+        slot.insert(list_type::s_iterator_to(from), to);
+        slot.erase(list_type::s_iterator_to(from));
+        from.wheel_.store(nullptr, std::memory_order_release);
+        to.wheel_.store(this, std::memory_order_release);
+    }
+
+    // called under mtx_
+    void arm() {
+        tim_.expires_at(origin_ + resolution_ * std::int64_t(current_ + 1));
+        tim_.async_wait(
+            [wp = weak_from_this()](boost::system::error_code const& ec) {
+                if (ec) return;
+                if (auto sp = wp.lock()) sp->on_tick();
+            }
+        );
+    }
+
+    void on_tick() {
+        std::vector<expired_entry> expired;
+        {
+            std::lock_guard<std::mutex> g{mtx_};
+            auto now_tick = tick_of(clock_type::now());
+            if (now_tick > current_) {
+                auto num = std::min<std::uint64_t>(now_tick - current_, slots_.size());
+                for (std::uint64_t i = 1; i <= num; ++i) {
+                    auto& slot = slots_[(current_ + i) % slots_.size()];
+                    for (auto it = slot.begin(); it != slot.end();) {
+                        auto& h = *it;
+                        if (h.tick_ > now_tick) {
+                            ++it;
+                            continue;
+                        }
+                        it = slot.erase(it);
+                        --size_;
+                        h.expired_ = true;
+                        expired.push_back(
+                            expired_entry{force_move(h.owner_), h.context_, h.on_expire_, &h}
+                        );
+                        h.wheel_.store(nullptr, std::memory_order_release);
+                    }
+                }
+                current_ = now_tick;
+            }
+            if (size_ == 0) {
+                running_ = false;
+            }
+            else {
+                arm();
+            }
+        }
+        for (auto& e : expired) {
+            if (auto owner = e.owner.lock()) {
+                e.on_expire(owner.get(), e.context, e.key);
+            }
+        }
+    }
+
+    mutable std::mutex mtx_;
+    as::steady_timer tim_;
+    clock_type::duration resolution_;
+    clock_type::time_point origin_;
+    std::vector<list_type> slots_;
+    std::uint64_t current_ = 0; // the last processed tick
+    std::size_t size_ = 0;
+    bool running_ = false;
+};
+
+namespace detail {
+
+class timer_wheel_service : public as::execution_context::service {
+public:
+    using key_type = timer_wheel_service;
+    static inline as::execution_context::id id;
+
+    explicit timer_wheel_service(as::execution_context& ctx)
+        :as::execution_context::service{ctx}
+    {}
+
+    // The wheel is created with the executor of the first call.
+    timer_wheel& wheel(as::any_io_executor const& exe) {
+        std::call_once(
+            once_,
+            [&] {
+                wheel_ = timer_wheel::create(exe);
+            }
+        );
+        return *wheel_;
+    }
+
+private:
+    void shutdown() override {
+        wheel_.reset();
+    }
+
+    std::once_flag once_;
+    std::shared_ptr<timer_wheel> wheel_;
+};
+
+} // namespace detail
+
+/**
+ * @brief get the timer_wheel that is shared in the io_context
+ * The wheel is created at the first call, and destroyed with the io_context.
+ */
+inline timer_wheel& use_timer_wheel(as::io_context& ioc) {
+    return as::use_service<detail::timer_wheel_service>(ioc).wheel(ioc.get_executor());
+}
+
+/**
+ * @brief get the timer_wheel that is shared in the execution context of the executor
+ * It is the same wheel as use_timer_wheel(ioc) if exe is (a strand of) the executor of ioc.
+ * The expire handlers are not called on exe unless the wheel is created by this call.
+ */
+inline timer_wheel& use_timer_wheel(as::any_io_executor const& exe) {
+    return as::use_service<detail::timer_wheel_service>(
+        as::query(exe, as::execution::context)
+    ).wheel(exe);
+}
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_UTIL_TIMER_WHEEL_HPP
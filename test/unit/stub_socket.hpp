@@ -216,15 +216,14 @@ struct basic_stub_socket {
                 socket.packet_it_opt_.emplace(begin);
             }
             auto packet_it = *socket.packet_it_opt_;
-            BOOST_ASSERT(
-                static_cast<std::size_t>(std::distance(packet_it, end)) >= mb.size()
-            );
+            auto rest_size = static_cast<std::size_t>(std::distance(packet_it, end));
+            auto copy_size = std::min(rest_size, mb.size());
             std::copy_n(
                 packet_it,
-                mb.size(),
+                copy_size,
                 static_cast<char*>(mb.data())
             );
-            std::advance(packet_it, static_cast<std::ptrdiff_t>(mb.size()));
+            std::advance(packet_it, static_cast<std::ptrdiff_t>(copy_size));
             if (packet_it == end) {
                 // all conttents have read
                 socket.packet_it_opt_.reset();
@@ -233,7 +232,7 @@ struct basic_stub_socket {
             else {
                 *socket.packet_it_opt_ = packet_it;
             }
-            self.complete(errc::make_error_code(errc::success), mb.size());
+            self.complete(errc::make_error_code(errc::success), copy_size);
         }
     };
 
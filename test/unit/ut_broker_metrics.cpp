@@ -0,0 +1,184 @@
+// Copyright Takatoshi Kondo 2024
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <broker/metrics.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_broker_metrics)
+
+namespace am = async_mqtt;
+using metrics = am::broker_metrics;
+
+BOOST_AUTO_TEST_CASE(bucket) {
+    BOOST_TEST(metrics::bucket(0) == 0);
+    BOOST_TEST(metrics::bucket(1) == 1);
+    BOOST_TEST(metrics::bucket(2) == 2);
+    BOOST_TEST(metrics::bucket(3) == 2);
+    BOOST_TEST(metrics::bucket(4) == 3);
+    BOOST_TEST(metrics::bucket(1023) == 10);
+    BOOST_TEST(metrics::bucket(1024) == 11);
+    BOOST_TEST(metrics::bucket(~std::uint64_t(0)) == 64);
+    for (std::size_t b = 1; b != 64; ++b) {
+        BOOST_TEST(metrics::bucket(metrics::histogram_snapshot::upper_bound(b)) == b);
+        BOOST_TEST(metrics::bucket(metrics::histogram_snapshot::upper_bound(b) + 1) == b + 1);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(threads) {
+    metrics m;
+    std::vector<std::thread> ths;
+    for (std::size_t t = 0; t != 4; ++t) {
+        ths.emplace_back(
+            [&] {
+                for (std::uint64_t i = 0; i != 1000; ++i) {
+                    m.add(metrics::counter::publish_received);
+                    m.add(metrics::counter::publish_received_bytes, 10);
+                    m.record(metrics::histogram::publish_fanout, i % 4);
+                }
+            }
+        );
+    }
+    for (auto& th : ths) th.join();
+    BOOST_TEST(m.threads() == 4);
+
+    auto s = m.collect();
+    BOOST_TEST(s.get(metrics::counter::publish_received) == 4000);
+    BOOST_TEST(s.get(metrics::counter::publish_received_bytes) == 40000);
+    BOOST_TEST(s.get(metrics::counter::subscribe_received) == 0);
+    auto const& h = s.get(metrics::histogram::publish_fanout);
+    BOOST_TEST(h.count == 4000);
+    BOOST_TEST(h.sum == 6000);
+    BOOST_TEST(h.buckets[0] == 1000);
+    BOOST_TEST(h.buckets[1] == 1000);
+    BOOST_TEST(h.buckets[2] == 2000);
+    BOOST_TEST(h.mean() == 1.5);
+    BOOST_TEST(h.quantile(0.1) == 0);
+    BOOST_TEST(h.quantile(0.4) == 1);
+    BOOST_TEST(h.quantile(0.99) == 3);
+    BOOST_TEST(h.max() == 3);
+}
+
+BOOST_AUTO_TEST_CASE(instances) {
+    // the slot cached by the thread is not mixed up between the objects
+    metrics m1;
+    metrics m2;
+    m1.add(metrics::counter::connect);
+    m2.add(metrics::counter::connect, 2);
+    m1.add(metrics::counter::connect);
+    BOOST_TEST(m1.collect().get(metrics::counter::connect) == 2);
+    BOOST_TEST(m2.collect().get(metrics::counter::connect) == 2);
+    BOOST_TEST(m1.threads() == 1);
+    {
+        metrics m3;
+        m3.add(metrics::counter::close);
+        BOOST_TEST(m3.collect().get(metrics::counter::close) == 1);
+    }
+    metrics m4;
+    BOOST_TEST(m4.collect().get(metrics::counter::close) == 0);
+    m4.add(metrics::counter::close);
+    BOOST_TEST(m4.collect().get(metrics::counter::close) == 1);
+}
+
+BOOST_AUTO_TEST_CASE(sample_latency) {
+    metrics m{4};
+    std::size_t sampled = 0;
+    for (std::size_t i = 0; i != 16; ++i) {
+        if (m.sample_latency()) ++sampled;
+    }
+    BOOST_TEST(sampled == 4);
+
+    metrics all{1};
+    BOOST_TEST(all.sample_latency());
+    BOOST_TEST(all.sample_latency());
+}
+
+BOOST_AUTO_TEST_CASE(for_each) {
+    metrics m;
+    m.add(metrics::counter::publish_sent, 5);
+    m.record(metrics::histogram::publish_handler_ns, 1000);
+    auto s = m.collect();
+    s.set(metrics::gauge::connections, 7);
+
+    std::map<std::string, std::uint64_t> values;
+    metrics::for_each(
+        s,
+        [&](std::string_view name, std::uint64_t v) {
+            values.emplace(std::string{name}, v);
+        }
+    );
+    BOOST_TEST(values.at("publish/sent") == 5);
+    BOOST_TEST(values.at("clients/connected") == 7);
+    BOOST_TEST(values.at("publish/latency_ns/count") == 1);
+    BOOST_TEST(values.at("publish/latency_ns/mean") == 1000);
+    BOOST_TEST(values.at("publish/latency_ns/p50") == 1023);
+    BOOST_TEST(values.at("subscribe/latency_ns/count") == 0);
+}
+
+BOOST_AUTO_TEST_CASE(write_text) {
+    metrics m;
+    m.add(metrics::counter::publish_received, 3);
+    m.record(metrics::histogram::publish_fanout, 2);
+    auto s = m.collect();
+    s.set(metrics::gauge::write_queue_max, 4);
+
+    std::ostringstream oss;
+    metrics::write_text(oss, s);
+    auto text = oss.str();
+    BOOST_TEST(text.find("# TYPE mqtt_broker_publish_received_total counter\n") != std::string::npos);
+    BOOST_TEST(text.find("\nmqtt_broker_publish_received_total 3\n") != std::string::npos);
+    BOOST_TEST(text.find("\nmqtt_broker_write_queue_max 4\n") != std::string::npos);
+    BOOST_TEST(text.find("\nmqtt_broker_publish_fanout{quantile=\"0.5\"} 3\n") != std::string::npos);
+    BOOST_TEST(text.find("\nmqtt_broker_publish_fanout_sum 2\n") != std::string::npos);
+    BOOST_TEST(text.find("\nmqtt_broker_publish_fanout_count 1\n") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(offline_queues) {
+    struct queue {
+        std::string username;
+        std::string client_id;
+        std::size_t messages;
+        std::size_t bytes;
+    };
+    std::vector<queue> queues{
+        {"u1", "c\"1", 3, 30},
+        {"u2", "c2", 1, 10},
+    };
+
+    std::map<std::string, std::string> values;
+    metrics::for_each_queue(
+        queues,
+        [&](std::string_view name, std::string value) {
+            values.emplace(std::string{name}, value);
+        }
+    );
+    // Only the aggregates. The usernames and the client ids are not published.
+    BOOST_TEST(values.size() == 2);
+    BOOST_TEST(values.at("offline/largest/messages") == "3");
+    BOOST_TEST(values.at("offline/largest/bytes") == "30");
+
+    std::ostringstream oss;
+    metrics::write_queues_text(oss, queues);
+    auto text = oss.str();
+    BOOST_TEST(text.find("# TYPE mqtt_broker_offline_queue_bytes gauge\n") != std::string::npos);
+    BOOST_TEST(
+        text.find("\nmqtt_broker_offline_queue_bytes{username=\"u1\",client_id=\"c\\\"1\"} 30\n") !=
+        std::string::npos
+    );
+    BOOST_TEST(
+        text.find("\nmqtt_broker_offline_queue_messages{username=\"u2\",client_id=\"c2\"} 1\n") !=
+        std::string::npos
+    );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
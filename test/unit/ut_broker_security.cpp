@@ -939,4 +939,95 @@ BOOST_AUTO_TEST_CASE(allow_pertial_deny_group) {
     BOOST_CHECK(security.auth_sub_user(security.auth_sub("topic"), "u2") == am::security::authorization::type::deny);
 }
 
+BOOST_AUTO_TEST_CASE(many_groups) {
+    // The group bitmap of a user spans more than one word
+    std::string groups;
+    for (int i = 0; i != 70; ++i) {
+        if (i != 0) groups += ",";
+        groups += R"({ "name": "@g)" + std::to_string(i) + R"(", "members": [)";
+        groups += (i % 2 == 0) ? R"("u1")" : R"("u2")";
+        groups += "] }";
+    }
+    std::string test = R"*(
+            {
+                "authentication": [
+                    { "name": "u1", "method": "plain_password", "password": "hoge" },
+                    { "name": "u2", "method": "plain_password", "password": "hoge" },
+                    { "name": "u3", "method": "plain_password", "password": "hoge" }
+                ],
+                "group": [ )*" + groups + R"*( ],
+                "authorization": [
+                    { "topic": "t1", "allow": { "pub":["@g68"], "sub":["@g68"] } },
+                    { "topic": "t2", "allow": { "pub":["@g69"], "sub":["@g69"] } },
+                    { "topic": "t3", "deny": { "sub":["@g68"] } },
+                    { "topic": "t3", "allow": { "sub":["u1"] } }
+                ]
+            }
+        )*";
+    am::security security;
+    BOOST_CHECK_NO_THROW(load_config(security, test));
+
+    BOOST_CHECK(security.auth_pub("t1", "u1") == am::security::authorization::type::allow);
+    BOOST_CHECK(security.auth_pub("t1", "u2") == am::security::authorization::type::deny);
+    BOOST_CHECK(security.auth_pub("t2", "u1") == am::security::authorization::type::deny);
+    BOOST_CHECK(security.auth_pub("t2", "u2") == am::security::authorization::type::allow);
+    BOOST_CHECK(security.auth_pub("t1", "u3") == am::security::authorization::type::deny);
+    BOOST_CHECK(security.auth_pub("t1", "unknown") == am::security::authorization::type::deny);
+
+    BOOST_CHECK(security.auth_sub_user(security.auth_sub("t1"), "u1") == am::security::authorization::type::allow);
+    BOOST_CHECK(security.auth_sub_user(security.auth_sub("t1"), "u2") == am::security::authorization::type::deny);
+    BOOST_CHECK(security.auth_sub_user(security.auth_sub("t2"), "u2") == am::security::authorization::type::allow);
+
+    // The rule for the user has precedence over the rules for the groups
+    BOOST_CHECK(security.auth_sub_user(security.auth_sub("t3"), "u1") == am::security::authorization::type::allow);
+}
+
+BOOST_AUTO_TEST_CASE(generation) {
+    am::security security;
+    security.default_config();
+    auto g1 = security.generation();
+
+    // Copies have the same settings and the same generation
+    auto copied = security;
+    BOOST_TEST(copied.generation() == g1);
+
+    auto rule_nr = security.add_auth("t1",
+        { "@any" }, am::security::authorization::type::deny,
+        { "@any" }, am::security::authorization::type::deny);
+    auto g2 = security.generation();
+    BOOST_TEST(g2 != g1);
+    BOOST_TEST(copied.generation() == g1);
+
+    security.remove_auth(rule_nr);
+    BOOST_TEST(security.generation() != g2);
+    BOOST_TEST(security.generation() != g1);
+
+    am::security other;
+    other.default_config();
+    BOOST_TEST(other.generation() != security.generation());
+}
+
+BOOST_AUTO_TEST_CASE(decision_cache) {
+    using access = am::security::decision_cache::access;
+    using type = am::security::authorization::type;
+    am::security::decision_cache cache;
+
+    BOOST_TEST(!cache.find(1, access::pub, "u1", "t1"));
+    cache.store(1, access::pub, "u1", "t1", type::allow);
+    BOOST_CHECK(cache.find(1, access::pub, "u1", "t1").value() == type::allow);
+
+    // Different generation, access, username, or topic
+    BOOST_TEST(!cache.find(2, access::pub, "u1", "t1"));
+    BOOST_TEST(!cache.find(1, access::sub, "u1", "t1"));
+    BOOST_TEST(!cache.find(1, access::pub, "u2", "t1"));
+    BOOST_TEST(!cache.find(1, access::pub, "u1", "t2"));
+
+    cache.store(2, access::pub, "u1", "t1", type::deny);
+    BOOST_CHECK(cache.find(2, access::pub, "u1", "t1").value() == type::deny);
+    BOOST_TEST(!cache.find(1, access::pub, "u1", "t1"));
+
+    // The cache of the calling thread is reused
+    BOOST_TEST(&am::security::decision_cache::local() == &am::security::decision_cache::local());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
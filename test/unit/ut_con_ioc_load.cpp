@@ -0,0 +1,120 @@
+// Copyright Takatoshi Kondo 2024
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <functional>
+#include <memory>
+#include <set>
+
+#include <async_mqtt/util/move.hpp>
+#include <broker/con_ioc_load.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_con_ioc_load)
+
+namespace am = async_mqtt;
+
+namespace {
+
+// calls the destroy handler like basic_endpoint
+struct connection : std::enable_shared_from_this<connection> {
+    ~connection() {
+        if (h_destroy) h_destroy();
+    }
+    void set_destroy_handler(std::function<void()> handler) {
+        h_destroy = am::force_move(handler);
+    }
+    std::function<void()> h_destroy;
+};
+
+std::shared_ptr<connection> make_con() {
+    return std::make_shared<connection>();
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE(least_loaded) {
+    am::con_ioc_load load{3};
+    BOOST_TEST(load.size() == 3);
+
+    // equally loaded iocs are chosen in turn
+    std::set<std::size_t> chosen;
+    for (std::size_t i = 0; i != 3; ++i) {
+        chosen.insert(load.least_loaded());
+    }
+    BOOST_TEST(chosen.size() == 3);
+
+    auto c0 = load.track(make_con(), 0);
+    auto c1 = load.track(make_con(), 1);
+    BOOST_TEST(load.connections(0) == 1);
+    BOOST_TEST(load.connections(1) == 1);
+    BOOST_TEST(load.connections(2) == 0);
+    for (std::size_t i = 0; i != 3; ++i) {
+        BOOST_TEST(load.least_loaded() == 2);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(track) {
+    am::con_ioc_load load{2};
+    auto sp = make_con();
+    auto raw = sp.get();
+    std::weak_ptr<connection> wp = sp;
+    std::shared_ptr<connection> self;
+    {
+        auto tracked = load.track(am::force_move(sp), 1);
+        BOOST_TEST(tracked.get() == raw);
+        BOOST_TEST(load.connections(1) == 1);
+        // e.g. an in-progress operation of the endpoint
+        self = raw->shared_from_this();
+        tracked.reset();
+        BOOST_TEST(load.connections(1) == 1);
+    }
+    // counted until the connection is destroyed
+    BOOST_TEST(load.connections(1) == 1);
+    self.reset();
+    BOOST_TEST(load.connections(1) == 0);
+    BOOST_TEST(wp.expired());
+}
+
+BOOST_AUTO_TEST_CASE(place) {
+    am::con_ioc_load load{2};
+    std::vector<std::shared_ptr<connection>> cons;
+    // the preferred ioc is kept while it is nearly balanced
+    BOOST_TEST(load.place(0) == 0);
+    cons.push_back(load.track(make_con(), 0));
+    BOOST_TEST(load.place(0) == 0);
+    cons.push_back(load.track(make_con(), 0));
+    // 2 connections on ioc 0 and none on ioc 1
+    BOOST_TEST(load.place(0) == 1);
+    BOOST_TEST(load.place(1) == 1);
+
+    for (std::size_t i = 0; i != 14; ++i) {
+        cons.push_back(load.track(make_con(), 0));
+    }
+    for (std::size_t i = 0; i != 16; ++i) {
+        cons.push_back(load.track(make_con(), 1));
+    }
+    // 16 and 16, up to 16 + 16 / 8 + 1 are kept
+    for (std::size_t i = 0; i != 4; ++i) {
+        BOOST_TEST(load.place(0) == 0);
+        cons.push_back(load.track(make_con(), 0));
+    }
+    BOOST_TEST(load.connections(0) == 20);
+    BOOST_TEST(load.place(0) == 1);
+}
+
+BOOST_AUTO_TEST_CASE(outlive) {
+    std::shared_ptr<connection> tracked;
+    {
+        am::con_ioc_load load{1};
+        tracked = load.track(make_con(), 0);
+    }
+    // the counters are kept by the tracked connection
+    tracked.reset();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,108 @@
+// Copyright Takatoshi Kondo 2024
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <string>
+
+#include <async_mqtt/packet/v3_1_1_connect.hpp>
+#include <async_mqtt/packet/v5_connect.hpp>
+#include <async_mqtt/packet/v3_1_1_pingreq.hpp>
+#include <async_mqtt/packet/packet_iterator.hpp>
+
+#include <broker/connect_peek.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_connect_peek)
+
+namespace am = async_mqtt;
+using status = am::connect_peek_result::status;
+
+template <typename Packet>
+std::string bytes_of(Packet const& p) {
+    auto cbs = p.const_buffer_sequence();
+    auto [b, e] = am::make_packet_range(cbs);
+    return std::string(b, e);
+}
+
+BOOST_AUTO_TEST_CASE(v3_1_1) {
+    auto bytes = bytes_of(
+        am::v3_1_1::connect_packet{
+            true,   // clean_session
+            0x1234, // keep_alive
+            "cid1",
+            "user1",
+            "pass1"
+        }
+    );
+    auto r = am::parse_connect_client_id(bytes);
+    BOOST_TEST((r.st == status::complete));
+    BOOST_TEST(r.client_id == "cid1");
+    // the bytes after the client id are not required
+    BOOST_TEST(r.size < bytes.size());
+
+    // every prefix requires more bytes
+    for (std::size_t i = 0; i != r.size; ++i) {
+        auto p = am::parse_connect_client_id(std::string_view{bytes}.substr(0, i));
+        BOOST_TEST((p.st == status::incomplete));
+        BOOST_TEST(p.size > i);
+        BOOST_TEST(p.size <= r.size);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(v5) {
+    auto bytes = bytes_of(
+        am::v5::connect_packet{
+            true,   // clean_start
+            0x1234, // keep_alive
+            "cid1",
+            std::nullopt, // user_name
+            std::nullopt, // password
+            am::properties{
+                am::property::session_expiry_interval(0x0fffffff),
+                am::property::user_property("mykey", std::string(200, 'v'))
+            }
+        }
+    );
+    auto r = am::parse_connect_client_id(bytes);
+    BOOST_TEST((r.st == status::complete));
+    BOOST_TEST(r.client_id == "cid1");
+    BOOST_TEST(r.size == bytes.size());
+
+    for (std::size_t i = 0; i != r.size; ++i) {
+        auto p = am::parse_connect_client_id(std::string_view{bytes}.substr(0, i));
+        BOOST_TEST((p.st == status::incomplete));
+        BOOST_TEST(p.size > i);
+        BOOST_TEST(p.size <= r.size);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(empty_client_id) {
+    auto bytes = bytes_of(
+        am::v5::connect_packet{
+            true,   // clean_start
+            0,      // keep_alive
+            ""
+        }
+    );
+    auto r = am::parse_connect_client_id(bytes);
+    BOOST_TEST((r.st == status::complete));
+    BOOST_TEST(r.client_id.empty());
+}
+
+BOOST_AUTO_TEST_CASE(invalid) {
+    auto bytes = bytes_of(am::v3_1_1::pingreq_packet{});
+    BOOST_TEST((am::parse_connect_client_id(bytes).st == status::invalid));
+
+    // remaining length is too long
+    BOOST_TEST((am::parse_connect_client_id("\x10\xff\xff\xff\xff").st == status::invalid));
+
+    // client id exceeds the packet
+    std::string over{'\x10', '\x0c', '\x00', '\x04', 'M', 'Q', 'T', 'T', '\x04', '\x02', '\x00', '\x00', '\x00', '\x09'};
+    BOOST_TEST((am::parse_connect_client_id(over).st == status::invalid));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
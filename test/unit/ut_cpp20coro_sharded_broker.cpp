@@ -0,0 +1,365 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <string>
+
+#include <boost/asio.hpp>
+
+#include <async_mqtt/endpoint.hpp>
+#include <async_mqtt/packet/packet_helper.hpp>
+#include <broker/endpoint_variant.hpp>
+#include <broker/sharded_broker.hpp>
+
+#include "cpp20coro_stub_socket.hpp"
+
+BOOST_AUTO_TEST_SUITE(ut_sharded_broker)
+
+namespace am = async_mqtt;
+namespace as = boost::asio;
+
+using epv_t = am::endpoint_variant<
+    am::role::server,
+    am::cpp20coro_stub_socket
+>;
+
+namespace {
+
+// find a client id that belongs to the shard
+std::string cid_on(am::sharded_broker<epv_t> const& brk, std::size_t shard, std::size_t& index) {
+    while (true) {
+        auto cid = "cid" + std::to_string(index++);
+        if (brk.shard_index(cid) == shard) return cid;
+    }
+}
+
+template <typename Ep>
+as::awaitable<void> connect(Ep& ep, std::string cid) {
+    auto c2b_packet = am::v3_1_1::connect_packet{
+        true,   // clean_session
+        0x1234, // keep_alive
+        am::force_move(cid)
+    };
+    co_await ep->next_layer().emulate_recv(
+        am::force_move(c2b_packet),
+        as::deferred
+    );
+
+    auto exp_packet = am::v3_1_1::connack_packet{
+        false,   // session_present
+        am::connect_return_code::accepted
+    };
+    auto b2c_packet = co_await ep->next_layer().wait_response(as::deferred);
+    BOOST_TEST(b2c_packet == exp_packet);
+}
+
+template <typename Ep>
+as::awaitable<void> subscribe(Ep& ep, std::string topic_filter) {
+    auto c2b_packet = am::v3_1_1::subscribe_packet{
+        0x1234,         // packet_id
+        {
+            {am::force_move(topic_filter), am::qos::at_most_once},
+        }
+    };
+    co_await ep->next_layer().emulate_recv(
+        am::force_move(c2b_packet),
+        as::deferred
+    );
+
+    auto exp_packet = am::v3_1_1::suback_packet{
+        0x1234,         // packet_id
+        {
+            am::suback_return_code::success_maximum_qos_0,
+        }
+    };
+    auto b2c_packet = co_await ep->next_layer().wait_response(as::deferred);
+    BOOST_TEST(b2c_packet == exp_packet);
+}
+
+template <typename Ep>
+as::awaitable<void> close(Ep& ep) {
+    co_await ep->next_layer().emulate_close(as::deferred);
+    auto [ec, b2c_close] = co_await ep->next_layer().wait_response(as::as_tuple(as::deferred));
+    BOOST_TEST(ec == am::errc::connection_reset);
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE(cross_shard) {
+    as::io_context ioc;
+    am::sharded_broker<epv_t> brk{
+        ioc,
+        {
+            as::make_strand(ioc.get_executor()),
+            as::make_strand(ioc.get_executor())
+        }
+    };
+    as::co_spawn(
+        ioc.get_executor(),
+        [&]() -> as::awaitable<void> {
+            try {
+                auto exe = co_await as::this_coro::executor;
+                std::size_t index = 0;
+                auto cid1 = cid_on(brk, 0, index);
+                auto cid2 = cid_on(brk, 1, index);
+
+                auto ep1 =
+                    am::endpoint<am::role::server, am::cpp20coro_stub_socket>::create(
+                        am::protocol_version::undetermined,
+                        am::protocol_version::v3_1_1,
+                        exe
+                    );
+                brk.handle_accept(epv_t{ep1});
+                auto ep2 =
+                    am::endpoint<am::role::server, am::cpp20coro_stub_socket>::create(
+                        am::protocol_version::undetermined,
+                        am::protocol_version::v3_1_1,
+                        exe
+                    );
+                brk.handle_accept(epv_t{ep2});
+
+                co_await connect(ep1, cid1);
+                co_await subscribe(ep1, "topic1");
+                co_await connect(ep2, cid2);
+
+                {
+                    // publish ep2 (shard 1)
+                    auto c2b_packet = am::v3_1_1::publish_packet{
+                        "topic1",
+                        "payload1",
+                        am::qos::at_most_once | am::pub::retain::yes
+                    };
+                    co_await ep2->next_layer().emulate_recv(
+                        am::force_move(c2b_packet),
+                        as::deferred
+                    );
+                }
+                {
+                    // recv ep1 (shard 0)
+                    auto exp_packet = am::v3_1_1::publish_packet{
+                        "topic1",
+                        "payload1",
+                        am::qos::at_most_once | am::pub::retain::no
+                    };
+                    auto b2c_packet = co_await ep1->next_layer().wait_response(as::deferred);
+                    BOOST_TEST(b2c_packet == exp_packet);
+                }
+                {
+                    // retained message is replicated to shard 0
+                    co_await subscribe(ep2, "topic1");
+                    auto exp_packet = am::v3_1_1::publish_packet{
+                        "topic1",
+                        "payload1",
+                        am::qos::at_most_once | am::pub::retain::yes
+                    };
+                    auto b2c_packet = co_await ep2->next_layer().wait_response(as::deferred);
+                    BOOST_TEST(b2c_packet == exp_packet);
+                }
+
+                co_await close(ep1);
+                co_await close(ep2);
+            }
+            catch (...) {
+                BOOST_TEST(false);
+            }
+            co_return;
+        },
+        as::detached
+    );
+    ioc.run();
+}
+
+BOOST_AUTO_TEST_CASE(shared_sub) {
+    as::io_context ioc;
+    am::sharded_broker<epv_t> brk{
+        ioc,
+        {
+            as::make_strand(ioc.get_executor()),
+            as::make_strand(ioc.get_executor())
+        }
+    };
+    as::co_spawn(
+        ioc.get_executor(),
+        [&]() -> as::awaitable<void> {
+            try {
+                auto exe = co_await as::this_coro::executor;
+                std::size_t index = 0;
+                auto cid1 = cid_on(brk, 0, index);
+                auto cid2 = cid_on(brk, 1, index);
+                auto cid3 = cid_on(brk, 1, index);
+
+                auto ep1 =
+                    am::endpoint<am::role::server, am::cpp20coro_stub_socket>::create(
+                        am::protocol_version::undetermined,
+                        am::protocol_version::v3_1_1,
+                        exe
+                    );
+                brk.handle_accept(epv_t{ep1});
+                auto ep2 =
+                    am::endpoint<am::role::server, am::cpp20coro_stub_socket>::create(
+                        am::protocol_version::undetermined,
+                        am::protocol_version::v3_1_1,
+                        exe
+                    );
+                brk.handle_accept(epv_t{ep2});
+                auto ep3 =
+                    am::endpoint<am::role::server, am::cpp20coro_stub_socket>::create(
+                        am::protocol_version::undetermined,
+                        am::protocol_version::v3_1_1,
+                        exe
+                    );
+                brk.handle_accept(epv_t{ep3});
+
+                co_await connect(ep1, cid1);
+                co_await subscribe(ep1, "$share/sn1/topic1");
+                co_await connect(ep2, cid2);
+                co_await subscribe(ep2, "$share/sn1/topic1");
+                co_await connect(ep3, cid3);
+
+                // Each message is delivered to only one member of the group.
+                // ep1 (shard 0) and ep2 (shard 1) are chosen in turn.
+                {
+                    auto c2b_packet = am::v3_1_1::publish_packet{
+                        "topic1",
+                        "payload1",
+                        am::qos::at_most_once
+                    };
+                    co_await ep3->next_layer().emulate_recv(
+                        am::force_move(c2b_packet),
+                        as::deferred
+                    );
+                }
+                {
+                    auto c2b_packet = am::v3_1_1::publish_packet{
+                        "topic1",
+                        "payload2",
+                        am::qos::at_most_once
+                    };
+                    co_await ep3->next_layer().emulate_recv(
+                        am::force_move(c2b_packet),
+                        as::deferred
+                    );
+                }
+                {
+                    auto exp_packet = am::v3_1_1::publish_packet{
+                        "topic1",
+                        "payload1",
+                        am::qos::at_most_once
+                    };
+                    auto b2c_packet = co_await ep1->next_layer().wait_response(as::deferred);
+                    BOOST_TEST(b2c_packet == exp_packet);
+                }
+                {
+                    auto exp_packet = am::v3_1_1::publish_packet{
+                        "topic1",
+                        "payload2",
+                        am::qos::at_most_once
+                    };
+                    auto b2c_packet = co_await ep2->next_layer().wait_response(as::deferred);
+                    BOOST_TEST(b2c_packet == exp_packet);
+                }
+
+                co_await close(ep1);
+                co_await close(ep2);
+                co_await close(ep3);
+            }
+            catch (...) {
+                BOOST_TEST(false);
+            }
+            co_return;
+        },
+        as::detached
+    );
+    ioc.run();
+}
+
+BOOST_AUTO_TEST_CASE(shared_sub_local_shard_first) {
+    as::io_context ioc;
+    am::sharded_broker<epv_t> brk{
+        ioc,
+        {
+            as::make_strand(ioc.get_executor()),
+            as::make_strand(ioc.get_executor())
+        }
+    };
+    brk.set_shared_subscription(am::shared_strategy::local_shard_first);
+    as::co_spawn(
+        ioc.get_executor(),
+        [&]() -> as::awaitable<void> {
+            try {
+                auto exe = co_await as::this_coro::executor;
+                std::size_t index = 0;
+                auto cid1 = cid_on(brk, 0, index);
+                auto cid2 = cid_on(brk, 1, index);
+                auto cid3 = cid_on(brk, 1, index);
+
+                auto ep1 =
+                    am::endpoint<am::role::server, am::cpp20coro_stub_socket>::create(
+                        am::protocol_version::undetermined,
+                        am::protocol_version::v3_1_1,
+                        exe
+                    );
+                brk.handle_accept(epv_t{ep1});
+                auto ep2 =
+                    am::endpoint<am::role::server, am::cpp20coro_stub_socket>::create(
+                        am::protocol_version::undetermined,
+                        am::protocol_version::v3_1_1,
+                        exe
+                    );
+                brk.handle_accept(epv_t{ep2});
+                auto ep3 =
+                    am::endpoint<am::role::server, am::cpp20coro_stub_socket>::create(
+                        am::protocol_version::undetermined,
+                        am::protocol_version::v3_1_1,
+                        exe
+                    );
+                brk.handle_accept(epv_t{ep3});
+
+                co_await connect(ep1, cid1);
+                co_await subscribe(ep1, "$share/sn1/topic1");
+                co_await connect(ep2, cid2);
+                co_await subscribe(ep2, "$share/sn1/topic1");
+                co_await connect(ep3, cid3);
+
+                // ep3 belongs to shard 1, so ep2 (shard 1) is always chosen.
+                for (auto payload : {"payload1", "payload2"}) {
+                    auto c2b_packet = am::v3_1_1::publish_packet{
+                        "topic1",
+                        payload,
+                        am::qos::at_most_once
+                    };
+                    co_await ep3->next_layer().emulate_recv(
+                        am::force_move(c2b_packet),
+                        as::deferred
+                    );
+                }
+                for (auto payload : {"payload1", "payload2"}) {
+                    auto exp_packet = am::v3_1_1::publish_packet{
+                        "topic1",
+                        payload,
+                        am::qos::at_most_once
+                    };
+                    auto b2c_packet = co_await ep2->next_layer().wait_response(as::deferred);
+                    BOOST_TEST(b2c_packet == exp_packet);
+                }
+
+                co_await close(ep1);
+                co_await close(ep2);
+                co_await close(ep3);
+            }
+            catch (...) {
+                BOOST_TEST(false);
+            }
+            co_return;
+        },
+        as::detached
+    );
+    ioc.run();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,247 @@
+// Copyright Takatoshi Kondo 2024
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <bench/hdr_histogram.hpp>
+#include <bench/latency_report.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_hdr_histogram)
+
+namespace am = async_mqtt;
+
+BOOST_AUTO_TEST_CASE(empty) {
+    am::hdr_histogram h;
+    BOOST_TEST(h.count() == 0);
+    BOOST_TEST(h.value_at_percentile(99) == 0);
+    BOOST_TEST(h.mean() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(percentile) {
+    am::hdr_histogram h{3'600'000'000, 3};
+    for (std::uint64_t v = 1; v <= 10000; ++v) h.record(v);
+    BOOST_TEST(h.count() == 10000);
+    BOOST_TEST(h.min() == 1);
+    BOOST_TEST(h.max() == 10000);
+    BOOST_TEST(h.mean() == 5000.5);
+    // the values up to 2048 are exact with 3 significant digits
+    BOOST_TEST(h.value_at_percentile(10) == 1000);
+    BOOST_TEST(h.value_at_percentile(0) == 1);
+    BOOST_TEST(h.value_at_percentile(100) == 10000);
+    auto within =
+        [](std::uint64_t actual, std::uint64_t expected) {
+            return actual >= expected && actual <= expected + expected / 1000;
+        };
+    BOOST_TEST(within(h.value_at_percentile(50), 5000));
+    BOOST_TEST(within(h.value_at_percentile(99), 9900));
+    BOOST_TEST(within(h.value_at_percentile(99.9), 9990));
+    BOOST_TEST(within(h.value_at_percentile(99.99), 9999));
+}
+
+BOOST_AUTO_TEST_CASE(tail) {
+    // the tail isn't hidden by the large number of small values
+    am::hdr_histogram h;
+    h.record(100, 999'800);
+    h.record(50'000'000, 200);
+    BOOST_TEST(h.value_at_percentile(99.9) == 100);
+    auto p9999 = h.value_at_percentile(99.99);
+    BOOST_TEST(p9999 >= 50'000'000u);
+    BOOST_TEST(p9999 <= 50'050'000u);
+    BOOST_TEST(h.max() == 50'000'000);
+}
+
+BOOST_AUTO_TEST_CASE(overflow) {
+    am::hdr_histogram h{1000, 2};
+    h.record(10);
+    h.record(5000);
+    BOOST_TEST(h.count() == 2);
+    BOOST_TEST(h.overflow() == 1);
+    BOOST_TEST(h.max() == 5000);
+    BOOST_TEST(h.value_at_percentile(100) == 5000);
+}
+
+BOOST_AUTO_TEST_CASE(merge) {
+    am::hdr_histogram a;
+    am::hdr_histogram b;
+    am::hdr_histogram all;
+    for (std::uint64_t v = 0; v != 1000; ++v) {
+        a.record(v * 3 + 5);
+        all.record(v * 3 + 5);
+        b.record(v * 1000 + 2);
+        all.record(v * 1000 + 2);
+    }
+    a.merge(b);
+    BOOST_TEST(a.count() == all.count());
+    BOOST_TEST(a.min() == 2);
+    BOOST_TEST(a.max() == all.max());
+    BOOST_TEST(a.mean() == all.mean());
+    for (double p : {50.0, 90.0, 99.0, 99.9, 99.99}) {
+        BOOST_TEST(a.value_at_percentile(p) == all.value_at_percentile(p));
+    }
+
+    // different layout
+    am::hdr_histogram c{100'000'000, 2};
+    c.merge(all);
+    BOOST_TEST(c.count() == all.count());
+    BOOST_TEST(c.min() == all.min());
+    BOOST_TEST(c.max() == all.max());
+    auto p99 = c.value_at_percentile(99);
+    BOOST_TEST(p99 >= all.value_at_percentile(99) * 99 / 100);
+    BOOST_TEST(p99 <= all.value_at_percentile(99) * 101 / 100);
+}
+
+BOOST_AUTO_TEST_CASE(serialize) {
+    am::hdr_histogram h;
+    h.record(0);
+    h.record(7, 3);
+    h.record(123'456'789);
+    std::stringstream ss;
+    h.write(ss);
+    auto r = am::hdr_histogram::read(ss);
+    BOOST_TEST(r.count() == 5);
+    BOOST_TEST(r.min() == 0);
+    BOOST_TEST(r.max() == 123'456'789);
+    BOOST_TEST(r.mean() == h.mean());
+    for (double p : {0.0, 50.0, 80.0, 100.0}) {
+        BOOST_TEST(r.value_at_percentile(p) == h.value_at_percentile(p));
+    }
+
+    std::stringstream bad{"hdr 3 1000 2 0 0 0 0\n5 1\nend\n"};
+    BOOST_CHECK_THROW(am::hdr_histogram::read(bad), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(recorder_threads) {
+    am::latency_recorder rec{2, 3};
+    std::vector<std::thread> ths;
+    for (std::size_t t = 0; t != 4; ++t) {
+        ths.emplace_back(
+            [&, t] {
+                for (std::uint64_t i = 0; i != 1000; ++i) {
+                    rec.record(1, t % 3, t * 1000 + i);
+                }
+            }
+        );
+    }
+    for (auto& th : ths) th.join();
+    BOOST_TEST(rec.threads() == 4);
+    BOOST_TEST(rec.merged(0, 0).count() == 0);
+    auto g0 = rec.merged(1, 0);
+    BOOST_TEST(g0.count() == 2000);
+    BOOST_TEST(g0.min() == 0);
+    BOOST_TEST(g0.max() == 3999);
+    BOOST_TEST(rec.merged(1, 1).count() == 1000);
+    BOOST_TEST(rec.merged(1, 2).count() == 1000);
+
+    rec.record(0, 0, 1);
+    rec.reset(1);
+    BOOST_TEST(rec.merged(1, 0).count() == 0);
+    BOOST_TEST(rec.merged(0, 0).count() == 1);
+    rec.record(1, 0, 7);
+    BOOST_TEST(rec.merged(1, 0).max() == 7);
+}
+
+BOOST_AUTO_TEST_CASE(series) {
+    am::throughput_series s{1000};
+    BOOST_TEST(s.interval_end(1500) == 2000);
+    BOOST_TEST(s.interval_end(2000) == 3000);
+    s.add_sent(10);
+    s.add_received(4);
+    s.sample(2000);
+    s.add_received(6);
+    s.sample(3000);
+    s.add_sent(1);
+    s.sample(3000); // the last partial interval
+    auto samples = s.samples();
+    BOOST_TEST(samples.size() == 2);
+    BOOST_TEST(samples[0].ts_ms == 2000);
+    BOOST_TEST(samples[0].sent == 10);
+    BOOST_TEST(samples[0].received == 4);
+    BOOST_TEST(samples[1].sent == 1);
+    BOOST_TEST(samples[1].received == 6);
+}
+
+BOOST_AUTO_TEST_CASE(report_merge) {
+    // e.g. a sender and a receiver process
+    am::latency_report sender;
+    sender.info["mode"] = "send";
+    am::hdr_histogram con;
+    con.record(300);
+    sender.add("connect", "all", con);
+    sender.series = {{1000, 10, 0}, {2000, 20, 0}};
+
+    am::latency_report receiver;
+    receiver.info["mode"] = "recv";
+    am::hdr_histogram pub;
+    pub.record(1000, 30);
+    receiver.add("connect", "all", con);
+    receiver.add("publish", "all", pub);
+    receiver.series = {{2000, 0, 10}, {3000, 0, 20}};
+
+    std::stringstream ss;
+    receiver.write(ss);
+    auto r = am::latency_report::read(ss);
+    BOOST_TEST(r.entries.size() == 2);
+    BOOST_TEST(r.series.size() == 2);
+
+    sender.merge(r);
+    BOOST_TEST(sender.info["mode"] == "send,recv");
+    BOOST_TEST(sender.entries.size() == 2);
+    BOOST_TEST(sender.entries[0].phase == "connect");
+    BOOST_TEST(sender.entries[0].hist.count() == 2);
+    BOOST_TEST(sender.entries[1].hist.count() == 30);
+    BOOST_TEST(sender.series.size() == 3);
+    BOOST_TEST(sender.series[1].ts_ms == 2000);
+    BOOST_TEST(sender.series[1].sent == 20);
+    BOOST_TEST(sender.series[1].received == 10);
+
+    am::latency_report other_interval;
+    other_interval.interval_ms = 500;
+    other_interval.series = {{500, 1, 1}};
+    BOOST_CHECK_THROW(sender.merge(other_interval), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(report_output) {
+    am::latency_report r;
+    r.info["qos"] = "1";
+    am::hdr_histogram h;
+    for (std::uint64_t v = 1; v <= 100; ++v) h.record(v);
+    r.add("publish", "all", h);
+    r.series = {{1000, 5, 4}};
+
+    BOOST_TEST(am::latency_report::percentile_label(99.9) == "p99_9");
+    BOOST_TEST(am::latency_report::percentile_label(50) == "p50");
+
+    std::ostringstream json;
+    r.write_json(json);
+    BOOST_TEST(json.str().find("\"qos\": \"1\"") != std::string::npos);
+    BOOST_TEST(json.str().find("\"phase\": \"publish\"") != std::string::npos);
+    BOOST_TEST(json.str().find("\"p99\": 99") != std::string::npos);
+    BOOST_TEST(json.str().find("{\"ts_ms\": 1000, \"sent\": 5, \"received\": 4}") != std::string::npos);
+
+    std::ostringstream csv;
+    r.write_latency_csv(csv);
+    BOOST_TEST(
+        csv.str() ==
+        "phase,group,count,min,p50,p90,p99,p99_9,p99_99,max,mean,overflow\n"
+        "publish,all,100,1,50,90,99,100,100,100,50.5,0\n"
+    );
+
+    std::ostringstream series;
+    r.write_throughput_csv(series);
+    BOOST_TEST(
+        series.str() ==
+        "ts_ms,sent,received,sent_per_sec,received_per_sec\n"
+        "1000,5,4,5,4\n"
+    );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -21,9 +21,33 @@ BOOST_AUTO_TEST_SUITE(ut_null_strand)
 namespace am = async_mqtt;
 namespace as = boost::asio;
 
+BOOST_AUTO_TEST_CASE(executor) {
+    as::io_context ioc;
+    auto ns1 = am::make_null_strand(ioc.get_executor());
+    auto ns2 = am::make_null_strand(ioc);
+    BOOST_CHECK(ns1 == ns2);
+    BOOST_CHECK(ns1.get_inner_executor() == ioc.get_executor());
+    BOOST_TEST(&as::query(ns1, as::execution::context) == &ioc);
+
+    as::any_io_executor exe = ns1;
+    std::vector<int> order;
+    as::post(
+        exe,
+        [&] {
+            // dispatch is called inline on the thread that runs the inner executor
+            as::dispatch(exe, [&] { order.push_back(1); });
+            order.push_back(2);
+            as::post(exe, [&] { order.push_back(4); });
+            order.push_back(3);
+        }
+    );
+    ioc.run();
+    BOOST_TEST(order == (std::vector<int>{1, 2, 3, 4}));
+}
+
 // v3_1_1
 
-BOOST_AUTO_TEST_CASE(epst) {
+BOOST_AUTO_TEST_CASE(ep) {
     auto version = am::protocol_version::v3_1_1;
     as::io_context ioc;
     auto guard = as::make_work_guard(ioc.get_executor());
@@ -33,11 +57,11 @@ BOOST_AUTO_TEST_CASE(epst) {
         }
     };
 
-    auto ep = am::endpoint_st<am::role::client, am::stub_socket>::create(
+    auto ep = am::endpoint<am::role::client, am::stub_socket>::create(
         version,
         // for stub_socket args
         version,
-        ioc.get_executor()
+        am::make_null_strand(ioc.get_executor())
     );
     auto fut1 = ep->async_acquire_unique_packet_id_wait_until(as::use_future);
     auto pid1 = fut1.get();
@@ -57,11 +81,11 @@ BOOST_AUTO_TEST_CASE(bep) {
         }
     };
 
-    auto ep = am::basic_endpoint<am::role::client, 4, am::null_strand, am::stub_socket>::create(
+    auto ep = am::basic_endpoint<am::role::client, 4, am::basic_stub_socket<4>>::create(
         version,
         // for stub_socket args
         version,
-        ioc.get_executor()
+        am::make_null_strand(ioc.get_executor())
     );
     auto fut1 = ep->async_acquire_unique_packet_id_wait_until(as::use_future);
     auto pid1 = fut1.get();
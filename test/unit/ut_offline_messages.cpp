@@ -0,0 +1,190 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <broker/offline_message.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_offline_messages)
+
+namespace am = async_mqtt;
+namespace as = boost::asio;
+
+namespace {
+
+struct fixture {
+    am::offline_push_result push(am::offline_messages& msgs, std::size_t size, am::qos qos_value) {
+        return msgs.push_back(
+            am::use_timer_wheel(ioc),
+            owner,
+            [](void*, void*, am::timer_wheel::handle const*) {},
+            next_id++,
+            "topic1",
+            std::vector<am::buffer>{am::buffer{std::string(size, 'x')}},
+            qos_value,
+            am::property_block{},
+            [&](std::uint64_t id) { dropped.push_back(id); }
+        );
+    }
+
+    as::io_context ioc;
+    std::shared_ptr<void> owner = std::make_shared<int>(0);
+    std::uint64_t next_id = 1;
+    std::vector<std::uint64_t> dropped;
+};
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE(unlimited) {
+    fixture f;
+    am::offline_quota quota;
+    {
+        am::offline_messages msgs{quota};
+        for (int i = 0; i != 100; ++i) {
+            BOOST_CHECK(f.push(msgs, 10, am::qos::at_least_once) == am::offline_push_result::queued);
+        }
+        BOOST_TEST(msgs.size() == 100);
+        BOOST_TEST(msgs.bytes() == 1000);
+        BOOST_TEST(quota.messages() == 100);
+        BOOST_TEST(quota.bytes() == 1000);
+    }
+    // destruction releases the total
+    BOOST_TEST(quota.messages() == 0);
+    BOOST_TEST(quota.bytes() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(drop_oldest) {
+    fixture f;
+    am::offline_quota quota;
+    quota.session.max_messages = 3;
+    am::offline_messages msgs{quota};
+    for (int i = 0; i != 5; ++i) {
+        BOOST_CHECK(f.push(msgs, 10, am::qos::at_least_once) == am::offline_push_result::queued);
+    }
+    BOOST_TEST(msgs.size() == 3);
+    BOOST_TEST(msgs.bytes() == 30);
+    BOOST_TEST(f.dropped == (std::vector<std::uint64_t>{1, 2}));
+    BOOST_TEST(quota.dropped() == 2);
+}
+
+BOOST_AUTO_TEST_CASE(drop_newest) {
+    fixture f;
+    am::offline_quota quota;
+    quota.session.max_bytes = 25;
+    quota.policy = am::offline_overflow_policy::drop_newest;
+    am::offline_messages msgs{quota};
+    BOOST_CHECK(f.push(msgs, 10, am::qos::at_least_once) == am::offline_push_result::queued);
+    BOOST_CHECK(f.push(msgs, 10, am::qos::at_least_once) == am::offline_push_result::queued);
+    BOOST_CHECK(f.push(msgs, 10, am::qos::at_least_once) == am::offline_push_result::dropped);
+    BOOST_CHECK(f.push(msgs, 5, am::qos::at_least_once) == am::offline_push_result::queued);
+    BOOST_TEST(msgs.size() == 3);
+    BOOST_TEST(msgs.bytes() == 25);
+    BOOST_TEST(f.dropped.empty());
+    BOOST_TEST(quota.dropped() == 1);
+}
+
+BOOST_AUTO_TEST_CASE(drop_qos0_first) {
+    fixture f;
+    am::offline_quota quota;
+    quota.session.max_messages = 3;
+    quota.policy = am::offline_overflow_policy::drop_qos0_first;
+    am::offline_messages msgs{quota};
+    f.push(msgs, 10, am::qos::at_least_once); // 1
+    f.push(msgs, 10, am::qos::at_most_once);  // 2
+    f.push(msgs, 10, am::qos::at_most_once);  // 3
+    BOOST_CHECK(f.push(msgs, 10, am::qos::exactly_once) == am::offline_push_result::queued);  // 4
+    BOOST_CHECK(f.push(msgs, 10, am::qos::at_least_once) == am::offline_push_result::queued); // 5
+    BOOST_TEST(f.dropped == (std::vector<std::uint64_t>{2, 3}));
+    // no QoS0 message is queued, the new QoS0 message is discarded
+    BOOST_CHECK(f.push(msgs, 10, am::qos::at_most_once) == am::offline_push_result::dropped); // 6
+    // the oldest one is erased for QoS1
+    BOOST_CHECK(f.push(msgs, 10, am::qos::at_least_once) == am::offline_push_result::queued); // 7
+    BOOST_TEST(f.dropped == (std::vector<std::uint64_t>{2, 3, 1}));
+    BOOST_TEST(msgs.size() == 3);
+    BOOST_TEST(quota.dropped() == 4);
+}
+
+BOOST_AUTO_TEST_CASE(disconnect) {
+    fixture f;
+    am::offline_quota quota;
+    quota.session.max_messages = 1;
+    quota.policy = am::offline_overflow_policy::disconnect;
+    am::offline_messages msgs{quota};
+    BOOST_CHECK(f.push(msgs, 10, am::qos::at_least_once) == am::offline_push_result::queued);
+    BOOST_CHECK(f.push(msgs, 10, am::qos::at_least_once) == am::offline_push_result::overflow);
+    BOOST_TEST(msgs.size() == 1);
+}
+
+BOOST_AUTO_TEST_CASE(global) {
+    fixture f;
+    am::offline_quota quota;
+    quota.global.max_messages = 3;
+    am::offline_messages msgs1{quota};
+    am::offline_messages msgs2{quota};
+    f.push(msgs1, 10, am::qos::at_least_once);
+    f.push(msgs1, 10, am::qos::at_least_once);
+    f.push(msgs1, 10, am::qos::at_least_once);
+    // msgs2 is empty, so the new message is discarded
+    BOOST_CHECK(f.push(msgs2, 10, am::qos::at_least_once) == am::offline_push_result::dropped);
+    // msgs1 makes room by itself
+    BOOST_CHECK(f.push(msgs1, 10, am::qos::at_least_once) == am::offline_push_result::queued);
+    BOOST_TEST(msgs1.size() == 3);
+    BOOST_TEST(quota.messages() == 3);
+    msgs1.clear();
+    BOOST_TEST(quota.messages() == 0);
+    BOOST_CHECK(f.push(msgs2, 10, am::qos::at_least_once) == am::offline_push_result::queued);
+}
+
+BOOST_AUTO_TEST_CASE(too_large) {
+    fixture f;
+    am::offline_quota quota;
+    quota.session.max_bytes = 25;
+    am::offline_messages msgs{quota};
+    f.push(msgs, 10, am::qos::at_least_once);
+    f.push(msgs, 10, am::qos::at_least_once);
+    // the queued messages are kept
+    BOOST_CHECK(f.push(msgs, 30, am::qos::at_least_once) == am::offline_push_result::dropped);
+    BOOST_TEST(msgs.size() == 2);
+    BOOST_TEST(f.dropped.empty());
+    BOOST_TEST(quota.dropped() == 1);
+}
+
+BOOST_AUTO_TEST_CASE(global_by_others) {
+    fixture f;
+    am::offline_quota quota;
+    quota.global.max_bytes = 30;
+    am::offline_messages msgs1{quota};
+    am::offline_messages msgs2{quota};
+    f.push(msgs1, 20, am::qos::at_least_once);
+    f.push(msgs2, 10, am::qos::at_least_once);
+    // erasing msgs2 doesn't make room, so only the new message is discarded
+    BOOST_CHECK(f.push(msgs2, 15, am::qos::at_least_once) == am::offline_push_result::dropped);
+    BOOST_TEST(msgs2.size() == 1);
+    BOOST_TEST(f.dropped.empty());
+    // erasing msgs2 makes room
+    BOOST_CHECK(f.push(msgs2, 5, am::qos::at_least_once) == am::offline_push_result::queued);
+    BOOST_TEST(f.dropped == (std::vector<std::uint64_t>{2}));
+    BOOST_TEST(quota.bytes() == 25);
+}
+
+BOOST_AUTO_TEST_CASE(keep_largest) {
+    std::vector<am::offline_queue_info> queues{
+        {"u", "c1", 1, 10},
+        {"u", "c2", 1, 30},
+        {"u", "c3", 1, 20},
+    };
+    am::keep_largest_offline_queues(queues, 2);
+    BOOST_TEST(queues.size() == 2);
+    BOOST_TEST(queues[0].client_id == "c2");
+    BOOST_TEST(queues[1].client_id == "c3");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,100 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <vector>
+#include <memory>
+
+#include <async_mqtt/util/op_queue.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_op_queue)
+
+namespace am = async_mqtt;
+
+BOOST_AUTO_TEST_CASE( immediate ) {
+    am::op_queue q;
+    std::vector<int> order;
+    BOOST_TEST(q.immediate_executable());
+    q.post([&] { order.push_back(1); });
+    BOOST_TEST(order == std::vector<int>{1});
+    BOOST_TEST(q.immediate_executable());
+    BOOST_TEST(q.empty());
+}
+
+BOOST_AUTO_TEST_CASE( serialize ) {
+    am::op_queue q;
+    std::vector<int> order;
+    auto op =
+        [&](int i) {
+            return
+                [&, i] {
+                    order.push_back(i);
+                    q.start_work();
+                };
+        };
+    q.post(op(1));
+    BOOST_TEST(!q.immediate_executable());
+    q.post(op(2));
+    q.post(op(3));
+    BOOST_TEST(order == std::vector<int>{1});
+
+    q.stop_work();
+    BOOST_TEST(q.poll_one() == 1);
+    BOOST_TEST((order == std::vector<int>{1, 2}));
+
+    q.stop_work();
+    BOOST_TEST(q.poll_one() == 1);
+    BOOST_TEST((order == std::vector<int>{1, 2, 3}));
+
+    q.stop_work();
+    BOOST_TEST(q.poll_one() == 0);
+    BOOST_TEST(q.immediate_executable());
+}
+
+BOOST_AUTO_TEST_CASE( post_between_stop_work_and_poll ) {
+    am::op_queue q;
+    std::vector<int> order;
+    q.post([&] { order.push_back(1); q.start_work(); });
+    q.stop_work();
+    // poll_one() is not called yet, so the next operation must be queued
+    q.post([&] { order.push_back(2); });
+    BOOST_TEST(order == std::vector<int>{1});
+    BOOST_TEST(q.poll_one() == 1);
+    BOOST_TEST((order == std::vector<int>{1, 2}));
+    BOOST_TEST(q.immediate_executable());
+}
+
+BOOST_AUTO_TEST_CASE( repost_in_handler ) {
+    // same as endpoint::close_op that re-posts itself while closing
+    am::op_queue q;
+    int count = 0;
+    std::function<void()> f =
+        [&] {
+            if (++count == 1) q.post(f);
+        };
+    q.post(f);
+    BOOST_TEST(count == 1);
+    BOOST_TEST(!q.empty());
+    BOOST_TEST(q.poll() == 1);
+    BOOST_TEST(count == 2);
+    BOOST_TEST(q.empty());
+    BOOST_TEST(q.immediate_executable());
+}
+
+BOOST_AUTO_TEST_CASE( destroy_pending ) {
+    auto sp = std::make_shared<int>(0);
+    {
+        am::op_queue q;
+        q.post([&] { q.start_work(); });
+        q.post([sp] {});
+        BOOST_TEST(sp.use_count() == 2);
+    }
+    BOOST_TEST(sp.use_count() == 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
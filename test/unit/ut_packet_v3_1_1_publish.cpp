@@ -423,4 +423,52 @@ BOOST_AUTO_TEST_CASE(v311_publish_error) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(v311_publish_set_packet_id) {
+    auto p = am::v3_1_1::publish_packet{
+        0x1234, // packet_id
+        "topic1",
+        "payload1",
+        am::qos::at_least_once
+    };
+    auto copied = p;
+    copied.set_packet_id(0x5678);
+    BOOST_TEST(p.packet_id() == 0x1234);
+    BOOST_TEST(copied.packet_id() == 0x5678);
+    BOOST_TEST(copied.size() == p.size());
+    {
+        auto expected = am::v3_1_1::publish_packet{
+            0x5678, // packet_id
+            "topic1",
+            "payload1",
+            am::qos::at_least_once
+        };
+        BOOST_TEST(copied == expected);
+        auto cbs1 = copied.const_buffer_sequence();
+        auto cbs2 = expected.const_buffer_sequence();
+        auto [b1, e1] = am::make_packet_range(cbs1);
+        auto [b2, e2] = am::make_packet_range(cbs2);
+        BOOST_TEST(std::equal(b1, e1, b2, e2));
+    }
+    try {
+        copied.set_packet_id(0);
+        BOOST_TEST(false);
+    }
+    catch (am::system_error const& se) {
+        BOOST_TEST(se.code() == am::disconnect_reason_code::protocol_error);
+    }
+
+    auto p0 = am::v3_1_1::publish_packet{
+        "topic1",
+        "payload1",
+        am::qos::at_most_once
+    };
+    try {
+        p0.set_packet_id(1);
+        BOOST_TEST(false);
+    }
+    catch (am::system_error const& se) {
+        BOOST_TEST(se.code() == am::disconnect_reason_code::protocol_error);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
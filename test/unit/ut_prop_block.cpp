@@ -0,0 +1,255 @@
+// Copyright Takatoshi Kondo 2024
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <async_mqtt/util/buffer.hpp>
+#include <async_mqtt/packet/property_block.hpp>
+#include <async_mqtt/packet/v5_publish.hpp>
+#include <async_mqtt/packet/packet_iterator.hpp>
+#include <async_mqtt/impl/buffer_to_packet_variant.ipp>
+#include <async_mqtt/packet/packet_variant.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_prop_block)
+
+namespace am = async_mqtt;
+
+namespace {
+
+am::properties sample_props() {
+    return am::properties{
+        am::property::content_type{"text/plain"},
+        am::property::message_expiry_interval{100},
+        am::property::user_property{"key", "val"}
+    };
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE(encode) {
+    auto props = sample_props();
+    am::property_block pb{props};
+    BOOST_TEST(!pb.empty());
+    BOOST_TEST(pb.size() == am::size(props));
+    BOOST_TEST(am::to_string(pb.const_buffer_sequence()) == am::to_string(am::const_buffer_sequence(props)));
+    BOOST_TEST(pb.num_of_const_buffer_sequence() == pb.const_buffer_sequence().size());
+    BOOST_TEST(pb.to_properties() == props);
+
+    BOOST_TEST(pb.contains(am::property::id::content_type));
+    BOOST_TEST(!pb.contains(am::property::id::topic_alias));
+    BOOST_TEST(*pb.message_expiry_interval() == 100);
+    BOOST_TEST(!pb.topic_alias());
+
+    am::property_block empty;
+    BOOST_TEST(empty.empty());
+    BOOST_TEST(empty.size() == 0);
+    BOOST_TEST(empty.num_of_const_buffer_sequence() == 0);
+    BOOST_TEST(empty.to_properties().empty());
+    BOOST_TEST(!empty.message_expiry_interval());
+}
+
+BOOST_AUTO_TEST_CASE(invalid_location) {
+    BOOST_CHECK_THROW(
+        (am::property_block{
+            am::properties{am::property::session_expiry_interval{10}},
+            am::property_location::publish
+        }),
+        am::system_error
+    );
+}
+
+BOOST_AUTO_TEST_CASE(overlay) {
+    am::property_block pb{sample_props()};
+
+    // replaces the encoded value
+    auto patched = pb.with_message_expiry_interval(40);
+    BOOST_TEST(*patched.message_expiry_interval() == 40);
+    BOOST_TEST(*pb.message_expiry_interval() == 100);
+    BOOST_TEST(patched.size() == pb.size());
+    auto expected = am::properties{
+        am::property::content_type{"text/plain"},
+        am::property::message_expiry_interval{40},
+        am::property::user_property{"key", "val"}
+    };
+    BOOST_TEST(am::to_string(patched.const_buffer_sequence()) == am::to_string(am::const_buffer_sequence(expected)));
+    BOOST_TEST(patched.num_of_const_buffer_sequence() == patched.const_buffer_sequence().size());
+    BOOST_TEST(patched.to_properties() == expected);
+
+    // appended after the other overlay
+    auto with_sid = patched.with_subscription_identifier(300);
+    expected.push_back(am::property::subscription_identifier{300});
+    BOOST_TEST(with_sid.size() == am::size(expected));
+    BOOST_TEST(am::to_string(with_sid.const_buffer_sequence()) == am::to_string(am::const_buffer_sequence(expected)));
+    BOOST_TEST(with_sid.to_properties() == expected);
+    BOOST_TEST(with_sid.contains(am::property::id::subscription_identifier));
+    BOOST_TEST(!patched.contains(am::property::id::subscription_identifier));
+
+    // the property is appended if it is not contained
+    am::property_block no_mei{am::properties{am::property::content_type{"text/plain"}}};
+    auto appended = no_mei.with_message_expiry_interval(5);
+    auto expected_appended = am::properties{
+        am::property::content_type{"text/plain"},
+        am::property::message_expiry_interval{5}
+    };
+    BOOST_TEST(am::to_string(appended.const_buffer_sequence()) == am::to_string(am::const_buffer_sequence(expected_appended)));
+    BOOST_TEST(appended.to_properties() == expected_appended);
+
+    auto only_sid = am::property_block{}.with_subscription_identifier(1);
+    BOOST_TEST(only_sid.to_properties() == am::properties{am::property::subscription_identifier{1}});
+}
+
+BOOST_AUTO_TEST_CASE(publish) {
+    am::property_block pb{sample_props()};
+    am::v5::publish_packet p1{
+        1,
+        "topic1",
+        "payload1",
+        am::qos::at_least_once,
+        pb.with_subscription_identifier(2)
+    };
+    auto props = sample_props();
+    props.push_back(am::property::subscription_identifier{2});
+    am::v5::publish_packet p2{
+        1,
+        "topic1",
+        "payload1",
+        am::qos::at_least_once,
+        props
+    };
+    BOOST_TEST(p1.size() == p2.size());
+    BOOST_TEST(p1.num_of_const_buffer_sequence() == p1.const_buffer_sequence().size());
+    BOOST_TEST(am::to_string(p1.const_buffer_sequence()) == am::to_string(p2.const_buffer_sequence()));
+    BOOST_TEST(*p1.message_expiry_interval() == 100);
+    BOOST_TEST(p1.props() == props);
+
+    p1.update_message_expiry_interval(10);
+    p2.update_message_expiry_interval(10);
+    BOOST_TEST(am::to_string(p1.const_buffer_sequence()) == am::to_string(p2.const_buffer_sequence()));
+    BOOST_TEST(*p1.message_expiry_interval() == 10);
+
+    // the properties are decoded to be modified
+    p1.add_topic_alias(3);
+    p2.add_topic_alias(3);
+    BOOST_TEST(am::to_string(p1.const_buffer_sequence()) == am::to_string(p2.const_buffer_sequence()));
+    BOOST_TEST(*p1.topic_alias() == 3);
+    p1.remove_topic_alias();
+    p2.remove_topic_alias();
+    BOOST_TEST(am::to_string(p1.const_buffer_sequence()) == am::to_string(p2.const_buffer_sequence()));
+
+    // the parsed packet is the same
+    auto buf = am::buffer{am::to_string(p1.const_buffer_sequence())};
+    am::error_code ec;
+    auto pv = am::buffer_to_packet_variant(buf, am::protocol_version::v5, ec);
+    BOOST_TEST(!ec);
+    auto p3 = pv.get_if<am::v5::publish_packet>();
+    BOOST_TEST_REQUIRE(p3);
+    BOOST_TEST(*p3 == p2);
+}
+
+BOOST_AUTO_TEST_CASE(raw) {
+    auto props = sample_props();
+    props.push_back(am::property::topic_alias{5});
+    props.push_back(am::property::user_property{"key2", "val2"});
+    auto encoded = am::buffer{am::to_string(am::const_buffer_sequence(props))};
+
+    am::error_code ec;
+    am::property_block pb{encoded, am::property_location::publish, ec};
+    BOOST_TEST(!ec);
+    BOOST_TEST(pb.size() == encoded.size());
+    BOOST_TEST(am::to_string(pb.const_buffer_sequence()) == std::string_view{encoded});
+    // the received bytes are shared
+    BOOST_TEST(pb.const_buffer_sequence().front().data() == encoded.data());
+    BOOST_TEST(*pb.message_expiry_interval() == 100);
+    BOOST_TEST(*pb.topic_alias() == 5);
+    BOOST_TEST(pb.contains(am::property::id::user_property));
+    BOOST_TEST(pb.to_properties() == props);
+
+    auto patched = pb.with_message_expiry_interval(7);
+    BOOST_TEST(*patched.message_expiry_interval() == 7);
+
+    am::property_block empty{am::buffer{}, am::property_location::publish, ec};
+    BOOST_TEST(!ec);
+    BOOST_TEST(empty.empty());
+}
+
+BOOST_AUTO_TEST_CASE(raw_invalid) {
+    using namespace std::literals;
+    auto check =
+        [](std::string bytes, am::property_location loc = am::property_location::publish) {
+            am::error_code ec_eager;
+            am::make_properties(am::buffer{bytes}, loc, ec_eager);
+            am::error_code ec;
+            am::property_block pb{am::buffer{bytes}, loc, ec};
+            BOOST_TEST(ec);
+            BOOST_TEST(ec == ec_eager);
+            BOOST_TEST(pb.empty());
+        };
+    // not allowed on PUBLISH (SessionExpiryInterval)
+    check("\x11\x00\x00\x00\x01"s);
+    // PayloadFormatIndicator is 2
+    check("\x01\x02"s);
+    // truncated MessageExpiryInterval
+    check("\x02\x00\x00"s);
+    // truncated ContentType
+    check("\x03\x00\x05" "ab"s);
+    // invalid UTF-8 ContentType
+    check("\x03\x00\x01\xff"s);
+    // SubscriptionIdentifier is 0
+    check("\x0b\x00"s);
+    // truncated value of UserProperty
+    check("\x26\x00\x01" "k" "\x00\x02" "v"s);
+    // ReceiveMaximum is 0
+    check("\x21\x00\x00"s, am::property_location::connect);
+    // MaximumPacketSize is 0
+    check("\x27\x00\x00\x00\x00"s, am::property_location::connect);
+    // unknown property id
+    check("\x7f\x00"s);
+}
+
+BOOST_AUTO_TEST_CASE(lazy_publish) {
+    auto props = sample_props();
+    props.push_back(am::property::topic_alias{3});
+    am::v5::publish_packet p{
+        1,
+        "topic1",
+        "payload1",
+        am::qos::at_least_once,
+        props
+    };
+    auto buf = am::buffer{am::to_string(p.const_buffer_sequence())};
+
+    am::error_code ec;
+    auto pv = am::buffer_to_packet_variant(buf, am::protocol_version::v5, am::property_decoding::lazy, ec);
+    BOOST_TEST(!ec);
+    auto lazy = pv.get_if<am::v5::publish_packet>();
+    BOOST_TEST_REQUIRE(lazy);
+    BOOST_TEST(am::to_string(lazy->const_buffer_sequence()) == std::string_view{buf});
+    BOOST_TEST(*lazy->topic_alias() == 3);
+    BOOST_TEST(*lazy->message_expiry_interval() == 100);
+    BOOST_TEST(lazy->props_as_block().size() == am::size(props));
+    BOOST_TEST(lazy->props() == props);
+    BOOST_TEST(*lazy == p);
+
+    // the properties are validated on receive
+    am::v5::publish_packet invalid{
+        1,
+        "topic1",
+        "payload1",
+        am::qos::at_least_once,
+        am::properties{am::property::content_type{"text/plain"}}
+    };
+    auto invalid_str = am::to_string(invalid.const_buffer_sequence());
+    // break the UTF-8 string of ContentType
+    invalid_str[invalid_str.find("text")] = '\xff';
+    am::error_code ec_eager;
+    am::buffer_to_packet_variant(am::buffer{invalid_str}, am::protocol_version::v5, ec_eager);
+    BOOST_TEST(ec_eager);
+    am::buffer_to_packet_variant(am::buffer{invalid_str}, am::protocol_version::v5, am::property_decoding::lazy, ec);
+    BOOST_TEST(ec == ec_eager);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
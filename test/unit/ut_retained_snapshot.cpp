@@ -0,0 +1,359 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+
+#include <broker/retained_messages.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_retained_snapshot)
+
+namespace am = async_mqtt;
+
+namespace {
+
+struct temp_file {
+    temp_file()
+        :path{
+            (
+                std::filesystem::temp_directory_path() /
+                ("ut_retained_snapshot_" + std::to_string(::getpid()) + "_" + std::to_string(counter()++))
+            ).string()
+        }
+    {
+        std::filesystem::remove(path);
+    }
+    ~temp_file() {
+        std::filesystem::remove(path);
+    }
+    static int& counter() {
+        static int c = 0;
+        return c;
+    }
+    std::string path;
+};
+
+am::retain_type make_retain(std::string topic, std::string payload, am::properties props = {}) {
+    return am::retain_type{
+        am::buffer{am::force_move(topic)},
+        std::vector<am::buffer>{am::buffer{am::force_move(payload)}},
+        am::force_move(props),
+        am::qos::at_least_once
+    };
+}
+
+std::string payload_of(am::retain_type const& r) {
+    std::string s;
+    for (auto const& b : r.payload) s.append(b.data(), b.size());
+    return s;
+}
+
+std::set<std::string> match(am::retained_messages const& m, std::string_view filter) {
+    std::set<std::string> topics;
+    m.find(filter, [&](am::retain_type const& r) { topics.insert(std::string{r.topic}); });
+    return topics;
+}
+
+std::set<std::string> match(am::retained_snapshot const& s, std::string_view filter) {
+    std::set<std::string> topics;
+    s.find(filter, [&](std::uint32_t v) { topics.insert(s.topic(v)); });
+    return topics;
+}
+
+std::shared_ptr<am::retained_snapshot const> write_and_open(
+    am::retained_messages const& m,
+    std::string const& path
+) {
+    am::retained_snapshot_writer writer;
+    m.collect(writer);
+    BOOST_TEST(writer.write(path));
+    return am::retained_snapshot::open(path);
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE(write_and_find) {
+    temp_file f;
+    am::retained_messages m;
+    for (auto topic : {"a", "a/b", "a/b/c", "a/c", "b", "a//c", "a/", "$SYS/x", "ab"}) {
+        m.insert_or_assign(topic, make_retain(topic, std::string{"p:"} + topic));
+    }
+    auto s = write_and_open(m, f.path);
+    BOOST_TEST_REQUIRE(s);
+    BOOST_TEST(s->size() == 9);
+
+    for (auto topic : {"a", "a/b", "a/b/c", "a/c", "b", "a//c", "a/", "$SYS/x", "ab"}) {
+        auto v = s->find_exact(topic);
+        BOOST_TEST_REQUIRE(v.has_value());
+        BOOST_TEST(s->topic(*v) == topic);
+        auto r = s->load(*v);
+        BOOST_TEST_REQUIRE(r.has_value());
+        BOOST_TEST(r->topic == topic);
+        BOOST_TEST(payload_of(*r) == std::string{"p:"} + topic);
+        BOOST_CHECK(r->qos_value == am::qos::at_least_once);
+    }
+    BOOST_TEST(!s->find_exact("a/b/c/d"));
+    BOOST_TEST(!s->find_exact("c"));
+
+    BOOST_TEST(match(*s, "a/+") == (std::set<std::string>{"a/b", "a/c", "a/"}));
+    BOOST_TEST(match(*s, "a/#") == (std::set<std::string>{"a", "a/b", "a/b/c", "a/c", "a//c", "a/"}));
+    BOOST_TEST(match(*s, "+/+/c") == (std::set<std::string>{"a/b/c", "a//c"}));
+    BOOST_TEST(match(*s, "#") == (std::set<std::string>{"a", "a/b", "a/b/c", "a/c", "b", "a//c", "a/", "ab"}));
+    BOOST_TEST(match(*s, "+") == (std::set<std::string>{"a", "b", "ab"}));
+    BOOST_TEST(match(*s, "$SYS/#") == (std::set<std::string>{"$SYS/x"}));
+    BOOST_TEST(match(*s, "+/b/#") == (std::set<std::string>{"a/b", "a/b/c"}));
+}
+
+BOOST_AUTO_TEST_CASE(payload_aliases_mapping) {
+    temp_file f;
+    std::optional<am::retain_type> r;
+    {
+        am::retained_messages m;
+        m.insert_or_assign("t", make_retain("t", "payload"));
+        auto s = write_and_open(m, f.path);
+        BOOST_TEST_REQUIRE(s);
+        if (auto l = s->load(*s->find_exact("t"))) r.emplace(am::force_move(*l));
+    }
+    // the buffer keeps the mapping
+    BOOST_TEST_REQUIRE(r.has_value());
+    BOOST_TEST(payload_of(*r) == "payload");
+}
+
+BOOST_AUTO_TEST_CASE(properties) {
+    temp_file f;
+    am::retained_messages m;
+    m.insert_or_assign(
+        "t",
+        make_retain(
+            "t",
+            "p",
+            am::properties{
+                am::property::content_type{"text/plain"},
+                am::property::message_expiry_interval{100}
+            }
+        )
+    );
+    am::retained_snapshot_writer writer;
+    m.collect(writer);
+    // emulate expiry because the live message has no scheduled timer
+    writer.add(
+        "u",
+        am::qos::at_most_once,
+        am::retained_snapshot_detail::to_epoch_seconds(std::chrono::system_clock::now()) + 50,
+        std::string{},
+        std::vector<am::buffer>{am::buffer{std::string{"q"}}}
+    );
+    writer.add(
+        "expired",
+        am::qos::at_most_once,
+        am::retained_snapshot_detail::to_epoch_seconds(std::chrono::system_clock::now()) - 1,
+        std::string{},
+        std::vector<am::buffer>{am::buffer{std::string{"q"}}}
+    );
+    BOOST_TEST(writer.write(f.path));
+    auto s = am::retained_snapshot::open(f.path);
+    BOOST_TEST_REQUIRE(s);
+    // expired messages are not written
+    BOOST_TEST(s->size() == 2);
+
+    auto r = s->load(*s->find_exact("t"));
+    BOOST_TEST_REQUIRE(r.has_value());
+    BOOST_TEST(r->props.size() == 2);
+    BOOST_CHECK(r->props[0] == am::property::content_type{"text/plain"});
+
+    // expires after loaded
+    auto v = *s->find_exact("u");
+    BOOST_TEST(s->load(v).has_value());
+    BOOST_TEST(!s->load(v, std::chrono::system_clock::now() + std::chrono::seconds(60)).has_value());
+}
+
+BOOST_AUTO_TEST_CASE(live_over_snapshot) {
+    temp_file f1;
+    temp_file f2;
+    am::retained_messages base;
+    for (auto topic : {"a/1", "a/2", "a/3"}) {
+        base.insert_or_assign(topic, make_retain(topic, "old"));
+    }
+
+    am::retained_messages m;
+    m.set_snapshot(write_and_open(base, f1.path));
+    BOOST_TEST(m.size() == 3);
+    auto generation = m.generation();
+
+    // overwrite
+    BOOST_TEST(m.insert_or_assign("a/1", make_retain("a/1", "new")) == 0);
+    // erase
+    BOOST_TEST(m.erase("a/2") == 1);
+    BOOST_TEST(m.erase("a/2") == 0);
+    // add
+    BOOST_TEST(m.insert_or_assign("a/4", make_retain("a/4", "new")) == 1);
+    BOOST_TEST(m.size() == 3);
+    BOOST_TEST(m.generation() != generation);
+
+    std::map<std::string, std::string> found;
+    m.find("a/+", [&](am::retain_type const& r) { found.emplace(std::string{r.topic}, payload_of(r)); });
+    BOOST_TEST(found.size() == 3);
+    BOOST_TEST(found["a/1"] == "new");
+    BOOST_TEST(found["a/3"] == "old");
+    BOOST_TEST(found["a/4"] == "new");
+    BOOST_TEST(match(m, "#") == (std::set<std::string>{"a/1", "a/3", "a/4"}));
+
+    // the next snapshot merges both layers
+    auto s = write_and_open(m, f2.path);
+    BOOST_TEST_REQUIRE(s);
+    BOOST_TEST(match(*s, "#") == (std::set<std::string>{"a/1", "a/3", "a/4"}));
+    BOOST_TEST(payload_of(*s->load(*s->find_exact("a/1"))) == "new");
+    BOOST_TEST(payload_of(*s->load(*s->find_exact("a/3"))) == "old");
+}
+
+BOOST_AUTO_TEST_CASE(delta) {
+    temp_file f;
+    auto delta_path = am::retained_snapshot::delta_path(f.path);
+    // the same as broker::save_retained_snapshot()
+    auto save =
+        [&](am::retained_messages& m) {
+            am::retained_snapshot_writer writer;
+            auto generation = m.collect_changes(writer);
+            BOOST_TEST(writer.write(writer.is_delta() ? delta_path : f.path));
+            m.saved(writer, generation);
+            return writer.is_delta();
+        };
+
+    // a/1 ... a/16
+    std::set<std::string> topics;
+    am::retained_messages m{4};
+    for (int i = 1; i <= 16; ++i) {
+        auto topic = "a/" + std::to_string(i);
+        m.insert_or_assign(topic, make_retain(topic, "old"));
+        topics.insert(topic);
+    }
+    // no full snapshot yet
+    BOOST_TEST(!save(m));
+    m.insert_or_assign("a/1", make_retain("a/1", "new"));
+    m.erase("a/2");
+    BOOST_TEST(save(m));
+    {
+        auto d = am::retained_snapshot::open(delta_path);
+        BOOST_TEST_REQUIRE(d);
+        BOOST_TEST(d->is_delta());
+        BOOST_TEST(d->size() == 2);
+        BOOST_TEST(d->erased(*d->find_exact("a/2")));
+        BOOST_TEST(!d->load(*d->find_exact("a/2")));
+    }
+
+    am::retained_messages loaded{4};
+    loaded.set_snapshot(
+        am::retained_snapshot::open(f.path),
+        am::retained_snapshot::open(delta_path)
+    );
+    topics.erase("a/2");
+    BOOST_TEST(loaded.size() == 15);
+    BOOST_TEST(match(loaded, "#") == topics);
+    std::map<std::string, std::string> found;
+    loaded.find("#", [&](am::retain_type const& r) { found.emplace(std::string{r.topic}, payload_of(r)); });
+    BOOST_TEST(found["a/1"] == "new");
+    BOOST_TEST(found["a/3"] == "old");
+
+    // the changes in the loaded delta are written again
+    BOOST_TEST(loaded.insert_or_assign("a/2", make_retain("a/2", "again")) == 1);
+    BOOST_TEST(loaded.erase("a/1") == 1);
+    topics.insert("a/2");
+    topics.erase("a/1");
+    BOOST_TEST(loaded.size() == 15);
+    BOOST_TEST(save(loaded));
+    {
+        am::retained_messages m2;
+        m2.set_snapshot(
+            am::retained_snapshot::open(f.path),
+            am::retained_snapshot::open(delta_path)
+        );
+        BOOST_TEST(match(m2, "#") == topics);
+    }
+
+    // many changes are written as the full snapshot
+    for (auto topic : {"a/3", "a/4", "a/5", "a/6"}) {
+        BOOST_TEST(loaded.erase(topic) == 1);
+        topics.erase(topic);
+    }
+    BOOST_TEST(!save(loaded));
+    {
+        // the old delta is not based on the new snapshot
+        am::retained_messages m2;
+        m2.set_snapshot(
+            am::retained_snapshot::open(f.path),
+            am::retained_snapshot::open(delta_path)
+        );
+        BOOST_TEST(match(m2, "#") == topics);
+        BOOST_TEST(m2.size() == 11);
+    }
+    std::filesystem::remove(delta_path);
+}
+
+BOOST_AUTO_TEST_CASE(partitions) {
+    temp_file f;
+    am::retained_messages base;
+    base.insert_or_assign("s/1", make_retain("s/1", "old"));
+    base.insert_or_assign("s/2", make_retain("s/2", "old"));
+
+    am::retained_messages m{4};
+    m.set_snapshot(write_and_open(base, f.path));
+    std::vector<std::thread> ths;
+    for (int t = 0; t != 4; ++t) {
+        ths.emplace_back(
+            [&, t] {
+                for (int i = 0; i != 100; ++i) {
+                    auto topic = "t" + std::to_string(t) + "/" + std::to_string(i);
+                    m.insert_or_assign(topic, make_retain(topic, "p"));
+                    if (i % 2) m.erase(topic);
+                    match(m, "#");
+                }
+            }
+        );
+    }
+    for (auto& th : ths) th.join();
+    BOOST_TEST(m.size() == 4 * 50 + 2);
+    BOOST_TEST(match(m, "t1/1").empty());
+    BOOST_TEST(match(m, "t1/2").size() == 1);
+
+    // the snapshot message is hidden from any partition
+    BOOST_TEST(m.erase("s/1") == 1);
+    BOOST_TEST(match(m, "s/#") == (std::set<std::string>{"s/2"}));
+    BOOST_TEST(m.erase_if("t2/4", [](am::retain_type const&) { return false; }) == false);
+    BOOST_TEST(m.erase_if("t2/4", [](am::retain_type const&) { return true; }) == true);
+    BOOST_TEST(m.size() == 4 * 50);
+}
+
+BOOST_AUTO_TEST_CASE(invalid_file) {
+    temp_file f;
+    BOOST_TEST(!am::retained_snapshot::open(f.path));
+    {
+        std::ofstream ofs{f.path, std::ios::binary};
+        ofs << std::string(200, 'x');
+    }
+    BOOST_TEST(!am::retained_snapshot::open(f.path));
+
+    // truncated
+    am::retained_messages m;
+    m.insert_or_assign("t", make_retain("t", "payload"));
+    {
+        am::retained_snapshot_writer writer;
+        m.collect(writer);
+        BOOST_TEST(writer.write(f.path));
+    }
+    std::filesystem::resize_file(f.path, std::filesystem::file_size(f.path) - 1);
+    BOOST_TEST(!am::retained_snapshot::open(f.path));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,295 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <thread>
+
+#include <broker/wal_session_store.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_session_store)
+
+namespace am = async_mqtt;
+namespace rec = am::session_record;
+
+namespace {
+
+struct temp_dir {
+    temp_dir()
+        :path{
+            (
+                std::filesystem::temp_directory_path() /
+                ("ut_session_store_" + std::to_string(::getpid()) + "_" + std::to_string(counter()++))
+            ).string()
+        }
+    {
+        std::filesystem::remove_all(path);
+    }
+    ~temp_dir() {
+        std::filesystem::remove_all(path);
+    }
+    static int& counter() {
+        static int c = 0;
+        return c;
+    }
+    std::string path;
+};
+
+void append_session(am::session_store& store, std::string const& cid) {
+    std::string r;
+    rec::session(r, "user1", cid, am::protocol_version::v5, 3600, rec::now_seconds());
+    store.append(r);
+    r.clear();
+    rec::subscribe(r, "user1", cid, "", "a/+", am::qos::at_least_once, 7);
+    store.append(r);
+    r.clear();
+    rec::subscribe(r, "user1", cid, "g1", "b/#", am::qos::exactly_once, std::nullopt);
+    store.append(r);
+    r.clear();
+    rec::offline_push(r, "user1", cid, 1, 100, "packet1");
+    store.append(r);
+    r.clear();
+    rec::offline_push(r, "user1", cid, 2, 101, "packet2");
+    store.append(r);
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE(records) {
+    am::session_images images;
+    std::string r;
+    rec::session(r, "user1", "cid1", am::protocol_version::v3_1_1, std::nullopt, 0);
+    BOOST_TEST(rec::apply(images, r));
+    r.clear();
+    rec::subscribe(r, "user1", "cid1", "", "a/b", am::qos::at_least_once | am::sub::nl::yes, 1);
+    BOOST_TEST(rec::apply(images, r));
+    r.clear();
+    rec::subscribe(r, "user1", "cid1", "", "a/c", am::qos::at_most_once, std::nullopt);
+    BOOST_TEST(rec::apply(images, r));
+    r.clear();
+    rec::unsubscribe(r, "user1", "cid1", "", "a/c");
+    BOOST_TEST(rec::apply(images, r));
+    r.clear();
+    rec::offline_push(r, "user1", "cid1", 1, 10, "p1");
+    BOOST_TEST(rec::apply(images, r));
+    r.clear();
+    rec::offline_push(r, "user1", "cid1", 2, 11, "p2");
+    BOOST_TEST(rec::apply(images, r));
+    r.clear();
+    rec::offline_push(r, "user1", "cid1", 3, 12, "p3");
+    BOOST_TEST(rec::apply(images, r));
+    r.clear();
+    rec::offline_push(r, "user1", "cid1", 4, 13, "p4");
+    BOOST_TEST(rec::apply(images, r));
+    r.clear();
+    rec::offline_pop(r, "user1", "cid1", 1);
+    BOOST_TEST(rec::apply(images, r));
+    r.clear();
+    rec::offline_erase(r, "user1", "cid1", 3);
+    BOOST_TEST(rec::apply(images, r));
+    r.clear();
+    std::vector<std::pair<std::uint32_t, std::string>> inflight{{1, "i1"}, {2, "i2"}};
+    rec::inflight_set(r, "user1", "cid1", inflight);
+    BOOST_TEST(rec::apply(images, r));
+    r.clear();
+    rec::inflight_erase(r, "user1", "cid1", 1);
+    BOOST_TEST(rec::apply(images, r));
+
+    BOOST_TEST(images.size() == 1);
+    auto const& img = images.at(am::session_images_key("user1", "cid1"));
+    BOOST_TEST(img.username == "user1");
+    BOOST_TEST(img.client_id == "cid1");
+    BOOST_CHECK(img.version == am::protocol_version::v3_1_1);
+    BOOST_CHECK(!img.session_expiry_interval);
+    BOOST_TEST(img.subscriptions.size() == 1);
+    auto const& sub = img.subscriptions.at({"", "a/b"});
+    BOOST_CHECK(am::sub::opts{sub.subopts}.get_qos() == am::qos::at_least_once);
+    BOOST_CHECK(am::sub::opts{sub.subopts}.get_nl() == am::sub::nl::yes);
+    BOOST_CHECK(sub.sid == 1u);
+    BOOST_TEST(img.offline_messages.size() == 2);
+    BOOST_TEST(img.offline_messages.at(2).packet == "p2");
+    BOOST_TEST(img.offline_messages.at(4).packet == "p4");
+    BOOST_TEST(img.inflight_messages.size() == 1);
+    BOOST_TEST(img.inflight_messages.at(2) == "i2");
+
+    // malformed
+    BOOST_TEST(!rec::apply(images, std::string_view{r.data(), r.size() - 1}));
+
+    r.clear();
+    rec::erase(r, "user1", "cid1");
+    BOOST_TEST(rec::apply(images, r));
+    BOOST_TEST(images.empty());
+}
+
+BOOST_AUTO_TEST_CASE(wal_recover) {
+    temp_dir dir;
+    {
+        am::wal_session_store store{am::wal_session_store_config{dir.path}};
+        append_session(store, "cid1");
+        append_session(store, "cid2");
+        std::string r;
+        rec::erase(r, "user1", "cid2");
+        store.append(r);
+        r.clear();
+        rec::offline_pop(r, "user1", "cid1", 1);
+        store.append(r);
+        store.flush();
+        BOOST_TEST(store.num_of_commits() >= 1u);
+    }
+    am::wal_session_store store{am::wal_session_store_config{dir.path}};
+    am::session_images images;
+    store.load(images);
+    BOOST_TEST(images.size() == 1);
+    auto const& img = images.at(am::session_images_key("user1", "cid1"));
+    BOOST_CHECK(img.session_expiry_interval == 3600u);
+    BOOST_TEST(img.subscriptions.size() == 2);
+    BOOST_TEST(img.offline_messages.size() == 1);
+    BOOST_TEST(img.offline_messages.at(2).packet == "packet2");
+}
+
+BOOST_AUTO_TEST_CASE(wal_torn_tail) {
+    temp_dir dir;
+    {
+        am::wal_session_store store{am::wal_session_store_config{dir.path}};
+        append_session(store, "cid1");
+        store.flush();
+    }
+    // emulate a crash in the middle of a write
+    for (auto const& e : std::filesystem::directory_iterator(dir.path)) {
+        if (e.path().extension() != ".log" || std::filesystem::file_size(e.path()) == 0) continue;
+        std::ofstream ofs{e.path(), std::ios::binary | std::ios::app};
+        ofs.write("\x40\x00\x00\x00\x01\x02", 6);
+    }
+    am::wal_session_store store{am::wal_session_store_config{dir.path}};
+    am::session_images images;
+    store.load(images);
+    BOOST_TEST(images.size() == 1);
+    BOOST_TEST(images.at(am::session_images_key("user1", "cid1")).offline_messages.size() == 2);
+}
+
+BOOST_AUTO_TEST_CASE(wal_compaction) {
+    temp_dir dir;
+    am::wal_session_store_config config{dir.path};
+    config.segment_size = 256;
+    config.compaction_segments = 2;
+    {
+        am::wal_session_store store{config};
+        for (int i = 0; i != 20; ++i) {
+            append_session(store, "cid" + std::to_string(i));
+            store.flush();
+        }
+        for (int i = 0; i != 20; i += 2) {
+            std::string r;
+            rec::erase(r, "user1", "cid" + std::to_string(i));
+            store.append(r);
+        }
+        store.compact();
+    }
+    std::size_t snapshots = 0;
+    std::size_t segments = 0;
+    for (auto const& e : std::filesystem::directory_iterator(dir.path)) {
+        if (e.path().extension() == ".snap") ++snapshots;
+        if (e.path().extension() == ".log") ++segments;
+    }
+    BOOST_TEST(snapshots == 1);
+    // the current segment at the destruction
+    BOOST_TEST(segments == 1);
+
+    am::wal_session_store store{config};
+    am::session_images images;
+    store.load(images);
+    BOOST_TEST(images.size() == 10);
+    for (int i = 1; i < 20; i += 2) {
+        auto const& img = images.at(am::session_images_key("user1", "cid" + std::to_string(i)));
+        BOOST_TEST(img.subscriptions.size() == 2);
+        BOOST_TEST(img.offline_messages.size() == 2);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(wal_compaction_parts) {
+    temp_dir dir;
+    am::wal_session_store_config config{dir.path};
+    // the sessions are compacted in several parts
+    config.compaction_memory = 512;
+    {
+        am::wal_session_store store{config};
+        for (int i = 0; i != 20; ++i) {
+            append_session(store, "cid" + std::to_string(i));
+        }
+        store.compact();
+    }
+    am::wal_session_store store{config};
+    am::session_images images;
+    store.load(images);
+    BOOST_TEST(images.size() == 20);
+    for (int i = 0; i != 20; ++i) {
+        auto const& img = images.at(am::session_images_key("user1", "cid" + std::to_string(i)));
+        BOOST_TEST(img.subscriptions.size() == 2);
+        BOOST_TEST(img.offline_messages.size() == 2);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(wal_when_committed) {
+    temp_dir dir;
+    am::wal_session_store store{am::wal_session_store_config{dir.path}};
+    std::promise<std::uint64_t> p;
+    append_session(store, "cid1");
+    store.when_committed(
+        [&] {
+            p.set_value(store.num_of_commits());
+        }
+    );
+    // the handler is called after the records are committed
+    BOOST_TEST(p.get_future().get() >= 1u);
+}
+
+BOOST_AUTO_TEST_CASE(wal_write_failure) {
+    temp_dir dir;
+    am::wal_session_store_config config{dir.path};
+    // a new segment is opened after each commit
+    config.segment_size = 1;
+    config.compaction_segments = 1000;
+    config.retry_interval = std::chrono::milliseconds(10);
+    {
+        am::wal_session_store store{config};
+        append_session(store, "cid1");
+        store.flush();
+        // the next segment can't be opened
+        std::filesystem::remove_all(dir.path);
+        append_session(store, "cid2");
+        store.flush();
+
+        std::atomic<bool> committed{false};
+        append_session(store, "cid3");
+        store.when_committed(
+            [&] {
+                committed.store(true);
+            }
+        );
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        // the records are kept pending, and the handler is not called
+        BOOST_TEST(!committed.load());
+        BOOST_TEST(store.num_of_failures() >= 1u);
+
+        std::filesystem::create_directories(dir.path);
+        store.flush();
+        BOOST_TEST(committed.load());
+    }
+    am::wal_session_store store{config};
+    am::session_images images;
+    store.load(images);
+    BOOST_TEST(images.size() == 1);
+    auto const& img = images.at(am::session_images_key("user1", "cid3"));
+    BOOST_TEST(img.subscriptions.size() == 2);
+    BOOST_TEST(img.offline_messages.size() == 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
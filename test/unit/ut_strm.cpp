@@ -8,6 +8,8 @@
 #include "../common/global_fixture.hpp"
 
 #include <thread>
+#include <string>
+#include <vector>
 
 #include <boost/asio.hpp>
 
@@ -60,4 +62,152 @@ BOOST_AUTO_TEST_CASE(write_cont) {
     ioc.run();
 }
 
+BOOST_AUTO_TEST_CASE(read_slab_multi) {
+    auto version = am::protocol_version::v3_1_1;
+    as::io_context ioc;
+
+    using strm_t = am::stream<async_mqtt::stub_socket>;
+    auto s = strm_t::create(
+        // for stub_socket args
+        version,
+        ioc.get_executor()
+    );
+    auto p1 = am::v3_1_1::publish_packet{"topic1", am::allocate_buffer("payload1"), am::qos::at_most_once};
+    auto p2 = am::v3_1_1::publish_packet{"topic2", am::allocate_buffer("payload2"), am::qos::at_most_once};
+    auto bytes = am::to_string(p1.const_buffer_sequence()) + am::to_string(p2.const_buffer_sequence());
+    s->next_layer().set_recv_packets(
+        {
+            // two packets are received by one read
+            {std::string_view{bytes}}
+        }
+    );
+
+    std::vector<am::buffer> bufs;
+    s->async_read_packet(
+        [&](am::error_code const& ec, am::buffer buf) {
+            BOOST_TEST(!ec);
+            bufs.push_back(am::force_move(buf));
+            s->async_read_packet(
+                [&](am::error_code const& ec, am::buffer buf) {
+                    BOOST_TEST(!ec);
+                    bufs.push_back(am::force_move(buf));
+                }
+            );
+        }
+    );
+    ioc.run();
+    BOOST_TEST(bufs.size() == 2);
+    BOOST_TEST(std::string_view(bufs[0]) == am::to_string(p1.const_buffer_sequence()));
+    BOOST_TEST(std::string_view(bufs[1]) == am::to_string(p2.const_buffer_sequence()));
+    // both packets alias the same slab
+    BOOST_TEST(bufs[0].data() + bufs[0].size() == bufs[1].data());
+}
+
+BOOST_AUTO_TEST_CASE(read_slab_straddle) {
+    auto version = am::protocol_version::v3_1_1;
+    as::io_context ioc;
+
+    using strm_t = am::stream<async_mqtt::stub_socket>;
+    auto s = strm_t::create(
+        // for stub_socket args
+        version,
+        ioc.get_executor()
+    );
+    auto p1 = am::v3_1_1::publish_packet{"topic1", am::allocate_buffer("payload1"), am::qos::at_most_once};
+    auto p2 = am::v3_1_1::publish_packet{"topic2", am::allocate_buffer("payload2"), am::qos::at_most_once};
+    auto s1 = am::to_string(p1.const_buffer_sequence());
+    auto s2 = am::to_string(p2.const_buffer_sequence());
+    // the slab can contain p1 and the first 3 bytes of p2
+    s->set_bulk_read_buffer_size(s1.size() + 3);
+    auto bytes = s1 + s2;
+    s->next_layer().set_recv_packets(
+        {
+            {std::string_view{bytes}.substr(0, s1.size() + 3)},
+            {std::string_view{bytes}.substr(s1.size() + 3)}
+        }
+    );
+
+    std::vector<am::buffer> bufs;
+    s->async_read_packet(
+        [&](am::error_code const& ec, am::buffer buf) {
+            BOOST_TEST(!ec);
+            bufs.push_back(am::force_move(buf));
+            s->async_read_packet(
+                [&](am::error_code const& ec, am::buffer buf) {
+                    BOOST_TEST(!ec);
+                    bufs.push_back(am::force_move(buf));
+                }
+            );
+        }
+    );
+    ioc.run();
+    BOOST_TEST(bufs.size() == 2);
+    BOOST_TEST(std::string_view(bufs[0]) == s1);
+    BOOST_TEST(std::string_view(bufs[1]) == s2);
+}
+
+BOOST_AUTO_TEST_CASE(read_slab_large) {
+    auto version = am::protocol_version::v3_1_1;
+    as::io_context ioc;
+
+    using strm_t = am::stream<async_mqtt::stub_socket>;
+    auto s = strm_t::create(
+        // for stub_socket args
+        version,
+        ioc.get_executor()
+    );
+    s->set_bulk_read_buffer_size(16);
+    auto p1 = am::v3_1_1::publish_packet{
+        "topic1",
+        am::allocate_buffer(std::string(1000, 'x')),
+        am::qos::at_most_once
+    };
+    s->next_layer().set_recv_packets(
+        {
+            {p1}
+        }
+    );
+
+    std::vector<am::buffer> bufs;
+    s->async_read_packet(
+        [&](am::error_code const& ec, am::buffer buf) {
+            BOOST_TEST(!ec);
+            bufs.push_back(am::force_move(buf));
+        }
+    );
+    ioc.run();
+    BOOST_TEST(bufs.size() == 1);
+    BOOST_TEST(std::string_view(bufs[0]) == am::to_string(p1.const_buffer_sequence()));
+}
+
+BOOST_AUTO_TEST_CASE(read_no_bulk) {
+    auto version = am::protocol_version::v3_1_1;
+    as::io_context ioc;
+
+    using strm_t = am::stream<async_mqtt::stub_socket>;
+    auto s = strm_t::create(
+        // for stub_socket args
+        version,
+        ioc.get_executor()
+    );
+    s->set_bulk_read_buffer_size(0);
+    auto p1 = am::v3_1_1::publish_packet{"topic1", am::allocate_buffer("payload1"), am::qos::at_most_once};
+    s->next_layer().set_recv_packets(
+        {
+            {p1}
+        }
+    );
+
+    std::vector<am::buffer> bufs;
+    s->async_read_packet(
+        [&](am::error_code const& ec, am::buffer buf) {
+            BOOST_TEST(!ec);
+            bufs.push_back(am::force_move(buf));
+        }
+    );
+    ioc.run();
+    BOOST_TEST(bufs.size() == 1);
+    BOOST_TEST(std::string_view(bufs[0]) == am::to_string(p1.const_buffer_sequence()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -6,7 +6,12 @@
 #include "../common/test_main.hpp"
 #include "../common/global_fixture.hpp"
 
+#include <thread>
+#include <atomic>
+#include <shared_mutex>
+
 #include <broker/subscription_map.hpp>
+#include <broker/rcu_subscription_map.hpp>
 
 BOOST_AUTO_TEST_SUITE(ut_subscription_map)
 
@@ -305,4 +310,176 @@ BOOST_AUTO_TEST_CASE( test_move_only ) {
     map.insert_or_assign("a/b/c", "456", my(2));
 }
 
+BOOST_AUTO_TEST_CASE( test_rcu_snapshot ) {
+    using sm_t = am::rcu_subscription_map<am::multiple_subscription_map<std::string, int>>;
+    std::shared_timed_mutex mtx;
+    sm_t map;
+    map.insert_or_assign("a/b", "before", 0);
+    // copy the map as soon as published
+    map.enable_snapshot(mtx, std::chrono::seconds(0));
+    BOOST_TEST(map.snapshot_enabled());
+
+    auto count =
+        [&](std::string_view topic) {
+            std::size_t ret = 0;
+            map.find(topic, [&](std::string const&, int) { ++ret; });
+            return ret;
+        };
+    BOOST_TEST(count("a/b") == 1);
+
+    // updates are not visible until published
+    {
+        std::lock_guard<std::shared_timed_mutex> g{mtx};
+        map.insert_or_assign("a/+", "123", 1);
+        map.insert_or_assign("#", "456", 2);
+    }
+    BOOST_TEST(count("a/b") == 1);
+    map.publish(mtx);
+    map.sync();
+    BOOST_TEST(count("a/b") == 3);
+    BOOST_TEST(map.any_match("x/y"));
+
+    // nothing to publish
+    map.publish(mtx);
+    map.sync();
+
+    {
+        std::lock_guard<std::shared_timed_mutex> g{mtx};
+        BOOST_TEST(map.erase("a/+", "123") == 1);
+    }
+    map.publish(mtx);
+    map.sync();
+    BOOST_TEST(count("a/b") == 2);
+    BOOST_TEST(map.size() == 2);
+    BOOST_TEST(map.any_match("a/b"));
+
+    // no reader is in the critical section, so the old snapshots are reclaimed
+    auto& d = am::rcu_domain::instance();
+    d.barrier();
+    BOOST_TEST(d.pending() == 0);
+
+    {
+        // a reader keeps the replaced snapshot
+        am::rcu_read_guard rg;
+        {
+            std::lock_guard<std::shared_timed_mutex> g{mtx};
+            map.erase("#", "456");
+        }
+        map.publish(mtx);
+        map.sync();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        BOOST_TEST(d.pending() == 1);
+    }
+    // reclaimed without any more publish
+    d.barrier();
+    BOOST_TEST(d.pending() == 0);
+    BOOST_TEST(count("a/b") == 1);
+    BOOST_TEST(!map.any_match("x/y"));
+}
+
+BOOST_AUTO_TEST_CASE( test_rcu_batch ) {
+    using sm_t = am::rcu_subscription_map<am::multiple_subscription_map<std::string, int>>;
+    std::shared_timed_mutex mtx;
+    sm_t map;
+    map.enable_snapshot(mtx, std::chrono::milliseconds(200));
+
+    auto count =
+        [&](std::string_view topic) {
+            std::size_t ret = 0;
+            map.find(topic, [&](std::string const&, int) { ++ret; });
+            return ret;
+        };
+
+    // in the interval, the updates are not copied
+    auto& d = am::rcu_domain::instance();
+    d.barrier();
+    std::atomic<int> called{0};
+    for (int i = 0; i != 10; ++i) {
+        {
+            std::lock_guard<std::shared_timed_mutex> g{mtx};
+            map.insert_or_assign("a/+", std::to_string(i), i);
+        }
+        map.publish(mtx);
+        map.when_published([&] { ++called; });
+        BOOST_TEST(count("a/b") == 0);
+    }
+    BOOST_TEST(d.pending() == 0);
+    BOOST_TEST(called.load() == 0);
+
+    // after the interval, all the updates are published by one copy
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    BOOST_TEST(count("a/b") == 10);
+    BOOST_TEST(called.load() == 10);
+    BOOST_TEST(d.pending() <= 1);
+    d.barrier();
+    BOOST_TEST(d.pending() == 0);
+
+    // published ones are called immediately
+    bool immediate = false;
+    map.when_published([&] { immediate = true; });
+    BOOST_TEST(immediate);
+
+    // sync() doesn't wait for the interval
+    {
+        std::lock_guard<std::shared_timed_mutex> g{mtx};
+        map.erase("a/+", "0");
+    }
+    map.publish(mtx);
+    map.sync();
+    BOOST_TEST(count("a/b") == 9);
+}
+
+BOOST_AUTO_TEST_CASE( test_rcu_concurrent ) {
+    using sm_t = am::rcu_subscription_map<am::multiple_subscription_map<std::string, std::string>>;
+    std::shared_timed_mutex mtx;
+    sm_t map;
+    map.enable_snapshot(mtx);
+    {
+        std::lock_guard<std::shared_timed_mutex> g{mtx};
+        map.insert_or_assign("a/b", "fixed", "fixed");
+    }
+    map.publish(mtx);
+    map.sync();
+
+    std::atomic<bool> finish{false};
+    std::atomic<bool> error{false};
+    std::vector<std::thread> readers;
+    for (int i = 0; i != 4; ++i) {
+        readers.emplace_back(
+            [&] {
+                while (!finish.load()) {
+                    bool fixed = false;
+                    map.find(
+                        "a/b",
+                        [&](std::string const& k, std::string const& v) {
+                            if (k != v) error.store(true);
+                            if (k == "fixed") fixed = true;
+                        }
+                    );
+                    if (!fixed) error.store(true);
+                }
+            }
+        );
+    }
+
+    for (int i = 0; i != 1000; ++i) {
+        auto k = std::to_string(i % 10);
+        {
+            std::lock_guard<std::shared_timed_mutex> g{mtx};
+            if (i % 2 == 0) {
+                map.insert_or_assign("a/+", k, k);
+            }
+            else {
+                map.erase("a/+", std::to_string((i - 1) % 10));
+            }
+        }
+        map.publish(mtx);
+    }
+    map.sync();
+    finish.store(true);
+    for (auto& t : readers) t.join();
+    BOOST_TEST(!error.load());
+    BOOST_TEST(map.size() == 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,253 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <random>
+#include <set>
+#include <shared_mutex>
+
+#include <broker/subscription_map.hpp>
+#include <broker/subscription_trie.hpp>
+#include <broker/rcu_subscription_map.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_subscription_trie)
+
+namespace am = async_mqtt;
+
+BOOST_AUTO_TEST_CASE( test_single_subscription ) {
+    std::string text = "example/test/A";
+
+    am::single_subscription_trie< std::string > map;
+    auto handle = map.insert(text, text).first;
+    BOOST_TEST(map.handle_to_topic_filter(handle) == text);
+    BOOST_TEST(map.insert(text, text).second == false);
+    map.update(handle, "new_value");
+    BOOST_TEST(map.erase(handle) == 1);
+
+    BOOST_TEST(map.insert(text, text).second == true);
+    BOOST_TEST(map.erase(text) == 1);
+
+    BOOST_TEST(map.size() == 0);
+    BOOST_TEST(map.internal_size() == 1);
+
+    std::vector<std::string> values = {
+        "example/test/A", "example/+/A", "example/#", "#"
+    };
+
+    for (auto const& i : values) {
+        map.insert(i, i);
+    }
+
+    // Attempt to remove entry which has no value
+    BOOST_TEST(map.erase("example") == 0);
+    BOOST_TEST(map.erase(*map.lookup("example")) == 0);
+
+    std::vector<std::string> matches;
+    map.find("example/test/A", [&matches](std::string const &a) {
+        matches.push_back(a);
+    });
+    BOOST_TEST(matches.size() == 4);
+
+    matches = {};
+    map.find("example/plus/A", [&matches](std::string const &a) {
+        matches.push_back(a);
+    });
+    BOOST_TEST(matches.size() == 3);
+
+    std::vector< am::single_subscription_trie< std::string >::handle > handles;
+    for (auto const& i : values) {
+        BOOST_TEST(map.erase(i) == 1);
+        handles.push_back(map.insert(i, i).first);
+    }
+
+    for (auto const& i : handles) {
+        BOOST_TEST(map.size() != 0);
+        BOOST_TEST(map.erase(i) == 1);
+    }
+
+    BOOST_TEST(map.size() == 0);
+    BOOST_TEST(map.internal_size() == 1);
+    // Only '+' and '#' are kept interned
+    BOOST_TEST(map.level_size() == 2);
+}
+
+BOOST_AUTO_TEST_CASE( test_multiple_subscription ) {
+    am::multiple_subscription_trie<std::string, int> map;
+
+    BOOST_TEST(map.insert_or_assign("a/b/c", "123", 0).second == true);
+    BOOST_TEST(map.size() == 1);
+    BOOST_TEST(map.internal_size() == 4);
+
+    BOOST_TEST(map.insert_or_assign("a/b/c", "123", 1).second == false);
+    map.find("a/b/c", [](std::string const &key, int value) {
+        BOOST_TEST(key == "123");
+        BOOST_TEST(value == 1);
+    });
+
+    map.insert_or_assign("a/b", "123", 0);
+    BOOST_TEST(map.size() == 2);
+    BOOST_TEST(map.internal_size() == 4);
+
+    BOOST_TEST(map.erase("a/b", "123") == 1);
+    BOOST_TEST(map.erase("a/b", "123") == 0);
+    BOOST_TEST(map.size() == 1);
+    BOOST_TEST(map.internal_size() == 4);
+
+    BOOST_TEST(map.erase(*map.lookup("a/b/c"), "123") == 1);
+    BOOST_TEST(map.size() == 0);
+    BOOST_TEST(map.internal_size() == 1);
+    BOOST_TEST(!map.lookup("a/b/c"));
+
+    // Empty levels are valid levels
+    auto h = map.insert_or_assign("/a//", "123", 0).first;
+    BOOST_TEST(map.handle_to_topic_filter(h) == "/a//");
+    BOOST_TEST(map.insert_or_assign(h, "456", 0).second == true);
+    BOOST_TEST(map.size() == 2);
+
+    std::size_t matches = 0;
+    map.find("/a//", [&matches](std::string const&, int) { ++matches; });
+    BOOST_TEST(matches == 2);
+
+    // Check if $ does not match # and + at root
+    map.insert_or_assign("#", "123", 10);
+    map.insert_or_assign("+/plus/A", "123", 10);
+    map.insert_or_assign("$SYS/#", "123", 10);
+
+    matches = 0;
+    map.find("example/plus/A", [&matches](std::string const&, int) { ++matches; });
+    BOOST_TEST(matches == 2);
+
+    matches = 0;
+    map.find("$SYS/plus/A", [&matches](std::string const&, int) { ++matches; });
+    BOOST_TEST(matches == 1);
+}
+
+BOOST_AUTO_TEST_CASE( test_many_children ) {
+    // Children of a node switch from the sorted array to the hash table and back
+    am::multiple_subscription_trie<std::string, std::size_t> map;
+    std::size_t const num = 1000;
+    for (std::size_t i = 0; i != num; ++i) {
+        map.insert_or_assign("dev/" + std::to_string(i) + "/temp", "cid", i);
+    }
+    BOOST_TEST(map.size() == num);
+    for (std::size_t i = 0; i != num; ++i) {
+        std::size_t found = num;
+        map.find("dev/" + std::to_string(i) + "/temp", [&](std::string const&, std::size_t v) { found = v; });
+        BOOST_TEST(found == i);
+    }
+    for (std::size_t i = 0; i != num - 3; ++i) {
+        BOOST_TEST(map.erase("dev/" + std::to_string(i) + "/temp", "cid") == 1);
+    }
+    for (std::size_t i = num - 3; i != num; ++i) {
+        std::size_t found = num;
+        map.find("dev/" + std::to_string(i) + "/temp", [&](std::string const&, std::size_t v) { found = v; });
+        BOOST_TEST(found == i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_move_only ) {
+
+    struct my {
+        my() = delete;
+        my(int) {}
+        my(my const&) = delete;
+        my(my&&) = default;
+        my& operator=(my const&) = delete;
+        my& operator=(my&&) = default;
+        ~my() = default;
+    };
+
+    using mi_t = am::multiple_subscription_trie<std::string, my>;
+    mi_t map;
+    map.insert_or_assign("a/b/c", "123", my(1));
+    map.insert_or_assign("a/b/c", "456", my(2));
+    map.modify("a/b/c", [](std::string const& /*key*/, my& /*value*/) {});
+}
+
+BOOST_AUTO_TEST_CASE( test_same_as_subscription_map ) {
+    // Random operations give the same results as multiple_subscription_map
+    am::multiple_subscription_map<std::string, int> m;
+    am::multiple_subscription_trie<std::string, int> t;
+
+    std::mt19937 rng(1);
+    std::vector<std::string> levels{"a", "b", "+", "#", "$SYS", ""};
+    for (int i = 0; i != 20; ++i) levels.push_back("l" + std::to_string(i));
+    auto generate = [&](bool filter) {
+        std::string s;
+        auto n = rng() % 4 + 1;
+        for (std::size_t i = 0; i != n; ++i) {
+            if (i != 0) s += '/';
+            auto l = levels[rng() % levels.size()];
+            if (!filter && (l == "+" || l == "#")) l = "a";
+            if (i != 0 && l == "$SYS") l = "b";
+            s += l;
+            if (l == "#") break;
+        }
+        return s;
+    };
+
+    std::vector<std::pair<std::string, std::string>> subscribed;
+    for (int i = 0; i != 20000; ++i) {
+        if (subscribed.empty() || rng() % 3 != 0) {
+            auto tf = generate(true);
+            auto key = std::to_string(rng() % 4);
+            auto r = t.insert_or_assign(tf, key, i);
+            BOOST_TEST(m.insert_or_assign(tf, key, i).second == r.second);
+            BOOST_TEST(t.handle_to_topic_filter(r.first) == tf);
+            if (r.second) subscribed.emplace_back(tf, key);
+        }
+        else {
+            auto n = rng() % subscribed.size();
+            auto const& [tf, key] = subscribed[n];
+            BOOST_TEST(m.erase(tf, key) == 1);
+            BOOST_TEST(t.erase(*t.lookup(tf), key) == 1);
+            subscribed[n] = subscribed.back();
+            subscribed.pop_back();
+        }
+        BOOST_TEST(m.size() == t.size());
+
+        auto topic = generate(false);
+        std::multiset<std::pair<std::string, int>> expected;
+        std::multiset<std::pair<std::string, int>> actual;
+        m.find(topic, [&](std::string const& k, int v) { expected.emplace(k, v); });
+        t.find(topic, [&](std::string const& k, int v) { actual.emplace(k, v); });
+        BOOST_TEST(expected == actual);
+    }
+
+    for (auto const& [tf, key] : subscribed) {
+        BOOST_TEST(t.erase(tf, key) == 1);
+    }
+    BOOST_TEST(t.size() == 0);
+    BOOST_TEST(t.internal_size() == 1);
+    BOOST_TEST(t.level_size() == 2);
+}
+
+BOOST_AUTO_TEST_CASE( test_rcu_snapshot ) {
+    using sm_t = am::rcu_subscription_map<am::multiple_subscription_trie<std::string, int>>;
+    std::shared_timed_mutex mtx;
+    sm_t map;
+    map.insert_or_assign("a/b", "before", 0);
+    map.enable_snapshot(mtx, std::chrono::seconds(0));
+
+    {
+        std::lock_guard<std::shared_timed_mutex> g{mtx};
+        map.insert_or_assign("a/+", "after", 1);
+    }
+    std::size_t matches = 0;
+    map.find("a/b", [&](std::string const&, int) { ++matches; });
+    BOOST_TEST(matches == 1);
+
+    map.publish(mtx);
+    map.sync();
+    matches = 0;
+    map.find("a/b", [&](std::string const&, int) { ++matches; });
+    BOOST_TEST(matches == 2);
+    BOOST_TEST(map.any_match("a/c"));
+    BOOST_TEST(!map.any_match("b/c"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,163 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <boost/asio/strand.hpp>
+
+#include <async_mqtt/util/timer_wheel.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_timer_wheel)
+
+namespace am = async_mqtt;
+namespace as = boost::asio;
+using namespace std::chrono_literals;
+
+namespace {
+
+struct owner {
+    void expired(am::timer_wheel::handle const* key, int id) {
+        BOOST_TEST(key->expired());
+        ids.push_back(id);
+    }
+
+    static void on_expire(void* o, void* context, am::timer_wheel::handle const* key) {
+        static_cast<owner*>(o)->expired(key, int(reinterpret_cast<std::intptr_t>(context)));
+    }
+
+    static void* context(int id) {
+        return reinterpret_cast<void*>(std::intptr_t(id));
+    }
+
+    std::vector<int> ids;
+};
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( expire ) {
+    as::io_context ioc;
+    auto wheel = am::timer_wheel::create(ioc.get_executor(), 10ms, std::size_t(4));
+    auto o = std::make_shared<owner>();
+    am::timer_wheel::handle h1;
+    am::timer_wheel::handle h2;
+    am::timer_wheel::handle h3;
+
+    // h3 expires after some rounds of the wheel
+    wheel->schedule(h3, 100ms, o, &owner::on_expire, owner::context(3));
+    wheel->schedule(h2, 50ms, o, &owner::on_expire, owner::context(2));
+    wheel->schedule(h1, 0ms, o, &owner::on_expire, owner::context(1));
+    BOOST_TEST(wheel->size() == 3);
+    BOOST_TEST(!h1.expired());
+    BOOST_TEST(h1.expiry().has_value());
+
+    auto start = std::chrono::steady_clock::now();
+    ioc.run();
+    BOOST_TEST((std::chrono::steady_clock::now() - start >= 100ms));
+    BOOST_TEST(o->ids == (std::vector<int>{1, 2, 3}));
+    BOOST_TEST(wheel->size() == 0);
+    BOOST_TEST(h3.expired());
+}
+
+BOOST_AUTO_TEST_CASE( cancel ) {
+    as::io_context ioc;
+    auto wheel = am::timer_wheel::create(ioc.get_executor(), 10ms);
+    auto o = std::make_shared<owner>();
+    am::timer_wheel::handle h1;
+    std::optional<am::timer_wheel::handle> h2{std::in_place};
+    am::timer_wheel::handle h3;
+
+    wheel->schedule(h1, 20ms, o, &owner::on_expire, owner::context(1));
+    wheel->schedule(*h2, 20ms, o, &owner::on_expire, owner::context(2));
+    wheel->schedule(h3, 20ms, o, &owner::on_expire, owner::context(3));
+    h1.cancel();
+    h2.reset();
+    BOOST_TEST(wheel->size() == 1);
+
+    // reschedule
+    wheel->schedule(h3, 30ms, o, &owner::on_expire, owner::context(4));
+    BOOST_TEST(wheel->size() == 1);
+
+    ioc.run();
+    BOOST_TEST(o->ids == (std::vector<int>{4}));
+    BOOST_TEST(!h1.expired());
+}
+
+BOOST_AUTO_TEST_CASE( owner_destroyed ) {
+    as::io_context ioc;
+    auto wheel = am::timer_wheel::create(ioc.get_executor(), 10ms);
+    auto o = std::make_shared<owner>();
+    std::weak_ptr<owner> wp = o;
+    am::timer_wheel::handle h;
+    int called = 0;
+    wheel->schedule(
+        h,
+        10ms,
+        o,
+        [](void*, void* context, am::timer_wheel::handle const*) {
+            ++*static_cast<int*>(context);
+        },
+        &called
+    );
+    o.reset();
+    ioc.run();
+    BOOST_TEST(called == 0);
+    BOOST_TEST(wp.expired());
+}
+
+BOOST_AUTO_TEST_CASE( move_and_copy ) {
+    as::io_context ioc;
+    auto wheel = am::timer_wheel::create(ioc.get_executor(), 10ms);
+    auto o = std::make_shared<owner>();
+    std::optional<am::timer_wheel::handle> from{std::in_place};
+    wheel->schedule(*from, 20ms, o, &owner::on_expire, owner::context(1));
+
+    // The copy is not scheduled
+    am::timer_wheel::handle copied{*from};
+    BOOST_TEST((copied.expiry() == from->expiry()));
+    BOOST_TEST(wheel->size() == 1);
+
+    // The move takes over the schedule
+    am::timer_wheel::handle moved{std::move(*from)};
+    from.reset();
+    BOOST_TEST(wheel->size() == 1);
+
+    ioc.run();
+    BOOST_TEST(o->ids == (std::vector<int>{1}));
+    BOOST_TEST(moved.expired());
+    BOOST_TEST(!copied.expired());
+}
+
+BOOST_AUTO_TEST_CASE( shared_in_io_context ) {
+    as::io_context ioc;
+    auto& w1 = am::use_timer_wheel(ioc);
+    auto& w2 = am::use_timer_wheel(ioc);
+    BOOST_TEST(&w1 == &w2);
+    BOOST_TEST((w1.resolution() == std::chrono::seconds(1)));
+    // The executor of the endpoint is usually a strand of the io_context.
+    auto& w3 = am::use_timer_wheel(as::any_io_executor{as::make_strand(ioc)});
+    BOOST_TEST(&w1 == &w3);
+}
+
+BOOST_AUTO_TEST_CASE( wheel_destroyed ) {
+    as::io_context ioc;
+    auto o = std::make_shared<owner>();
+    am::timer_wheel::handle h;
+    {
+        auto wheel = am::timer_wheel::create(ioc.get_executor(), 10ms);
+        wheel->schedule(h, 10ms, o, &owner::on_expire, owner::context(1));
+    }
+    ioc.run();
+    BOOST_TEST(o->ids.empty());
+    // h is not scheduled anymore, so it can be destroyed safely
+}
+
+BOOST_AUTO_TEST_SUITE_END()
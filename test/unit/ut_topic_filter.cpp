@@ -0,0 +1,121 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <set>
+
+#include <broker/topic_filter.hpp>
+#include <broker/subscription_map.hpp>
+#include <broker/subscription_trie.hpp>
+#include <broker/retained_topic_map.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_topic_filter)
+
+namespace am = async_mqtt;
+
+BOOST_AUTO_TEST_CASE( find_separator ) {
+    // Cover the vectorized blocks and the scalar tail
+    for (std::size_t size = 0; size != 100; ++size) {
+        for (std::size_t pos = 0; pos <= size; ++pos) {
+            std::string s(size, 'a');
+            if (pos != size) s[pos] = '/';
+            auto p = am::topic_filter_find_separator(s.data(), s.data() + s.size());
+            BOOST_TEST(std::size_t(p - s.data()) == pos);
+        }
+    }
+
+    // The separator after the end is not found
+    std::string s(64, '/');
+    auto p = am::topic_filter_find_separator(s.data() + 1, s.data() + 1);
+    BOOST_TEST(p == s.data() + 1);
+}
+
+BOOST_AUTO_TEST_CASE( tokenizer ) {
+    std::vector<std::string_view> topics {
+        "a",
+        "/",
+        "a/b/c",
+        "//a//",
+        "a_very_long_level_that_is_longer_than_32_bytes/b/another_very_long_level_that_is_longer_than_32_bytes",
+    };
+    for (auto topic : topics) {
+        std::vector<std::string_view> expected;
+        std::size_t first = 0;
+        while (true) {
+            auto pos = topic.find('/', first);
+            expected.push_back(topic.substr(first, pos - first));
+            if (pos == std::string_view::npos) break;
+            first = pos + 1;
+        }
+
+        std::vector<std::string_view> actual;
+        auto count = am::topic_filter_tokenizer(topic, [&](std::string_view t) { actual.push_back(t); return true; });
+        BOOST_TEST(count == expected.size());
+        BOOST_TEST(actual == expected);
+
+        am::topic_levels levels{topic};
+        BOOST_TEST(levels.topic() == topic);
+        BOOST_TEST(levels.size() == expected.size());
+        for (std::size_t i = 0; i != levels.size(); ++i) {
+            BOOST_TEST(levels[i] == expected[i]);
+            BOOST_TEST(levels.hash(i) == std::hash<std::string_view>{}(expected[i]));
+        }
+
+        actual.clear();
+        count = am::topic_filter_tokenizer(levels, [&](std::string_view t) { actual.push_back(t); return true; });
+        BOOST_TEST(count == expected.size());
+        BOOST_TEST(actual == expected);
+    }
+
+    // Stop at the first level
+    am::topic_levels levels{"a/b/c"};
+    BOOST_TEST(am::topic_filter_tokenizer(levels, [](std::string_view) { return false; }) == 1);
+}
+
+BOOST_AUTO_TEST_CASE( find_by_levels ) {
+    std::vector<std::string_view> filters {
+        "a/b/c", "a/+/c", "a/#", "#", "+/+/+", "$SYS/#", "/a//", "+/a/+/",
+    };
+    std::vector<std::string_view> topics {
+        "a/b/c", "a/x/c", "a", "$SYS/a/b", "/a//", "b/a/c/", "x/y/z",
+    };
+
+    am::multiple_subscription_map<std::string, std::string> m;
+    am::multiple_subscription_trie<std::string, std::string> t;
+    for (auto f : filters) {
+        m.insert_or_assign(f, "cid", std::string(f));
+        t.insert_or_assign(f, "cid", std::string(f));
+    }
+
+    am::retained_topic_map<std::string> r;
+    for (auto topic : topics) {
+        am::topic_levels levels{topic};
+        auto collect =
+            [&](auto const& map, auto const& topic) {
+                std::multiset<std::string> ret;
+                map.find(topic, [&](std::string const&, std::string const& f) { ret.insert(f); });
+                return ret;
+            };
+        auto expected = collect(m, topic);
+        BOOST_TEST(collect(m, levels) == expected);
+        BOOST_TEST(collect(t, topic) == expected);
+        BOOST_TEST(collect(t, levels) == expected);
+
+        BOOST_TEST(r.insert_or_assign(levels, std::string(topic)) == 1);
+    }
+
+    BOOST_TEST(r.size() == topics.size());
+    std::size_t matches = 0;
+    r.find("a/+/c", [&](std::string const&) { ++matches; });
+    BOOST_TEST(matches == 2);
+    for (auto topic : topics) {
+        BOOST_TEST(r.erase(am::topic_levels{topic}) == 1);
+    }
+    BOOST_TEST(r.size() == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
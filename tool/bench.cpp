@@ -7,6 +7,9 @@
 #include <thread>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
 
 #include <boost/asio.hpp>
 #include <boost/program_options.hpp>
@@ -26,6 +29,8 @@
 #include <async_mqtt/predefined_layer/wss.hpp>
 #endif // defined(ASYNC_MQTT_USE_TLS) && defined(ASYNC_MQTT_USE_WS)
 
+#include <bench/latency_report.hpp>
+
 #include "locked_cout.hpp"
 
 namespace as = boost::asio;
@@ -44,10 +49,26 @@ enum class phase {
     publish
 };
 
+static constexpr std::size_t phase_num = static_cast<std::size_t>(phase::publish) + 1;
+
+inline char const* phase_str(phase ph) {
+    switch (ph) {
+    case phase::connect:              return "connect";
+    case phase::sub_delay:            return "sub_delay";
+    case phase::subscribe:            return "subscribe";
+    case phase::pub_delay:            return "pub_delay";
+    case phase::idle:                 return "idle";
+    case phase::pub_after_idle_delay: return "pub_after_idle_delay";
+    case phase::publish:              return "publish";
+    default:                          return "unknown";
+    }
+}
+
 enum class mode {
     single,
     send,
-    recv
+    recv,
+    connect
 };
 
 enum class ev_type {
@@ -56,6 +77,49 @@ enum class ev_type {
     other
 };
 
+enum class arrival {
+    interval, // closed-loop. each client publishes on its timer, latency is measured from the actual send.
+    constant, // open-loop. the sends are scheduled on the intended timeline at the fixed rate.
+    poisson,  // open-loop. exponentially distributed gaps.
+    burst     // open-loop. all clients send burst_size publishes at the same time.
+};
+
+// open-loop load and the rate sweep
+struct load_context {
+    struct step {
+        double rate;
+        double achieved;
+        am::hdr_histogram hist;
+        std::int64_t max_lag_us;
+        bool saturated;
+    };
+
+    bool open_loop() const {
+        return arr != arrival::interval;
+    }
+
+    void update_lag(std::int64_t lag_us) {
+        auto cur = max_lag_us.load();
+        while (cur < lag_us && !max_lag_us.compare_exchange_weak(cur, lag_us)) {
+        }
+    }
+
+    arrival arr = arrival::interval;
+    double rate = 0;                   ///< publishes/sec of all clients
+    std::size_t burst_size = 1;
+    std::size_t measure_times = 0;     ///< publishes for each client excluding idle ones
+    double sweep_factor = 0;           ///< 0 means no sweep
+    double sweep_max_rate = 0;         ///< 0 means no limit
+    std::size_t sweep_p99_limit_ms = 0; ///< 0 means no limit
+    bool sweep_restart = false;
+    double knee_rate = 0;
+    std::atomic<std::int64_t> max_lag_us{0}; ///< how late the sends are than the intended time
+    std::vector<step> steps;
+};
+
+// a step is saturated if the received rate is lower than the ratio of the target rate
+static constexpr double saturation_ratio = 0.95;
+
 #include <boost/asio/yield.hpp>
 struct bench_context {
     bench_context(
@@ -109,7 +173,14 @@ struct bench_context {
         bool close_after_report,
         std::optional<bool> tcp_no_delay_opt,
         std::optional<std::size_t> send_buf_size_opt,
-        std::optional<std::size_t> recv_buf_size_opt
+        std::optional<std::size_t> recv_buf_size_opt,
+        am::latency_recorder& lat,
+        am::throughput_series& series,
+        as::system_timer& tim_series,
+        std::size_t group_clients,
+        std::map<std::string, std::string> const& report_info,
+        std::string const& report_prefix,
+        load_context& load
     )
     :ws_path{ws_path},
      version{version},
@@ -157,7 +228,14 @@ struct bench_context {
      close_after_report{close_after_report},
      tcp_no_delay_opt{tcp_no_delay_opt},
      send_buf_size_opt{send_buf_size_opt},
-     recv_buf_size_opt{recv_buf_size_opt}
+     recv_buf_size_opt{recv_buf_size_opt},
+     lat{lat},
+     series{series},
+     tim_series{tim_series},
+     group_clients{group_clients},
+     report_info{report_info},
+     report_prefix{report_prefix},
+     load{load}
     {
     }
 
@@ -212,8 +290,41 @@ struct bench_context {
     std::optional<bool> tcp_no_delay_opt;
     std::optional<std::size_t> send_buf_size_opt;
     std::optional<std::size_t> recv_buf_size_opt;
+    am::latency_recorder& lat;
+    am::throughput_series& series;
+    as::system_timer& tim_series;
+    std::size_t group_clients;
+    std::map<std::string, std::string> const& report_info;
+    std::string const& report_prefix;
+    load_context& load;
 };
 
+static void write_report_files(std::string const& prefix, am::latency_report const& r) {
+    {
+        std::ofstream o{prefix + ".json"};
+        r.write_json(o);
+    }
+    {
+        std::ofstream o{prefix + "_latency.csv"};
+        r.write_latency_csv(o);
+    }
+    {
+        std::ofstream o{prefix + "_throughput.csv"};
+        r.write_throughput_csv(o);
+    }
+    {
+        // for --merge_reports
+        std::ofstream o{prefix + ".hdr"};
+        r.write(o);
+    }
+    locked_cout()
+        << "report written to "
+        << prefix << ".json "
+        << prefix << "_latency.csv "
+        << prefix << "_throughput.csv "
+        << prefix << ".hdr" << std::endl;
+}
+
 template <typename ClientInfo>
 struct bench {
     using ep_type = typename ClientInfo::client_type;
@@ -253,9 +364,13 @@ private:
         reenter (coro_) {
             tp_con_ = std::chrono::steady_clock::now();
             // Setup
-            for (auto& ci : cis_) {
-                ci.init_timer(ci.c->get_executor());
-                ci.c->set_auto_pub_response(true);
+            {
+                std::size_t index = 0;
+                for (auto& ci : cis_) {
+                    ci.init_timer(ci.c->get_executor());
+                    ci.c->set_auto_pub_response(true);
+                    if (bc_.group_clients != 0) ci.group = index++ / bc_.group_clients;
+                }
             }
 
             yield {
@@ -315,6 +430,7 @@ private:
                 std::optional<std::string> pw;
                 if (bc_.username) un.emplace(*bc_.username);
                 if (bc_.password) pw.emplace(*bc_.password);
+                pci->req_sent = std::chrono::steady_clock::now();
                 switch (bc_.version) {
                 case am::protocol_version::v5: {
                     am::properties props;
@@ -379,6 +495,7 @@ private:
                 am::overload {
                     [&](am::v5::connack_packet const& p) {
                         if (p.code() == am::connect_reason_code::success) {
+                            record_response(phase::connect, *pci);
                             --bc_.rest_connect;
                         }
                         else {
@@ -387,6 +504,7 @@ private:
                     },
                     [&](am::v3_1_1::connack_packet const& p) {
                         if (p.code() == am::connect_return_code::accepted) {
+                            record_response(phase::connect, *pci);
                             --bc_.rest_connect;
                         }
                         else {
@@ -405,6 +523,31 @@ private:
                 ).count()
                 << "s" << std::endl;
 
+            if (bc_.md == mode::connect) {
+                // connection storm. all clients have been connected.
+                auto elapsed_us = std::max(
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - tp_con_
+                    ).count(),
+                    std::chrono::microseconds::rep(1)
+                );
+                locked_cout()
+                    << "connects:" << cis_.size()
+                    << " elapsed:" << boost::format("%+12d") % elapsed_us << " us "
+                    << "connects/sec:"
+                    << boost::format("%.1f") % (double(cis_.size()) * 1000000 / double(elapsed_us))
+                    << std::endl;
+                report();
+                locked_cout() << "Finish" << std::endl;
+                bc_.tim_progress->cancel();
+                for (auto& ci : cis_) {
+                    ci.c->async_close([]{});
+                }
+                for (auto& guard_ioc : bc_.guard_iocs) guard_ioc.reset();
+                bc_.guard_ioc_timer.reset();
+                return;
+            }
+
             if (bc_.md == mode::single || bc_.md == mode::recv) {
                 // subscribe delay
                 bc_.ph.store(phase::sub_delay);
@@ -450,6 +593,7 @@ private:
                 );
                 BOOST_ASSERT(!ec);
                 yield {
+                    pci->req_sent = std::chrono::steady_clock::now();
                     switch (bc_.version) {
                     case am::protocol_version::v5: {
                         pci->c->async_send(
@@ -518,6 +662,7 @@ private:
                             if (p.entries().front() == am::suback_reason_code::granted_qos_0 ||
                                 p.entries().front() == am::suback_reason_code::granted_qos_1 ||
                                 p.entries().front() == am::suback_reason_code::granted_qos_2) {
+                                record_response(phase::subscribe, *pci);
                                 --bc_.rest_sub;
                             }
                             else {
@@ -529,6 +674,7 @@ private:
                             if (p.entries().front() == am::suback_return_code::success_maximum_qos_0 ||
                                 p.entries().front() == am::suback_return_code::success_maximum_qos_1 ||
                                 p.entries().front() == am::suback_return_code::success_maximum_qos_2) {
+                                record_response(phase::subscribe, *pci);
                                 --bc_.rest_sub;
                             }
                             else {
@@ -666,9 +812,7 @@ private:
                 for (auto& ci : cis_) {
                     if (bc_.md == mode::single || bc_.md == mode::send) {
                         // pub interval
-                        auto tp =
-                            std::chrono::nanoseconds(bc_.all_interval_ns) * index++;
-                        ci.tim->expires_after(tp);
+                        ci.tim->expires_after(first_pub_delay(ci, index++));
                         ci.tim->async_wait(
                             as::append(
                                 *this,
@@ -690,7 +834,7 @@ private:
 
             for (;;) yield {
                 auto send_publish =
-                    [this, &pci] (am::pub::opts opts) {
+                    [this, &pci] (am::pub::opts opts, std::chrono::steady_clock::time_point intended) {
                         switch (bc_.version) {
                         case am::protocol_version::v5: {
                             pci->c->async_send(
@@ -700,7 +844,7 @@ private:
                                         if (!bc_.fixed_topic.empty()) return bc_.fixed_topic;
                                         return bc_.topic_prefix + pci->index_str;
                                     }(),
-                                    pci->send_payload(bc_.md),
+                                    pci->send_payload(bc_.md, intended),
                                     opts,
                                     am::properties{}
                                 },
@@ -720,7 +864,7 @@ private:
                                         if (!bc_.fixed_topic.empty()) return bc_.fixed_topic;
                                         return bc_.topic_prefix + pci->index_str;
                                     }(),
-                                    pci->send_payload(bc_.md),
+                                    pci->send_payload(bc_.md, intended),
                                     opts
                                 },
                                 as::append(
@@ -791,6 +935,7 @@ private:
                         }
                         break;
                     case pub_recv::pub_finish: {
+                        if (bc_.load.sweep_factor != 0 && next_sweep_step(pci)) return;
                         locked_cout() << "Report" << std::endl;
                         std::size_t maxmax = 0;
                         std::string maxmax_cid;
@@ -853,6 +998,7 @@ private:
                             << "maxmin:" << boost::format("%+12d") % maxmin << " us "
                             << "(" << boost::format("%+8d") % (maxmin / 1000) << " ms ) "
                             << "client_id:" << maxmin_cid << std::endl;
+                        report();
                         locked_cout() << "Finish" << std::endl;
                         bc_.tim_progress->cancel();
                         if (bc_.close_after_report) {
@@ -876,28 +1022,43 @@ private:
                 }
                 else if (evt == ev_type::other) {
                     if (bc_.md == mode::single || bc_.md == mode::send) {
+                        // intended is the time the publish should be sent.
+                        // The latency is measured from it.
                         auto trigger_pub =
-                            [&] {
+                            [&] (std::chrono::steady_clock::time_point intended) {
                                 if (bc_.qos == am::qos::at_least_once ||
                                     bc_.qos == am::qos::exactly_once) {
-                                    pci->c->async_acquire_unique_packet_id(
-                                        as::append(
-                                            *this,
-                                            pci
-                                        )
-                                    );
-                                    BOOST_ASSERT(!ec);
+                                    if (bc_.load.open_loop() && bc_.ph.load() == phase::publish) {
+                                        // don't wait for the packet id. the send must not be delayed.
+                                        auto pid_opt = pci->c->acquire_unique_packet_id();
+                                        if (!pid_opt) {
+                                            locked_cout() << "packet_id exhausted. the broker doesn't respond to the rate" << std::endl;
+                                            exit(-1);
+                                        }
+                                        pci->pid = *pid_opt;
+                                    }
+                                    else {
+                                        pci->c->async_acquire_unique_packet_id(
+                                            as::append(
+                                                *this,
+                                                pci
+                                            )
+                                        );
+                                        BOOST_ASSERT(!ec);
+                                    }
                                     am::pub::opts opts = bc_.qos | bc_.retain;
-                                    pci->sent.at(pci->send_times - 1) = std::chrono::steady_clock::now();
-                                    send_publish(opts);
+                                    pci->sent.at(pci->send_times - 1) = intended;
+                                    bc_.series.add_sent();
+                                    send_publish(opts, intended);
                                     BOOST_ASSERT(pci->send_times != 0);
                                     --pci->send_times;
                                 }
                                 else {
                                     pci->pid = 0;
                                     am::pub::opts opts = bc_.qos | bc_.retain;
-                                    pci->sent.at(pci->send_times - 1) = std::chrono::steady_clock::now();
-                                    send_publish(opts);
+                                    pci->sent.at(pci->send_times - 1) = intended;
+                                    bc_.series.add_sent();
+                                    send_publish(opts, intended);
                                     BOOST_ASSERT(pci->send_times != 0);
                                     --pci->send_times;
                                 }
@@ -911,7 +1072,7 @@ private:
                                 locked_cout() << "pub interval (idle) timer error:" << ec.message() << std::endl;
                                 exit(-1);
                             }
-                            trigger_pub();
+                            trigger_pub(std::chrono::steady_clock::now());
                             BOOST_ASSERT(pci->send_idle_count != 0);
 
                             if (bc_.md == mode::send) {
@@ -946,46 +1107,99 @@ private:
                                 );
                             }
                             break;
-                        case phase::publish:
+                        case phase::publish: {
                             // pub interval timer fired
                             if (ec) {
                                 locked_cout() << "pub interval timer error:" << ec.message() << std::endl;
                                 exit(-1);
                             }
-                            trigger_pub();
-                            if (pci->send_times != 0) {
-                                pci->tim->expires_at(
-                                    pci->tim->expiry() +
-                                    std::chrono::milliseconds(bc_.pub_interval_ms)
-                                );
-                                pci->tim->async_wait(
-                                    as::append(
-                                        *this,
-                                        pci
-                                    )
+                            std::size_t sent = 0;
+                            if (bc_.load.open_loop()) {
+                                // Open-loop. The timer expiry is the intended time. If the
+                                // client is behind the timeline e.g. the broker or the strand
+                                // stalled, all overdue publishes are sent now with their
+                                // intended times, so the stall is included in the latency.
+                                auto intended = pci->tim->expiry();
+                                auto now = std::chrono::steady_clock::now();
+                                bc_.load.update_lag(
+                                    std::chrono::duration_cast<std::chrono::microseconds>(
+                                        now - intended
+                                    ).count()
                                 );
+                                for (;;) {
+                                    trigger_pub(intended);
+                                    ++sent;
+                                    if (pci->send_times == 0) break;
+                                    intended += next_pub_gap(*pci);
+                                    if (intended > now) break;
+                                }
+                                if (pci->send_times != 0) {
+                                    pci->tim->expires_at(intended);
+                                    pci->tim->async_wait(
+                                        as::append(
+                                            *this,
+                                            pci
+                                        )
+                                    );
+                                }
+                            }
+                            else {
+                                trigger_pub(std::chrono::steady_clock::now());
+                                ++sent;
+                                if (pci->send_times != 0) {
+                                    pci->tim->expires_at(
+                                        pci->tim->expiry() +
+                                        std::chrono::milliseconds(bc_.pub_interval_ms)
+                                    );
+                                    pci->tim->async_wait(
+                                        as::append(
+                                            *this,
+                                            pci
+                                        )
+                                    );
+                                }
                             }
                             if (bc_.md == mode::send) {
-                                BOOST_ASSERT(bc_.rest_times > 0);
-                                --bc_.rest_times;
-                                if (bc_.rest_times == 0) {
+                                BOOST_ASSERT(bc_.rest_times >= sent);
+                                if ((bc_.rest_times -= sent) == 0) {
                                     locked_cout() << "all publish finished. after measured Ctrl-C to stop the program" << std::endl;
+                                    report();
                                     bc_.tim_progress->cancel();
                                     std::promise<void> p;
                                     p.get_future().wait(); // infinity wait
                                 }
                             }
-                            break;
+                        } break;
                         case phase::pub_after_idle_delay: {
                             bc_.ph.store(phase::publish);
                             bc_.tp_publish = std::chrono::steady_clock::now();
-                            locked_cout() << "Publish (measure)" << std::endl;
+                            if (bc_.load.sweep_restart) {
+                                // the next step of the rate sweep
+                                bc_.load.sweep_restart = false;
+                                bc_.rest_times = bc_.load.measure_times * cis_.size();
+                                for (auto& ci : cis_) {
+                                    ci.send_times = bc_.load.measure_times;
+                                    ci.recv_times = bc_.load.measure_times;
+                                    ci.burst_count = 0;
+                                    ci.rtt_us.clear();
+                                    ci.c->async_recv(
+                                        as::append(
+                                            *this,
+                                            &ci
+                                        )
+                                    );
+                                }
+                                locked_cout()
+                                    << "Publish (measure) rate:"
+                                    << boost::format("%.1f") % bc_.load.rate << " publish/sec" << std::endl;
+                            }
+                            else {
+                                locked_cout() << "Publish (measure)" << std::endl;
+                            }
                             std::size_t index = 0;
                             for (auto& ci : cis_) {
                                 // pub interval
-                                auto tp =
-                                    std::chrono::nanoseconds(bc_.all_interval_ns) * index++;
-                                ci.tim->expires_after(tp);
+                                ci.tim->expires_after(first_pub_delay(ci, index++));
                                 ci.tim->async_wait(
                                     as::append(
                                         *this,
@@ -1006,6 +1220,164 @@ private:
 
 private:
 
+    void record_response(phase ph, ClientInfo const& ci) {
+        auto dur_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - ci.req_sent
+        ).count();
+        bc_.lat.record(static_cast<std::size_t>(ph), ci.group, static_cast<std::uint64_t>(dur_us));
+    }
+
+    std::chrono::nanoseconds first_pub_delay(ClientInfo& ci, std::size_t index) {
+        if (bc_.ph.load() != phase::publish || !bc_.load.open_loop()) {
+            return std::chrono::nanoseconds(bc_.all_interval_ns) * index;
+        }
+        switch (bc_.load.arr) {
+        case arrival::constant:
+            // the clients are spread evenly over the gap
+            return std::chrono::nanoseconds(
+                static_cast<std::int64_t>(1e9 * double(index) / bc_.load.rate)
+            );
+        case arrival::poisson:
+            return next_pub_gap(ci);
+        default:
+            // all clients start the burst at the same time
+            return std::chrono::nanoseconds(0);
+        }
+    }
+
+    std::chrono::nanoseconds next_pub_gap(ClientInfo& ci) {
+        // mean gap of the client
+        auto mean_ns = 1e9 * double(cis_.size()) / bc_.load.rate;
+        switch (bc_.load.arr) {
+        case arrival::poisson: {
+            std::exponential_distribution<double> dist{1.0 / mean_ns};
+            return std::chrono::nanoseconds(static_cast<std::int64_t>(dist(ci.rng)));
+        }
+        case arrival::burst:
+            if (++ci.burst_count < bc_.load.burst_size) return std::chrono::nanoseconds(0);
+            ci.burst_count = 0;
+            return std::chrono::nanoseconds(
+                static_cast<std::int64_t>(mean_ns * double(bc_.load.burst_size))
+            );
+        default:
+            return std::chrono::nanoseconds(static_cast<std::int64_t>(mean_ns));
+        }
+    }
+
+    // Evaluate the finished step of the rate sweep.
+    // If the rate is not saturated, the next step is started and returns true.
+    bool next_sweep_step(ClientInfo* pci) {
+        auto& ld = bc_.load;
+        auto elapsed_ns = std::max(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - bc_.tp_publish
+            ).count(),
+            std::chrono::nanoseconds::rep(1)
+        );
+        am::hdr_histogram hist;
+        for (std::size_t g = 0; g != bc_.lat.groups(); ++g) {
+            hist.merge(bc_.lat.merged(static_cast<std::size_t>(phase::publish), g));
+        }
+        auto achieved = double(ld.measure_times * cis_.size()) * 1e9 / double(elapsed_ns);
+        auto p99 = hist.value_at_percentile(99);
+        bool saturated =
+            achieved < ld.rate * saturation_ratio ||
+            (ld.sweep_p99_limit_ms != 0 && p99 > ld.sweep_p99_limit_ms * 1000);
+        ld.steps.push_back(load_context::step{ld.rate, achieved, hist, ld.max_lag_us.load(), saturated});
+        locked_cout()
+            << "[sweep] rate:" << boost::format("%12.1f") % ld.rate
+            << " achieved:" << boost::format("%12.1f") % achieved
+            << " p50:" << boost::format("%8d") % hist.value_at_percentile(50)
+            << " p99:" << boost::format("%8d") % p99
+            << " p99.9:" << boost::format("%8d") % hist.value_at_percentile(99.9)
+            << " max:" << boost::format("%8d") % hist.max() << " us"
+            << " lag:" << boost::format("%8d") % ld.max_lag_us.load() << " us"
+            << (saturated ? " saturated" : "")
+            << std::endl;
+
+        auto next_rate = ld.rate * ld.sweep_factor;
+        if (saturated || (ld.sweep_max_rate != 0 && next_rate > ld.sweep_max_rate)) {
+            for (auto const& st : ld.steps) {
+                if (!st.saturated) ld.knee_rate = st.rate;
+            }
+            if (ld.knee_rate == 0) {
+                locked_cout() << "[sweep] saturated at the first rate. decrease rate" << std::endl;
+            }
+            else {
+                locked_cout()
+                    << "[sweep] saturation knee:" << boost::format("%.1f") % ld.knee_rate
+                    << " publish/sec" << (saturated ? "" : " (not saturated up to sweep_max_rate)")
+                    << std::endl;
+            }
+            return false;
+        }
+
+        ld.rate = next_rate;
+        ld.max_lag_us = 0;
+        ld.sweep_restart = true;
+        bc_.lat.reset(static_cast<std::size_t>(phase::publish));
+        bc_.ph.store(phase::pub_after_idle_delay);
+        bc_.tp_pub_after_idle_delay = std::chrono::steady_clock::now();
+        bc_.tim_delay.expires_after(std::chrono::milliseconds(bc_.pub_after_idle_delay_ms));
+        bc_.tim_delay.async_wait(
+            as::append(
+                *this,
+                pci
+            )
+        );
+        return true;
+    }
+
+    // The histograms of the threads are merged. It is called after the last
+    // response is recorded, so all the records are visible via rest_* atomics.
+    void report() {
+        auto now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()
+        ).count();
+        as::post(
+            bc_.tim_series.get_executor(),
+            [&tim = bc_.tim_series] {
+                tim.cancel();
+            }
+        );
+        bc_.series.sample(bc_.series.interval_end(now_ms));
+
+        am::latency_report r;
+        r.info = bc_.report_info;
+        if (bc_.load.open_loop()) {
+            r.info["max_schedule_lag_us"] = std::to_string(bc_.load.max_lag_us.load());
+            locked_cout() << "max schedule lag:" << bc_.load.max_lag_us.load() << " us" << std::endl;
+        }
+        for (auto const& st : bc_.load.steps) {
+            r.add("sweep_" + std::to_string(static_cast<std::uint64_t>(st.rate)), "all", st.hist);
+        }
+        if (bc_.load.knee_rate != 0) {
+            r.info["knee_rate"] = std::to_string(static_cast<std::uint64_t>(bc_.load.knee_rate));
+        }
+        r.interval_ms = bc_.series.interval_ms();
+        r.series = bc_.series.samples();
+        for (std::size_t p = 0; p != bc_.lat.phases(); ++p) {
+            auto ph_str = phase_str(static_cast<phase>(p));
+            if (bc_.lat.groups() == 1) {
+                auto h = bc_.lat.merged(p, 0);
+                if (h.count() != 0) r.add(ph_str, "all", h);
+                continue;
+            }
+            std::vector<am::hdr_histogram> hs;
+            for (std::size_t g = 0; g != bc_.lat.groups(); ++g) {
+                hs.push_back(bc_.lat.merged(p, g));
+                if (hs.back().count() != 0) r.add(ph_str, "all", hs.back());
+            }
+            for (std::size_t g = 0; g != hs.size(); ++g) {
+                if (hs[g].count() != 0) r.add(ph_str, "g" + std::to_string(g), hs[g]);
+            }
+        }
+        std::ostringstream oss;
+        r.write_text(oss);
+        locked_cout() << "Latency" << std::endl << oss.str() << std::flush;
+        if (!bc_.report_prefix.empty()) write_report_files(bc_.report_prefix, r);
+    }
+
     enum class pub_recv {
         cont,
         idle_finish,
@@ -1024,39 +1396,44 @@ private:
             return pub_recv::cont;
         }
         BOOST_ASSERT(bc_.rest_times > 0);
+        bc_.series.add_received();
+
+        auto dur_us =
+            [&] () -> std::int64_t {
+                if (bc_.md == mode::single) {
+                    auto recv = std::chrono::steady_clock::now();
+                    return
+                        static_cast<std::int64_t>(
+                            std::chrono::duration_cast<std::chrono::microseconds>(
+                                recv - ci.sent.at(ci.recv_times - 1)
+                            ).count()
+                        );
+                }
+                else {
+                    auto recv = std::chrono::system_clock::now();
+                    BOOST_ASSERT(bc_.md == mode::recv);
+                    auto ts = payload.substr(8 + 8, ts_size);
+                    auto ts_val = boost::lexical_cast<std::int64_t>(ts);
+                    return
+                        static_cast<std::int64_t>(
+                            (
+                                static_cast<std::int64_t>(
+                                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                        recv.time_since_epoch()
+                                    ).count()
+                                )
+                                -
+                                ts_val
+                            ) / 1000
+                        );
+                }
+            } ();
+        // the clock of the sender in the other process can be ahead
+        auto rtt_us = static_cast<std::uint64_t>(std::max(dur_us, std::int64_t(0)));
 
         if (bc_.rest_idle == 0) {
             // actual measure (no idle)
-            auto dur_us =
-                [&] () -> std::int64_t {
-                    if (bc_.md == mode::single) {
-                        auto recv = std::chrono::steady_clock::now();
-                        return
-                            static_cast<std::int64_t>(
-                                std::chrono::duration_cast<std::chrono::microseconds>(
-                                    recv - ci.sent.at(ci.recv_times - 1)
-                                ).count()
-                            );
-                    }
-                    else {
-                        auto recv = std::chrono::system_clock::now();
-                        BOOST_ASSERT(bc_.md == mode::recv);
-                        auto ts = payload.substr(8 + 8, ts_size);
-                        auto ts_val = boost::lexical_cast<std::int64_t>(ts);
-                        return
-                            static_cast<std::int64_t>(
-                                (
-                                    static_cast<std::int64_t>(
-                                        std::chrono::duration_cast<std::chrono::nanoseconds>(
-                                            recv.time_since_epoch()
-                                        ).count()
-                                    )
-                                    -
-                                    ts_val
-                                ) / 1000
-                            );
-                    }
-                } ();
+            bc_.lat.record(static_cast<std::size_t>(phase::publish), ci.group, rtt_us);
             if (bc_.limit_ms != 0 && static_cast<unsigned long>(dur_us) > bc_.limit_ms * 1000) {
                 locked_cout() << "RTT:" << (dur_us / 1000) << "ms over " << bc_.limit_ms << "ms" << std::endl;
             }
@@ -1083,6 +1460,7 @@ private:
             }
         }
         else {
+            bc_.lat.record(static_cast<std::size_t>(phase::idle), ci.group, rtt_us);
             --ci.recv_times;
             --bc_.rest_times;
             std::size_t expected = 1;
@@ -1317,10 +1695,12 @@ int main(int argc, char *argv[]) {
             (
                 "mode",
                 boost::program_options::value<std::string>()->default_value("single"),
-                "bench mode. [single|send|recv] "
+                "bench mode. [single|send|recv|connect] "
                 "single is send/recv by bench. "
                 "send is publish only. payload contains timestamp. "
                 "recv is receive only. time is caluclated by timestamp. "
+                "connect is connection storm. all clients connect and connects/sec is reported. "
+                "set con_interval_ms to 0 to connect them at once. "
             )
             (
                 "manager",
@@ -1343,6 +1723,76 @@ int main(int argc, char *argv[]) {
                 boost::program_options::value<bool>()->default_value(true),
                 "All clients disconnect after report. Set false if you want to avoid noises by close on multiple bench measuring. "
             )
+            (
+                "arrival",
+                boost::program_options::value<std::string>()->default_value("interval"),
+                "publish arrival pattern of the measure phase. [interval|constant|poisson|burst] "
+                "interval is closed-loop, each client publishes every pub_interval_ms and the latency is measured from the actual send. "
+                "constant, poisson, and burst are open-loop, the publishes are scheduled on the intended timeline at rate "
+                "and sent even if the previous ones are not finished. the latency is measured from the intended time. "
+                "burst sends burst_size publishes for each client at the same time. "
+            )
+            (
+                "rate",
+                boost::program_options::value<double>()->default_value(0),
+                "target publish/sec of all clients for the open-loop arrival. 0 means decided by pub_interval_ms and clients."
+            )
+            (
+                "burst_size",
+                boost::program_options::value<std::size_t>()->default_value(10),
+                "number of publishes for each client at once for arrival burst"
+            )
+            (
+                "sweep_factor",
+                boost::program_options::value<double>()->default_value(0),
+                "sweep the open-loop rate to find the saturation knee. the measure phase is repeated with the rate "
+                "multiplied by sweep_factor until the received rate is lower than the target or p99 exceeds sweep_p99_limit_ms. "
+                "it must be greater than 1. 0 means no sweep. only for mode single."
+            )
+            (
+                "sweep_max_rate",
+                boost::program_options::value<double>()->default_value(0),
+                "the maximum rate of the sweep. 0 means no limit."
+            )
+            (
+                "sweep_p99_limit_ms",
+                boost::program_options::value<std::size_t>()->default_value(0),
+                "the rate is saturated if p99 latency exceeds it. 0 means no limit."
+            )
+            (
+                "group_clients",
+                boost::program_options::value<std::size_t>()->default_value(0),
+                "Number of clients in a latency report group. Clients are grouped in the order of the index. "
+                "0 means all clients are in one group."
+            )
+            (
+                "hist_digits",
+                boost::program_options::value<unsigned int>()->default_value(3),
+                "Significant decimal digits of the latency histograms. 1 to 5."
+            )
+            (
+                "series_interval_ms",
+                boost::program_options::value<std::size_t>()->default_value(1000),
+                "Interval of the throughput time series (ms). "
+                "The intervals are aligned to the system clock to merge the reports of the processes."
+            )
+            (
+                "report_prefix",
+                boost::program_options::value<std::string>()->default_value(""),
+                "Write the report to report_prefix.json, report_prefix_latency.csv, report_prefix_throughput.csv, "
+                "and report_prefix.hdr. The .hdr file can be merged by merge_reports. Empty means no files."
+            )
+            (
+                "report_label",
+                boost::program_options::value<std::string>()->default_value(""),
+                "Label of the report e.g. the build of the broker. It is written to the info of the report."
+            )
+            (
+                "merge_reports",
+                boost::program_options::value<std::vector<std::string>>()->multitoken(),
+                "Merge the .hdr files of the bench processes e.g. the manager, the workers, and the receivers. "
+                "The merged report is printed and written by report_prefix. No clients are run. "
+            )
             ;
 
         desc.add(general_desc);
@@ -1396,6 +1846,9 @@ int main(int argc, char *argv[]) {
             else if (auto p = boost::any_cast<bool>(&e.second.value())) {
                 std::cout << std::boolalpha << *p;
             }
+            else if (auto p = boost::any_cast<double>(&e.second.value())) {
+                std::cout << *p;
+            }
             else if (auto p = boost::any_cast<std::vector<std::string>>(&e.second.value())) {
                 for (auto const& e : *p) {
                     std::cout << e << " ";
@@ -1430,6 +1883,23 @@ int main(int argc, char *argv[]) {
         am::setup_log();
 #endif
 
+        auto report_prefix = vm["report_prefix"].as<std::string>();
+        if (vm.count("merge_reports")) {
+            am::latency_report merged;
+            for (auto const& file : vm["merge_reports"].as<std::vector<std::string>>()) {
+                std::ifstream input(file);
+                if (!input.good()) {
+                    std::cerr << "report file '" << file << "' not found" << std::endl;
+                    return -1;
+                }
+                merged.merge(am::latency_report::read(input));
+            }
+            std::cout << "Latency" << std::endl;
+            merged.write_text(std::cout);
+            if (!report_prefix.empty()) write_report_files(report_prefix, merged);
+            return 0;
+        }
+
         if (!vm.count("target")) {
             std::cerr << "target host:port must be set at least one entry" << std::endl;
             return -1;
@@ -1613,24 +2083,27 @@ int main(int argc, char *argv[]) {
         else if (md_str == "recv") {
             md = mode::recv;
         }
+        else if (md_str == "connect") {
+            md = mode::connect;
+        }
         else {
             std::cout
                 << "invalid mode:" << md_str
-                << " mode should be [single|send|recv]."
+                << " mode should be [single|send|recv|connect]."
                 << std::endl;
             return -1;
         }
 
-        if (md == mode::recv) {
+        if (md == mode::recv || md == mode::connect) {
             if (num_of_workers > 0) {
                 std::cout
-                    << "you cannot set options both mode recv and manager"
+                    << "you cannot set options both mode " << md_str << " and manager"
                     << std::endl;
                 return -1;
             }
             if (manager_hp) {
                 std::cout
-                    << "you cannot set options both mode recv and work_for"
+                    << "you cannot set options both mode " << md_str << " and work_for"
                     << std::endl;
                 return -1;
             }
@@ -1644,6 +2117,81 @@ int main(int argc, char *argv[]) {
 
         auto progress_timer_sec = vm["progress_timer_sec"].as<std::size_t>();
 
+        load_context load;
+        auto arrival_str = vm["arrival"].as<std::string>();
+        if (arrival_str == "interval") {
+            load.arr = arrival::interval;
+        }
+        else if (arrival_str == "constant") {
+            load.arr = arrival::constant;
+        }
+        else if (arrival_str == "poisson") {
+            load.arr = arrival::poisson;
+        }
+        else if (arrival_str == "burst") {
+            load.arr = arrival::burst;
+        }
+        else {
+            std::cout
+                << "invalid arrival:" << arrival_str
+                << " arrival should be [interval|constant|poisson|burst]."
+                << std::endl;
+            return -1;
+        }
+        load.rate = vm["rate"].as<double>();
+        if (load.rate < 0) {
+            std::cout << "rate must not be negative" << std::endl;
+            return -1;
+        }
+        load.burst_size = vm["burst_size"].as<std::size_t>();
+        if (load.burst_size == 0) {
+            std::cout << "burst_size must be greater than 0" << std::endl;
+            return -1;
+        }
+        load.measure_times = vm["times"].as<std::size_t>();
+        load.sweep_factor = vm["sweep_factor"].as<double>();
+        load.sweep_max_rate = vm["sweep_max_rate"].as<double>();
+        load.sweep_p99_limit_ms = vm["sweep_p99_limit_ms"].as<std::size_t>();
+        if (load.sweep_factor != 0) {
+            if (load.sweep_factor <= 1) {
+                std::cout << "sweep_factor must be greater than 1" << std::endl;
+                return -1;
+            }
+            if (md != mode::single || !load.open_loop()) {
+                std::cout << "sweep requires mode single and open-loop arrival" << std::endl;
+                return -1;
+            }
+        }
+
+        auto group_clients = vm["group_clients"].as<std::size_t>();
+        auto hist_digits = vm["hist_digits"].as<unsigned int>();
+        if (hist_digits < 1 || hist_digits > 5) {
+            std::cout << "hist_digits must be 1 to 5. hist_digits:" << hist_digits << std::endl;
+            return -1;
+        }
+        auto series_interval_ms = vm["series_interval_ms"].as<std::size_t>();
+        if (series_interval_ms == 0) {
+            std::cout << "series_interval_ms must be greater than 0" << std::endl;
+            return -1;
+        }
+        std::map<std::string, std::string> report_info {
+            {"host", as::ip::host_name()},
+            {"mode", md_str},
+            {"protocol", vm["protocol"].as<std::string>()},
+            {"mqtt_version", vm["mqtt_version"].as<std::string>()},
+            {"qos", std::to_string(vm["qos"].as<unsigned int>())},
+            {"payload_size", std::to_string(payload_size)},
+            {"clients", std::to_string(clients)},
+            {"start_index", std::to_string(start_index)},
+            {"times", std::to_string(vm["times"].as<std::size_t>())},
+            {"pub_interval_ms", std::to_string(vm["pub_interval_ms"].as<std::size_t>())},
+            {"arrival", arrival_str}
+        };
+
+        if (!vm["report_label"].as<std::string>().empty()) {
+            report_info.emplace("label", vm["report_label"].as<std::string>());
+        }
+
         std::uint64_t pub_interval_us = pub_interval_ms * 1000;
         std::cout << "pub_interval:" << pub_interval_us << " us" << std::endl;
         std::uint64_t all_interval_ns = pub_interval_us * 1000 / static_cast<std::uint64_t>(clients);
@@ -1666,6 +2214,13 @@ int main(int argc, char *argv[]) {
                 return result;
             }();
         std::cout << pps_str_with_comma <<  " publish/sec" << std::endl;
+        if (load.open_loop()) {
+            if (load.rate == 0) load.rate = 1e9 / double(all_interval_ns);
+            std::cout
+                << "open-loop arrival:" << arrival_str
+                << " rate:" << load.rate << " publish/sec" << std::endl;
+            report_info.emplace("rate", std::to_string(static_cast<std::uint64_t>(load.rate)));
+        }
         auto num_of_iocs =
             [&] () -> std::size_t {
                 if (vm.count("iocs")) {
@@ -1747,6 +2302,7 @@ int main(int argc, char *argv[]) {
                  recv_times{times},
                  send_idle_count{idle_count},
                  recv_idle_count{idle_count},
+                 rng{index},
                  host{am::force_move(host)},
                  port{am::force_move(port)}
             {
@@ -1764,7 +2320,7 @@ int main(int argc, char *argv[]) {
             std::string get_client_id() const {
                 return cid_prefix + index_str;
             }
-            std::string send_payload(mode md) {
+            std::string send_payload(mode md, std::chrono::steady_clock::time_point intended) {
                 std::string ret = payload_str;
                 auto variable =
                     [&] {
@@ -1778,7 +2334,9 @@ int main(int argc, char *argv[]) {
                                  % send_times
                                  % std::chrono::duration_cast<std::chrono::nanoseconds>(
                                      // use system clock for multi node synchronization
-                                     std::chrono::system_clock::now().time_since_epoch()).count()
+                                     // the receiver measures the latency from the intended time
+                                     std::chrono::system_clock::now().time_since_epoch() -
+                                     (std::chrono::steady_clock::now() - intended)).count()
                                 ).str();
                         default:
                             locked_cout() << "invalid mode" << std::endl;
@@ -1816,6 +2374,10 @@ int main(int argc, char *argv[]) {
             std::size_t recv_idle_count;
             std::vector<std::chrono::steady_clock::time_point> sent;
             std::vector<std::size_t> rtt_us;
+            std::chrono::steady_clock::time_point req_sent; ///< CONNECT or SUBSCRIBE
+            std::size_t group = 0;
+            std::mt19937_64 rng; ///< for arrival::poisson
+            std::size_t burst_count = 0;
             std::shared_ptr<as::steady_timer> tim;
             std::string host;
             std::string port;
@@ -1838,6 +2400,38 @@ int main(int argc, char *argv[]) {
         std::atomic<std::size_t> rest_idle{pub_idle_count * clients};
         std::atomic<std::uint64_t> rest_times{times * clients};
 
+        // latency in microseconds up to an hour
+        am::latency_recorder lat{
+            phase_num,
+            group_clients == 0 ? 1 : (clients + group_clients - 1) / group_clients,
+            std::uint64_t(3600) * 1000 * 1000,
+            static_cast<int>(hist_digits)
+        };
+        am::throughput_series series{series_interval_ms};
+        as::system_timer tim_series{ioc_progress_timer};
+        std::function <void()> tim_series_proc =
+            [&] {
+                auto now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()
+                ).count();
+                auto end_ms = series.interval_end(now_ms);
+                tim_series.expires_at(
+                    std::chrono::system_clock::time_point(
+                        std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                            std::chrono::milliseconds(end_ms)
+                        )
+                    )
+                );
+                tim_series.async_wait(
+                    [&, end_ms] (boost::system::error_code const& ec) {
+                        if (!ec) {
+                            series.sample(end_ms);
+                            tim_series_proc();
+                        }
+                    }
+                );
+            };
+
         std::function <void()> tim_progress_proc =
             [&, wp = std::weak_ptr<as::steady_timer>(tim_progress)] {
                 if (auto sp = wp.lock()) {
@@ -1925,6 +2519,7 @@ int main(int argc, char *argv[]) {
                 if (progress_timer_sec > 0) {
                     tim_progress_proc();
                 }
+                tim_series_proc();
                 std::thread th_progress_timer {
                     [&] {
                         ioc_progress_timer.run();
@@ -1970,6 +2565,12 @@ int main(int argc, char *argv[]) {
                 for (auto& th : ths) th.join();
                 th_timer.join();
                 tim_progress->cancel();
+                as::post(
+                    ioc_progress_timer,
+                    [&] {
+                        tim_series.cancel();
+                    }
+                );
                 th_progress_timer.join();
                 signals.cancel();
                 th_signal.join();
@@ -2022,7 +2623,14 @@ int main(int argc, char *argv[]) {
             vm["close_after_report"].as<bool>(),
             tcp_no_delay_opt,
             send_buf_size_opt,
-            recv_buf_size_opt
+            recv_buf_size_opt,
+            lat,
+            series,
+            tim_series,
+            group_clients,
+            report_info,
+            report_prefix,
+            load
         );
 
         if (protocol == "mqtt") {
@@ -4,10 +4,12 @@
 // (See accompanying file LICENSE_1_0.txt or copy at
 // http://www.boost.org/LICENSE_1_0.txt)
 
+#include <cstdio>
 #include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <algorithm>
+#include <sstream>
 #include <thread>
 #include <stdexcept>
 
@@ -31,8 +33,13 @@
 
 #include <broker/endpoint_variant.hpp>
 #include <broker/broker.hpp>
+#include <broker/sharded_broker.hpp>
+#include <broker/wal_session_store.hpp>
 #include <broker/constant.hpp>
 #include <broker/fixed_core_map.hpp>
+#include <broker/con_ioc_load.hpp>
+#include <broker/connect_peek.hpp>
+#include <broker/metrics.hpp>
 
 namespace am = async_mqtt;
 namespace as = boost::asio;
@@ -138,9 +145,8 @@ void run_broker(boost::program_options::variables_map const& vm) {
 #endif // defined(ASYNC_MQTT_USE_TLS)
         >;
 
-        am::broker<
-            epv_type
-        > brk{timer_ioc, vm["recycling_allocator"].as<bool>()};
+        std::optional<am::broker<epv_type>> brk;
+        std::optional<am::sharded_broker<epv_type>> sharded_brk;
 
         auto num_of_iocs =
             [&] () -> std::size_t {
@@ -172,10 +178,13 @@ void run_broker(boost::program_options::variables_map const& vm) {
                 << threads_per_ioc;
         }
 
+        auto num_of_shards = vm["shards"].as<std::size_t>();
+
         ASYNC_MQTT_LOG("mqtt_broker", info)
             << "iocs:" << num_of_iocs
             << " threads_per_ioc:" << threads_per_ioc
-            << " total threads:" << num_of_iocs * threads_per_ioc;
+            << " total threads:" << num_of_iocs * threads_per_ioc
+            << " shards:" << num_of_shards;
 
         auto set_auth =
             [&] {
@@ -190,7 +199,12 @@ void run_broker(boost::program_options::variables_map const& vm) {
                         if (input) {
                             am::security security;
                             security.load_json(input);
-                            brk.set_security(am::force_move(security));
+                            if (sharded_brk) {
+                                sharded_brk->set_security(am::force_move(security));
+                            }
+                            else {
+                                brk->set_security(am::force_move(security));
+                            }
                         }
                         else {
                             ASYNC_MQTT_LOG("mqtt_broker", warning)
@@ -201,14 +215,12 @@ void run_broker(boost::program_options::variables_map const& vm) {
                     }
                 }
             };
-        set_auth();
         as::io_context accept_ioc;
 
         int concurrency_hint = boost::numeric_cast<int>(threads_per_ioc);
         if (concurrency_hint == 1) {
             concurrency_hint = BOOST_ASIO_CONCURRENCY_HINT_UNSAFE_IO;
         }
-        std::mutex mtx_con_iocs;
         std::vector<std::shared_ptr<as::io_context>> con_iocs;
         con_iocs.reserve(num_of_iocs);
         for (std::size_t i = 0; i != num_of_iocs; ++i) {
@@ -226,21 +238,449 @@ void run_broker(boost::program_options::variables_map const& vm) {
             guard_con_iocs.emplace_back(con_ioc->get_executor());
         }
 
-        auto con_iocs_it = con_iocs.begin();
+        // When each con_ioc is run by one thread, the thread serializes the handlers,
+        // so the connections and the shards don't pay for the strand.
+        auto con_executor =
+            [threads_per_ioc](as::io_context& con_ioc) -> as::any_io_executor {
+                if (threads_per_ioc == 1) {
+                    return am::make_null_strand(con_ioc.get_executor());
+                }
+                return as::make_strand(con_ioc.get_executor());
+            };
+        ASYNC_MQTT_LOG("mqtt_broker", info)
+            << "strand:" << (threads_per_ioc == 1 ? "null_strand" : "strand");
+
+        if (num_of_shards == 0) {
+            brk.emplace(timer_ioc, vm["recycling_allocator"].as<bool>());
+        }
+        else {
+            // shard i is pinned to con_iocs[i % num_of_iocs]
+            std::vector<as::any_io_executor> shard_exes;
+            shard_exes.reserve(num_of_shards);
+            for (std::size_t i = 0; i != num_of_shards; ++i) {
+                shard_exes.emplace_back(con_executor(*con_iocs[i % con_iocs.size()]));
+            }
+            sharded_brk.emplace(timer_ioc, shard_exes, vm["recycling_allocator"].as<bool>());
+        }
+        if (vm["subscription_snapshot"].as<bool>()) {
+            if (sharded_brk) {
+                sharded_brk->enable_subscription_snapshot();
+            }
+            else {
+                brk->enable_subscription_snapshot();
+            }
+        }
+        {
+            auto strategy_str = vm["shared_sub_strategy"].as<std::string>();
+            auto strategy = am::shared_strategy_from_string(strategy_str);
+            if (!strategy) {
+                ASYNC_MQTT_LOG("mqtt_broker", warning)
+                    << "invalid shared_sub_strategy:" << strategy_str << " round_robin is used";
+                strategy_str = "round_robin";
+                strategy = am::shared_strategy::round_robin;
+            }
+            auto max_inflight = vm["shared_sub_max_inflight"].as<std::size_t>();
+            ASYNC_MQTT_LOG("mqtt_broker", info)
+                << "shared_sub_strategy:" << strategy_str
+                << " shared_sub_max_inflight:" << max_inflight;
+            if (sharded_brk) {
+                sharded_brk->set_shared_subscription(*strategy, max_inflight);
+            }
+            else {
+                brk->set_shared_subscription(*strategy, max_inflight);
+            }
+        }
+        set_auth();
+
+        {
+            am::offline_limits session{
+                vm["offline_max_messages"].as<std::size_t>(),
+                vm["offline_max_bytes"].as<std::size_t>()
+            };
+            am::offline_limits global{
+                vm["offline_global_max_messages"].as<std::size_t>(),
+                vm["offline_global_max_bytes"].as<std::size_t>()
+            };
+            auto policy_str = vm["offline_overflow_policy"].as<std::string>();
+            auto policy = am::offline_overflow_policy::drop_oldest;
+            if (policy_str == "drop_oldest") {
+                policy = am::offline_overflow_policy::drop_oldest;
+            }
+            else if (policy_str == "drop_newest") {
+                policy = am::offline_overflow_policy::drop_newest;
+            }
+            else if (policy_str == "drop_qos0_first") {
+                policy = am::offline_overflow_policy::drop_qos0_first;
+            }
+            else if (policy_str == "disconnect") {
+                policy = am::offline_overflow_policy::disconnect;
+            }
+            else {
+                ASYNC_MQTT_LOG("mqtt_broker", warning)
+                    << "invalid offline_overflow_policy:" << policy_str << " drop_oldest is used";
+                policy_str = "drop_oldest";
+            }
+            ASYNC_MQTT_LOG("mqtt_broker", info)
+                << "offline_max_messages:" << session.max_messages
+                << " offline_max_bytes:" << session.max_bytes
+                << " offline_global_max_messages:" << global.max_messages
+                << " offline_global_max_bytes:" << global.max_bytes
+                << " offline_overflow_policy:" << policy_str;
+            if (sharded_brk) {
+                sharded_brk->set_offline_quota(session, global, policy);
+            }
+            else {
+                brk->set_offline_quota(session, global, policy);
+            }
+        }
+
+        if (vm.count("session_store_dir")) {
+            auto dir = vm["session_store_dir"].as<std::string>();
+            if (!dir.empty()) {
+                am::wal_session_store_config config{dir};
+                config.fsync = vm["session_store_fsync"].as<bool>();
+                config.commit_interval =
+                    std::chrono::microseconds{vm["session_store_commit_interval_us"].as<std::size_t>()};
+                config.segment_size = vm["session_store_segment_size"].as<std::size_t>();
+                ASYNC_MQTT_LOG("mqtt_broker", info)
+                    << "session_store_dir:" << dir
+                    << " fsync:" << std::boolalpha << config.fsync
+                    << " commit_interval_us:" << config.commit_interval.count();
+                if (sharded_brk) {
+                    sharded_brk->set_session_store(
+                        [&](std::size_t shard) {
+                            auto shard_config = config;
+                            shard_config.dir = dir + "/shard-" + std::to_string(shard);
+                            return std::make_shared<am::wal_session_store>(am::force_move(shard_config));
+                        }
+                    );
+                }
+                else {
+                    brk->set_session_store(std::make_shared<am::wal_session_store>(am::force_move(config)));
+                }
+            }
+        }
+
+        as::steady_timer tim_offline_report{timer_ioc};
+        auto offline_report_interval =
+            std::chrono::seconds{vm["offline_queue_report_interval"].as<std::size_t>()};
+        auto offline_queue_report_num = vm["offline_queue_report_num"].as<std::size_t>();
+        // It is also used for the metrics.
+        auto largest_offline_queues =
+            [&] {
+                return sharded_brk
+                    ? sharded_brk->largest_offline_queues(offline_queue_report_num)
+                    : brk->largest_offline_queues(offline_queue_report_num);
+            };
+        std::function<void()> offline_report =
+            [&] {
+                tim_offline_report.expires_after(offline_report_interval);
+                tim_offline_report.async_wait(
+                    [&](am::error_code const& ec) {
+                        if (ec) return;
+                        auto queues = largest_offline_queues();
+                        for (auto const& q : queues) {
+                            ASYNC_MQTT_LOG("mqtt_broker", info)
+                                << "offline queue username:" << q.username
+                                << " cid:" << q.client_id
+                                << " messages:" << q.messages
+                                << " bytes:" << q.bytes;
+                        }
+                        offline_report();
+                    }
+                );
+            };
+        if (offline_report_interval.count() != 0) offline_report();
+
+        // The snapshot is written on its own thread because writing the file blocks.
+        as::io_context snapshot_ioc;
+        as::steady_timer tim_retained_snapshot{snapshot_ioc};
+        std::string retained_snapshot_file;
+        if (vm.count("retained_snapshot_file")) {
+            retained_snapshot_file = vm["retained_snapshot_file"].as<std::string>();
+        }
+        auto retained_snapshot_interval =
+            std::chrono::seconds{vm["retained_snapshot_interval"].as<std::size_t>()};
+        if (!retained_snapshot_file.empty()) {
+            ASYNC_MQTT_LOG("mqtt_broker", info)
+                << "retained_snapshot_file:" << retained_snapshot_file
+                << " interval:" << retained_snapshot_interval.count();
+            if (auto snapshot = am::retained_snapshot::open(retained_snapshot_file)) {
+                // the delta is ignored if it is not based on the snapshot
+                auto delta = am::retained_snapshot::open(
+                    am::retained_snapshot::delta_path(retained_snapshot_file)
+                );
+                if (sharded_brk) {
+                    sharded_brk->set_retained_snapshot(am::force_move(snapshot), am::force_move(delta));
+                }
+                else {
+                    brk->set_retained_snapshot(am::force_move(snapshot), am::force_move(delta));
+                }
+            }
+        }
+        std::function<void()> retained_snapshot =
+            [&] {
+                tim_retained_snapshot.expires_after(retained_snapshot_interval);
+                tim_retained_snapshot.async_wait(
+                    [&](am::error_code const& ec) {
+                        if (ec) return;
+                        if (sharded_brk) {
+                            sharded_brk->save_retained_snapshot(retained_snapshot_file);
+                        }
+                        else {
+                            brk->save_retained_snapshot(retained_snapshot_file);
+                        }
+                        retained_snapshot();
+                    }
+                );
+            };
+        if (!retained_snapshot_file.empty() && retained_snapshot_interval.count() != 0) {
+            retained_snapshot();
+        }
+
+        // The metrics are recorded only if they are published or scraped.
+        // They are collected on snapshot_ioc because the file writing blocks.
+        auto metrics_interval = std::chrono::seconds{vm["metrics_interval"].as<std::size_t>()};
+        std::string metrics_file;
+        if (vm.count("metrics_file")) {
+            metrics_file = vm["metrics_file"].as<std::string>();
+        }
+        auto metrics_port = vm["metrics_port"].as<std::uint16_t>();
+        // The endpoint has no authentication, so it is bound to the loopback by default.
+        auto metrics_address = as::ip::make_address(vm["metrics_address"].as<std::string>());
+        if (metrics_interval.count() != 0 || metrics_port != 0) {
+            ASYNC_MQTT_LOG("mqtt_broker", info)
+                << "metrics_interval:" << metrics_interval.count()
+                << " metrics_file:" << metrics_file
+                << " metrics_address:" << metrics_address
+                << " metrics_port:" << metrics_port;
+            auto metrics = std::make_shared<am::broker_metrics>();
+            if (sharded_brk) {
+                sharded_brk->set_metrics(metrics);
+            }
+            else {
+                brk->set_metrics(metrics);
+            }
+        }
+        auto collect_metrics =
+            [&] {
+                return sharded_brk ? sharded_brk->collect_metrics() : brk->collect_metrics();
+            };
+        auto write_metrics_file =
+            [&](am::broker_metrics::snapshot const& s, std::vector<am::offline_queue_info> const& queues) {
+                auto tmp = metrics_file + ".tmp";
+                {
+                    std::ofstream ofs{tmp, std::ios::trunc};
+                    am::broker_metrics::write_text(ofs, s);
+                    am::broker_metrics::write_queues_text(ofs, queues);
+                    if (!ofs) {
+                        ASYNC_MQTT_LOG("mqtt_broker", warning)
+                            << "failed to write metrics_file:" << tmp;
+                        return;
+                    }
+                }
+                if (std::rename(tmp.c_str(), metrics_file.c_str()) != 0) {
+                    ASYNC_MQTT_LOG("mqtt_broker", warning)
+                        << "failed to rename metrics_file:" << metrics_file;
+                }
+            };
+        as::steady_timer tim_metrics{snapshot_ioc};
+        std::function<void()> publish_metrics =
+            [&] {
+                tim_metrics.expires_after(metrics_interval);
+                tim_metrics.async_wait(
+                    [&](am::error_code const& ec) {
+                        if (ec) return;
+                        auto s = collect_metrics();
+                        auto queues = largest_offline_queues();
+                        auto publish =
+                            [&](std::string_view name, std::string value) {
+                                std::string topic{"$SYS/broker/"};
+                                topic += name;
+                                am::buffer t{am::force_move(topic)};
+                                am::buffer p{am::force_move(value)};
+                                auto opts = am::qos::at_most_once | am::pub::retain::yes;
+                                if (sharded_brk) {
+                                    sharded_brk->publish_system(am::force_move(t), am::force_move(p), opts);
+                                }
+                                else {
+                                    brk->publish_system(am::force_move(t), am::force_move(p), opts);
+                                }
+                            };
+                        am::broker_metrics::for_each(
+                            s,
+                            [&](std::string_view name, std::uint64_t value) {
+                                publish(name, std::to_string(value));
+                            }
+                        );
+                        am::broker_metrics::for_each_queue(
+                            queues,
+                            [&](std::string_view name, std::string value) {
+                                publish(name, am::force_move(value));
+                            }
+                        );
+                        if (!metrics_file.empty()) write_metrics_file(s, queues);
+                        publish_metrics();
+                    }
+                );
+            };
+        if (metrics_interval.count() != 0) publish_metrics();
 
-        auto con_ioc_getter =
-            [&mtx_con_iocs, &con_iocs, &con_iocs_it]() -> as::io_context& {
-                std::lock_guard<std::mutex> g{mtx_con_iocs};
-                auto& ret = **con_iocs_it;
-                ++con_iocs_it;
-                if (con_iocs_it == con_iocs.end()) con_iocs_it = con_iocs.begin();
-                return ret;
+        // A plain text scrape endpoint. It responds to any HTTP request with the
+        // Prometheus text exposition format, and then closes the connection.
+        std::optional<as::ip::tcp::acceptor> metrics_ac;
+        std::function<void()> metrics_accept;
+        auto serve_metrics =
+            [&](as::ip::tcp::socket sock) {
+                struct scrape {
+                    explicit scrape(as::ip::tcp::socket sock)
+                        :sock{am::force_move(sock)},
+                         tim{this->sock.get_executor()}
+                    {}
+                    as::ip::tcp::socket sock;
+                    as::steady_timer tim;
+                    as::streambuf request{8192};
+                    std::string response;
+                };
+                auto sp = std::make_shared<scrape>(am::force_move(sock));
+                // the client that doesn't send the request is disconnected
+                sp->tim.expires_after(std::chrono::seconds{5});
+                sp->tim.async_wait(
+                    [sp](am::error_code const& ec) {
+                        if (ec) return;
+                        am::error_code ignored;
+                        sp->sock.close(ignored);
+                    }
+                );
+                as::async_read_until(
+                    sp->sock,
+                    sp->request,
+                    "\r\n\r\n",
+                    [&collect_metrics, &largest_offline_queues, sp](am::error_code const& ec, std::size_t) {
+                        if (ec) {
+                            sp->tim.cancel();
+                            return;
+                        }
+                        std::ostringstream body;
+                        am::broker_metrics::write_text(body, collect_metrics());
+                        am::broker_metrics::write_queues_text(body, largest_offline_queues());
+                        auto body_str = body.str();
+                        sp->response =
+                            "HTTP/1.0 200 OK\r\n"
+                            "Content-Type: text/plain; version=0.0.4\r\n"
+                            "Content-Length: " + std::to_string(body_str.size()) + "\r\n"
+                            "\r\n" + body_str;
+                        as::async_write(
+                            sp->sock,
+                            as::buffer(sp->response),
+                            [sp](am::error_code const&, std::size_t) {
+                                sp->tim.cancel();
+                                am::error_code ignored;
+                                sp->sock.shutdown(as::ip::tcp::socket::shutdown_both, ignored);
+                                sp->sock.close(ignored);
+                            }
+                        );
+                    }
+                );
+            };
+        if (metrics_port != 0) {
+            metrics_ac.emplace(snapshot_ioc, as::ip::tcp::endpoint{metrics_address, metrics_port});
+            metrics_accept =
+                [&] {
+                    metrics_ac->async_accept(
+                        [&](am::error_code const& ec, as::ip::tcp::socket sock) {
+                            if (ec == as::error::operation_aborted) return;
+                            if (ec) {
+                                ASYNC_MQTT_LOG("mqtt_broker", error)
+                                    << "metrics accept error:" << ec.message();
+                            }
+                            else {
+                                serve_metrics(am::force_move(sock));
+                            }
+                            metrics_accept();
+                        }
+                    );
+                };
+            metrics_accept();
+        }
+        std::thread th_snapshot {
+            [&snapshot_ioc] {
+                try {
+                    snapshot_ioc.run();
+                }
+                catch (std::exception const& e) {
+                    ASYNC_MQTT_LOG("mqtt_broker", error)
+                        << "th_snapshot exception:" << e.what();
+                }
+                ASYNC_MQTT_LOG("mqtt_broker", trace) << "snapshot_ioc.run() finished";
+            }
+        };
+
+        // On the sharded broker, the connections of MQTT on TCP are placed on the owner
+        // shard's io_context (see below). The other protocols can't be peeked before the
+        // handshake, so they stay on the accepting io_context and their packets are
+        // posted to the shard's executor.
+        auto handle_accept =
+            [&](epv_type epv, std::optional<std::string> preauthed_user_name = std::nullopt) {
+                if (sharded_brk) {
+                    sharded_brk->handle_accept(am::force_move(epv), am::force_move(preauthed_user_name));
+                }
+                else {
+                    brk->handle_accept(am::force_move(epv), am::force_move(preauthed_user_name));
+                }
+            };
+
+        // A new connection is placed on the con_ioc that has the fewest connections.
+        // The acceptor that runs on a con_ioc passes the index of it as local, and
+        // the connection stays on that con_ioc while the con_iocs are nearly balanced.
+        am::con_ioc_load con_ioc_load{con_iocs.size()};
+        auto con_ioc_index =
+            [&con_ioc_load](std::optional<std::size_t> local) {
+                return local ? con_ioc_load.place(*local) : con_ioc_load.least_loaded();
+            };
+
+        // When reuseport_acceptors is true, each con_ioc has its own listening socket and
+        // accepts and handshakes its connections. Otherwise accept_ioc accepts all of them.
+        auto reuseport_acceptors = vm["reuseport_acceptors"].as<bool>();
+        ASYNC_MQTT_LOG("mqtt_broker", info)
+            << "reuseport_acceptors:" << std::boolalpha << reuseport_acceptors;
+        auto make_acceptors =
+            [&](std::uint16_t port) {
+                as::ip::tcp::endpoint endpoint{as::ip::tcp::v4(), port};
+                std::vector<as::ip::tcp::acceptor> acs;
+                if (!reuseport_acceptors) {
+                    acs.emplace_back(accept_ioc, endpoint);
+                    return acs;
+                }
+#if defined(SO_REUSEPORT)
+                using reuse_port = as::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+                acs.reserve(con_iocs.size());
+                for (auto& con_ioc : con_iocs) {
+                    auto& ac = acs.emplace_back(*con_ioc);
+                    ac.open(endpoint.protocol());
+                    ac.set_option(as::socket_base::reuse_address(true));
+                    ac.set_option(reuse_port(true));
+                    ac.bind(endpoint);
+                    ac.listen();
+                }
+                return acs;
+#else  // defined(SO_REUSEPORT)
+                throw std::runtime_error("reuseport_acceptors is not supported on this platform");
+#endif // defined(SO_REUSEPORT)
+            };
+        auto start_accept =
+            [&](std::vector<as::ip::tcp::acceptor>& acs, auto& async_accept) {
+                for (std::size_t i = 0; i != acs.size(); ++i) {
+                    async_accept(
+                        acs[i],
+                        reuseport_acceptors ? std::optional<std::size_t>{i} : std::nullopt
+                    );
+                }
             };
 
         // mqtt (MQTT on TCP)
-        std::optional<as::ip::tcp::endpoint> mqtt_endpoint;
-        std::optional<as::ip::tcp::acceptor> mqtt_ac;
-        std::function<void()> mqtt_async_accept;
+        std::vector<as::ip::tcp::acceptor> mqtt_acs;
+        std::function<void(as::ip::tcp::acceptor&, std::optional<std::size_t>)> mqtt_async_accept;
         auto apply_socket_opts =
             [&](auto& lowest_layer) {
                 if (vm.count("tcp_no_delay")) {
@@ -261,105 +701,196 @@ void run_broker(boost::program_options::variables_map const& vm) {
                     );
                 }
             };
+        // The connection is accepted on the io_context of the acceptor, and then
+        // the socket is moved onto the io_context of the endpoint. The endpoint is
+        // placed when the connection arrives, so the load at that time is used.
+        auto assign_socket =
+            [](auto& lowest_layer, as::ip::tcp::socket& sock) {
+                am::error_code ec;
+                auto protocol = sock.local_endpoint(ec).protocol();
+                if (!ec) {
+                    lowest_layer.assign(protocol, sock.release(ec), ec);
+                }
+                if (ec) {
+                    ASYNC_MQTT_LOG("mqtt_broker", error)
+                        << "TCP assign error:" << ec.message();
+                    return false;
+                }
+                return true;
+            };
 
         if (vm.count("tcp.port")) {
-            mqtt_endpoint.emplace(as::ip::tcp::v4(), vm["tcp.port"].as<std::uint16_t>());
-            mqtt_ac.emplace(accept_ioc, *mqtt_endpoint);
-            mqtt_async_accept =
-                [&] {
-                    auto epsp =
+            mqtt_acs = make_acceptors(vm["tcp.port"].as<std::uint16_t>());
+            auto create_mqtt_endpoint =
+                [&](as::any_io_executor exe, std::size_t index) {
+                    auto epsp = con_ioc_load.track(
                         am::basic_endpoint<
                             am::role::server,
                             2,
                             am::protocol::mqtt
                         >::create(
                             am::protocol_version::undetermined,
-                            as::make_strand(con_ioc_getter().get_executor())
-                        );
+                            am::force_move(exe)
+                        ),
+                        index
+                    );
                     epsp->set_bulk_write(vm["bulk_write"].as<bool>());
+                    epsp->set_bulk_write_limits(
+                        vm["bulk_write_max_bytes"].as<std::size_t>(),
+                        vm["bulk_write_max_iovecs"].as<std::size_t>()
+                    );
                     epsp->set_bulk_read_buffer_size(vm["bulk_read_buf_size"].as<std::size_t>());
-                    auto& lowest_layer = epsp->lowest_layer();
-                    mqtt_ac->async_accept(
-                        lowest_layer,
-                        [&mqtt_async_accept, &apply_socket_opts, &lowest_layer, &brk, epsp]
-                        (boost::system::error_code const& ec) mutable {
-                            if (ec) {
-                                ASYNC_MQTT_LOG("mqtt_broker", error)
-                                    << "TCP accept error:" << ec.message();
+                    if (vm["lazy_property_decoding"].as<bool>()) {
+                        epsp->set_property_decoding(am::property_decoding::lazy);
+                    }
+                    return epsp;
+                };
+            if (sharded_brk) {
+                // The client id is peeked before the endpoint is created, and the socket
+                // is moved onto the io_context of the owner shard. The packets of the
+                // connection are handled on the io_context that the socket is on.
+                mqtt_async_accept =
+                    [&](as::ip::tcp::acceptor& ac, std::optional<std::size_t> local) {
+                        ac.async_accept(
+                            [&, local]
+                            (boost::system::error_code const& ec, as::ip::tcp::socket sock) mutable {
+                                if (ec) {
+                                    ASYNC_MQTT_LOG("mqtt_broker", error)
+                                        << "TCP accept error:" << ec.message();
+                                    mqtt_async_accept(ac, local);
+                                    return;
+                                }
+                                apply_socket_opts(sock);
+                                auto sp = std::make_shared<as::ip::tcp::socket>(am::force_move(sock));
+                                am::async_peek_client_id(
+                                    *sp,
+                                    am::default_connect_peek_max_size,
+                                    [&, sp, local]
+                                    (am::error_code const& ec, std::optional<std::string> client_id) {
+                                        if (ec) {
+                                            ASYNC_MQTT_LOG("mqtt_broker", info)
+                                                << "peek CONNECT error:" << ec.message();
+                                            return;
+                                        }
+                                        auto home =
+                                            [&]() -> std::optional<std::size_t> {
+                                                if (!client_id) return std::nullopt;
+                                                if (!client_id->empty()) {
+                                                    return sharded_brk->shard_index(*client_id);
+                                                }
+                                                // the client id is assigned by the home shard
+                                                return con_ioc_index(local) % sharded_brk->size();
+                                            } ();
+                                        auto index = home ? *home % con_iocs.size() : con_ioc_index(local);
+                                        auto epsp = create_mqtt_endpoint(
+                                            home ? sharded_brk->shard_executor(*home)
+                                                 : con_executor(*con_iocs[index]),
+                                            index
+                                        );
+                                        if (!assign_socket(epsp->lowest_layer(), *sp)) return;
+                                        sharded_brk->handle_accept(epv_type{force_move(epsp)}, std::nullopt, home);
+                                    }
+                                );
+                                mqtt_async_accept(ac, local);
                             }
-                            else {
-                                apply_socket_opts(lowest_layer);
-                                brk.handle_accept(epv_type{force_move(epsp)});
+                        );
+                    };
+            }
+            else {
+                mqtt_async_accept =
+                    [&](as::ip::tcp::acceptor& ac, std::optional<std::size_t> local) {
+                        ac.async_accept(
+                            [&, local]
+                            (boost::system::error_code const& ec, as::ip::tcp::socket sock) {
+                                if (ec) {
+                                    ASYNC_MQTT_LOG("mqtt_broker", error)
+                                        << "TCP accept error:" << ec.message();
+                                }
+                                else {
+                                    apply_socket_opts(sock);
+                                    auto index = con_ioc_index(local);
+                                    auto epsp = create_mqtt_endpoint(con_executor(*con_iocs[index]), index);
+                                    if (assign_socket(epsp->lowest_layer(), sock)) {
+                                        handle_accept(epv_type{force_move(epsp)});
+                                    }
+                                }
+                                mqtt_async_accept(ac, local);
                             }
-                            mqtt_async_accept();
-                        }
-                    );
-                };
+                        );
+                    };
+            }
 
-            mqtt_async_accept();
+            start_accept(mqtt_acs, mqtt_async_accept);
         }
 
 #if defined(ASYNC_MQTT_USE_WS)
         // ws (MQTT on WebSocket)
-        std::optional<as::ip::tcp::endpoint> ws_endpoint;
-        std::optional<as::ip::tcp::acceptor> ws_ac;
-        std::function<void()> ws_async_accept;
+        std::vector<as::ip::tcp::acceptor> ws_acs;
+        std::function<void(as::ip::tcp::acceptor&, std::optional<std::size_t>)> ws_async_accept;
         if (vm.count("ws.port")) {
-            ws_endpoint.emplace(as::ip::tcp::v4(), vm["ws.port"].as<std::uint16_t>());
-            ws_ac.emplace(accept_ioc, *ws_endpoint);
+            ws_acs = make_acceptors(vm["ws.port"].as<std::uint16_t>());
             ws_async_accept =
-                [&] {
-                    auto epsp =
-                        am::basic_endpoint<
-                            am::role::server,
-                            2,
-                            am::protocol::ws
-                        >::create(
-                            am::protocol_version::undetermined,
-                            as::make_strand(con_ioc_getter().get_executor())
-                        );
-                    epsp->set_bulk_write(vm["bulk_write"].as<bool>());
-                    epsp->set_bulk_read_buffer_size(vm["bulk_read_buf_size"].as<std::size_t>());
-                    auto& lowest_layer = epsp->lowest_layer();
-                    ws_ac->async_accept(
-                        lowest_layer,
-                        [&ws_async_accept, &apply_socket_opts, &lowest_layer, &brk, epsp]
-                        (boost::system::error_code const& ec) mutable {
+                [&](as::ip::tcp::acceptor& ac, std::optional<std::size_t> local) {
+                    ac.async_accept(
+                        [&, local]
+                        (boost::system::error_code const& ec, as::ip::tcp::socket sock) {
                             if (ec) {
                                 ASYNC_MQTT_LOG("mqtt_broker", error)
                                     << "TCP accept error:" << ec.message();
+                                ws_async_accept(ac, local);
+                                return;
                             }
-                            else {
-                                apply_socket_opts(lowest_layer);
+                            apply_socket_opts(sock);
+                            auto index = con_ioc_index(local);
+                            auto epsp = con_ioc_load.track(
+                                am::basic_endpoint<
+                                    am::role::server,
+                                    2,
+                                    am::protocol::ws
+                                >::create(
+                                    am::protocol_version::undetermined,
+                                    con_executor(*con_iocs[index])
+                                ),
+                                index
+                            );
+                            epsp->set_bulk_write(vm["bulk_write"].as<bool>());
+                            epsp->set_bulk_write_limits(
+                                vm["bulk_write_max_bytes"].as<std::size_t>(),
+                                vm["bulk_write_max_iovecs"].as<std::size_t>()
+                            );
+                            epsp->set_bulk_read_buffer_size(vm["bulk_read_buf_size"].as<std::size_t>());
+                            if (vm["lazy_property_decoding"].as<bool>()) {
+                                epsp->set_property_decoding(am::property_decoding::lazy);
+                            }
+                            if (assign_socket(epsp->lowest_layer(), sock)) {
                                 auto& ws_layer = epsp->next_layer();
                                 ws_layer.async_accept(
-                                    [&brk, epsp]
+                                    [&handle_accept, epsp]
                                     (boost::system::error_code const& ec) mutable {
                                         if (ec) {
                                             ASYNC_MQTT_LOG("mqtt_broker", error)
                                                 << "WS accept error:" << ec.message();
                                         }
                                         else {
-                                            brk.handle_accept(epv_type{force_move(epsp)});
+                                            handle_accept(epv_type{force_move(epsp)});
                                         }
                                     }
                                 );
                             }
-                            ws_async_accept();
+                            ws_async_accept(ac, local);
                         }
                     );
                 };
 
-            ws_async_accept();
+            start_accept(ws_acs, ws_async_accept);
         }
 
 #endif // defined(ASYNC_MQTT_USE_WS)
 
 #if defined(ASYNC_MQTT_USE_TLS)
         // mqtts (MQTT on TLS TCP)
-        std::optional<as::ip::tcp::endpoint> mqtts_endpoint;
-        std::optional<as::ip::tcp::acceptor> mqtts_ac;
-        std::function<void()> mqtts_async_accept;
+        std::vector<as::ip::tcp::acceptor> mqtts_acs;
+        std::function<void(as::ip::tcp::acceptor&, std::optional<std::size_t>)> mqtts_async_accept;
         std::optional<as::steady_timer> mqtts_timer;
         mqtts_timer.emplace(accept_ioc);
         auto mqtts_verify_field_obj =
@@ -374,10 +905,9 @@ void run_broker(boost::program_options::variables_map const& vm) {
             );
         }
         if (vm.count("tls.port")) {
-            mqtts_endpoint.emplace(as::ip::tcp::v4(), vm["tls.port"].as<std::uint16_t>());
-            mqtts_ac.emplace(accept_ioc, *mqtts_endpoint);
+            mqtts_acs = make_acceptors(vm["tls.port"].as<std::uint16_t>());
             mqtts_async_accept =
-                [&] {
+                [&](as::ip::tcp::acceptor& ac, std::optional<std::size_t> local) {
                     std::optional<std::string> verify_file;
                     if (vm.count("verify_file")) {
                         verify_file = vm["verify_file"].as<std::string>();
@@ -403,57 +933,66 @@ void run_broker(boost::program_options::variables_map const& vm) {
                                 );
                         }
                     );
-                    auto epsp =
-                        am::basic_endpoint<
-                            am::role::server,
-                            2,
-                            am::protocol::mqtts
-                        >::create(
-                            am::protocol_version::undetermined,
-                            as::make_strand(con_ioc_getter().get_executor()),
-                            *mqtts_ctx
-                        );
-                    epsp->set_bulk_write(vm["bulk_write"].as<bool>());
-                    epsp->set_bulk_read_buffer_size(vm["bulk_read_buf_size"].as<std::size_t>());
-                    auto& lowest_layer = epsp->lowest_layer();
-                    mqtts_ac->async_accept(
-                        lowest_layer,
-                        [&mqtts_async_accept, &apply_socket_opts, &lowest_layer, &brk, epsp, username, mqtts_ctx]
-                        (boost::system::error_code const& ec) mutable {
+                    ac.async_accept(
+                        [&, local, username, mqtts_ctx]
+                        (boost::system::error_code const& ec, as::ip::tcp::socket sock) {
                             if (ec) {
                                 ASYNC_MQTT_LOG("mqtt_broker", error)
                                     << "TCP accept error:" << ec.message();
+                                mqtts_async_accept(ac, local);
+                                return;
                             }
-                            else {
+                            apply_socket_opts(sock);
+                            auto index = con_ioc_index(local);
+                            auto epsp = con_ioc_load.track(
+                                am::basic_endpoint<
+                                    am::role::server,
+                                    2,
+                                    am::protocol::mqtts
+                                >::create(
+                                    am::protocol_version::undetermined,
+                                    con_executor(*con_iocs[index]),
+                                    *mqtts_ctx
+                                ),
+                                index
+                            );
+                            epsp->set_bulk_write(vm["bulk_write"].as<bool>());
+                            epsp->set_bulk_write_limits(
+                                vm["bulk_write_max_bytes"].as<std::size_t>(),
+                                vm["bulk_write_max_iovecs"].as<std::size_t>()
+                            );
+                            epsp->set_bulk_read_buffer_size(vm["bulk_read_buf_size"].as<std::size_t>());
+                            if (vm["lazy_property_decoding"].as<bool>()) {
+                                epsp->set_property_decoding(am::property_decoding::lazy);
+                            }
+                            if (assign_socket(epsp->lowest_layer(), sock)) {
                                 // TBD insert underlying timeout here
-                                apply_socket_opts(lowest_layer);
                                 epsp->next_layer().async_handshake(
                                     as::ssl::stream_base::server,
-                                    [&brk, epsp, username, mqtts_ctx]
+                                    [&handle_accept, epsp, username, mqtts_ctx]
                                     (boost::system::error_code const& ec) mutable {
                                         if (ec) {
                                             ASYNC_MQTT_LOG("mqtt_broker", error)
                                                 << "TLS handshake error:" << ec.message();
                                         }
                                         else {
-                                            brk.handle_accept(epv_type{force_move(epsp)}, *username);
+                                            handle_accept(epv_type{force_move(epsp)}, *username);
                                         }
                                     }
                                 );
                             }
-                            mqtts_async_accept();
+                            mqtts_async_accept(ac, local);
                         }
                     );
                 };
 
-            mqtts_async_accept();
+            start_accept(mqtts_acs, mqtts_async_accept);
         }
 
 #if defined(ASYNC_MQTT_USE_WS)
         // wss (MQTT on WebScoket TLS TCP)
-        std::optional<as::ip::tcp::endpoint> wss_endpoint;
-        std::optional<as::ip::tcp::acceptor> wss_ac;
-        std::function<void()> wss_async_accept;
+        std::vector<as::ip::tcp::acceptor> wss_acs;
+        std::function<void(as::ip::tcp::acceptor&, std::optional<std::size_t>)> wss_async_accept;
         std::optional<as::steady_timer> wss_timer;
         wss_timer.emplace(accept_ioc);
         auto wss_verify_field_obj =
@@ -468,10 +1007,9 @@ void run_broker(boost::program_options::variables_map const& vm) {
             );
         }
         if (vm.count("wss.port")) {
-            wss_endpoint.emplace(as::ip::tcp::v4(), vm["wss.port"].as<std::uint16_t>());
-            wss_ac.emplace(accept_ioc, *wss_endpoint);
+            wss_acs = make_acceptors(vm["wss.port"].as<std::uint16_t>());
             wss_async_accept =
-                [&] {
+                [&](as::ip::tcp::acceptor& ac, std::optional<std::size_t> local) {
                     std::optional<std::string> verify_file;
                     if (vm.count("verify_file")) {
                         verify_file = vm["verify_file"].as<std::string>();
@@ -497,33 +1035,43 @@ void run_broker(boost::program_options::variables_map const& vm) {
                                 );
                         }
                     );
-                    auto epsp =
-                        am::basic_endpoint<
-                            am::role::server,
-                            2,
-                            am::protocol::wss
-                        >::create(
-                            am::protocol_version::undetermined,
-                            as::make_strand(con_ioc_getter().get_executor()),
-                            *wss_ctx
-                        );
-                    epsp->set_bulk_write(vm["bulk_write"].as<bool>());
-                    epsp->set_bulk_read_buffer_size(vm["bulk_read_buf_size"].as<std::size_t>());
-                    auto& lowest_layer = epsp->lowest_layer();
-                    wss_ac->async_accept(
-                        lowest_layer,
-                        [&wss_async_accept, &apply_socket_opts, &lowest_layer, &brk, epsp, username, wss_ctx]
-                        (boost::system::error_code const& ec) mutable {
+                    ac.async_accept(
+                        [&, local, username, wss_ctx]
+                        (boost::system::error_code const& ec, as::ip::tcp::socket sock) {
                             if (ec) {
                                 ASYNC_MQTT_LOG("mqtt_broker", error)
                                     << "TCP accept error:" << ec.message();
+                                wss_async_accept(ac, local);
+                                return;
                             }
-                            else {
+                            apply_socket_opts(sock);
+                            auto index = con_ioc_index(local);
+                            auto epsp = con_ioc_load.track(
+                                am::basic_endpoint<
+                                    am::role::server,
+                                    2,
+                                    am::protocol::wss
+                                >::create(
+                                    am::protocol_version::undetermined,
+                                    con_executor(*con_iocs[index]),
+                                    *wss_ctx
+                                ),
+                                index
+                            );
+                            epsp->set_bulk_write(vm["bulk_write"].as<bool>());
+                            epsp->set_bulk_write_limits(
+                                vm["bulk_write_max_bytes"].as<std::size_t>(),
+                                vm["bulk_write_max_iovecs"].as<std::size_t>()
+                            );
+                            epsp->set_bulk_read_buffer_size(vm["bulk_read_buf_size"].as<std::size_t>());
+                            if (vm["lazy_property_decoding"].as<bool>()) {
+                                epsp->set_property_decoding(am::property_decoding::lazy);
+                            }
+                            if (assign_socket(epsp->lowest_layer(), sock)) {
                                 // TBD insert underlying timeout here
-                                apply_socket_opts(lowest_layer);
                                 epsp->next_layer().next_layer().async_handshake(
                                     as::ssl::stream_base::server,
-                                    [&brk, epsp, username, wss_ctx]
+                                    [&handle_accept, epsp, username, wss_ctx]
                                     (boost::system::error_code const& ec) mutable {
                                         if (ec) {
                                             ASYNC_MQTT_LOG("mqtt_broker", error)
@@ -533,14 +1081,14 @@ void run_broker(boost::program_options::variables_map const& vm) {
                                             auto& ws_layer = epsp->next_layer();
                                             ws_layer.binary(true);
                                             ws_layer.async_accept(
-                                                [&brk, epsp, username]
+                                                [&handle_accept, epsp, username]
                                                 (boost::system::error_code const& ec) mutable {
                                                     if (ec) {
                                                         ASYNC_MQTT_LOG("mqtt_broker", error)
                                                             << "WS accept error:" << ec.message();
                                                     }
                                                     else {
-                                                        brk.handle_accept(epv_type{force_move(epsp)}, *username);
+                                                        handle_accept(epv_type{force_move(epsp)}, *username);
                                                     }
                                                 }
                                             );
@@ -548,12 +1096,12 @@ void run_broker(boost::program_options::variables_map const& vm) {
                                     }
                                 );
                             }
-                            wss_async_accept();
+                            wss_async_accept(ac, local);
                         }
                     );
                 };
 
-            wss_async_accept();
+            start_accept(wss_acs, wss_async_accept);
         }
 
 #endif // defined(ASYNC_MQTT_USE_WS)
@@ -664,10 +1212,22 @@ void run_broker(boost::program_options::variables_map const& vm) {
         for (auto& t : ts) t.join();
         ASYNC_MQTT_LOG("mqtt_broker", trace) << "ts joined";
 
+        as::post(timer_ioc, [&] { tim_offline_report.cancel(); });
         guard_timer_ioc.reset();
         th_timer.join();
         ASYNC_MQTT_LOG("mqtt_broker", trace) << "th_timer joined";
 
+        as::post(
+            snapshot_ioc,
+            [&] {
+                tim_retained_snapshot.cancel();
+                tim_metrics.cancel();
+                if (metrics_ac) metrics_ac->close();
+            }
+        );
+        th_snapshot.join();
+        ASYNC_MQTT_LOG("mqtt_broker", trace) << "th_snapshot joined";
+
         signals.cancel();
         th_signal.join();
         ASYNC_MQTT_LOG("mqtt_broker", trace) << "th_signal joined";
@@ -704,6 +1264,124 @@ int main(int argc, char *argv[]) {
                 boost::program_options::value<std::size_t>()->default_value(1),
                 "Number of worker threads for each io_context."
             )
+            (
+                "shards",
+                boost::program_options::value<std::size_t>()->default_value(0),
+                "Number of broker shards. If set 0 then the broker is not sharded. "
+                "Sessions are partitioned by client id and the shard N is pinned to the io_context N % iocs. "
+                "Setting the same value as iocs is recommended."
+            )
+            (
+                "subscription_snapshot",
+                boost::program_options::value<bool>()->default_value(false),
+                "Match PUBLISH against an immutable snapshot of the subscriptions without locking. "
+                "SUBSCRIBE/UNSUBSCRIBE never block publishers but copy the whole subscription map."
+            )
+            (
+                "shared_sub_strategy",
+                boost::program_options::value<std::string>()->default_value("round_robin"),
+                "How a shared subscription chooses the member for each message. "
+                "round_robin, least_inflight, sticky (by topic name) or local_shard_first"
+            )
+            (
+                "shared_sub_max_inflight",
+                boost::program_options::value<std::size_t>()->default_value(0),
+                "A shared subscription member that has this number of unacknowledged QoS1/QoS2 messages "
+                "is skipped. 0 means unlimited"
+            )
+            (
+                "session_store_dir",
+                boost::program_options::value<std::string>(),
+                "Directory of the write-ahead log of the sessions. If set, sessions that remain after "
+                "disconnection and their offline messages survive the broker restart. "
+                "Each shard uses the sub directory shard-N."
+            )
+            (
+                "session_store_fsync",
+                boost::program_options::value<bool>()->default_value(true),
+                "Call fsync on each group commit of the session store"
+            )
+            (
+                "session_store_commit_interval_us",
+                boost::program_options::value<std::size_t>()->default_value(1000),
+                "Maximum time in microseconds to wait for more records before the group commit"
+            )
+            (
+                "session_store_segment_size",
+                boost::program_options::value<std::size_t>()->default_value(64 * 1024 * 1024),
+                "Size of a segment file of the session store. Closed segments are compacted into a snapshot"
+            )
+            (
+                "offline_max_messages",
+                boost::program_options::value<std::size_t>()->default_value(0),
+                "Maximum number of the offline messages of a session. 0 means unlimited"
+            )
+            (
+                "offline_max_bytes",
+                boost::program_options::value<std::size_t>()->default_value(0),
+                "Maximum sum of the payload sizes of the offline messages of a session. 0 means unlimited"
+            )
+            (
+                "offline_global_max_messages",
+                boost::program_options::value<std::size_t>()->default_value(0),
+                "Maximum number of the offline messages of all sessions. 0 means unlimited"
+            )
+            (
+                "offline_global_max_bytes",
+                boost::program_options::value<std::size_t>()->default_value(0),
+                "Maximum sum of the payload sizes of the offline messages of all sessions. 0 means unlimited"
+            )
+            (
+                "offline_overflow_policy",
+                boost::program_options::value<std::string>()->default_value("drop_oldest"),
+                "Behavior when a new offline message exceeds the limits. "
+                "drop_oldest, drop_newest, drop_qos0_first or disconnect"
+            )
+            (
+                "offline_queue_report_interval",
+                boost::program_options::value<std::size_t>()->default_value(0),
+                "Interval in seconds to log the largest offline queues. 0 means no report"
+            )
+            (
+                "offline_queue_report_num",
+                boost::program_options::value<std::size_t>()->default_value(10),
+                "Number of the offline queues in the report"
+            )
+            (
+                "retained_snapshot_file",
+                boost::program_options::value<std::string>(),
+                "File of the retained messages snapshot. If set, the snapshot is mapped on start and "
+                "the retained messages are written to it periodically"
+            )
+            (
+                "retained_snapshot_interval",
+                boost::program_options::value<std::size_t>()->default_value(60),
+                "Interval in seconds to write the retained messages snapshot if they are modified. "
+                "0 means no periodic write"
+            )
+            (
+                "metrics_interval",
+                boost::program_options::value<std::size_t>()->default_value(0),
+                "Interval in seconds to publish the metrics on the retained $SYS/broker/ topics "
+                "and to write metrics_file. 0 means no periodic publication"
+            )
+            (
+                "metrics_file",
+                boost::program_options::value<std::string>(),
+                "File that the metrics are written to in the Prometheus text format every metrics_interval"
+            )
+            (
+                "metrics_port",
+                boost::program_options::value<std::uint16_t>()->default_value(0),
+                "Port of the plain HTTP endpoint that responds with the metrics in the Prometheus text format. "
+                "0 means no endpoint"
+            )
+            (
+                "metrics_address",
+                boost::program_options::value<std::string>()->default_value("127.0.0.1"),
+                "Address that the metrics endpoint is bound to. The endpoint has no authentication, "
+                "so expose it only to trusted networks, e.g. 0.0.0.0 behind a firewall"
+            )
             (
                 "tcp_no_delay",
                 boost::program_options::value<bool>()->default_value(true),
@@ -724,10 +1402,25 @@ int main(int argc, char *argv[]) {
                 boost::program_options::value<bool>()->default_value(false),
                 "Set bulk write mode for all connections"
             )
+            (
+                "bulk_write_max_bytes",
+                boost::program_options::value<std::size_t>()->default_value(am::default_bulk_write_max_bytes),
+                "Maximum bytes of packets that are concatenated into one write in bulk write mode"
+            )
+            (
+                "bulk_write_max_iovecs",
+                boost::program_options::value<std::size_t>()->default_value(am::default_bulk_write_max_iovecs),
+                "Maximum number of buffers that are concatenated into one write in bulk write mode"
+            )
             (
                 "bulk_read_buf_size",
-                boost::program_options::value<std::size_t>()->default_value(0),
-                "If 0(default), disable bulk read. Otherwise the buffer size of internal async_read_some() call for bulk read"
+                boost::program_options::value<std::size_t>()->default_value(am::default_bulk_read_buffer_size),
+                "If 0, disable bulk read. Otherwise the size of internal read buffer (slab) for bulk read"
+            )
+            (
+                "lazy_property_decoding",
+                boost::program_options::value<bool>()->default_value(false),
+                "Validate the properties of received PUBLISH packets but decode them only when needed"
             )
             (
                 "recycling_allocator",
@@ -769,6 +1462,11 @@ int main(int argc, char *argv[]) {
                 boost::program_options::value<bool>()->default_value(false),
                 "Use the specific CPU core by ioc."
             )
+            (
+                "reuseport_acceptors",
+                boost::program_options::value<bool>()->default_value(false),
+                "Open a SO_REUSEPORT listening socket per ioc. Each ioc accepts and handshakes its own connections."
+            )
             ;
 
         boost::program_options::options_description notls_desc("TCP Server options");
@@ -0,0 +1,322 @@
+// Copyright Takatoshi Kondo 2024
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_BENCH_HDR_HISTOGRAM_HPP)
+#define ASYNC_MQTT_BENCH_HDR_HISTOGRAM_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/assert.hpp>
+
+namespace async_mqtt {
+
+/**
+ * @brief High Dynamic Range histogram
+ * The values from 0 to highest are recorded with the given number of significant
+ * decimal digits. e.g. when significant_digits is 3, the recorded value 123456 is
+ * distinguished from 123556 but not from 123500. The relative error of the
+ * percentiles is smaller than 10^-significant_digits regardless of the magnitude
+ * of the value.
+ * The layout is the same as HdrHistogram. The range is split into the buckets of
+ * the powers of 2, each bucket has the same number of linear sub buckets.
+ * Values greater than highest are counted as highest, and counted by overflow().
+ * min(), max(), and mean() are exact.
+ *
+ * #### Thread Safety
+ *    - Distinct objects: Safe
+ *    - Shared objects: Unsafe
+ */
+class hdr_histogram {
+public:
+    /**
+     * @brief constructor
+     * @param highest            the highest trackable value. it must be 2 or greater.
+     * @param significant_digits the number of significant decimal digits. from 1 to 5.
+     */
+    explicit hdr_histogram(
+        std::uint64_t highest = 3'600'000'000,
+        int significant_digits = 3
+    )
+        :highest_{highest},
+         significant_digits_{significant_digits}
+    {
+        BOOST_ASSERT(highest >= 2);
+        BOOST_ASSERT(significant_digits >= 1 && significant_digits <= 5);
+        std::uint64_t largest_single_unit = 2;
+        for (int i = 0; i != significant_digits; ++i) largest_single_unit *= 10;
+        int sub_bucket_count_magnitude = bit_width(largest_single_unit - 1);
+        sub_bucket_half_count_magnitude_ = sub_bucket_count_magnitude - 1;
+        sub_bucket_count_ = std::uint64_t(1) << sub_bucket_count_magnitude;
+        sub_bucket_half_count_ = sub_bucket_count_ / 2;
+        sub_bucket_mask_ = sub_bucket_count_ - 1;
+
+        std::size_t bucket_count = 1;
+        for (auto smallest_untrackable = sub_bucket_count_;
+             smallest_untrackable <= highest;
+             smallest_untrackable <<= 1) {
+            ++bucket_count;
+            if (smallest_untrackable > std::numeric_limits<std::uint64_t>::max() / 2) break;
+        }
+        counts_.resize((bucket_count + 1) * sub_bucket_half_count_);
+    }
+
+    /**
+     * @brief record the value
+     * @param value the value
+     * @param n     the number of times
+     */
+    void record(std::uint64_t value, std::uint64_t n = 1) {
+        if (n == 0) return;
+        if (value > highest_) {
+            overflow_ += n;
+            counts_[index(highest_)] += n;
+        }
+        else {
+            counts_[index(value)] += n;
+        }
+        if (total_ == 0 || value < min_) min_ = value;
+        if (value > max_) max_ = value;
+        total_ += n;
+        sum_ += double(value) * double(n);
+    }
+
+    /**
+     * @brief add all values recorded by other
+     * The layout of other can be different from this.
+     * @param other the histogram to merge
+     */
+    void merge(hdr_histogram const& other) {
+        if (other.total_ == 0) return;
+        min_ = total_ == 0 ? other.min_ : std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+        sum_ += other.sum_;
+        if (same_layout(other)) {
+            for (std::size_t i = 0; i != counts_.size(); ++i) counts_[i] += other.counts_[i];
+            total_ += other.total_;
+            overflow_ += other.overflow_;
+        }
+        else {
+            // the overflowed values of other are counted here by the loop if they are
+            // greater than highest_
+            if (other.value_from_index(other.index(other.highest_)) <= highest_) {
+                overflow_ += other.overflow_;
+            }
+            for (std::size_t i = 0; i != other.counts_.size(); ++i) {
+                auto c = other.counts_[i];
+                if (c == 0) continue;
+                auto v = other.value_from_index(i);
+                if (v > highest_) {
+                    overflow_ += c;
+                    v = highest_;
+                }
+                counts_[index(v)] += c;
+                total_ += c;
+            }
+        }
+    }
+
+    std::uint64_t count() const {
+        return total_;
+    }
+
+    std::uint64_t overflow() const {
+        return overflow_;
+    }
+
+    std::uint64_t highest() const {
+        return highest_;
+    }
+
+    int significant_digits() const {
+        return significant_digits_;
+    }
+
+    std::uint64_t min() const {
+        return min_;
+    }
+
+    std::uint64_t max() const {
+        return max_;
+    }
+
+    double mean() const {
+        if (total_ == 0) return 0;
+        return sum_ / double(total_);
+    }
+
+    /**
+     * @brief get the value at the percentile
+     * The value is the highest value that is equivalent to the recorded one,
+     * so it is never smaller than the actual value. The percentile 100 is max().
+     * @param percentile from 0 to 100
+     * @return the value. 0 if nothing is recorded.
+     */
+    std::uint64_t value_at_percentile(double percentile) const {
+        if (total_ == 0) return 0;
+        if (percentile >= 100.0) return max_;
+        percentile = std::max(percentile, 0.0);
+        auto target = static_cast<std::uint64_t>(
+            std::ceil(percentile / 100.0 * double(total_))
+        );
+        target = std::max(target, std::uint64_t(1));
+        std::uint64_t cumulative = 0;
+        for (std::size_t i = 0; i != counts_.size(); ++i) {
+            cumulative += counts_[i];
+            if (cumulative >= target) {
+                return std::min(std::max(highest_equivalent_value(i), min_), max_);
+            }
+        }
+        return max_;
+    }
+
+    /**
+     * @brief call func for each recorded value
+     * @param func the function called as func(lowest, highest, count). lowest and highest
+     *             are the range of the values that are counted as the same.
+     */
+    template <typename Func>
+    void for_each(Func&& func) const {
+        for (std::size_t i = 0; i != counts_.size(); ++i) {
+            if (counts_[i] == 0) continue;
+            func(value_from_index(i), highest_equivalent_value(i), counts_[i]);
+        }
+    }
+
+    /**
+     * @brief write the histogram as text
+     * The format is the header line `hdr <significant_digits> <highest> <count>
+     * <min> <max> <sum> <overflow>`, a `<value> <count>` line for each recorded
+     * value, and the `end` line. It is independent of the platform and can be
+     * read by read().
+     */
+    void write(std::ostream& o) const {
+        o << "hdr "
+          << significant_digits_ << ' '
+          << highest_ << ' '
+          << total_ << ' '
+          << min_ << ' '
+          << max_ << ' ';
+        auto prec = o.precision(17);
+        o << sum_;
+        o.precision(prec);
+        o << ' ' << overflow_ << '\n';
+        for_each(
+            [&](std::uint64_t lowest, std::uint64_t, std::uint64_t c) {
+                o << lowest << ' ' << c << '\n';
+            }
+        );
+        o << "end\n";
+    }
+
+    /**
+     * @brief read the histogram written by write()
+     * @param i the input stream
+     * @return the histogram
+     * @throw std::runtime_error if the input is malformed
+     */
+    static hdr_histogram read(std::istream& i) {
+        std::string tag;
+        int digits = 0;
+        std::uint64_t highest = 0;
+        std::uint64_t total = 0;
+        std::uint64_t min = 0;
+        std::uint64_t max = 0;
+        double sum = 0;
+        std::uint64_t overflow = 0;
+        if (!(i >> tag >> digits >> highest >> total >> min >> max >> sum >> overflow) ||
+            tag != "hdr" || digits < 1 || digits > 5 || highest < 2) {
+            throw std::runtime_error("hdr_histogram: invalid header");
+        }
+        hdr_histogram h{highest, digits};
+        std::uint64_t recorded = 0;
+        for (;;) {
+            std::string v;
+            if (!(i >> v)) throw std::runtime_error("hdr_histogram: end is not found");
+            if (v == "end") break;
+            std::uint64_t c = 0;
+            if (!(i >> c)) throw std::runtime_error("hdr_histogram: invalid count");
+            auto value = std::stoull(v);
+            if (value > highest) throw std::runtime_error("hdr_histogram: value out of range");
+            h.counts_[h.index(value)] += c;
+            recorded += c;
+        }
+        if (recorded != total) throw std::runtime_error("hdr_histogram: count mismatch");
+        h.total_ = total;
+        h.min_ = min;
+        h.max_ = max;
+        h.sum_ = sum;
+        h.overflow_ = overflow;
+        return h;
+    }
+
+private:
+    static int bit_width(std::uint64_t v) {
+        int w = 0;
+        while (v != 0) {
+            v >>= 1;
+            ++w;
+        }
+        return w;
+    }
+
+    bool same_layout(hdr_histogram const& other) const {
+        return
+            sub_bucket_count_ == other.sub_bucket_count_ &&
+            counts_.size() == other.counts_.size();
+    }
+
+    std::size_t index(std::uint64_t value) const {
+        int bucket = bit_width(value | sub_bucket_mask_) - (sub_bucket_half_count_magnitude_ + 1);
+        auto sub_bucket = value >> bucket;
+        return
+            (std::size_t(bucket + 1) << sub_bucket_half_count_magnitude_) +
+            std::size_t(sub_bucket - sub_bucket_half_count_);
+    }
+
+    int bucket_of_index(std::size_t i) const {
+        return std::max(int(i >> sub_bucket_half_count_magnitude_) - 1, 0);
+    }
+
+    std::uint64_t value_from_index(std::size_t i) const {
+        int bucket = int(i >> sub_bucket_half_count_magnitude_) - 1;
+        std::uint64_t sub_bucket = (i & (sub_bucket_half_count_ - 1)) + sub_bucket_half_count_;
+        if (bucket < 0) {
+            sub_bucket -= sub_bucket_half_count_;
+            bucket = 0;
+        }
+        return sub_bucket << bucket;
+    }
+
+    std::uint64_t highest_equivalent_value(std::size_t i) const {
+        return value_from_index(i) + (std::uint64_t(1) << bucket_of_index(i)) - 1;
+    }
+
+    std::uint64_t highest_;
+    int significant_digits_;
+    int sub_bucket_half_count_magnitude_ = 0;
+    std::uint64_t sub_bucket_count_ = 0;
+    std::uint64_t sub_bucket_half_count_ = 0;
+    std::uint64_t sub_bucket_mask_ = 0;
+    std::vector<std::uint64_t> counts_;
+    std::uint64_t total_ = 0;
+    std::uint64_t overflow_ = 0;
+    std::uint64_t min_ = 0;
+    std::uint64_t max_ = 0;
+    double sum_ = 0;
+};
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_BENCH_HDR_HISTOGRAM_HPP
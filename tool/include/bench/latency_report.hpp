@@ -0,0 +1,522 @@
+// Copyright Takatoshi Kondo 2024
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_BENCH_LATENCY_REPORT_HPP)
+#define ASYNC_MQTT_BENCH_LATENCY_REPORT_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/assert.hpp>
+
+#include <async_mqtt/util/move.hpp>
+
+#include <bench/hdr_histogram.hpp>
+
+namespace async_mqtt {
+
+/**
+ * @brief latency histograms for each phase and client group recorded by multiple threads
+ * #### Thread Safety
+ *    - Distinct objects: Safe
+ *    - Shared objects: record() is safe. merged() is safe after the recording
+ *      threads are joined or synchronized with the caller.
+ *
+ * Each thread records to its own histograms, so recording doesn't lock.
+ * The histograms are allocated on the first record of the phase and group.
+ */
+class latency_recorder {
+public:
+    /**
+     * @brief constructor
+     * @param phases             the number of phases
+     * @param groups             the number of client groups
+     * @param highest            the highest trackable value
+     * @param significant_digits the number of significant decimal digits
+     */
+    latency_recorder(
+        std::size_t phases,
+        std::size_t groups,
+        std::uint64_t highest = 3'600'000'000,
+        int significant_digits = 3
+    )
+        :id_{next_id()++},
+         phases_{phases},
+         groups_{groups},
+         highest_{highest},
+         significant_digits_{significant_digits}
+    {
+        BOOST_ASSERT(phases != 0);
+        BOOST_ASSERT(groups != 0);
+    }
+
+    latency_recorder(latency_recorder const&) = delete;
+    latency_recorder& operator=(latency_recorder const&) = delete;
+
+    void record(std::size_t phase, std::size_t group, std::uint64_t value) {
+        BOOST_ASSERT(phase < phases_);
+        BOOST_ASSERT(group < groups_);
+        auto& h = local().hists[phase * groups_ + group];
+        if (!h) h = std::make_unique<hdr_histogram>(highest_, significant_digits_);
+        h->record(value);
+    }
+
+    /**
+     * @brief get the histogram merged from all threads
+     * @param phase the phase
+     * @param group the client group
+     * @return the merged histogram
+     */
+    hdr_histogram merged(std::size_t phase, std::size_t group) const {
+        BOOST_ASSERT(phase < phases_);
+        BOOST_ASSERT(group < groups_);
+        hdr_histogram h{highest_, significant_digits_};
+        std::lock_guard<std::mutex> g{mtx_};
+        for (auto const& sl : slots_) {
+            if (auto const& p = sl->hists[phase * groups_ + group]) h.merge(*p);
+        }
+        return h;
+    }
+
+    /**
+     * @brief clear the histograms of the phase
+     * It must not be called concurrently with record() of the phase.
+     * @param phase the phase
+     */
+    void reset(std::size_t phase) {
+        BOOST_ASSERT(phase < phases_);
+        std::lock_guard<std::mutex> g{mtx_};
+        for (auto& sl : slots_) {
+            for (std::size_t group = 0; group != groups_; ++group) {
+                sl->hists[phase * groups_ + group].reset();
+            }
+        }
+    }
+
+    std::size_t phases() const {
+        return phases_;
+    }
+
+    std::size_t groups() const {
+        return groups_;
+    }
+
+    std::size_t threads() const {
+        std::lock_guard<std::mutex> g{mtx_};
+        return slots_.size();
+    }
+
+private:
+    struct slot {
+        explicit slot(std::size_t num)
+            :hists(num)
+        {
+        }
+        std::vector<std::unique_ptr<hdr_histogram>> hists;
+    };
+
+    slot& local() {
+        // the same way as broker_metrics
+        auto& c = cache();
+        if (c.id == id_) return *c.sl;
+        return register_thread(c);
+    }
+
+    struct thread_cache {
+        std::uint64_t id = 0;
+        slot* sl = nullptr;
+    };
+
+    static thread_cache& cache() {
+        thread_local thread_cache c;
+        return c;
+    }
+
+    slot& register_thread(thread_cache& c) {
+        std::lock_guard<std::mutex> g{mtx_};
+        auto [it, inserted] = index_.emplace(std::this_thread::get_id(), nullptr);
+        if (inserted) {
+            slots_.push_back(std::make_unique<slot>(phases_ * groups_));
+            it->second = slots_.back().get();
+        }
+        c.id = id_;
+        c.sl = it->second;
+        return *c.sl;
+    }
+
+    static std::atomic<std::uint64_t>& next_id() {
+        static std::atomic<std::uint64_t> id{1};
+        return id;
+    }
+
+    std::uint64_t id_;
+    std::size_t phases_;
+    std::size_t groups_;
+    std::uint64_t highest_;
+    int significant_digits_;
+    mutable std::mutex mtx_;
+    std::map<std::thread::id, slot*> index_;
+    std::vector<std::unique_ptr<slot>> slots_;
+};
+
+/**
+ * @brief the number of messages in an interval
+ * The interval ends at ts_ms. It is aligned to the interval on the system clock,
+ * so the samples of the processes on the synchronized hosts can be summed up.
+ */
+struct throughput_sample {
+    std::int64_t ts_ms;     ///< the end of the interval. milliseconds since epoch
+    std::uint64_t sent;     ///< messages sent in the interval
+    std::uint64_t received; ///< messages received in the interval
+};
+
+/**
+ * @brief sent and received messages counted by multiple threads
+ * #### Thread Safety
+ *    - Distinct objects: Safe
+ *    - Shared objects: Safe
+ */
+class throughput_series {
+public:
+    explicit throughput_series(std::uint64_t interval_ms = 1000)
+        :interval_ms_{interval_ms}
+    {
+        BOOST_ASSERT(interval_ms != 0);
+    }
+
+    void add_sent(std::uint64_t n = 1) {
+        sent_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void add_received(std::uint64_t n = 1) {
+        received_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    std::uint64_t interval_ms() const {
+        return interval_ms_;
+    }
+
+    /**
+     * @brief get the end of the interval that contains ts_ms
+     * @param ts_ms milliseconds since epoch
+     * @return milliseconds since epoch
+     */
+    std::int64_t interval_end(std::int64_t ts_ms) const {
+        auto iv = std::int64_t(interval_ms_);
+        return (ts_ms / iv + 1) * iv;
+    }
+
+    /**
+     * @brief add the messages counted since the previous sample as a sample
+     * The messages are added to the last sample if it has the same ts_ms.
+     * @param ts_ms the end of the interval
+     */
+    void sample(std::int64_t ts_ms) {
+        std::lock_guard<std::mutex> g{mtx_};
+        auto sent = sent_.load(std::memory_order_relaxed);
+        auto received = received_.load(std::memory_order_relaxed);
+        if (!samples_.empty() && samples_.back().ts_ms >= ts_ms) {
+            samples_.back().sent += sent - last_sent_;
+            samples_.back().received += received - last_received_;
+        }
+        else {
+            samples_.push_back(throughput_sample{ts_ms, sent - last_sent_, received - last_received_});
+        }
+        last_sent_ = sent;
+        last_received_ = received;
+    }
+
+    std::vector<throughput_sample> samples() const {
+        std::lock_guard<std::mutex> g{mtx_};
+        return samples_;
+    }
+
+private:
+    std::uint64_t interval_ms_;
+    std::atomic<std::uint64_t> sent_{0};
+    std::atomic<std::uint64_t> received_{0};
+    mutable std::mutex mtx_;
+    std::uint64_t last_sent_ = 0;
+    std::uint64_t last_received_ = 0;
+    std::vector<throughput_sample> samples_;
+};
+
+/**
+ * @brief latency histograms and throughput series of bench processes
+ * A report is written to a file by write() and the reports of several processes
+ * e.g. the manager, the workers, and the receivers, are merged by read() and merge().
+ * The histograms are merged by the phase and the group, and the samples are summed
+ * by ts_ms.
+ */
+struct latency_report {
+    static constexpr std::array<double, 5> percentiles{50.0, 90.0, 99.0, 99.9, 99.99};
+
+    struct entry {
+        std::string phase;
+        std::string group;
+        hdr_histogram hist;
+    };
+
+    void add(std::string phase, std::string group, hdr_histogram const& hist) {
+        for (auto& e : entries) {
+            if (e.phase == phase && e.group == group) {
+                e.hist.merge(hist);
+                return;
+            }
+        }
+        entries.push_back(entry{force_move(phase), force_move(group), hist});
+    }
+
+    /**
+     * @brief merge other into this
+     * @param other report to merge
+     * @throw std::runtime_error if the throughput intervals are different
+     */
+    void merge(latency_report const& other) {
+        for (auto const& [k, v] : other.info) {
+            auto it = info.find(k);
+            if (it == info.end()) {
+                info.emplace(k, v);
+            }
+            else if (it->second != v) {
+                it->second += ',' + v;
+            }
+        }
+        for (auto const& e : other.entries) add(e.phase, e.group, e.hist);
+        if (other.series.empty()) return;
+        if (series.empty()) {
+            interval_ms = other.interval_ms;
+        }
+        else if (interval_ms != other.interval_ms) {
+            throw std::runtime_error("latency_report: interval_ms mismatch");
+        }
+        std::map<std::int64_t, throughput_sample> m;
+        for (auto const& s : series) m.emplace(s.ts_ms, s);
+        for (auto const& s : other.series) {
+            auto [it, inserted] = m.emplace(s.ts_ms, s);
+            if (!inserted) {
+                it->second.sent += s.sent;
+                it->second.received += s.received;
+            }
+        }
+        series.clear();
+        for (auto const& kv : m) series.push_back(kv.second);
+    }
+
+    /**
+     * @brief write the report to be read by read()
+     */
+    void write(std::ostream& o) const {
+        o << "latency_report 1\n";
+        for (auto const& [k, v] : info) {
+            o << "info " << k << ' ' << v << '\n';
+        }
+        for (auto const& e : entries) {
+            o << "entry " << e.phase << ' ' << e.group << '\n';
+            e.hist.write(o);
+        }
+        o << "series " << interval_ms << ' ' << series.size() << '\n';
+        for (auto const& s : series) {
+            o << s.ts_ms << ' ' << s.sent << ' ' << s.received << '\n';
+        }
+        o << "end\n";
+    }
+
+    /**
+     * @brief read the report written by write()
+     * @throw std::runtime_error if the input is malformed
+     */
+    static latency_report read(std::istream& i) {
+        latency_report r;
+        std::string tag;
+        int version = 0;
+        if (!(i >> tag >> version) || tag != "latency_report" || version != 1) {
+            throw std::runtime_error("latency_report: invalid header");
+        }
+        for (;;) {
+            if (!(i >> tag)) throw std::runtime_error("latency_report: end is not found");
+            if (tag == "end") break;
+            if (tag == "info") {
+                std::string k;
+                std::string v;
+                i >> k >> std::ws;
+                std::getline(i, v);
+                r.info[k] = v;
+            }
+            else if (tag == "entry") {
+                std::string phase;
+                std::string group;
+                i >> phase >> group;
+                r.add(force_move(phase), force_move(group), hdr_histogram::read(i));
+            }
+            else if (tag == "series") {
+                std::size_t num = 0;
+                if (!(i >> r.interval_ms >> num) || r.interval_ms == 0) {
+                    throw std::runtime_error("latency_report: invalid series");
+                }
+                for (std::size_t n = 0; n != num; ++n) {
+                    throughput_sample s{};
+                    if (!(i >> s.ts_ms >> s.sent >> s.received)) {
+                        throw std::runtime_error("latency_report: invalid sample");
+                    }
+                    r.series.push_back(s);
+                }
+            }
+            else {
+                throw std::runtime_error("latency_report: unknown tag " + tag);
+            }
+        }
+        return r;
+    }
+
+    /**
+     * @brief write the percentiles of each entry as a table
+     * @param unit the unit of the values
+     */
+    void write_text(std::ostream& o, std::string const& unit = "us") const {
+        auto flags = o.flags();
+        o << std::left << std::setw(12) << "phase" << std::setw(10) << "group"
+          << std::right << std::setw(10) << "count"
+          << std::setw(10) << "min";
+        for (auto p : percentiles) o << std::setw(10) << percentile_label(p);
+        o << std::setw(10) << "max" << std::setw(12) << "mean"
+          << "  (" << unit << ")\n";
+        for (auto const& e : entries) {
+            o << std::left << std::setw(12) << e.phase << std::setw(10) << e.group
+              << std::right << std::setw(10) << e.hist.count()
+              << std::setw(10) << e.hist.min();
+            for (auto p : percentiles) o << std::setw(10) << e.hist.value_at_percentile(p);
+            o << std::setw(10) << e.hist.max()
+              << std::setw(12) << std::fixed << std::setprecision(1) << e.hist.mean();
+            if (e.hist.overflow() != 0) o << "  overflow:" << e.hist.overflow();
+            o << '\n';
+        }
+        o.flags(flags);
+    }
+
+    /**
+     * @brief write the report as JSON
+     * The object has `info`, `latency` as the array of the entries that have the
+     * percentiles, and `throughput` as the array of the samples.
+     */
+    void write_json(std::ostream& o, std::string const& unit = "us") const {
+        o << "{\n  \"info\": {";
+        bool first = true;
+        for (auto const& [k, v] : info) {
+            o << (first ? "\n" : ",\n") << "    " << quote(k) << ": " << quote(v);
+            first = false;
+        }
+        o << (first ? "},\n" : "\n  },\n");
+        o << "  \"unit\": " << quote(unit) << ",\n";
+        o << "  \"latency\": [";
+        first = true;
+        for (auto const& e : entries) {
+            o << (first ? "\n" : ",\n")
+              << "    {\"phase\": " << quote(e.phase)
+              << ", \"group\": " << quote(e.group)
+              << ", \"count\": " << e.hist.count()
+              << ", \"min\": " << e.hist.min();
+            for (auto p : percentiles) {
+                o << ", \"" << percentile_label(p) << "\": " << e.hist.value_at_percentile(p);
+            }
+            o << ", \"max\": " << e.hist.max()
+              << ", \"mean\": " << std::fixed << std::setprecision(1) << e.hist.mean()
+              << ", \"overflow\": " << e.hist.overflow()
+              << "}";
+            first = false;
+        }
+        o << (first ? "],\n" : "\n  ],\n");
+        o << "  \"interval_ms\": " << interval_ms << ",\n";
+        o << "  \"throughput\": [";
+        first = true;
+        for (auto const& s : series) {
+            o << (first ? "\n" : ",\n")
+              << "    {\"ts_ms\": " << s.ts_ms
+              << ", \"sent\": " << s.sent
+              << ", \"received\": " << s.received
+              << "}";
+            first = false;
+        }
+        o << (first ? "]\n" : "\n  ]\n");
+        o << "}\n";
+    }
+
+    /**
+     * @brief write the percentiles of each entry as CSV
+     */
+    void write_latency_csv(std::ostream& o) const {
+        o << "phase,group,count,min";
+        for (auto p : percentiles) o << ',' << percentile_label(p);
+        o << ",max,mean,overflow\n";
+        for (auto const& e : entries) {
+            o << e.phase << ',' << e.group << ',' << e.hist.count() << ',' << e.hist.min();
+            for (auto p : percentiles) o << ',' << e.hist.value_at_percentile(p);
+            o << ',' << e.hist.max()
+              << ',' << std::fixed << std::setprecision(1) << e.hist.mean()
+              << ',' << e.hist.overflow() << '\n';
+        }
+    }
+
+    /**
+     * @brief write the throughput series as CSV
+     * The rates are messages per second.
+     */
+    void write_throughput_csv(std::ostream& o) const {
+        o << "ts_ms,sent,received,sent_per_sec,received_per_sec\n";
+        for (auto const& s : series) {
+            o << s.ts_ms << ',' << s.sent << ',' << s.received
+              << ',' << s.sent * 1000 / interval_ms
+              << ',' << s.received * 1000 / interval_ms << '\n';
+        }
+    }
+
+    static std::string percentile_label(double p) {
+        // 99.9 -> p99_9
+        std::string s = std::to_string(p);
+        s.erase(s.find_last_not_of('0') + 1);
+        if (s.back() == '.') s.pop_back();
+        std::replace(s.begin(), s.end(), '.', '_');
+        return "p" + s;
+    }
+
+    std::map<std::string, std::string> info;
+    std::vector<entry> entries;
+    std::uint64_t interval_ms = 1000;
+    std::vector<throughput_sample> series;
+
+private:
+    static std::string quote(std::string const& s) {
+        std::string r = "\"";
+        for (char c : s) {
+            switch (c) {
+            case '"':  r += "\\\""; break;
+            case '\\': r += "\\\\"; break;
+            case '\n': r += "\\n"; break;
+            default:   r += c; break;
+            }
+        }
+        r += '"';
+        return r;
+    }
+};
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_BENCH_LATENCY_REPORT_HPP
@@ -7,15 +7,25 @@
 #if !defined(ASYNC_MQTT_BROKER_BROKER_HPP)
 #define ASYNC_MQTT_BROKER_BROKER_HPP
 
+#include <algorithm>
+#include <filesystem>
+#include <unordered_map>
+
+#include <boost/container/small_vector.hpp>
+
 #include <async_mqtt/all.hpp>
 #include <broker/endpoint_variant.hpp>
+#include <broker/metrics.hpp>
 #include <broker/security.hpp>
 #include <broker/mutex.hpp>
 #include <broker/session_state.hpp>
+#include <broker/session_store.hpp>
 #include <broker/sub_con_map.hpp>
 #include <broker/retained_messages.hpp>
 #include <broker/retained_topic_map.hpp>
+#include <broker/rcu.hpp>
 #include <broker/shared_target_impl.hpp>
+#include <broker/sharded_broker_fwd.hpp>
 #include <broker/mutex.hpp>
 #include <broker/uuid.hpp>
 
@@ -34,9 +44,14 @@ public:
     broker(as::io_context& timer_ioc, bool recycling_allocator = false)
         :timer_ioc_{timer_ioc},
          tim_disconnect_{timer_ioc_},
+         mtx_shared_subs_map_{mtx_subs_map_},
+         shared_subs_map_{subs_map_},
+         shared_targets_{own_shared_targets_},
+         retains_{own_retains_},
          recycling_allocator_{recycling_allocator} {
         std::unique_lock<mutex> g_sec{mtx_security_};
         security_.default_config();
+        security_updated();
     }
 
     void handle_accept(epsp_type epsp, std::optional<std::string> preauthed_user_name = {}) {
@@ -50,9 +65,348 @@ public:
     void set_security(security&& sec) {
         std::unique_lock<mutex> g_sec{mtx_security_};
         security_ = force_move(sec);
+        security_updated();
+    }
+
+    /**
+     * @brief enable the snapshot mode of the subscription map
+     *
+     * Publishers match the topic against an immutable snapshot of the
+     * subscriptions without locking, so SUBSCRIBE/UNSUBSCRIBE never block them.
+     * Instead, the publisher thread of the map copies it at most once per
+     * rcu_subscription_map's publish interval, and SUBACK/UNSUBACK are sent
+     * after the copy.
+     * It must be called before accepting connections.
+     */
+    void enable_subscription_snapshot() {
+        subs_map_.enable_snapshot(mtx_subs_map_);
+    }
+
+    /**
+     * @brief set the quota of the offline messages
+     *
+     * Offline messages are queued while the client is disconnected or its packet
+     * ids are exhausted. When a new message exceeds the limits of the session or
+     * the total limits of the broker, the policy is applied to the session.
+     * It must be called before accepting connections.
+     * @param session limits of each session
+     * @param global  limits of the total of all sessions
+     * @param policy  overflow policy
+     */
+    void set_offline_quota(
+        offline_limits session,
+        offline_limits global,
+        offline_overflow_policy policy
+    ) {
+        offline_quota_.session = session;
+        offline_quota_.global = global;
+        offline_quota_.policy = policy;
+    }
+
+    /**
+     * @brief set how the shared subscription group chooses the member
+     *
+     * On the shard of sharded_broker, the settings of the group are used.
+     * It must be called before accepting connections.
+     * @param strategy     the strategy to choose the member
+     * @param max_inflight the member that has this number of unacknowledged QoS1/QoS2
+     *                     messages is skipped. 0 means no limit.
+     */
+    void set_shared_subscription(shared_strategy strategy, std::size_t max_inflight = 0) {
+        shared_targets_.set_strategy(strategy, max_inflight);
+    }
+
+    /**
+     * @brief get the quota of the offline messages and the current total
+     */
+    offline_quota const& get_offline_quota() const {
+        return offline_quota_;
+    }
+
+    /**
+     * @brief get the largest offline queues
+     * @param num the maximum number of the queues
+     * @return queues in descending order of bytes
+     */
+    std::vector<offline_queue_info> largest_offline_queues(std::size_t num) const {
+        std::vector<offline_queue_info> queues;
+        {
+            std::shared_lock<mutex> g(mtx_sessions_);
+            for (auto const& ss : sessions_.template get<tag_cid>()) {
+                auto [messages, bytes] = ss->offline_queue_usage();
+                if (messages == 0) continue;
+                queues.push_back(
+                    offline_queue_info{ss->get_username(), ss->client_id(), messages, bytes}
+                );
+            }
+        }
+        keep_largest_offline_queues(queues, num);
+        return queues;
+    }
+
+    /**
+     * @brief set the persistence backend of the sessions
+     *
+     * The persistent sessions in the store are restored as offline sessions with
+     * their subscriptions, offline messages and inflight messages. After that, the
+     * changes of the persistent sessions are appended to the store.
+     * Will messages and QoS2 packet ids received from the clients are not stored.
+     * It must be called before accepting connections.
+     * @param store session store
+     */
+    void set_session_store(std::shared_ptr<session_store> store) {
+        session_images images;
+        store->load(images);
+
+        std::lock_guard<mutex> g(mtx_sessions_);
+        auto& idx = sessions_.template get<tag_cid>();
+        std::size_t restored = 0;
+        for (auto const& [key, image] : images) {
+            auto sssp = session_state<epsp_type>::restore(
+                timer_ioc_,
+                mtx_subs_map_,
+                subs_map_,
+                mtx_shared_subs_map_,
+                shared_subs_map_,
+                shared_targets_,
+                offline_quota_,
+                image,
+                store,
+                // will_sender
+                [this](auto&&... params) {
+                    this->do_publish(std::forward<decltype(params)>(params)...);
+                },
+                [this](std::shared_ptr<as::steady_timer> const& sp_tim) {
+                    session_expired(sp_tim);
+                }
+            );
+            if (!sssp) {
+                // expired while the broker was stopped
+                std::string record;
+                session_record::erase(record, image.username, image.client_id);
+                store->append(record);
+                continue;
+            }
+            idx.insert(force_move(sssp));
+            ++restored;
+        }
+        session_store_ = force_move(store);
+        ASYNC_MQTT_LOG("mqtt_broker", info)
+            << ASYNC_MQTT_ADD_VALUE(address, this)
+            << "restored sessions:" << restored;
+    }
+
+    /**
+     * @brief set the snapshot of the retained messages
+     *
+     * The messages in the snapshot are served from the mapped file without loading.
+     * The messages published after that are kept in memory over the snapshot.
+     * It must be called before accepting connections.
+     * @param snapshot snapshot that is opened by retained_snapshot::open()
+     * @param delta    delta of the snapshot that is opened by retained_snapshot::open()
+     */
+    void set_retained_snapshot(
+        std::shared_ptr<retained_snapshot const> snapshot,
+        std::shared_ptr<retained_snapshot const> delta = nullptr
+    ) {
+        retains_.set_snapshot(force_move(snapshot), force_move(delta));
+        ASYNC_MQTT_LOG("mqtt_broker", info)
+            << ASYNC_MQTT_ADD_VALUE(address, this)
+            << "retained messages:" << retains_.size();
+    }
+
+    /**
+     * @brief write the snapshot of the retained messages
+     *
+     * Nothing is written if the retained messages are not modified since the last
+     * successful call. While the modified topics are a small part of the messages,
+     * only they are written to retained_snapshot::delta_path() of path. Otherwise,
+     * all messages are written to path and the delta is removed.
+     * The messages are collected under the lock, and the file is written without
+     * the lock. It must not be called concurrently.
+     * @param path file path of the full snapshot
+     * @return true if succeeded or not modified
+     */
+    bool save_retained_snapshot(std::string const& path) {
+        if (saved_retains_generation_ == retains_.generation()) return true;
+        retained_snapshot_writer writer;
+        auto generation = retains_.collect_changes(writer);
+        auto delta_path = retained_snapshot::delta_path(path);
+        if (!writer.write(writer.is_delta() ? delta_path : path)) return false;
+        if (!writer.is_delta()) {
+            // the old delta is based on the replaced snapshot
+            std::error_code ec;
+            std::filesystem::remove(delta_path, ec);
+        }
+        retains_.saved(writer, generation);
+        saved_retains_generation_ = generation;
+        return true;
+    }
+
+    /**
+     * @brief set the metrics
+     *
+     * The received packets, the deliveries and the handler latencies are recorded to it.
+     * It must be called before accepting connections.
+     * @param metrics metrics. nullptr disables recording.
+     */
+    void set_metrics(std::shared_ptr<broker_metrics> metrics) {
+        metrics_ = force_move(metrics);
+    }
+
+    /**
+     * @brief aggregate the metrics and sample the gauges
+     * It can be called from any threads.
+     * @return aggregated values. The counters and histograms are zero if set_metrics() is not called.
+     */
+    broker_metrics::snapshot collect_metrics() const {
+        broker_metrics::snapshot s;
+        if (metrics_) s = metrics_->collect();
+        sample_gauges(s);
+        return s;
+    }
+
+    /**
+     * @brief publish the message from the broker itself
+     *
+     * It is used for the $SYS topics. The message is delivered to the subscribers
+     * that are authorized to subscribe the topic. If opts has retain, the message is
+     * retained.
+     * It can be called from any threads.
+     * @param topic   topic
+     * @param payload payload
+     * @param opts    publish options
+     */
+    void publish_system(buffer topic, buffer payload, pub::opts opts) {
+        std::shared_lock<mutex> g(mtx_sessions_);
+        do_publish_local(
+            std::string{},
+            protocol_version::v5,
+            force_move(topic),
+            std::vector<buffer>{force_move(payload)},
+            opts,
+            property_block{},
+            // shared subscriptions of the group are processed by the first shard
+            !group_ || shard_index_ == 0
+        );
     }
 
 private:
+    friend class sharded_broker<Epsp>;
+
+    // Add the current values of this broker to the gauges of s.
+    void sample_gauges(broker_metrics::snapshot& s) const {
+        using gauge = broker_metrics::gauge;
+        std::size_t sessions = 0;
+        std::size_t connections = 0;
+        std::uint64_t queued = 0;
+        std::uint64_t queued_max = s.get(gauge::write_queue_max);
+        {
+            std::shared_lock<mutex> g(mtx_sessions_);
+            for (auto const& ss : sessions_.template get<tag_cid>()) {
+                ++sessions;
+                if (auto epsp = ss->lock()) {
+                    ++connections;
+                    auto q = epsp.get_write_stats().queued;
+                    queued += q;
+                    queued_max = std::max(queued_max, q);
+                }
+            }
+        }
+        s.set(gauge::sessions, s.get(gauge::sessions) + sessions);
+        s.set(gauge::connections, s.get(gauge::connections) + connections);
+        s.set(gauge::offline_messages, s.get(gauge::offline_messages) + offline_quota_.messages());
+        s.set(gauge::offline_bytes, s.get(gauge::offline_bytes) + offline_quota_.bytes());
+        s.set(gauge::offline_dropped, s.get(gauge::offline_dropped) + offline_quota_.dropped());
+        s.set(gauge::write_queue_packets, s.get(gauge::write_queue_packets) + queued);
+        s.set(gauge::write_queue_max, queued_max);
+    }
+
+    /**
+     * @brief constructor for a shard of sharded_broker
+     * @param timer_ioc       io_context for timers
+     * @param group           sharded_broker that owns this shard
+     * @param shard_index     index of this shard in the group
+     * @param shard_exe       all packets of the sessions that belong to this shard are handled on it
+     * @param mtx_shared_subs_map mutex of shared_subs_map
+     * @param shared_subs_map shared subscriptions of the group
+     * @param shared_targets  shared subscription targets of the group
+     * @param retains         retained messages of the group
+     * @param recycling_allocator use recycling_allocator for receiving packets
+     */
+    broker(
+        as::io_context& timer_ioc,
+        sharded_broker<Epsp>& group,
+        std::size_t shard_index,
+        as::any_io_executor shard_exe,
+        mutex& mtx_shared_subs_map,
+        sub_con_map<epsp_type>& shared_subs_map,
+        shared_target<epsp_type>& shared_targets,
+        retained_messages& retains,
+        bool recycling_allocator
+    )
+        :timer_ioc_{timer_ioc},
+         tim_disconnect_{timer_ioc_},
+         mtx_shared_subs_map_{mtx_shared_subs_map},
+         shared_subs_map_{shared_subs_map},
+         shared_targets_{shared_targets},
+         retains_{retains},
+         group_{&group},
+         shard_index_{shard_index},
+         shard_exe_{force_move(shard_exe)},
+         recycling_allocator_{recycling_allocator} {
+        std::unique_lock<mutex> g_sec{mtx_security_};
+        security_.default_config();
+        security_updated();
+    }
+
+    ~broker() {
+        // The sessions are destroyed after the grace period, and they refer to the
+        // members of the broker. Wait for them before the members are destroyed.
+        sessions_.clear();
+        subs_map_.sync();
+        shared_subs_map_.sync();
+        rcu_domain::instance().barrier();
+    }
+
+    // Called by sharded_broker on shard_exe_ with the CONNECT packet that
+    // has already been read for routing.
+    void handle_connect(epsp_type epsp, packet_variant pv) {
+        pv.visit(
+            overload {
+                [&](v3_1_1::connect_packet& p) {
+                    connect_handler(
+                        force_move(epsp),
+                        p.client_id(),
+                        p.user_name(),
+                        p.password(),
+                        p.get_will(),
+                        p.clean_session(),
+                        p.keep_alive(),
+                        properties{}
+                    );
+                },
+                [&](v5::connect_packet& p) {
+                    connect_handler(
+                        force_move(epsp),
+                        p.client_id(),
+                        p.user_name(),
+                        p.password(),
+                        p.get_will(),
+                        p.clean_start(),
+                        p.keep_alive(),
+                        p.props()
+                    );
+                },
+                [&](auto const&) {
+                    ASYNC_MQTT_LOG("mqtt_broker", fatal)
+                        << ASYNC_MQTT_ADD_VALUE(address, epsp.get_address())
+                        << "invalid variant";
+                }
+            }
+        );
+    }
+
     void async_read_packet(epsp_type epsp) {
         auto recv_proc =
             [this, epsp]
@@ -99,9 +453,9 @@ private:
                                 force_move(epsp),
                                 p.packet_id(),
                                 p.opts(),
-                                p.topic(),
+                                p.topic_as_buffer(),
                                 p.payload_as_buffer(),
-                                properties{}
+                                property_block{}
                             );
                         },
                         [&](v5::publish_packet& p) {
@@ -109,9 +463,10 @@ private:
                                 force_move(epsp),
                                 p.packet_id(),
                                 p.opts(),
-                                p.topic(),
+                                p.topic_as_buffer(),
                                 p.payload_as_buffer(),
-                                p.props()
+                                // not decoded if the packet is received with property_decoding::lazy
+                                p.props_as_block()
                             );
                         },
                         [&](v3_1_1::puback_packet& p) {
@@ -256,8 +611,27 @@ private:
                 );
             };
 
+        auto recv =
+            [&](auto&& h) {
+                // On the sharded broker, all packets of the session are
+                // handled on the executor of the shard that owns the session.
+                if (shard_exe_) {
+                    epsp.async_recv(
+                        as::bind_executor(
+                            *shard_exe_,
+                            std::forward<decltype(h)>(h)
+                        )
+                    );
+                }
+                else {
+                    epsp.async_recv(
+                        std::forward<decltype(h)>(h)
+                    );
+                }
+            };
+
         if (recycling_allocator_) {
-            epsp.async_recv(
+            recv(
                 as::bind_allocator(
                     as::recycling_allocator<char>(),
                     recv_proc
@@ -265,7 +639,7 @@ private:
             );
         }
         else {
-            epsp.async_recv(
+            recv(
                 recv_proc
             );
         }
@@ -281,6 +655,7 @@ private:
         std::uint16_t /*keep_alive*/,
         properties props
     ) {
+        if (metrics_) metrics_->add(broker_metrics::counter::connect);
         std::optional<std::string> username;
         if (auto paun_opt = epsp.get_preauthed_user_name()) {
             std::shared_lock<mutex> g_sec{mtx_security_};
@@ -407,7 +782,10 @@ private:
                     timer_ioc_,
                     mtx_subs_map_,
                     subs_map_,
+                    mtx_shared_subs_map_,
+                    shared_subs_map_,
                     shared_targets_,
+                    offline_quota_,
                     epsp,
                     client_id,
                     *username,
@@ -421,6 +799,8 @@ private:
                     force_move(session_expiry_interval)
                 )
             );
+            (*it)->set_store(session_store_);
+            (*it)->persist_session();
             if (response_topic_requested) {
                 // set_response_topic never modify key part
                 set_response_topic(const_cast<session_state<epsp_type>&>(**it), connack_props, *username);
@@ -488,7 +868,10 @@ private:
                                 timer_ioc_,
                                 mtx_subs_map_,
                                 subs_map_,
+                                mtx_shared_subs_map_,
+                                shared_subs_map_,
                                 shared_targets_,
+                                offline_quota_,
                                 epsp,
                                 client_id,
                                 *username,
@@ -503,6 +886,8 @@ private:
                             )
                         );
                         BOOST_ASSERT(inserted);
+                        (*it)->set_store(session_store_);
+                        (*it)->persist_session();
                         if (response_topic_requested) {
                             // set_response_topic never modify key part
                             set_response_topic(const_cast<session_state<epsp_type>&>(**it), connack_props, *username);
@@ -671,22 +1056,19 @@ private:
                 return rt;
             } ();
 
-        auto rule_nr =
-            [&] {
-                std::unique_lock<mutex> g_sec{mtx_security_};
-                return security_.add_auth(
-                    response_topic,
-                    { "@any" }, security::authorization::type::allow,
-                    { username }, security::authorization::type::allow
-                );
-            } ();
+        // Anyone can publish to the response topic, and only the user can subscribe it.
+        // The rule is not added to security_, so the cached decisions of the other
+        // topics are kept.
+        {
+            std::unique_lock<mutex> g{mtx_response_topics_};
+            response_topics_.insert_or_assign(response_topic, username);
+        }
 
         s.set_clean_handler(
-            [this, response_topic, rule_nr]() {
-                std::lock_guard<mutex> g(mtx_retains_);
+            [this, response_topic]() {
                 retains_.erase(response_topic);
-                std::unique_lock<mutex> g_sec{mtx_security_};
-                security_.remove_auth(rule_nr);
+                std::unique_lock<mutex> g{mtx_response_topics_};
+                response_topics_.erase(response_topic);
             }
         );
 
@@ -707,7 +1089,7 @@ private:
         case protocol_version::v3_1_1:
             if (client_id.empty()) {
                 if (clean_start) {
-                    epsp.set_client_id(create_uuid_string());
+                    assign_client_id(epsp);
                 }
                 else {
                     // https://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc385349242
@@ -759,7 +1141,7 @@ private:
                 // Handling errors, and then it MUST close the Network Connection [MQTT-3.1.3-8].
                 //
                 // mqtt_cpp author's note: On v5.0, no Clean Start restriction is described.
-                epsp.set_client_id(create_uuid_string());
+                assign_client_id(epsp);
                 connack_props.emplace_back(
                     property::assigned_client_identifier{std::string{epsp.get_client_id()}}
                 );
@@ -772,6 +1154,14 @@ private:
         return true;
     }
 
+    static void assign_client_id(epsp_type& epsp) {
+        // sharded_broker assigns the client id before routing the connection
+        // to the shard. In that case, the assigned one is used.
+        if (epsp.get_client_id().empty()) {
+            epsp.set_client_id(create_uuid_string());
+        }
+    }
+
     struct send_connack_op {
         this_type& brk;
         epsp_type epsp;
@@ -872,9 +1262,9 @@ private:
         epsp_type epsp,
         packet_id_type packet_id,
         pub::opts opts,
-        std::string topic,
+        buffer topic,
         std::vector<buffer> payload,
-        properties props
+        property_block props
     ) {
         auto usg = unique_scope_guard(
             [&] {
@@ -882,6 +1272,20 @@ private:
             }
         );
 
+        std::optional<std::chrono::steady_clock::time_point> start;
+        if (metrics_) {
+            if (metrics_->sample_latency()) start.emplace(std::chrono::steady_clock::now());
+            std::size_t bytes = 0;
+            for (auto const& b : payload) bytes += b.size();
+            metrics_->add(broker_metrics::counter::publish_received);
+            metrics_->add(broker_metrics::counter::publish_received_bytes, bytes);
+        }
+        auto lsg = unique_scope_guard(
+            [&] {
+                if (start) metrics_->record_since(broker_metrics::histogram::publish_handler_ns, *start);
+            }
+        );
+
         std::shared_lock<mutex> g(mtx_sessions_);
         auto& idx = sessions_.template get<tag_con>();
         auto it = idx.find(epsp);
@@ -893,8 +1297,9 @@ private:
         // erased from sessions_
         if (it == idx.end()) return;
 
+        // It captures by value to be called after the stored messages are committed.
         auto send_pubres =
-            [&] (bool authorized, bool matched) {
+            [this, epsp, packet_id, opts] (bool authorized, bool matched) mutable {
                 switch (opts.get_qos()) {
                 case qos::at_least_once:
                     switch (epsp.get_protocol_version()) {
@@ -1066,35 +1471,59 @@ private:
             };
 
         // See if this session is authorized to publish this topic
-        if ([&] {
-                std::shared_lock<mutex> g_sec{mtx_security_};
-                return security_.auth_pub(topic, (*it)->get_username()) != security::authorization::type::allow;
-            } ()
-        ) {
+        if (auth_pub(topic, (*it)->get_username()) != security::authorization::type::allow) {
             // Publish not authorized
+            if (metrics_) metrics_->add(broker_metrics::counter::publish_dropped);
             send_pubres(false, false);
             return;
         }
 
-        properties forward_props;
-
-        for (auto&& prop : props) {
-            force_move(prop).visit(
-                overload {
-                    [&](property::topic_alias&&) {
-                        // TopicAlias is not forwarded
-                        // https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901113
-                        // A receiver MUST NOT carry forward any Topic Alias mappings from
-                        // one Network Connection to another [MQTT-3.3.2-7].
-                    },
-                    [&](property::subscription_identifier&& p) {
-                        ASYNC_MQTT_LOG("mqtt_broker", warning)
-                            << ASYNC_MQTT_ADD_VALUE(address, epsp.get_address())
-                            << "Subscription Identifier from client not forwarded sid:" << p.val();
-                    },
-                    [&](auto&& p) {
-                        forward_props.push_back(force_move(p));
+        // TopicAlias and SubscriptionIdentifier are removed.
+        // If they are not contained, the properties are forwarded as they are encoded.
+        if (props.contains(property::id::topic_alias) ||
+            props.contains(property::id::subscription_identifier)) {
+            properties forward_props;
+            for (auto&& prop : props.to_properties()) {
+                force_move(prop).visit(
+                    overload {
+                        [&](property::topic_alias&&) {
+                            // TopicAlias is not forwarded
+                            // https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901113
+                            // A receiver MUST NOT carry forward any Topic Alias mappings from
+                            // one Network Connection to another [MQTT-3.3.2-7].
+                        },
+                        [&](property::subscription_identifier&& p) {
+                            ASYNC_MQTT_LOG("mqtt_broker", warning)
+                                << ASYNC_MQTT_ADD_VALUE(address, epsp.get_address())
+                                << "Subscription Identifier from client not forwarded sid:" << p.val();
+                        },
+                        [&](auto&& p) {
+                            forward_props.push_back(force_move(p));
+                        }
                     }
+                );
+            }
+            props = property_block{forward_props};
+        }
+
+        // The message is acknowledged after it is durable in the offline queues
+        // of the persistent sessions. On the sharded broker, the sessions could
+        // belong to the other shards that have their own stores. Each shard that
+        // the message is delivered to holds a copy of the gate until its store
+        // commits, and the acknowledgement is sent when the last copy is released.
+        // The value of the gate is whether the message matched.
+        std::shared_ptr<bool> commit_gate;
+        if (session_store_ && opts.get_qos() != qos::at_most_once) {
+            commit_gate.reset(
+                new bool{false},
+                [epsp, send_pubres = force_move(send_pubres)](bool* matched) {
+                    as::post(
+                        epsp.get_executor(),
+                        [send_pubres, matched = *matched]() mutable {
+                            send_pubres(true, matched);
+                        }
+                    );
+                    delete matched;
                 }
             );
         }
@@ -1104,9 +1533,15 @@ private:
             force_move(topic),
             force_move(payload),
             opts.get_qos() | opts.get_retain(), // remove dup flag
-            force_move(forward_props)
+            force_move(props),
+            commit_gate
         );
 
+        if (commit_gate) {
+            *commit_gate = matched;
+            hold_until_committed(force_move(commit_gate));
+            return;
+        }
         send_pubres(true, matched);
     }
 
@@ -1121,104 +1556,373 @@ private:
      */
     bool do_publish(
         session_state<epsp_type> const& source_ss,
-        std::string topic,
+        buffer topic,
         std::vector<buffer> payload,
         pub::opts opts,
         properties props
+    ) {
+        return do_publish(
+            source_ss,
+            force_move(topic),
+            force_move(payload),
+            opts,
+            property_block{props}
+        );
+    }
+
+    /**
+     * @brief do_publish Publish a message to any subscribed clients.
+     *
+     * @param source_ss - soource session_state.
+     * @param topic - The topic to publish the message on.
+     * @param payload - The payload of the message.
+     * @param pubopts - publish options
+     * @param props - encoded properties
+     * @param commit_gate - held by the shards until their session stores commit the message
+     */
+    bool do_publish(
+        session_state<epsp_type> const& source_ss,
+        buffer topic,
+        std::vector<buffer> payload,
+        pub::opts opts,
+        property_block props,
+        std::shared_ptr<void> const& commit_gate = nullptr
+    ) {
+        bool matched = false;
+        if (group_ && group_->size() > 1) {
+            // Posted only to the shards that have matching subscriptions.
+            matched = group_->publish_to_peers(
+                shard_index_,
+                source_ss.client_id(),
+                source_ss.get_protocol_version(),
+                topic,
+                payload,
+                opts,
+                props,
+                commit_gate
+            );
+        }
+        if (do_publish_local(
+                source_ss.client_id(),
+                source_ss.get_protocol_version(),
+                force_move(topic),
+                force_move(payload),
+                opts,
+                force_move(props),
+                true, // shared subscriptions
+                commit_gate
+            )
+        ) {
+            matched = true;
+        }
+        return matched;
+    }
+
+    // A message that is published on the other shard.
+    // It is shared by all the shards that it is posted to.
+    struct peer_publish {
+        std::string source_client_id;
+        protocol_version source_version;
+        buffer topic;
+        std::vector<buffer> payload;
+        pub::opts opts;
+        property_block props;
+        std::shared_ptr<void> commit_gate; ///< nullptr if the acknowledgement doesn't wait
+    };
+
+    /**
+     * @brief Publish a message that is published on the other shard.
+     *
+     * Called on shard_exe_ by sharded_broker.
+     * Shared subscriptions have already been processed by the source shard.
+     */
+    void publish_from_peer(peer_publish const& msg) {
+        std::shared_lock<mutex> g(mtx_sessions_);
+        do_publish_local(
+            msg.source_client_id,
+            msg.source_version,
+            msg.topic,
+            msg.payload,
+            msg.opts,
+            msg.props,
+            false // shared subscriptions
+        );
+        hold_until_committed(msg.commit_gate);
+    }
+
+    // Hold the gate until the records that are appended so far are committed.
+    void hold_until_committed(std::shared_ptr<void> commit_gate) {
+        if (!commit_gate || !session_store_) return;
+        session_store_->when_committed(
+            [commit_gate = force_move(commit_gate)] {}
+        );
+    }
+
+    /**
+     * @brief Deliver a message to the session that belongs to this shard.
+     *
+     * Called on shard_exe_ by sharded_broker when the other shard chooses
+     * the session as the target of the shared subscription.
+     * Authorization has already been checked by the source shard.
+     */
+    void deliver_from_peer(
+        std::string const& username,
+        std::string const& client_id,
+        buffer topic,
+        std::vector<buffer> payload,
+        pub::opts opts,
+        properties props,
+        std::shared_ptr<void> commit_gate
+    ) {
+        std::shared_lock<mutex> g(mtx_sessions_);
+        auto& idx = sessions_.template get<tag_cid>();
+        auto it = idx.find(std::make_tuple(username, client_id));
+        // The session could be erased after it was chosen.
+        if (it == idx.end()) return;
+        (*it)->deliver(
+            timer_ioc_,
+            force_move(topic),
+            force_move(payload),
+            opts,
+            force_move(props)
+        );
+        hold_until_committed(force_move(commit_gate));
+    }
+
+    // expire handler of timer_wheel. owner is expiry_owner of the retained message.
+    static void retained_message_expired(void* owner, void* context, timer_wheel::handle const* key) {
+        auto& brk = *static_cast<this_type*>(context);
+        auto const& topic = *static_cast<std::string const*>(owner);
+        brk.retains_.erase_if(
+            topic,
+            [&](retain_type const& r) {
+                // the retained message could have been replaced by the new one
+                return &r.tim_message_expiry == key && r.tim_message_expiry.expired();
+            }
+        );
+    }
+
+    void session_expired(std::shared_ptr<as::steady_timer> const& sp_tim) {
+        // lock for expire (async)
+        std::lock_guard<mutex> g(mtx_sessions_);
+        auto& idx = sessions_.template get<tag_tim>();
+        auto [b, e] = idx.equal_range(sp_tim);
+        while (b != e) {
+            (*b)->persist_erase();
+            b = idx.erase(b);
+        }
+    }
+
+    // Call it under the exclusive lock of mtx_security_ after security_ is updated.
+    void security_updated() {
+        security_generation_.store(security_.generation(), std::memory_order_release);
+    }
+
+    // The authorized subscribers of a topic and the generation of security_ that made them
+    using auth_users_type = std::optional<std::pair<std::uint64_t, security::authorized_subscribers>>;
+
+    // Get the user that the topic is given to as the response topic.
+    // The response topics are created as UUIDs when they are given, so no decision
+    // about them is cached before. The decisions that depend on them are not cached.
+    std::optional<std::string> response_topic_owner(std::string_view topic) const {
+        std::shared_lock<mutex> g{mtx_response_topics_};
+        auto it = response_topics_.find(std::string{topic});
+        if (it == response_topics_.end()) return std::nullopt;
+        return it->second;
+    }
+
+    bool is_subscribe_authorized(std::string const& username, std::string_view topic_filter) const {
+        {
+            std::shared_lock<mutex> g_sec{mtx_security_};
+            if (security_.is_subscribe_authorized(username, topic_filter)) return true;
+        }
+        return response_topic_owner(topic_filter) == username;
+    }
+
+    // Authorization decisions are cached per thread with the generation of security_.
+    // If the decision is cached, mtx_security_ is not locked.
+    security::authorization::type auth_pub(std::string_view topic, std::string_view username) const {
+        using access = security::decision_cache::access;
+        auto& cache = security::decision_cache::local();
+        if (auto d = cache.find(
+                security_generation_.load(std::memory_order_acquire),
+                access::pub,
+                username,
+                topic
+            )
+        ) {
+            return *d;
+        }
+        if (response_topic_owner(topic)) return security::authorization::type::allow;
+        std::shared_lock<mutex> g_sec{mtx_security_};
+        auto d = security_.auth_pub(topic_levels{topic}, username);
+        cache.store(security_.generation(), access::pub, username, topic, d);
+        return d;
+    }
+
+    security::authorization::type auth_sub(
+        topic_levels const& levels,
+        std::string_view username,
+        auth_users_type& auth_users
+    ) const {
+        using access = security::decision_cache::access;
+        auto& cache = security::decision_cache::local();
+        if (auto d = cache.find(
+                security_generation_.load(std::memory_order_acquire),
+                access::sub,
+                username,
+                levels.topic()
+            )
+        ) {
+            return *d;
+        }
+        if (response_topic_owner(levels.topic()) == username) {
+            return security::authorization::type::allow;
+        }
+        std::shared_lock<mutex> g_sec{mtx_security_};
+        // auth_users could be made by the older settings. Then it is made again.
+        if (!auth_users || auth_users->first != security_.generation()) {
+            auth_users.emplace(security_.generation(), security_.auth_sub(levels));
+        }
+        auto d = security_.auth_sub_user(auth_users->second, username);
+        cache.store(security_.generation(), access::sub, username, levels.topic(), d);
+        return d;
+    }
+
+    bool do_publish_local(
+        std::string const& source_client_id,
+        protocol_version source_version,
+        buffer topic,
+        std::vector<buffer> payload,
+        pub::opts opts,
+        property_block props,
+        bool process_shared,
+        std::shared_ptr<void> const& commit_gate = nullptr
     ) {
         bool matched = false;
+        std::size_t deliveries = 0;
+
+        // The topic is tokenized once here, and then referred by all lookups below
+        topic_levels levels{topic};
 
         // Get auth rights for this topic
-        // auth_users prepared once here, and then referred multiple times in subs_map_.modify() for efficiency
-        auto auth_users =
-            [&] {
-                std::shared_lock<mutex> g_sec{mtx_security_};
-                return security_.auth_sub(topic);
-            } ();
+        // auth_users is prepared at the first decision that is not cached, and then
+        // referred multiple times in subs_map_.find() for efficiency
+        auth_users_type auth_users;
+
+        // The outgoing packets are built once per (QoS, retain, subscription identifier)
+        // and shared by the subscribers.
+        publish_fanout fanout{topic, payload, props};
 
         // publish the message to subscribers.
         // retain is delivered as the original only if rap_value is rap::retain.
         // On MQTT v3.1.1, rap_value is always rap::dont.
         auto deliver =
-            [&] (session_state<epsp_type>& ss, subscription<epsp_type>& sub, auto const& auth_users) {
+            [&] (session_state<epsp_type>& ss, subscription<epsp_type> const& sub, auto& auth_users, bool forward) {
 
                 // See if this session is authorized to subscribe this topic
-                {
-                    std::shared_lock<mutex> g_sec{mtx_security_};
-                    auto access = security_.auth_sub_user(auth_users, ss.get_username());
-                    if (access != security::authorization::type::allow) return false;
+                if (auth_sub(levels, ss.get_username(), auth_users) != security::authorization::type::allow) {
+                    return false;
                 }
                 pub::opts new_opts = std::min(opts.get_qos(), sub.opts.get_qos());
                 if (sub.opts.get_rap() == sub::rap::retain && opts.get_retain() == pub::retain::yes) {
                     new_opts |= pub::retain::yes;
                 }
 
-                if (sub.sid) {
-                    props.push_back(property::subscription_identifier(boost::numeric_cast<std::uint32_t>(*sub.sid)));
-                    ss.deliver(
-                        timer_ioc_,
+                if (forward) {
+                    // The session could belong to the other shard.
+                    // Only the owner shard can access it safely.
+                    auto forward_props = props.to_properties();
+                    if (sub.sid) {
+                        forward_props.push_back(property::subscription_identifier(boost::numeric_cast<std::uint32_t>(*sub.sid)));
+                    }
+                    group_->deliver_to_owner(
+                        ss.get_username(),
+                        ss.client_id(),
                         topic,
                         payload,
                         new_opts,
-                        props
+                        force_move(forward_props),
+                        commit_gate
                     );
-                    props.pop_back();
                 }
                 else {
                     ss.deliver(
                         timer_ioc_,
-                        topic,
-                        payload,
+                        fanout,
                         new_opts,
-                        props
+                        sub.sid
                     );
                 }
+                ++deliveries;
                 return true;
             };
 
-        //                  share_name   topic_filter
-        std::set<std::tuple<std::string_view, std::string_view>> sent;
+        // Each member of the group matches the topic, and the message is delivered
+        // to one of them once per group.
+        boost::container::small_vector<shared_group<epsp_type> const*, 4> sent;
+
+        auto deliver_shared =
+            [&](subscription<epsp_type> const& sub, bool forward) {
+                BOOST_ASSERT(sub.group);
+                auto const* group = sub.group.get();
+                if (std::find(sent.begin(), sent.end(), group) != sent.end()) return;
+                sent.push_back(group);
+                // The member list that select() reads is freed after the read-side
+                // critical section. The session of the chosen member is destroyed after
+                // that too, see session_state::retire().
+                rcu_read_guard g;
+                if (auto const* m = group->select(levels.topic(), shard_index_)) {
+                    // The member of this shard is delivered directly.
+                    if (deliver(m->sub.ss.get(), m->sub, auth_users, forward && m->shard != shard_index_)) {
+                        matched = true;
+                    }
+                }
+            };
 
         {
-            std::shared_lock<mutex> g{mtx_subs_map_};
-            subs_map_.modify(
-                topic,
-                [&](std::string const& /*key*/, subscription<epsp_type>& sub) {
+            // On the snapshot mode, subs_map_ is read without the lock.
+            // The sessions in the snapshot are destroyed after the readers leave.
+            // See session_state::retire().
+            std::shared_lock<mutex> g{mtx_subs_map_, std::defer_lock};
+            if (!subs_map_.snapshot_enabled()) g.lock();
+            subs_map_.find(
+                levels,
+                [&](std::string const& /*key*/, subscription<epsp_type> const& sub) {
                     if (sub.sharename.empty()) {
                         // Non shared subscriptions
 
                         // If NL (no local) subscription option is set and
                         // publisher is the same as subscriber, then skip it.
                         if (sub.opts.get_nl() == sub::nl::yes &&
-                            sub.ss.get().client_id() ==  source_ss.client_id()) return;
-                        if (deliver(sub.ss.get(), sub, auth_users)) matched = true;
+                            sub.ss.get().client_id() ==  source_client_id) return;
+                        if (deliver(sub.ss.get(), sub, auth_users, false)) matched = true;
                     }
                     else {
                         // Shared subscriptions
-                        bool inserted;
-                        std::tie(std::ignore, inserted) = sent.emplace(sub.sharename, sub.topic);
-                        if (inserted) {
-                            if (auto ssr_sub_opt = shared_targets_.get_target(sub.sharename, sub.topic)) {
-                                auto [ssr, sub] = *ssr_sub_opt;
-                                if (deliver(ssr.get(), sub, auth_users)) matched = true;
-                            }
-                        }
+                        deliver_shared(sub, false);
                     }
                 }
             );
         }
 
+        if (group_ && process_shared) {
+            // On the sharded broker, shared subscriptions are stored in the
+            // group and the target is chosen here once per share name.
+            // shared_subs_map_ is on the snapshot mode, so it is read without the lock.
+            // The sessions in the snapshot are destroyed after the readers leave.
+            shared_subs_map_.find(
+                levels,
+                [&](std::string const& /*key*/, subscription<epsp_type> const& sub) {
+                    deliver_shared(sub, true);
+                }
+            );
+        }
+
         std::optional<std::chrono::steady_clock::duration> message_expiry_interval;
-        if (source_ss.get_protocol_version() == protocol_version::v5) {
-            for (auto const& prop : props) {
-                prop.visit(
-                    overload {
-                        [&](property::message_expiry_interval const& v) {
-                            message_expiry_interval.emplace(std::chrono::seconds(v.val()));
-                        },
-                        [&](auto const&){}
-                    }
-                );
+        if (source_version == protocol_version::v5) {
+            if (auto mei = fanout.message_expiry_interval()) {
+                message_expiry_interval.emplace(std::chrono::seconds(*mei));
             }
         }
 
@@ -1243,38 +1947,40 @@ private:
          *        received message has the retain flag set, in which case
          *        the retained message is removed.
          */
-        if (opts.get_retain() == pub::retain::yes) {
+        // On the sharded broker, the retained messages are shared by the shards and
+        // updated by the source shard.
+        if (opts.get_retain() == pub::retain::yes && process_shared) {
             if (payload.empty()) {
-                std::lock_guard<mutex> g(mtx_retains_);
-                retains_.erase(topic);
+                retains_.erase(levels);
             }
             else {
-                std::shared_ptr<as::steady_timer> tim_message_expiry;
+                // The stored message doesn't keep the read slab alive.
+                retain_type rt {
+                    fanout.stored_topic(),
+                    fanout.stored_payload(),
+                    fanout.stored_props(std::nullopt).to_properties(),
+                    opts.get_qos()
+                };
                 if (message_expiry_interval) {
-                    tim_message_expiry = std::make_shared<as::steady_timer>(timer_ioc_, *message_expiry_interval);
-                    tim_message_expiry->async_wait(
-                        [this, topic = topic, wp = std::weak_ptr<as::steady_timer>(tim_message_expiry)]
-                        (boost::system::error_code const& ec) {
-                            if (auto sp = wp.lock()) {
-                                if (!ec) {
-                                    retains_.erase(topic);
-                                }
-                            }
-                        }
+                    rt.expiry_owner = std::make_shared<std::string>(topic);
+                    use_timer_wheel(timer_ioc_).schedule(
+                        rt.tim_message_expiry,
+                        *message_expiry_interval,
+                        rt.expiry_owner,
+                        &this_type::retained_message_expired,
+                        this
                     );
                 }
 
-                std::lock_guard<mutex> g(mtx_retains_);
-                retains_.insert_or_assign(
-                    topic,
-                    retain_type {
-                        topic,
-                        force_move(payload),
-                        force_move(props),
-                        opts.get_qos(),
-                        tim_message_expiry
-                    }
-                );
+                // the move takes over the schedule of tim_message_expiry
+                retains_.insert_or_assign(levels, force_move(rt));
+            }
+        }
+        if (metrics_) {
+            metrics_->add(broker_metrics::counter::publish_sent, deliveries);
+            // On the sharded broker, the fanout is recorded by the source shard only.
+            if (process_shared) {
+                metrics_->record(broker_metrics::histogram::publish_fanout, deliveries);
             }
         }
         return matched;
@@ -1307,6 +2013,7 @@ private:
         // See https://github.com/boostorg/multi_index/issues/50
         auto& ss = const_cast<session_state<epsp_type>&>(**it);
         ss.erase_inflight_message_by_packet_id(packet_id);
+        ss.publish_acknowledged();
         ss.send_offline_messages_by_packet_id_release();
     }
 
@@ -1531,6 +2238,7 @@ private:
         // See https://github.com/boostorg/multi_index/issues/50
         auto& ss = const_cast<session_state<epsp_type>&>(**it);
         ss.erase_inflight_message_by_packet_id(packet_id);
+        ss.publish_acknowledged();
         ss.send_offline_messages_by_packet_id_release();
     }
 
@@ -1545,6 +2253,16 @@ private:
                 async_read_packet(force_move(epsp));
             }
         );
+        std::optional<std::chrono::steady_clock::time_point> start;
+        if (metrics_) {
+            if (metrics_->sample_latency()) start.emplace(std::chrono::steady_clock::now());
+            metrics_->add(broker_metrics::counter::subscribe_received);
+        }
+        auto lsg = unique_scope_guard(
+            [&] {
+                if (start) metrics_->record_since(broker_metrics::histogram::subscribe_handler_ns, *start);
+            }
+        );
         std::shared_lock<mutex> g(mtx_sessions_);
         auto& idx = sessions_.template get<tag_con>();
         auto it = idx.find(epsp);
@@ -1575,10 +2293,10 @@ private:
                 if (sid) {
                     props.push_back(property::subscription_identifier(std::uint32_t(*sid)));
                 }
-                if (r.tim_message_expiry) {
+                if (auto expiry = r.tim_message_expiry.expiry()) {
                     auto d =
                         std::chrono::duration_cast<std::chrono::seconds>(
-                            r.tim_message_expiry->expiry() - std::chrono::steady_clock::now()
+                            *expiry - std::chrono::steady_clock::now()
                         ).count();
                     for (auto& prop : props) {
                         prop.visit(
@@ -1617,24 +2335,18 @@ private:
             std::vector<suback_return_code> res;
             res.reserve(entries.size());
             for (auto& e : entries) {
-                if (!e ||
-                    [&] {
-                        std::shared_lock<mutex> g_sec{mtx_security_};
-                        return security_.is_subscribe_authorized(ss.get_username(), e.topic());
-                    } ()
-                ) {
+                if (!e || is_subscribe_authorized(ss.get_username(), e.topic())) {
                     res.emplace_back(qos_to_suback_return_code(e.opts().get_qos())); // converts to granted_qos_x
                     ssr.get().subscribe(
                         e.sharename(),
                         e.topic(),
                         e.opts(),
                         [&] {
-                            std::shared_lock<mutex> g(mtx_retains_);
                             retains_.find(
                                 e.topic(),
                                 [&](retain_type const& r) {
                                     retain_deliver.emplace_back(
-                                        [&publish_proc, &r, qos_value = e.opts().get_qos(), sid] {
+                                        [&publish_proc, r, qos_value = e.opts().get_qos(), sid] {
                                             publish_proc(r, qos_value, sid);
                                         }
                                     );
@@ -1649,18 +2361,11 @@ private:
                 }
             }
             // Acknowledge the subscriptions, and the registered QOS settings
-            epsp.async_send(
+            send_subscription_ack(
+                epsp,
                 v3_1_1::suback_packet{
                     packet_id,
                     force_move(res)
-                },
-                [epsp]
-                (error_code const& ec) {
-                    if (ec) {
-                        ASYNC_MQTT_LOG("mqtt_broker", info)
-                            << ASYNC_MQTT_ADD_VALUE(address, epsp.get_address())
-                            << ec.message();
-                    }
                 }
             );
         } break;
@@ -1685,23 +2390,18 @@ private:
             res.reserve(entries.size());
             for (auto& e : entries) {
                 if (e) {
-                    if ([&] {
-                            std::shared_lock<mutex> g_sec{mtx_security_};
-                            return security_.is_subscribe_authorized(ss.get_username(), e.topic());
-                        } ()
-                    ) {
+                    if (is_subscribe_authorized(ss.get_username(), e.topic())) {
                         res.emplace_back(qos_to_suback_reason_code(e.opts().get_qos())); // converts to granted_qos_x
                         ssr.get().subscribe(
                             e.sharename(),
                             e.topic(),
                             e.opts(),
                             [&] {
-                                std::shared_lock<mutex> g(mtx_retains_);
                                 retains_.find(
                                     e.topic(),
                                     [&](retain_type const& r) {
                                         retain_deliver.emplace_back(
-                                            [&publish_proc, &r, qos_value = e.opts().get_qos(), sid] {
+                                            [&publish_proc, r, qos_value = e.opts().get_qos(), sid] {
                                                 publish_proc(r, qos_value, sid);
                                             }
                                         );
@@ -1722,19 +2422,12 @@ private:
             }
             if (h_subscribe_props_) h_subscribe_props_(props);
             // Acknowledge the subscriptions, and the registered QOS settings
-            epsp.async_send(
+            send_subscription_ack(
+                epsp,
                 v5::suback_packet{
                     packet_id,
                     force_move(res),
                     suback_props_
-                },
-                [epsp]
-                (error_code const& ec) {
-                    if (ec) {
-                        ASYNC_MQTT_LOG("mqtt_broker", info)
-                            << ASYNC_MQTT_ADD_VALUE(address, epsp.get_address())
-                            << ec.message();
-                    }
                 }
             );
         } break;
@@ -1759,6 +2452,7 @@ private:
                 async_read_packet(force_move(epsp));
             }
         );
+        if (metrics_) metrics_->add(broker_metrics::counter::unsubscribe_received);
 
 
         std::shared_lock<mutex> g(mtx_sessions_);
@@ -1794,23 +2488,17 @@ private:
 
         switch (epsp.get_protocol_version()) {
         case protocol_version::v3_1_1:
-            epsp.async_send(
+            send_subscription_ack(
+                epsp,
                 v3_1_1::unsuback_packet{
                     packet_id
-                },
-                [epsp]
-                (error_code const& ec) {
-                    if (ec) {
-                        ASYNC_MQTT_LOG("mqtt_broker", info)
-                            << ASYNC_MQTT_ADD_VALUE(address, epsp.get_address())
-                            << ec.message();
-                    }
                 }
             );
             break;
         case protocol_version::v5:
             if (h_unsubscribe_props_) h_unsubscribe_props_(props);
-            epsp.async_send(
+            send_subscription_ack(
+                epsp,
                 v5::unsuback_packet{
                     packet_id,
                     std::vector<unsuback_reason_code>(
@@ -1818,14 +2506,6 @@ private:
                         unsuback_reason_code::success
                     ),
                     unsuback_props_
-                },
-                [epsp]
-                (error_code const& ec) {
-                    if (ec) {
-                        ASYNC_MQTT_LOG("mqtt_broker", info)
-                            << ASYNC_MQTT_ADD_VALUE(address, epsp.get_address())
-                            << ec.message();
-                    }
                 }
             );
             break;
@@ -1835,6 +2515,40 @@ private:
         }
     }
 
+    // On the snapshot mode, SUBACK/UNSUBACK are sent after the snapshots that
+    // contain the (un)subscriptions are published, so that the messages published
+    // after the client receives them are delivered as subscribed.
+    template <typename Packet>
+    void send_subscription_ack(epsp_type const& epsp, Packet packet) {
+        auto send =
+            [epsp, packet = force_move(packet)]() mutable {
+                epsp.async_send(
+                    force_move(packet),
+                    [epsp]
+                    (error_code const& ec) {
+                        if (ec) {
+                            ASYNC_MQTT_LOG("mqtt_broker", info)
+                                << ASYNC_MQTT_ADD_VALUE(address, epsp.get_address())
+                                << ec.message();
+                        }
+                    }
+                );
+            };
+        if (!subs_map_.snapshot_enabled() && !shared_subs_map_.snapshot_enabled()) {
+            send();
+            return;
+        }
+        subs_map_.when_published(
+            [this, epsp, send] {
+                shared_subs_map_.when_published(
+                    [epsp, send] {
+                        as::post(epsp.get_executor(), send);
+                    }
+                );
+            }
+        );
+    }
+
     void pingreq_handler(
         epsp_type epsp
     ) {
@@ -1943,7 +2657,7 @@ private:
                 self.complete(false);
                 return;
             }
-
+            if (brk.metrics_) brk.metrics_->add(broker_metrics::counter::close);
 
             if ((*it)->remain_after_close()) {
                 idx.modify(
@@ -2034,9 +2748,7 @@ private:
                     epsp,
                     [&brk = this->brk]
                     (std::shared_ptr<as::steady_timer> const& sp_tim) {
-                        // lock for expire (async)
-                        std::lock_guard<mutex> g(brk.mtx_sessions_);
-                        brk.sessions_.template get<tag_tim>().erase(sp_tim);
+                        brk.session_expired(sp_tim);
                     }
                 );
                 self.complete(true);
@@ -2204,19 +2916,42 @@ private:
     // Authorization and authentication settings
     mutable mutex mtx_security_;
     security security_;
+    std::atomic<std::uint64_t> security_generation_{0}; ///< generation of security_ for the decision cache
+
+    // Response topics that are given by the response information, and their users.
+    // They are kept out of security_ because they change at each CONNECT.
+    mutable mutex mtx_response_topics_;
+    std::unordered_map<std::string, std::string> response_topics_;
 
     mutable mutex mtx_subs_map_;
     sub_con_map<epsp_type> subs_map_;   ///< subscription information
-    shared_target<epsp_type> shared_targets_; ///< shared subscription targets
+    shared_target<epsp_type> own_shared_targets_; ///< shared subscription targets
+
+    // Shared subscriptions. They refer to the members above, or the members of
+    // sharded_broker if this broker is a shard of it.
+    mutex& mtx_shared_subs_map_;
+    sub_con_map<epsp_type>& shared_subs_map_;
+    shared_target<epsp_type>& shared_targets_;
+
+    sharded_broker<Epsp>* group_ = nullptr; ///< nullptr if this broker is not a shard
+    std::size_t shard_index_ = 0;
+    std::optional<as::any_io_executor> shard_exe_;
+
+    offline_quota offline_quota_; ///< session_state has a reference of it
+    std::shared_ptr<broker_metrics> metrics_; ///< nullptr if the metrics are not recorded
 
     ///< Map of active client id and connections
     /// session_state has references of subs_map_ and shared_targets_.
     /// because session_state (member of sessions_) has references of subs_map_ and shared_targets_.
     mutable mutex mtx_sessions_;
     session_states<epsp_type> sessions_;
+    std::shared_ptr<session_store> session_store_;
 
-    mutable mutex mtx_retains_;
-    retained_messages retains_; ///< A list of messages retained so they can be sent to newly subscribed clients.
+    retained_messages own_retains_; ///< A list of messages retained so they can be sent to newly subscribed clients.
+
+    // It refers to own_retains_, or the one of sharded_broker if this broker is a shard of it.
+    retained_messages& retains_;
+    std::optional<std::uint64_t> saved_retains_generation_; ///< accessed only by save_retained_snapshot()
 
     // MQTTv5 members
     properties connack_props_;
@@ -2243,4 +2978,6 @@ private:
 
 } // namespace async_mqtt
 
+#include <broker/sharded_broker.hpp>
+
 #endif // ASYNC_MQTT_BROKER_BROKER_HPP
@@ -0,0 +1,132 @@
+// Copyright Takatoshi Kondo 2024
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_BROKER_CON_IOC_LOAD_HPP)
+#define ASYNC_MQTT_BROKER_CON_IOC_LOAD_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <memory>
+
+#include <boost/assert.hpp>
+
+namespace async_mqtt {
+
+/**
+ * @brief number of live connections per connection io_context
+ * #### Thread Safety
+ *    - Distinct objects: Safe
+ *    - Shared objects: Safe
+ *
+ * It is used to place a new connection on the io_context that has the fewest connections.
+ * The connection is counted until it is destroyed. It includes the time that its
+ * in-progress operations keep it alive after the user releases it.
+ * The counters outlive this object if the tracked connections are still alive.
+ */
+class con_ioc_load {
+public:
+    /**
+     * @brief constructor
+     * @param num_of_iocs number of the connection io_contexts
+     */
+    explicit con_ioc_load(std::size_t num_of_iocs)
+        :state_{std::make_shared<state>(num_of_iocs)}
+    {
+        BOOST_ASSERT(num_of_iocs != 0);
+    }
+
+    /**
+     * @brief Get number of the io_contexts
+     * @return number of the io_contexts
+     */
+    std::size_t size() const {
+        return state_->size;
+    }
+
+    /**
+     * @brief Get number of live connections on the io_context
+     * @param index index of the io_context
+     * @return number of live connections
+     */
+    std::size_t connections(std::size_t index) const {
+        BOOST_ASSERT(index < size());
+        return state_->counts[index].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Get the io_context that has the fewest connections
+     * The ties are broken in turn, so connections are distributed round-robin while the
+     * io_contexts are equally loaded.
+     * @return index of the io_context
+     */
+    std::size_t least_loaded() {
+        auto start = state_->cursor.fetch_add(1, std::memory_order_relaxed) % size();
+        auto ret = start;
+        auto min = std::numeric_limits<std::size_t>::max();
+        for (std::size_t i = 0; i != size(); ++i) {
+            auto index = (start + i) % size();
+            auto num = connections(index);
+            if (num < min) {
+                min = num;
+                ret = index;
+            }
+        }
+        return ret;
+    }
+
+    /**
+     * @brief Get the io_context for the connection accepted on the preferred io_context
+     * The preferred one is kept unless its connections exceed the least loaded one's by more
+     * than 1/8 + 1, so the accepting io_context usually handshakes its own connections.
+     * @param preferred index of the io_context that accepted the connection
+     * @return index of the io_context
+     */
+    std::size_t place(std::size_t preferred) {
+        BOOST_ASSERT(preferred < size());
+        auto index = least_loaded();
+        auto min = connections(index);
+        if (connections(preferred) <= min + min / 8 + 1) return preferred;
+        return index;
+    }
+
+    /**
+     * @brief Count the connection on the io_context until it is destroyed
+     * @param sp    connection. T has set_destroy_handler() like basic_endpoint,
+     *              and the handler must not be replaced after this call.
+     * @param index index of the io_context that the connection is placed on
+     * @return sp
+     */
+    template <typename T>
+    std::shared_ptr<T> track(std::shared_ptr<T> sp, std::size_t index) {
+        BOOST_ASSERT(index < size());
+        state_->counts[index].fetch_add(1, std::memory_order_relaxed);
+        sp->set_destroy_handler(
+            [st = state_, index] {
+                st->counts[index].fetch_sub(1, std::memory_order_relaxed);
+            }
+        );
+        return sp;
+    }
+
+private:
+    struct state {
+        explicit state(std::size_t size)
+            :size{size},
+             counts{std::make_unique<std::atomic<std::size_t>[]>(size)}
+        {
+        }
+        std::size_t size;
+        std::unique_ptr<std::atomic<std::size_t>[]> counts;
+        std::atomic<std::size_t> cursor{0};
+    };
+
+    std::shared_ptr<state> state_;
+};
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_BROKER_CON_IOC_LOAD_HPP
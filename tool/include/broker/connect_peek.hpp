@@ -0,0 +1,207 @@
+// Copyright Takatoshi Kondo 2024
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_BROKER_CONNECT_PEEK_HPP)
+#define ASYNC_MQTT_BROKER_CONNECT_PEEK_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include <async_mqtt/error.hpp>
+#include <async_mqtt/util/move.hpp>
+
+namespace async_mqtt {
+
+namespace as = boost::asio;
+
+/**
+ * @brief the default maximum number of bytes that are peeked to find the client id
+ * It covers CONNECT packets that have moderate properties before the client id.
+ */
+static constexpr std::size_t default_connect_peek_max_size = 4096;
+
+/**
+ * @brief result of parse_connect_client_id()
+ */
+struct connect_peek_result {
+    enum class status {
+        incomplete, ///< more bytes are required. size is the number of them.
+        invalid,    ///< the bytes are not CONNECT packet
+        complete    ///< client_id is found
+    };
+    status st;
+    std::size_t size = 0;
+    std::string_view client_id = {};
+};
+
+/**
+ * @brief get the client id from the head of CONNECT packet
+ * Only the bytes to the client id are parsed. The rest of the packet is checked
+ * by the endpoint.
+ * @param bytes the head of the bytes that are received on the connection
+ * @return result. client_id refers to bytes.
+ */
+inline connect_peek_result parse_connect_client_id(std::string_view bytes) {
+    using status = connect_peek_result::status;
+    std::size_t pos = 0;
+    auto incomplete =
+        [&](std::size_t required) {
+            return connect_peek_result{status::incomplete, required};
+        };
+    auto invalid = connect_peek_result{status::invalid};
+    // returns std::nullopt if the bytes are not enough or invalid
+    auto variable_bytes =
+        [&]() -> std::optional<std::uint32_t> {
+            std::uint32_t val = 0;
+            for (std::size_t i = 0; i != 4; ++i) {
+                if (pos == bytes.size()) return std::nullopt;
+                auto b = static_cast<std::uint8_t>(bytes[pos++]);
+                val |= std::uint32_t(b & 0b01111111) << (7 * i);
+                if (!(b & 0b10000000)) return val;
+            }
+            return std::nullopt;
+        };
+    auto two_bytes =
+        [&] {
+            auto val =
+                std::size_t(static_cast<std::uint8_t>(bytes[pos])) << 8 |
+                std::size_t(static_cast<std::uint8_t>(bytes[pos + 1]));
+            pos += 2;
+            return val;
+        };
+
+    // fixed header
+    if (bytes.empty()) return incomplete(1);
+    if (static_cast<std::uint8_t>(bytes[pos++]) != 0x10) return invalid;
+    auto remaining_length = variable_bytes();
+    if (!remaining_length) {
+        if (pos == bytes.size() && pos < 5) return incomplete(pos + 1);
+        return invalid;
+    }
+    auto packet_end = pos + *remaining_length;
+
+    // protocol name, protocol level, connect flags, and keep alive
+    if (bytes.size() < pos + 2) return incomplete(pos + 2);
+    auto name_length = two_bytes();
+    pos += name_length;
+    if (bytes.size() < pos + 4) return incomplete(pos + 4);
+    auto level = static_cast<std::uint8_t>(bytes[pos]);
+    pos += 4;
+
+    // properties
+    if (level == 5) {
+        auto props_begin = pos;
+        auto props_length = variable_bytes();
+        if (!props_length) {
+            if (pos == bytes.size() && pos - props_begin < 4) return incomplete(pos + 1);
+            return invalid;
+        }
+        pos += *props_length;
+    }
+
+    // client id
+    if (bytes.size() < pos + 2) return incomplete(pos + 2);
+    auto client_id_length = two_bytes();
+    if (pos + client_id_length > packet_end) return invalid;
+    if (bytes.size() < pos + client_id_length) return incomplete(pos + client_id_length);
+    return connect_peek_result{
+        status::complete,
+        pos + client_id_length,
+        bytes.substr(pos, client_id_length)
+    };
+}
+
+/**
+ * @brief peek the client id of CONNECT packet on the socket
+ * The bytes are left on the socket, so the endpoint that the socket is moved into
+ * receives the CONNECT packet after that. It is used to place the connection on the
+ * executor of the shard that owns the client id before the endpoint is created.
+ * The socket is waited for with the receive low watermark set to the required bytes,
+ * and the watermark is set back to 1 before the handler is called.
+ * @param sock     socket. It must be alive until the handler is called.
+ * @param max_size the maximum number of bytes to peek
+ * @param handler  called with error_code and the client id. The client id is
+ *                 std::nullopt if the first packet is not CONNECT or the client id
+ *                 isn't within max_size bytes.
+ */
+template <typename Socket, typename Handler>
+void async_peek_client_id(Socket& sock, std::size_t max_size, Handler&& handler) {
+    using handler_type = std::decay_t<Handler>;
+    struct peek_op : std::enable_shared_from_this<peek_op> {
+        peek_op(Socket& sock, std::size_t max_size, handler_type handler)
+            :sock{sock},
+             buf(max_size),
+             handler{force_move(handler)}
+        {}
+
+        void start() {
+            sock.async_wait(
+                Socket::wait_read,
+                [self = this->shared_from_this()]
+                (error_code const& ec) {
+                    self->on_readable(ec);
+                }
+            );
+        }
+
+        void on_readable(error_code ec) {
+            if (ec) {
+                complete(ec, std::nullopt);
+                return;
+            }
+            auto size = sock.receive(as::buffer(buf), Socket::message_peek, ec);
+            if (ec) {
+                complete(ec, std::nullopt);
+                return;
+            }
+            if (size == 0) {
+                complete(as::error::eof, std::nullopt);
+                return;
+            }
+            auto r = parse_connect_client_id(std::string_view{buf.data(), size});
+            switch (r.st) {
+            case connect_peek_result::status::complete:
+                complete(ec, std::string{r.client_id});
+                return;
+            case connect_peek_result::status::invalid:
+                complete(ec, std::nullopt);
+                return;
+            case connect_peek_result::status::incomplete:
+                if (r.size > buf.size()) {
+                    complete(ec, std::nullopt);
+                    return;
+                }
+                // not to be woken up until the required bytes arrive
+                sock.set_option(typename Socket::receive_low_watermark(int(r.size)), ec);
+                start();
+                return;
+            }
+        }
+
+        void complete(error_code ec, std::optional<std::string> client_id) {
+            error_code ignored;
+            sock.set_option(typename Socket::receive_low_watermark(1), ignored);
+            handler(ec, force_move(client_id));
+        }
+
+        Socket& sock;
+        std::vector<char> buf;
+        handler_type handler;
+    };
+    std::make_shared<peek_op>(sock, max_size, std::forward<Handler>(handler))->start();
+}
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_BROKER_CONNECT_PEEK_HPP
@@ -0,0 +1,32 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_BROKER_DEFAULT_SUBSCRIPTION_MAP_HPP)
+#define ASYNC_MQTT_BROKER_DEFAULT_SUBSCRIPTION_MAP_HPP
+
+#include <broker/subscription_map.hpp>
+#include <broker/subscription_trie.hpp>
+
+namespace async_mqtt {
+
+// The subscription map implementation that is used by the broker.
+// If ASYNC_MQTT_BROKER_USE_SUBSCRIPTION_TRIE is defined, the compact trie
+// (subscription_trie.hpp) is used.
+#if defined(ASYNC_MQTT_BROKER_USE_SUBSCRIPTION_TRIE)
+
+template <typename Key, typename Value>
+using default_multiple_subscription_map = multiple_subscription_trie<Key, Value>;
+
+#else  // defined(ASYNC_MQTT_BROKER_USE_SUBSCRIPTION_TRIE)
+
+template <typename Key, typename Value>
+using default_multiple_subscription_map = multiple_subscription_map<Key, Value>;
+
+#endif // defined(ASYNC_MQTT_BROKER_USE_SUBSCRIPTION_TRIE)
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_BROKER_DEFAULT_SUBSCRIPTION_MAP_HPP
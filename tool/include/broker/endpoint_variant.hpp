@@ -326,6 +326,18 @@ public:
         );
     }
 
+    /**
+     * @brief Get the statistics of packet writing.
+     * It can be called from any threads.
+     */
+    write_stats get_write_stats() const {
+        return visit(
+            [&](auto& ep) {
+                return ep.get_write_stats();
+            }
+        );
+    }
+
     void set_preauthed_user_name(std::optional<std::string> user_name) {
         preauthed_user_name_ = force_move(user_name);
     }
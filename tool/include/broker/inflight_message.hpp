@@ -12,8 +12,8 @@
 #include <optional>
 #include <variant>
 
-#include <boost/asio/steady_timer.hpp>
 #include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 #include <boost/multi_index/sequenced_index.hpp>
 #include <boost/multi_index/key.hpp>
@@ -21,6 +21,7 @@
 #include <async_mqtt/util/overload.hpp>
 #include <async_mqtt/packet/store_packet_variant.hpp>
 #include <async_mqtt/util/log.hpp>
+#include <async_mqtt/util/timer_wheel.hpp>
 
 #include <broker/tags.hpp>
 
@@ -32,11 +33,9 @@ class inflight_messages;
 
 class inflight_message {
 public:
-    inflight_message(
-        store_packet_variant packet,
-        std::shared_ptr<as::steady_timer> tim_message_expiry)
-        :packet_ { force_move(packet) },
-         tim_message_expiry_ { force_move(tim_message_expiry) }
+    explicit inflight_message(
+        store_packet_variant packet)
+        :packet_ { force_move(packet) }
     {}
 
     packet_id_type packet_id() const {
@@ -46,14 +45,14 @@ public:
     template <typename Epsp>
     void send(Epsp& epsp) const {
         std::optional<store_packet_variant> packet_opt;
-        if (tim_message_expiry_) {
+        if (auto expiry = tim_message_expiry_.expiry()) {
             packet_.visit(
                 overload {
                     [&](v5::basic_publish_packet<sizeof(packet_id_type)> const& m) {
                         auto updated_packet = m;
                         auto d =
                             std::chrono::duration_cast<std::chrono::seconds>(
-                                tim_message_expiry_->expiry() - std::chrono::steady_clock::now()
+                                *expiry - std::chrono::steady_clock::now()
                             ).count();
                         if (d < 0) d = 0;
                         updated_packet.update_message_expiry_interval(static_cast<std::uint32_t>(d));
@@ -81,23 +80,43 @@ public:
         return packet_;
     }
 
+    timer_wheel::handle const* tim_address() const {
+        return &tim_message_expiry_;
+    }
+
+    bool expired() const {
+        return tim_message_expiry_.expired();
+    }
+
 private:
     friend class inflight_messages;
 
     store_packet_variant packet_;
-    std::shared_ptr<as::steady_timer> tim_message_expiry_;
+    // scheduled only if the packet has MessageExpiryInterval
+    mutable timer_wheel::handle tim_message_expiry_;
 };
 
 class inflight_messages {
 public:
+    /**
+     * @brief insert the message
+     * @param packet            packet
+     * @param message_expiry    if it is set, the message is expired after it
+     * @param wheel             timer_wheel
+     * @param owner             on_expire is called only if it is alive
+     * @param on_expire         expire handler
+     */
     void insert(
         store_packet_variant packet,
-        std::shared_ptr<as::steady_timer> tim_message_expiry
+        std::optional<std::chrono::steady_clock::duration> message_expiry,
+        timer_wheel& wheel,
+        std::weak_ptr<void> owner,
+        timer_wheel::expire_handler on_expire
     ) {
-        messages_.emplace_back(
-            force_move(packet),
-            force_move(tim_message_expiry)
-        );
+        auto [it, inserted] = messages_.emplace_back(force_move(packet));
+        if (inserted && message_expiry) {
+            wheel.schedule(it->tim_message_expiry_, *message_expiry, force_move(owner), on_expire);
+        }
     }
 
     template <typename Epsp>
@@ -132,9 +151,9 @@ private:
                 mi::tag<tag_pid>,
                 BOOST_MULTI_INDEX_CONST_MEM_FUN(inflight_message, packet_id_type, packet_id)
             >,
-            mi::ordered_non_unique<
+            mi::hashed_unique<
                 mi::tag<tag_tim>,
-                BOOST_MULTI_INDEX_MEMBER(inflight_message, std::shared_ptr<as::steady_timer>, tim_message_expiry_)
+                BOOST_MULTI_INDEX_CONST_MEM_FUN(inflight_message, timer_wheel::handle const*, tim_address)
             >
         >
     >;
@@ -0,0 +1,481 @@
+// Copyright Takatoshi Kondo 2024
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_BROKER_METRICS_HPP)
+#define ASYNC_MQTT_BROKER_METRICS_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/assert.hpp>
+
+namespace async_mqtt {
+
+/**
+ * @brief counters and histograms of the broker
+ * #### Thread Safety
+ *    - Distinct objects: Safe
+ *    - Shared objects: Safe
+ *
+ * Each thread updates its own cache line aligned slot, so updating doesn't
+ * lock and doesn't contend with the other threads. The slot is written only by
+ * its thread, so the values are updated by relaxed load and store instead of
+ * read-modify-write instructions.
+ * The slots are aggregated on demand by collect(). The aggregated values are
+ * not an atomic snapshot, each value is consistent by itself.
+ */
+class broker_metrics {
+public:
+    enum class counter : std::size_t {
+        connect,                ///< accepted CONNECT packets
+        close,                  ///< closed connections
+        publish_received,       ///< received PUBLISH packets
+        publish_received_bytes, ///< payload bytes of received PUBLISH packets
+        publish_sent,           ///< PUBLISH deliveries to the subscribers
+        publish_dropped,        ///< received PUBLISH packets that are not authorized
+        subscribe_received,     ///< received SUBSCRIBE packets
+        unsubscribe_received,   ///< received UNSUBSCRIBE packets
+        num
+    };
+
+    enum class histogram : std::size_t {
+        publish_handler_ns,   ///< time to handle a received PUBLISH packet (sampled)
+        subscribe_handler_ns, ///< time to handle a received SUBSCRIBE packet (sampled)
+        publish_fanout,       ///< number of deliveries per published message
+        num
+    };
+
+    /**
+     * @brief values that are sampled at the collection time
+     * They are filled by the broker, not by broker_metrics.
+     */
+    enum class gauge : std::size_t {
+        sessions,              ///< sessions including offline ones
+        connections,           ///< online sessions
+        offline_messages,      ///< queued offline messages
+        offline_bytes,         ///< payload bytes of queued offline messages
+        offline_dropped,       ///< offline messages discarded by the quota
+        write_queue_packets,   ///< packets waiting to be written of all connections
+        write_queue_max,       ///< the maximum packets waiting to be written of a connection
+        num
+    };
+
+    static constexpr std::size_t counter_num = std::size_t(counter::num);
+    static constexpr std::size_t histogram_num = std::size_t(histogram::num);
+    static constexpr std::size_t gauge_num = std::size_t(gauge::num);
+
+    /**
+     * The bucket of the value v is the bit width of v. The bucket 0 is v == 0 and
+     * the bucket n holds [2^(n-1), 2^n - 1].
+     */
+    static constexpr std::size_t bucket_num = 65;
+
+    /**
+     * @brief aggregated histogram
+     */
+    struct histogram_snapshot {
+        std::array<std::uint64_t, bucket_num> buckets{};
+        std::uint64_t count = 0;
+        std::uint64_t sum = 0;
+
+        /**
+         * @brief get the upper bound of the bucket that contains the quantile
+         * @param q quantile between 0.0 and 1.0
+         * @return the upper bound. 0 if no value is recorded
+         */
+        std::uint64_t quantile(double q) const {
+            if (count == 0) return 0;
+            auto rank = std::uint64_t(q * double(count));
+            if (rank >= count) rank = count - 1;
+            std::uint64_t seen = 0;
+            for (std::size_t i = 0; i != bucket_num; ++i) {
+                seen += buckets[i];
+                if (seen > rank) return upper_bound(i);
+            }
+            return upper_bound(bucket_num - 1);
+        }
+
+        /**
+         * @brief get the upper bound of the highest non-empty bucket
+         */
+        std::uint64_t max() const {
+            for (std::size_t i = bucket_num; i != 0; --i) {
+                if (buckets[i - 1] != 0) return upper_bound(i - 1);
+            }
+            return 0;
+        }
+
+        double mean() const {
+            if (count == 0) return 0;
+            return double(sum) / double(count);
+        }
+
+        static std::uint64_t upper_bound(std::size_t bucket) {
+            if (bucket == 0) return 0;
+            if (bucket == 64) return ~std::uint64_t(0);
+            return (std::uint64_t(1) << bucket) - 1;
+        }
+    };
+
+    /**
+     * @brief aggregated values
+     */
+    struct snapshot {
+        std::array<std::uint64_t, counter_num> counters{};
+        std::array<histogram_snapshot, histogram_num> histograms{};
+        std::array<std::uint64_t, gauge_num> gauges{};
+
+        std::uint64_t get(counter c) const {
+            return counters[std::size_t(c)];
+        }
+        histogram_snapshot const& get(histogram h) const {
+            return histograms[std::size_t(h)];
+        }
+        std::uint64_t get(gauge g) const {
+            return gauges[std::size_t(g)];
+        }
+        void set(gauge g, std::uint64_t v) {
+            gauges[std::size_t(g)] = v;
+        }
+    };
+
+    /**
+     * @brief constructor
+     * @param latency_sampling the latencies are measured once per latency_sampling calls of
+     *                         sample_latency() on each thread. It must be a power of 2.
+     *                         1 measures all of them.
+     */
+    explicit broker_metrics(std::uint64_t latency_sampling = 64)
+        :id_{next_id().fetch_add(1, std::memory_order_relaxed)},
+         latency_mask_{latency_sampling - 1}
+    {
+        BOOST_ASSERT(latency_sampling != 0 && (latency_sampling & latency_mask_) == 0);
+    }
+
+    broker_metrics(broker_metrics const&) = delete;
+    broker_metrics& operator=(broker_metrics const&) = delete;
+
+    /**
+     * @brief add the value to the counter
+     */
+    void add(counter c, std::uint64_t v = 1) {
+        auto& a = local().counters[std::size_t(c)];
+        a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief record the value to the histogram
+     */
+    void record(histogram h, std::uint64_t v) {
+        auto& hs = local().histograms[std::size_t(h)];
+        auto inc =
+            [](std::atomic<std::uint64_t>& a, std::uint64_t v) {
+                a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+            };
+        inc(hs.buckets[bucket(v)], 1);
+        inc(hs.count, 1);
+        inc(hs.sum, v);
+    }
+
+    /**
+     * @brief decide whether the latency of this call is measured
+     * Reading the clock costs more than updating the values, so the latencies
+     * are sampled. The counters are not sampled.
+     * @return true if the latency should be measured
+     */
+    bool sample_latency() {
+        auto& a = local().ticks;
+        auto t = a.load(std::memory_order_relaxed);
+        a.store(t + 1, std::memory_order_relaxed);
+        return (t & latency_mask_) == 0;
+    }
+
+    /**
+     * @brief record the elapsed time since start in nanoseconds
+     */
+    void record_since(histogram h, std::chrono::steady_clock::time_point start) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start
+        ).count();
+        record(h, ns < 0 ? 0 : std::uint64_t(ns));
+    }
+
+    /**
+     * @brief aggregate the values of all threads
+     * The gauges are zero. They are filled by the broker.
+     */
+    snapshot collect() const {
+        snapshot s;
+        std::lock_guard<std::mutex> g{mtx_};
+        for (auto const& sl : slots_) {
+            for (std::size_t i = 0; i != counter_num; ++i) {
+                s.counters[i] += sl->counters[i].load(std::memory_order_relaxed);
+            }
+            for (std::size_t i = 0; i != histogram_num; ++i) {
+                auto const& src = sl->histograms[i];
+                auto& dst = s.histograms[i];
+                for (std::size_t b = 0; b != bucket_num; ++b) {
+                    dst.buckets[b] += src.buckets[b].load(std::memory_order_relaxed);
+                }
+                dst.count += src.count.load(std::memory_order_relaxed);
+                dst.sum += src.sum.load(std::memory_order_relaxed);
+            }
+        }
+        return s;
+    }
+
+    /**
+     * @brief get the number of the threads that have updated the metrics
+     */
+    std::size_t threads() const {
+        std::lock_guard<std::mutex> g{mtx_};
+        return slots_.size();
+    }
+
+    static std::size_t bucket(std::uint64_t v) {
+        if (v == 0) return 0;
+        std::size_t width = 1;
+        if (v >> 32) { width += 32; v >>= 32; }
+        if (v >> 16) { width += 16; v >>= 16; }
+        if (v >> 8)  { width += 8;  v >>= 8; }
+        if (v >> 4)  { width += 4;  v >>= 4; }
+        if (v >> 2)  { width += 2;  v >>= 2; }
+        if (v >> 1)  { width += 1; }
+        return width;
+    }
+
+    static std::string_view name(counter c) {
+        static constexpr std::array<std::string_view, counter_num> names {
+            "connect/received",
+            "close",
+            "publish/received",
+            "publish/bytes/received",
+            "publish/sent",
+            "publish/dropped",
+            "subscribe/received",
+            "unsubscribe/received",
+        };
+        return names[std::size_t(c)];
+    }
+
+    static std::string_view name(histogram h) {
+        static constexpr std::array<std::string_view, histogram_num> names {
+            "publish/latency_ns",
+            "subscribe/latency_ns",
+            "publish/fanout",
+        };
+        return names[std::size_t(h)];
+    }
+
+    static std::string_view name(gauge g) {
+        static constexpr std::array<std::string_view, gauge_num> names {
+            "sessions",
+            "clients/connected",
+            "offline/messages",
+            "offline/bytes",
+            "offline/dropped",
+            "write_queue/packets",
+            "write_queue/max",
+        };
+        return names[std::size_t(g)];
+    }
+
+    /**
+     * @brief call f(name, value) for each value of the snapshot
+     * The name is the path of the value, e.g. "publish/received".
+     * Each histogram is expanded to count, mean, p50, p99, p999 and max.
+     */
+    template <typename Func>
+    static void for_each(snapshot const& s, Func&& f) {
+        for (std::size_t i = 0; i != counter_num; ++i) {
+            f(name(counter(i)), s.counters[i]);
+        }
+        for (std::size_t i = 0; i != gauge_num; ++i) {
+            f(name(gauge(i)), s.gauges[i]);
+        }
+        for (std::size_t i = 0; i != histogram_num; ++i) {
+            auto const& h = s.histograms[i];
+            std::string base{name(histogram(i))};
+            f(base + "/count", h.count);
+            f(base + "/mean", std::uint64_t(h.mean()));
+            f(base + "/p50", h.quantile(0.5));
+            f(base + "/p99", h.quantile(0.99));
+            f(base + "/p999", h.quantile(0.999));
+            f(base + "/max", h.max());
+        }
+    }
+
+    /**
+     * @brief write the snapshot as the Prometheus text exposition format
+     * The name of the value is prefix followed by the path that '/' is replaced with '_'.
+     * @param o      output stream
+     * @param s      snapshot
+     * @param prefix prefix of the names
+     */
+    static void write_text(std::ostream& o, snapshot const& s, std::string_view prefix = "mqtt_broker_") {
+        auto metric_name =
+            [&](std::string_view path) {
+                std::string ret{prefix};
+                for (auto c : path) ret.push_back(c == '/' ? '_' : c);
+                return ret;
+            };
+        for (std::size_t i = 0; i != counter_num; ++i) {
+            auto n = metric_name(name(counter(i))) + "_total";
+            o << "# TYPE " << n << " counter\n";
+            o << n << ' ' << s.counters[i] << '\n';
+        }
+        for (std::size_t i = 0; i != gauge_num; ++i) {
+            auto n = metric_name(name(gauge(i)));
+            o << "# TYPE " << n << " gauge\n";
+            o << n << ' ' << s.gauges[i] << '\n';
+        }
+        for (std::size_t i = 0; i != histogram_num; ++i) {
+            auto const& h = s.histograms[i];
+            auto n = metric_name(name(histogram(i)));
+            o << "# TYPE " << n << " summary\n";
+            for (auto [q, label] : {
+                    std::pair<double, char const*>{0.5, "0.5"},
+                    std::pair<double, char const*>{0.99, "0.99"},
+                    std::pair<double, char const*>{0.999, "0.999"}
+                }
+            ) {
+                o << n << "{quantile=\"" << label << "\"} " << h.quantile(q) << '\n';
+            }
+            o << n << "_sum " << h.sum << '\n';
+            o << n << "_count " << h.count << '\n';
+        }
+    }
+
+    /**
+     * @brief call f(name, value) for the aggregates of the offline queues
+     * The names are "offline/largest/messages" and "offline/largest/bytes", and the values
+     * are the largest numbers of the queues. The usernames and the client ids are not
+     * included, because they are only for the operators.
+     * @param queues range of offline_queue_info
+     */
+    template <typename Queues, typename Func>
+    static void for_each_queue(Queues const& queues, Func&& f) {
+        std::size_t messages = 0;
+        std::size_t bytes = 0;
+        for (auto const& q : queues) {
+            messages = std::max<std::size_t>(messages, q.messages);
+            bytes = std::max<std::size_t>(bytes, q.bytes);
+        }
+        f("offline/largest/messages", std::to_string(messages));
+        f("offline/largest/bytes", std::to_string(bytes));
+    }
+
+    /**
+     * @brief write the offline queues as the Prometheus text exposition format
+     * Each queue is labeled with username and client_id.
+     * @param o      output stream
+     * @param queues range of offline_queue_info in descending order of bytes
+     * @param prefix prefix of the names
+     */
+    template <typename Queues>
+    static void write_queues_text(std::ostream& o, Queues const& queues, std::string_view prefix = "mqtt_broker_") {
+        auto label =
+            [](std::string_view v) {
+                std::string ret;
+                for (auto c : v) {
+                    switch (c) {
+                    case '\\': ret += "\\\\"; break;
+                    case '"':  ret += "\\\""; break;
+                    case '\n': ret += "\\n"; break;
+                    default:   ret.push_back(c); break;
+                    }
+                }
+                return ret;
+            };
+        auto write =
+            [&](std::string_view field, auto value_of) {
+                std::string n{prefix};
+                n += "offline_queue_";
+                n += field;
+                o << "# TYPE " << n << " gauge\n";
+                for (auto const& q : queues) {
+                    o << n
+                      << "{username=\"" << label(q.username)
+                      << "\",client_id=\"" << label(q.client_id) << "\"} "
+                      << value_of(q) << '\n';
+                }
+            };
+        write("messages", [](auto const& q) { return q.messages; });
+        write("bytes", [](auto const& q) { return q.bytes; });
+    }
+
+private:
+    struct histogram_slot {
+        std::array<std::atomic<std::uint64_t>, bucket_num> buckets{};
+        std::atomic<std::uint64_t> count{0};
+        std::atomic<std::uint64_t> sum{0};
+    };
+
+    // aligned to the cache line in order to avoid false sharing between the threads
+    struct alignas(64) slot {
+        std::array<std::atomic<std::uint64_t>, counter_num> counters{};
+        std::array<histogram_slot, histogram_num> histograms{};
+        std::atomic<std::uint64_t> ticks{0}; ///< for sample_latency()
+    };
+
+    slot& local() {
+        // The slot of the last used broker_metrics is cached per thread.
+        // The id is never reused, so the cache of a destroyed object is never hit.
+        auto& c = cache();
+        if (c.id == id_) return *c.sl;
+        return register_thread(c);
+    }
+
+    struct thread_cache {
+        std::uint64_t id = 0;
+        slot* sl = nullptr;
+    };
+
+    static thread_cache& cache() {
+        thread_local thread_cache c;
+        return c;
+    }
+
+    slot& register_thread(thread_cache& c) {
+        std::lock_guard<std::mutex> g{mtx_};
+        auto [it, inserted] = index_.emplace(std::this_thread::get_id(), nullptr);
+        if (inserted) {
+            slots_.push_back(std::make_unique<slot>());
+            it->second = slots_.back().get();
+        }
+        c.id = id_;
+        c.sl = it->second;
+        return *c.sl;
+    }
+
+    static std::atomic<std::uint64_t>& next_id() {
+        static std::atomic<std::uint64_t> id{1};
+        return id;
+    }
+
+    std::uint64_t id_;
+    std::uint64_t latency_mask_;
+    mutable std::mutex mtx_;
+    std::map<std::thread::id, slot*> index_;
+    std::vector<std::unique_ptr<slot>> slots_;
+};
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_BROKER_METRICS_HPP
@@ -7,18 +7,23 @@
 #if !defined(ASYNC_MQTT_BROKER_OFFLINE_MESSAGE_HPP)
 #define ASYNC_MQTT_BROKER_OFFLINE_MESSAGE_HPP
 
+#include <algorithm>
+#include <atomic>
 #include <optional>
+#include <string>
+#include <vector>
 
-#include <boost/asio/steady_timer.hpp>
 #include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 #include <boost/multi_index/sequenced_index.hpp>
 #include <boost/multi_index/key.hpp>
 
 #include <async_mqtt/util/buffer.hpp>
 #include <async_mqtt/util/log.hpp>
+#include <async_mqtt/util/timer_wheel.hpp>
 #include <async_mqtt/protocol_version.hpp>
-#include <async_mqtt/packet/property_variant.hpp>
+#include <async_mqtt/packet/property_block.hpp>
 #include <async_mqtt/packet/v3_1_1_publish.hpp>
 #include <async_mqtt/packet/v3_1_1_pubrel.hpp>
 #include <async_mqtt/packet/v5_publish.hpp>
@@ -33,6 +38,127 @@ namespace mi = boost::multi_index;
 
 class offline_messages;
 
+/**
+ * @brief behavior when a new offline message exceeds the quota
+ */
+enum class offline_overflow_policy {
+    drop_oldest,     ///< erase the oldest messages of the session
+    drop_newest,     ///< discard the new message
+    drop_qos0_first, ///< erase the oldest QoS0 messages of the session, then behave as drop_oldest
+    disconnect,      ///< discard the new message and disconnect the client if it is connected
+};
+
+/**
+ * @brief limits of the offline messages
+ */
+struct offline_limits {
+    std::size_t max_messages = 0; ///< 0 means unlimited
+    std::size_t max_bytes = 0;    ///< sum of the payload sizes. 0 means unlimited
+
+    bool exceeded(std::size_t messages, std::size_t bytes) const {
+        return
+            (max_messages != 0 && messages > max_messages) ||
+            (max_bytes != 0 && bytes > max_bytes);
+    }
+};
+
+/**
+ * @brief quota of the offline messages shared by all sessions of the broker
+ *
+ * Each session is limited by session, and the total of the sessions is limited
+ * by global. When a new message exceeds either of them, the policy is applied
+ * to the queue of the session that receives the message. If the queue can't make
+ * room for the message, that is the message is larger than session.max_bytes or
+ * the global limit is exceeded by the other sessions, only the new message is
+ * discarded regardless of the policy. The total is updated
+ * atomically but it is not locked while the policy is applied, so the global
+ * limit could be exceeded by the number of the concurrent publishers.
+ * Set the limits before accepting connections.
+ */
+class offline_quota {
+public:
+    offline_limits session;
+    offline_limits global;
+    offline_overflow_policy policy = offline_overflow_policy::drop_oldest;
+
+    /**
+     * @brief get the number of the offline messages of all sessions
+     */
+    std::size_t messages() const {
+        return messages_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief get the sum of the payload sizes of the offline messages of all sessions
+     */
+    std::size_t bytes() const {
+        return bytes_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief get the number of the offline messages that have been discarded by the quota
+     */
+    std::size_t dropped() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+private:
+    friend class offline_messages;
+
+    void add(std::size_t bytes) {
+        messages_.fetch_add(1, std::memory_order_relaxed);
+        bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void sub(std::size_t messages, std::size_t bytes) {
+        messages_.fetch_sub(messages, std::memory_order_relaxed);
+        bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    void drop() {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::atomic<std::size_t> messages_{0};
+    std::atomic<std::size_t> bytes_{0};
+    std::atomic<std::size_t> dropped_{0};
+};
+
+/**
+ * @brief offline queue of a session
+ */
+struct offline_queue_info {
+    std::string username;
+    std::string client_id;
+    std::size_t messages;
+    std::size_t bytes; ///< sum of the payload sizes
+};
+
+/**
+ * @brief keep the num largest queues in descending order of bytes
+ */
+inline void keep_largest_offline_queues(std::vector<offline_queue_info>& queues, std::size_t num) {
+    auto mid = queues.begin() + std::ptrdiff_t(std::min(num, queues.size()));
+    std::partial_sort(
+        queues.begin(),
+        mid,
+        queues.end(),
+        [](offline_queue_info const& lhs, offline_queue_info const& rhs) {
+            return lhs.bytes > rhs.bytes;
+        }
+    );
+    queues.erase(mid, queues.end());
+}
+
+/**
+ * @brief result of offline_messages::push_back()
+ */
+enum class offline_push_result {
+    queued,   ///< the message is queued
+    dropped,  ///< the message is discarded by the quota
+    overflow, ///< the message is discarded and the policy is disconnect
+};
+
 // The offline_message structure holds messages that have been published on a
 // topic that a not-currently-connected client is subscribed to.
 // When a new connection is made with the client id for this saved data,
@@ -40,16 +166,18 @@ class offline_messages;
 class offline_message {
 public:
     offline_message(
-        std::string topic,
+        std::uint64_t id,
+        buffer topic,
         std::vector<buffer> payload,
+        std::size_t size,
         pub::opts pubopts,
-        properties props,
-        std::shared_ptr<as::steady_timer> tim_message_expiry)
-        : topic_{force_move(topic)},
+        property_block props)
+        : id_{id},
+          topic_{force_move(topic)},
           payload_(force_move(payload)),
+          size_{size},
           pubopts_{pubopts},
-          props_(force_move(props)),
-          tim_message_expiry_{force_move(tim_message_expiry)}
+          props_(force_move(props))
     {
     }
 
@@ -84,10 +212,10 @@ public:
                             pubopts_,
                             props_
                         };
-                    if (tim_message_expiry_) {
+                    if (auto expiry = tim_message_expiry_.expiry()) {
                         auto d =
                             std::chrono::duration_cast<std::chrono::seconds>(
-                                tim_message_expiry_->expiry() - std::chrono::steady_clock::now()
+                                *expiry - std::chrono::steady_clock::now()
                             ).count();
                         if (d < 0) d = 0;
                         packet.update_message_expiry_interval(static_cast<uint32_t>(d));
@@ -126,23 +254,59 @@ public:
         }
     }
 
+    timer_wheel::handle const* tim_address() const {
+        return &tim_message_expiry_;
+    }
+
+    std::uint64_t id() const {
+        return id_;
+    }
+
+    qos get_qos() const {
+        return pubopts_.get_qos();
+    }
+
 private:
     friend class offline_messages;
 
-    std::string topic_;
+    std::uint64_t id_;
+    buffer topic_;
     std::vector<buffer> payload_;
+    std::size_t size_; // payload bytes
     pub::opts pubopts_;
-    properties props_;
-    std::shared_ptr<as::steady_timer> tim_message_expiry_;
+    property_block props_;
+    // scheduled only if the message has MessageExpiryInterval
+    mutable timer_wheel::handle tim_message_expiry_;
 };
 
 class offline_messages {
 public:
+    explicit offline_messages(offline_quota& quota)
+        :quota_{quota}
+    {}
+
+    ~offline_messages() {
+        clear();
+    }
+
+    offline_messages(offline_messages const&) = delete;
+    offline_messages& operator=(offline_messages const&) = delete;
+
     template <typename Epsp>
     void send_until_fail(Epsp& epsp, protocol_version ver) {
+        send_until_fail(epsp, ver, [](std::uint64_t) {});
+    }
+
+    /**
+     * @brief send the messages until packet_id is exhausted
+     * @param sent_handler called with the id of the last sent (and popped) message
+     */
+    template <typename Epsp, typename SentHandler>
+    void send_until_fail(Epsp& epsp, protocol_version ver, SentHandler&& sent_handler) {
         epsp.dispatch(
-            [this, epsp, ver] {
+            [this, epsp, ver, sent_handler = std::forward<SentHandler>(sent_handler)] () mutable {
                 auto& idx = messages_.get<tag_seq>();
+                std::optional<std::uint64_t> last_id;
                 while (!idx.empty()) {
                     auto it = idx.begin();
 
@@ -150,65 +314,111 @@ public:
                     // See https://github.com/boostorg/multi_index/issues/50
                     auto& m = const_cast<offline_message&>(*it);
                     if (m.send(epsp, ver)) {
-                        idx.pop_front();
+                        last_id.emplace(m.id());
+                        erase(it);
                     }
                     else {
                         break;
                     }
                 }
+                if (last_id) sent_handler(*last_id);
             }
         );
     }
 
     void clear() {
+        quota_.sub(messages_.size(), bytes_);
         messages_.clear();
+        bytes_ = 0;
     }
 
     bool empty() const {
         return messages_.empty();
     }
 
-    void push_back(
-        as::io_context& timer_ioc,
-        std::string pub_topic,
+    /**
+     * @brief get the number of the messages
+     */
+    std::size_t size() const {
+        return messages_.size();
+    }
+
+    /**
+     * @brief get the sum of the payload sizes of the messages
+     */
+    std::size_t bytes() const {
+        return bytes_;
+    }
+
+    /**
+     * @brief push back the message
+     * If the message has MessageExpiryInterval, it is scheduled on the wheel.
+     * When it expires, on_expire is called with the owner. Then the owner calls
+     * erase_expired() under its lock.
+     * If the message exceeds the quota, the policy of the quota is applied.
+     * @param wheel     timer_wheel
+     * @param owner     on_expire is called only if it is alive
+     * @param on_expire expire handler
+     * @param id        id of the message. It must be greater than the ids of the queued messages.
+     * @param dropped   called with the id of each message that is erased to make room
+     * @return result
+     */
+    template <typename DroppedHandler>
+    offline_push_result push_back(
+        timer_wheel& wheel,
+        std::weak_ptr<void> owner,
+        timer_wheel::expire_handler on_expire,
+        std::uint64_t id,
+        buffer pub_topic,
         std::vector<buffer> payload,
         pub::opts pubopts,
-        properties props) {
-        std::optional<std::chrono::steady_clock::duration> message_expiry_interval;
+        property_block props,
+        DroppedHandler&& dropped) {
+        std::size_t size = 0;
+        for (auto const& b : payload) size += b.size();
 
-        for (auto const& prop : props) {
-            prop.visit(
-                overload {
-                    [&](property::message_expiry_interval const& p) {
-                        message_expiry_interval.emplace(std::chrono::seconds(p.val()));
-                    },
-                    [](auto const&){}
-                }
-            );
+        if (auto result = make_room(size, pubopts.get_qos(), dropped)) {
+            return *result;
         }
 
-        std::shared_ptr<as::steady_timer> tim_message_expiry;
-        if (message_expiry_interval) {
-            tim_message_expiry = std::make_shared<as::steady_timer>(timer_ioc, *message_expiry_interval);
-            tim_message_expiry->async_wait(
-                [this, wp = std::weak_ptr<as::steady_timer>(tim_message_expiry)](error_code ec) mutable {
-                    if (auto sp = wp.lock()) {
-                        if (!ec) {
-                            messages_.get<tag_tim>().erase(sp);
-                        }
-                    }
-                }
-            );
+        std::optional<std::chrono::steady_clock::duration> message_expiry_interval;
+        if (auto mei = props.message_expiry_interval()) {
+            message_expiry_interval.emplace(std::chrono::seconds(*mei));
         }
 
         auto& seq_idx = messages_.get<tag_seq>();
-        seq_idx.emplace_back(
+        auto [it, inserted] = seq_idx.emplace_back(
+            id,
             force_move(pub_topic),
             force_move(payload),
+            size,
             pubopts,
-            force_move(props),
-            force_move(tim_message_expiry)
+            force_move(props)
         );
+        if (inserted) {
+            bytes_ += size;
+            quota_.add(size);
+            if (message_expiry_interval) {
+                wheel.schedule(it->tim_message_expiry_, *message_expiry_interval, force_move(owner), on_expire);
+            }
+        }
+        return offline_push_result::queued;
+    }
+
+    /**
+     * @brief erase the message if the handle has expired
+     * @param key the handle that is passed to the expire handler
+     * @return the id of the erased message
+     */
+    std::optional<std::uint64_t> erase_expired(timer_wheel::handle const* key) {
+        auto& idx = messages_.get<tag_tim>();
+        auto it = idx.find(key);
+        if (it != idx.end() && it->tim_message_expiry_.expired()) {
+            auto id = it->id();
+            erase(messages_.project<tag_seq>(it));
+            return id;
+        }
+        return std::nullopt;
     }
 
 private:
@@ -218,14 +428,90 @@ private:
             mi::sequenced<
                 mi::tag<tag_seq>
             >,
-            mi::ordered_non_unique<
+            mi::hashed_unique<
                 mi::tag<tag_tim>,
-                mi::key<&offline_message::tim_message_expiry_>
+                mi::key<&offline_message::tim_address>
+            >,
+            // QoS0 messages come first in the order of arrival
+            mi::ordered_unique<
+                mi::tag<tag_qos>,
+                mi::key<&offline_message::get_qos, &offline_message::id>
             >
         >
     >;
 
+    using seq_iterator = mi_offline_message::index<tag_seq>::type::iterator;
+
+    void erase(seq_iterator it) {
+        bytes_ -= it->size_;
+        quota_.sub(1, it->size_);
+        messages_.get<tag_seq>().erase(it);
+    }
+
+    bool exceeded(std::size_t size) const {
+        return
+            quota_.session.exceeded(messages_.size() + 1, bytes_ + size) ||
+            quota_.global.exceeded(quota_.messages() + 1, quota_.bytes() + size);
+    }
+
+    // True if the message doesn't fit even if the queue is empty.
+    bool never_fits(std::size_t size) const {
+        if (quota_.session.max_bytes != 0 && size > quota_.session.max_bytes) return true;
+        // the total of the other sessions. It can be updated concurrently.
+        auto others_messages = quota_.messages() - std::min(quota_.messages(), messages_.size());
+        auto others_bytes = quota_.bytes() - std::min(quota_.bytes(), bytes_);
+        return quota_.global.exceeded(others_messages + 1, others_bytes + size);
+    }
+
+    // Apply the policy until the new message fits the quota.
+    // Return the result if the new message is not queued.
+    template <typename DroppedHandler>
+    std::optional<offline_push_result> make_room(std::size_t size, qos qos_value, DroppedHandler& dropped) {
+        if (!exceeded(size)) return std::nullopt;
+        if (never_fits(size)) {
+            // Erasing the queued messages doesn't help.
+            quota_.drop();
+            return offline_push_result::dropped;
+        }
+        while (exceeded(size)) {
+            auto& seq_idx = messages_.get<tag_seq>();
+            switch (quota_.policy) {
+            case offline_overflow_policy::drop_newest:
+                quota_.drop();
+                return offline_push_result::dropped;
+            case offline_overflow_policy::disconnect:
+                quota_.drop();
+                return offline_push_result::overflow;
+            case offline_overflow_policy::drop_qos0_first: {
+                auto& qos_idx = messages_.get<tag_qos>();
+                auto it = qos_idx.begin();
+                if (it != qos_idx.end() && it->get_qos() == qos::at_most_once) {
+                    quota_.drop();
+                    dropped(it->id());
+                    erase(messages_.project<tag_seq>(it));
+                    continue;
+                }
+                // no QoS0 message is queued
+                if (qos_value == qos::at_most_once) {
+                    quota_.drop();
+                    return offline_push_result::dropped;
+                }
+            } [[fallthrough]];
+            case offline_overflow_policy::drop_oldest:
+                quota_.drop();
+                // the other sessions have queued messages concurrently
+                if (seq_idx.empty()) return offline_push_result::dropped;
+                dropped(seq_idx.front().id());
+                erase(seq_idx.begin());
+                break;
+            }
+        }
+        return std::nullopt;
+    }
+
+    offline_quota& quota_;
     mi_offline_message messages_;
+    std::size_t bytes_ = 0;
 };
 
 } // namespace async_mqtt
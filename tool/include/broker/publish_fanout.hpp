@@ -0,0 +1,230 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_BROKER_PUBLISH_FANOUT_HPP)
+#define ASYNC_MQTT_BROKER_PUBLISH_FANOUT_HPP
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <boost/numeric/conversion/cast.hpp>
+
+#include <async_mqtt/util/buffer.hpp>
+#include <async_mqtt/util/stream.hpp>
+#include <async_mqtt/packet/v3_1_1_publish.hpp>
+#include <async_mqtt/packet/v5_publish.hpp>
+#include <async_mqtt/packet/property_variant.hpp>
+#include <async_mqtt/packet/property_block.hpp>
+
+namespace async_mqtt {
+
+/**
+ * @brief the largest message that is copied before it is stored
+ * Received buffers alias the read slab of the stream. A stored (offline or retained)
+ * message can live long, so a small one is copied not to keep the whole slab alive.
+ * A message larger than this wastes at most the same size of the slab.
+ */
+static constexpr std::size_t stored_message_copy_threshold = default_bulk_read_buffer_size / 2;
+
+/**
+ * @brief copy the topic and the payload into one allocation if they are small
+ * @return true if they are copied
+ */
+inline bool detach_from_slab(buffer& topic, std::vector<buffer>& payload) {
+    auto size = topic.size();
+    for (auto const& b : payload) size += b.size();
+    if (size > stored_message_copy_threshold) return false;
+    auto storage = std::make_shared<std::string>();
+    storage->reserve(size);
+    storage->append(topic.data(), topic.size());
+    for (auto const& b : payload) storage->append(b.data(), b.size());
+    std::string_view sv{*storage};
+    auto topic_size = topic.size();
+    topic = buffer{sv.substr(0, topic_size), storage};
+    if (!payload.empty()) {
+        payload = std::vector<buffer>{buffer{sv.substr(topic_size), force_move(storage)}};
+    }
+    return true;
+}
+
+/**
+ * Outgoing PUBLISH packets of one published message.
+ *
+ * A packet is built once per delivery shape, that is protocol version,
+ * publish options (QoS and retain) and subscription identifier. Each recipient
+ * copies the packet and sets only its packet id. The topic and the payload
+ * buffers are shared by all the packets.
+ * The properties are encoded once, and the subscription identifier is overlaid
+ * on them without re-encoding.
+ * It is used only while the message is delivered, so the packets are kept in
+ * vectors that are searched linearly.
+ */
+class publish_fanout {
+public:
+    publish_fanout(
+        buffer topic,
+        std::vector<buffer> const& payload,
+        properties const& props
+    ):topic_{force_move(topic)},
+      payload_{payload},
+      props_{props}
+    {}
+
+    publish_fanout(
+        buffer topic,
+        std::vector<buffer> const& payload,
+        property_block props
+    ):topic_{force_move(topic)},
+      payload_{payload},
+      props_{force_move(props)}
+    {}
+
+    /**
+     * @brief Get the packet for MQTT v3.1.1
+     * The reference is valid until the next call. Copy it, and if QoS is
+     * AtLeastOnce or ExactlyOnce, call set_packet_id() on the copy.
+     */
+    v3_1_1::publish_packet const& v3_1_1_packet(pub::opts opts) {
+        auto key = std::uint8_t(opts);
+        for (auto const& e : v3_1_1_packets_) {
+            if (std::get<0>(e) == key) return std::get<1>(e);
+        }
+        v3_1_1_packets_.emplace_back(
+            key,
+            v3_1_1::publish_packet{
+                placeholder_packet_id(opts),
+                topic_,
+                payload_,
+                opts
+            }
+        );
+        return std::get<1>(v3_1_1_packets_.back());
+    }
+
+    /**
+     * @brief Get the packet for MQTT v5
+     * The reference is valid until the next call. Copy it, and if QoS is
+     * AtLeastOnce or ExactlyOnce, call set_packet_id() on the copy.
+     */
+    v5::publish_packet const& v5_packet(pub::opts opts, std::optional<std::size_t> sid) {
+        auto key = std::uint8_t(opts);
+        for (auto const& e : v5_packets_) {
+            if (std::get<0>(e) == key && std::get<1>(e) == sid) return std::get<2>(e);
+        }
+        v5_packets_.emplace_back(
+            key,
+            sid,
+            v5::publish_packet{
+                placeholder_packet_id(opts),
+                topic_,
+                payload_,
+                opts,
+                props(sid)
+            }
+        );
+        return std::get<2>(v5_packets_.back());
+    }
+
+    buffer const& topic() const {
+        return topic_;
+    }
+
+    std::vector<buffer> const& payload() const {
+        return payload_;
+    }
+
+    /**
+     * @brief Get the properties with the subscription identifier
+     */
+    property_block props(std::optional<std::size_t> sid) const {
+        if (sid) {
+            return props_.with_subscription_identifier(boost::numeric_cast<std::uint32_t>(*sid));
+        }
+        return props_;
+    }
+
+    /**
+     * @brief Get the topic of the stored message
+     * The stored message is the copy of the message for the offline queues and
+     * the retained messages. It is made once at the first call and shared by them.
+     * See detach_from_slab().
+     */
+    buffer const& stored_topic() {
+        return stored().topic;
+    }
+
+    /**
+     * @brief Get the payload of the stored message
+     */
+    std::vector<buffer> const& stored_payload() {
+        return stored().payload;
+    }
+
+    /**
+     * @brief Get the properties of the stored message with the subscription identifier
+     */
+    property_block stored_props(std::optional<std::size_t> sid) {
+        auto const& props = stored().props;
+        if (sid) {
+            return props.with_subscription_identifier(boost::numeric_cast<std::uint32_t>(*sid));
+        }
+        return props;
+    }
+
+    /**
+     * @brief Get MessageExpiryInterval of the message
+     */
+    std::optional<std::uint32_t> message_expiry_interval() const {
+        return props_.message_expiry_interval();
+    }
+
+    /**
+     * @brief Get the number of built packets (for test)
+     */
+    std::size_t num_of_packets() const {
+        return v3_1_1_packets_.size() + v5_packets_.size();
+    }
+
+private:
+    struct stored_message {
+        buffer topic;
+        std::vector<buffer> payload;
+        property_block props;
+    };
+
+    stored_message const& stored() {
+        if (!stored_) {
+            stored_message m{topic_, payload_, props_};
+            if (detach_from_slab(m.topic, m.payload) && !props_.empty()) {
+                // encoded again into its own buffer
+                m.props = property_block{props_.to_properties()};
+            }
+            stored_.emplace(force_move(m));
+        }
+        return *stored_;
+    }
+
+    // The packet id is replaced by each recipient.
+    static packet_id_type placeholder_packet_id(pub::opts opts) {
+        auto qos_value = opts.get_qos();
+        if (qos_value == qos::at_least_once || qos_value == qos::exactly_once) return 1;
+        return 0;
+    }
+
+    buffer topic_;
+    std::vector<buffer> payload_;
+    property_block props_;
+    std::optional<stored_message> stored_;
+    std::vector<std::tuple<std::uint8_t, v3_1_1::publish_packet>> v3_1_1_packets_;
+    std::vector<std::tuple<std::uint8_t, std::optional<std::size_t>, v5::publish_packet>> v5_packets_;
+};
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_BROKER_PUBLISH_FANOUT_HPP
@@ -0,0 +1,249 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_BROKER_RCU_HPP)
+#define ASYNC_MQTT_BROKER_RCU_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/assert.hpp>
+
+#include <async_mqtt/util/move.hpp>
+
+namespace async_mqtt {
+
+/**
+ * @brief epoch based read-copy-update domain
+ *
+ * Readers announce the global epoch at the beginning of the read-side critical
+ * section into their own (cache line padded) record, and clear it at the end.
+ * Readers only load shared state and store into their own record, so they never
+ * execute a read-modify-write on a shared cache line.
+ *
+ * Writers replace the shared pointer, call advance(), and keep the old object
+ * until min_active() reaches the returned epoch. After that, no reader can
+ * refer to the old object.
+ * Or writers pass the destruction of the old object to retire(). The reclaimer
+ * thread of the domain calls it after the grace period, so the old objects are
+ * freed even if no more updates come.
+ *
+ * Reader records are allocated per thread when the thread enters the first
+ * read-side critical section and reused after the thread exits.
+ */
+class rcu_domain {
+public:
+    static rcu_domain& instance() {
+        static rcu_domain d;
+        return d;
+    }
+
+    /**
+     * @brief enter the read-side critical section. It can be nested.
+     */
+    void read_lock() {
+        auto& r = local();
+        if (r.depth++ == 0) {
+            // seq_cst store on the own record. If the writer's scan misses it,
+            // the following load of the protected pointer returns the replaced one.
+            r.rec->epoch.store(epoch_.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+        }
+    }
+
+    /**
+     * @brief leave the read-side critical section
+     */
+    void read_unlock() {
+        auto& r = local();
+        BOOST_ASSERT(r.depth > 0);
+        if (--r.depth == 0) {
+            r.rec->epoch.store(0, std::memory_order_release);
+        }
+    }
+
+    /**
+     * @brief start a new epoch
+     *
+     * Call it after the protected pointer is replaced.
+     * @return the new epoch. The replaced object can be reclaimed if min_active() >= it.
+     */
+    std::uint64_t advance() {
+        return epoch_.fetch_add(1, std::memory_order_seq_cst) + 1;
+    }
+
+    /**
+     * @brief get the oldest epoch that is announced by the readers
+     * @return the oldest epoch. If no reader is in the critical section, the max value.
+     */
+    std::uint64_t min_active() const {
+        std::uint64_t ret = std::numeric_limits<std::uint64_t>::max();
+        std::lock_guard<std::mutex> g{mtx_records_};
+        for (auto const& r : records_) {
+            auto e = r.epoch.load(std::memory_order_seq_cst);
+            if (e != 0 && e < ret) ret = e;
+        }
+        return ret;
+    }
+
+    /**
+     * @brief call the function after the grace period
+     *
+     * Call it after the protected pointer is replaced. The function is called on the
+     * reclaimer thread after all the readers that could refer to the replaced object
+     * leave the read-side critical section. It is called without any lock of the
+     * domain, so it can destroy an object whose destructor locks the other mutexes
+     * or calls retire().
+     * @param f function that destroys the replaced object
+     */
+    void retire(std::function<void()> f) {
+        auto epoch = advance();
+        {
+            std::lock_guard<std::mutex> g{mtx_retired_};
+            retired_.emplace_back(epoch, force_move(f));
+            if (!reclaimer_.joinable()) {
+                reclaimer_ = std::thread{[this] { reclaim_loop(); }};
+            }
+        }
+        cv_retired_.notify_one();
+    }
+
+    /**
+     * @brief wait until all retired functions are called
+     *
+     * It must not be called in the read-side critical section, or while a lock
+     * that the retired functions need is held.
+     */
+    void barrier() {
+        std::unique_lock<std::mutex> g{mtx_retired_};
+        cv_reclaimed_.wait(g, [&] { return retired_.empty() && calling_ == 0; });
+    }
+
+    /**
+     * @brief get the number of retired functions that are not called yet (for test)
+     */
+    std::size_t pending() const {
+        std::lock_guard<std::mutex> g{mtx_retired_};
+        return retired_.size() + calling_;
+    }
+
+private:
+    rcu_domain() = default;
+
+    ~rcu_domain() {
+        {
+            std::lock_guard<std::mutex> g{mtx_retired_};
+            stop_ = true;
+        }
+        cv_retired_.notify_one();
+        if (reclaimer_.joinable()) reclaimer_.join();
+    }
+
+    void reclaim_loop() {
+        std::unique_lock<std::mutex> g{mtx_retired_};
+        while (true) {
+            cv_retired_.wait(g, [&] { return stop_ || !retired_.empty(); });
+            if (retired_.empty()) return;
+            auto min = min_active();
+            std::vector<std::function<void()>> ready;
+            while (!retired_.empty() && retired_.front().first <= min) {
+                ready.push_back(force_move(retired_.front().second));
+                retired_.pop_front();
+            }
+            if (ready.empty()) {
+                // Readers are in the critical section. Poll until they leave.
+                cv_retired_.wait_for(g, std::chrono::milliseconds(1));
+                continue;
+            }
+            calling_ = ready.size();
+            g.unlock();
+            for (auto& f : ready) f();
+            ready.clear();
+            g.lock();
+            calling_ = 0;
+            cv_reclaimed_.notify_all();
+        }
+    }
+
+    // Each record occupies its own cache line.
+    struct alignas(64) record {
+        std::atomic<std::uint64_t> epoch{0}; // 0 means quiescent
+        bool used = false;
+    };
+
+    struct local_record {
+        explicit local_record(rcu_domain& d)
+            :dom{d}
+        {
+            std::lock_guard<std::mutex> g{dom.mtx_records_};
+            for (auto& r : dom.records_) {
+                if (!r.used) {
+                    rec = &r;
+                    break;
+                }
+            }
+            if (!rec) rec = &dom.records_.emplace_back();
+            rec->used = true;
+        }
+        ~local_record() {
+            std::lock_guard<std::mutex> g{dom.mtx_records_};
+            rec->epoch.store(0, std::memory_order_release);
+            rec->used = false;
+        }
+        rcu_domain& dom;
+        record* rec = nullptr;
+        std::size_t depth = 0;
+    };
+
+    local_record& local() {
+        thread_local local_record r{*this};
+        return r;
+    }
+
+    alignas(64) std::atomic<std::uint64_t> epoch_{1};
+    mutable std::mutex mtx_records_;
+    std::deque<record> records_; // deque keeps the addresses of the records
+
+    mutable std::mutex mtx_retired_;
+    std::condition_variable cv_retired_;
+    std::condition_variable cv_reclaimed_;
+    std::deque<std::pair<std::uint64_t, std::function<void()>>> retired_;
+    std::size_t calling_ = 0;
+    bool stop_ = false;
+    std::thread reclaimer_;
+};
+
+/**
+ * @brief RAII guard of the read-side critical section
+ */
+class rcu_read_guard {
+public:
+    explicit rcu_read_guard(rcu_domain& d = rcu_domain::instance())
+        :d_{d}
+    {
+        d_.read_lock();
+    }
+    ~rcu_read_guard() {
+        d_.read_unlock();
+    }
+    rcu_read_guard(rcu_read_guard const&) = delete;
+    rcu_read_guard& operator=(rcu_read_guard const&) = delete;
+
+private:
+    rcu_domain& d_;
+};
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_BROKER_RCU_HPP
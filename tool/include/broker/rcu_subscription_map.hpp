@@ -0,0 +1,304 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_BROKER_RCU_SUBSCRIPTION_MAP_HPP)
+#define ASYNC_MQTT_BROKER_RCU_SUBSCRIPTION_MAP_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/assert.hpp>
+
+#include <async_mqtt/util/move.hpp>
+
+#include <broker/mutex.hpp>
+#include <broker/subscription_map.hpp>
+#include <broker/rcu.hpp>
+
+namespace async_mqtt {
+
+/**
+ * @brief subscription map that has an optional RCU snapshot mode
+ *
+ * If the snapshot mode is disabled (default), it is the same as Map.
+ * The caller protects both updates and find() by the caller's mutex.
+ *
+ * If the snapshot mode is enabled, find() matches against an immutable copy
+ * (snapshot) of the map in the rcu_domain's read-side critical section.
+ * It never locks, and never blocks on updates.
+ * Updates are done on the map itself under the caller's exclusive lock
+ * as usual, and then requested to be published by publish().
+ *
+ * The publisher thread copies the map into a new snapshot at most once per
+ * publish interval, so a burst of subscribes/unsubscribes is published as one
+ * copy. Until then, find() doesn't see the updates. The callers that need to
+ * see them, e.g. SUBACK, wait for the publish by when_published() or sync().
+ * The replaced snapshots are freed by the reclaimer thread of the rcu_domain.
+ *
+ * @tparam Map multiple_subscription_map
+ */
+template <typename Map>
+class rcu_subscription_map : public Map {
+public:
+    using handle = typename Map::handle;
+
+    /**
+     * @brief the default minimum interval between the copies of the map
+     */
+    static constexpr std::chrono::steady_clock::duration default_publish_interval =
+        std::chrono::milliseconds(10);
+
+    rcu_subscription_map() = default;
+    rcu_subscription_map(rcu_subscription_map const&) = delete;
+    rcu_subscription_map& operator=(rcu_subscription_map const&) = delete;
+
+    ~rcu_subscription_map() {
+        if (publisher_.joinable()) {
+            {
+                std::lock_guard<std::mutex> g_pub{mtx_publish_};
+                stop_ = true;
+            }
+            cv_publish_.notify_all();
+            publisher_.join();
+        }
+        // No reader can exist here. The waiters are called without the publish.
+        for (auto& w : waiters_) w.second();
+        delete snapshot_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief enable the snapshot mode
+     *
+     * It must be called before any concurrent access.
+     * It starts the publisher thread.
+     * @param mtx              the caller's mutex that protects the updates
+     * @param publish_interval the minimum interval between the copies of the map.
+     *                         0 copies the map as soon as publish() is called.
+     */
+    void enable_snapshot(
+        mutex& mtx,
+        std::chrono::steady_clock::duration publish_interval = default_publish_interval
+    ) {
+        if (snapshot_enabled_) return;
+        snapshot_enabled_ = true;
+        mtx_ = &mtx;
+        publish_interval_ = publish_interval;
+        snapshot_.store(new Map(static_cast<Map const&>(*this)), std::memory_order_seq_cst);
+        published_version_ = version_.load(std::memory_order_relaxed);
+        done_version_ = published_version_;
+        published_at_ = std::chrono::steady_clock::now();
+        publisher_ = std::thread([this] { run(); });
+    }
+
+    bool snapshot_enabled() const {
+        return snapshot_enabled_;
+    }
+
+    // Updates. They must be called under the caller's exclusive lock.
+
+    template <typename K, typename V>
+    std::pair<handle, bool> insert_or_assign(std::string_view topic_filter, K&& key, V&& value) {
+        version_.fetch_add(1, std::memory_order_relaxed);
+        return Map::insert_or_assign(topic_filter, std::forward<K>(key), std::forward<V>(value));
+    }
+
+    template <typename K, typename V>
+    std::pair<handle, bool> insert_or_assign(handle const& h, K&& key, V&& value) {
+        version_.fetch_add(1, std::memory_order_relaxed);
+        return Map::insert_or_assign(h, std::forward<K>(key), std::forward<V>(value));
+    }
+
+    template <typename Key>
+    std::size_t erase(handle const& h, Key const& key) {
+        version_.fetch_add(1, std::memory_order_relaxed);
+        return Map::erase(h, key);
+    }
+
+    template <typename Key>
+    std::size_t erase(std::string_view topic_filter, Key const& key) {
+        version_.fetch_add(1, std::memory_order_relaxed);
+        return Map::erase(topic_filter, key);
+    }
+
+    /**
+     * @brief request to publish the updates
+     *
+     * Call it after the caller's exclusive lock is released.
+     * It doesn't copy the map. The publisher thread copies it after the
+     * publish interval from the previous copy.
+     * @param mtx the caller's mutex that protects the updates
+     */
+    void publish(mutex& mtx) {
+        if (!snapshot_enabled_) return;
+        BOOST_ASSERT(&mtx == mtx_);
+        (void)mtx;
+        {
+            std::lock_guard<std::mutex> g_pub{mtx_publish_};
+            if (published_version_ == version_.load(std::memory_order_relaxed)) return;
+            requested_ = true;
+        }
+        cv_publish_.notify_all();
+    }
+
+    /**
+     * @brief call the function after the updates so far are published
+     *
+     * If the updates have already been published or the snapshot mode is
+     * disabled, the function is called immediately on the caller's thread.
+     * Otherwise, it is called on the publisher thread. It must not block.
+     * @param f function to call
+     */
+    void when_published(std::function<void()> f) {
+        if (snapshot_enabled_) {
+            std::unique_lock<std::mutex> g_pub{mtx_publish_};
+            auto version = version_.load(std::memory_order_relaxed);
+            if (!stop_ && done_version_ < version) {
+                waiters_.emplace_back(version, force_move(f));
+                requested_ = true;
+                g_pub.unlock();
+                cv_publish_.notify_all();
+                return;
+            }
+        }
+        f();
+    }
+
+    /**
+     * @brief publish the updates so far without waiting for the publish interval
+     *
+     * It blocks until the snapshot is published and the functions registered
+     * by when_published() for the updates are called.
+     */
+    void sync() {
+        if (!snapshot_enabled_) return;
+        std::unique_lock<std::mutex> g_pub{mtx_publish_};
+        auto version = version_.load(std::memory_order_relaxed);
+        if (done_version_ >= version) return;
+        requested_ = true;
+        urgent_ = true;
+        cv_publish_.notify_all();
+        cv_done_.wait(g_pub, [&] { return stop_ || done_version_ >= version; });
+    }
+
+    /**
+     * @brief find all topic filters that match the specified topic
+     *
+     * If the snapshot mode is enabled, the caller doesn't need to lock the mutex.
+     * Otherwise, the caller needs to lock the mutex at least shared.
+     * @param topic std::string_view or topic_levels
+     */
+    template <typename Topic, typename Output>
+    void find(Topic const& topic, Output&& callback) const {
+        if (!snapshot_enabled_) {
+            Map::find(topic, std::forward<Output>(callback));
+            return;
+        }
+        rcu_read_guard g;
+        snapshot_.load(std::memory_order_seq_cst)->find(topic, std::forward<Output>(callback));
+    }
+
+    /**
+     * @brief check whether any topic filter matches the specified topic
+     *
+     * It is checked against the snapshot without locking, and each matching topic
+     * filter is checked once regardless of the number of its subscribers.
+     * The snapshot mode must be enabled. It can be called from any threads.
+     * @param topic std::string_view or topic_levels
+     */
+    template <typename Topic>
+    bool any_match(Topic const& topic) const {
+        BOOST_ASSERT(snapshot_enabled_);
+        rcu_read_guard g;
+        return snapshot_.load(std::memory_order_seq_cst)->any_match(topic);
+    }
+
+private:
+    // the publisher thread
+    void run() {
+        std::unique_lock<std::mutex> g_pub{mtx_publish_};
+        while (true) {
+            cv_publish_.wait(g_pub, [&] { return stop_ || requested_; });
+            if (stop_) return;
+            // collect the updates in the interval into one copy
+            cv_publish_.wait_until(
+                g_pub,
+                published_at_ + publish_interval_,
+                [&] { return stop_ || urgent_; }
+            );
+            if (stop_) return;
+            requested_ = false;
+            urgent_ = false;
+            g_pub.unlock();
+
+            std::unique_ptr<Map> next;
+            std::uint64_t version;
+            {
+                std::shared_lock<mutex> g{*mtx_};
+                version = version_.load(std::memory_order_relaxed);
+                if (version != published_version_) {
+                    next.reset(new Map(static_cast<Map const&>(*this)));
+                }
+            }
+            if (next) {
+                auto prev = snapshot_.exchange(next.release(), std::memory_order_seq_cst);
+                rcu_domain::instance().retire([prev] { delete prev; });
+            }
+
+            g_pub.lock();
+            published_version_ = version;
+            published_at_ = std::chrono::steady_clock::now();
+            std::vector<std::function<void()>> ready;
+            for (auto it = waiters_.begin(); it != waiters_.end();) {
+                if (it->first <= version) {
+                    ready.push_back(force_move(it->second));
+                    it = waiters_.erase(it);
+                }
+                else {
+                    ++it;
+                }
+            }
+            g_pub.unlock();
+            for (auto& f : ready) f();
+            g_pub.lock();
+            done_version_ = version;
+            cv_done_.notify_all();
+        }
+    }
+
+    bool snapshot_enabled_ = false;
+    mutex* mtx_ = nullptr;
+    std::chrono::steady_clock::duration publish_interval_ = default_publish_interval;
+    std::atomic<std::uint64_t> version_{0}; // updated under the caller's exclusive lock
+    std::atomic<Map const*> snapshot_{nullptr};
+
+    // protected by mtx_publish_
+    std::mutex mtx_publish_;
+    std::condition_variable cv_publish_;
+    std::condition_variable cv_done_;
+    std::uint64_t published_version_ = 0; // version of the snapshot
+    std::uint64_t done_version_ = 0;      // version whose waiters have been called
+    std::chrono::steady_clock::time_point published_at_;
+    bool requested_ = false;
+    bool urgent_ = false;
+    bool stop_ = false;
+    std::deque<std::pair<std::uint64_t, std::function<void()>>> waiters_;
+    std::thread publisher_;
+};
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_BROKER_RCU_SUBSCRIPTION_MAP_HPP
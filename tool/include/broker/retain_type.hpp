@@ -7,9 +7,10 @@
 #if !defined(ASYNC_MQTT_BROKER_RETAIN_TYPE_HPP)
 #define ASYNC_MQTT_BROKER_RETAIN_TYPE_HPP
 
-#include <boost/asio/steady_timer.hpp>
+#include <memory>
 
 #include <async_mqtt/util/buffer.hpp>
+#include <async_mqtt/util/timer_wheel.hpp>
 #include <async_mqtt/packet/property_variant.hpp>
 #include <async_mqtt/packet/subopts.hpp>
 
@@ -19,15 +20,13 @@ namespace async_mqtt {
 // case clients add a new subscription to the associated topics.
 struct retain_type {
     retain_type(
-        std::string topic,
+        buffer topic,
         std::vector<buffer> payload,
         properties props,
-        qos qos_value,
-        std::shared_ptr<as::steady_timer> tim_message_expiry = std::shared_ptr<as::steady_timer>())
+        qos qos_value)
         :topic(force_move(topic)),
          props(force_move(props)),
-         qos_value(qos_value),
-         tim_message_expiry(force_move(tim_message_expiry))
+         qos_value(qos_value)
     {
         auto it = std::cbegin(payload);
         auto end = std::cend(payload);
@@ -36,11 +35,14 @@ struct retain_type {
         }
     }
 
-    std::string topic;
+    buffer topic;
     std::vector<buffer> payload;
     properties props;
     qos qos_value;
-    std::shared_ptr<as::steady_timer> tim_message_expiry;
+    // scheduled only if the message has MessageExpiryInterval
+    timer_wheel::handle tim_message_expiry;
+    // The owner of tim_message_expiry. It holds the topic for the expire handler.
+    std::shared_ptr<std::string> expiry_owner;
 };
 
 } // namespace async_mqtt
@@ -7,14 +7,428 @@
 #if !defined(ASYNC_MQTT_BROKER_RETAINED_MESSAGES_HPP)
 #define ASYNC_MQTT_BROKER_RETAINED_MESSAGES_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <functional> // reference_wrapper
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include <boost/assert.hpp>
+
+#include <broker/mutex.hpp>
 #include <broker/retain_type.hpp>
 #include <broker/retained_topic_map.hpp>
+#include <broker/retained_snapshot.hpp>
 
 namespace async_mqtt {
 
-using retained_messages = retained_topic_map<retain_type>;
+/**
+ * @brief retained messages
+ *
+ * The messages are stored in three layers. The base layer is the full snapshot that
+ * was loaded on start, and the delta layer is the delta over it. They are never modified.
+ * The live layer has the messages that are published after that. Publishing or erasing
+ * a topic hides the message of the lower layers.
+ * The messages of the snapshots are created on demand when a subscription matches them.
+ *
+ * The topics that are modified after the last full snapshot are tracked, and
+ * collect_changes() writes only them as a delta while they are a small part of
+ * the messages.
+ *
+ * It is thread safe. The live layer is partitioned by the hash of the topic, and
+ * each partition has its own lock, so the publishers of different topics don't
+ * contend. The hidden messages of the snapshots are marked in bitmaps that are
+ * read without the lock.
+ */
+class retained_messages {
+public:
+    /**
+     * @brief constructor
+     * @param partitions the number of the partitions of the live layer
+     */
+    explicit retained_messages(std::size_t partitions = 1)
+        :partitions_(std::max<std::size_t>(partitions, 1)) {
+    }
+
+    retained_messages(retained_messages const&) = delete;
+    retained_messages& operator=(retained_messages const&) = delete;
+
+    /**
+     * @brief set the base layer and the delta layer
+     *
+     * It must be called before any concurrent access.
+     * @param snapshot snapshot. nullptr clears the base layer.
+     * @param delta    delta of the snapshot. It is ignored if it is not based on the snapshot.
+     */
+    void set_snapshot(
+        std::shared_ptr<retained_snapshot const> snapshot,
+        std::shared_ptr<retained_snapshot const> delta = nullptr
+    ) {
+        auto gs = lock_all<std::unique_lock<mutex>>();
+        base_ = force_move(snapshot);
+        delta_.reset();
+        for (auto& p : partitions_) p.dirty.clear();
+        full_id_.reset();
+        std::size_t snapshot_size = 0;
+        auto generation = ++generation_;
+        hidden_.reset(base_ ? base_->size() : 0);
+        delta_hidden_.reset(0);
+        if (base_) {
+            // 0 is written by the old version that doesn't support the delta
+            if (base_->id() != 0) full_id_.emplace(base_->id());
+            if (delta && delta->is_delta() && full_id_ && delta->id() == *full_id_) {
+                delta_ = force_move(delta);
+                delta_hidden_.reset(delta_->size());
+                for (std::uint32_t v = 0; v != delta_->size(); ++v) {
+                    auto topic = delta_->topic(v);
+                    if (auto bv = base_->find_exact(topic)) hidden_.insert(*bv);
+                    if (!delta_->erased(v)) ++snapshot_size;
+                    // the next delta replaces this one
+                    auto& p = partition_of(topic);
+                    p.dirty.emplace(force_move(topic), generation);
+                }
+            }
+            snapshot_size += base_->size() - hidden_.count();
+        }
+        snapshot_size_.store(snapshot_size, std::memory_order_relaxed);
+    }
+
+    template<typename Topic, typename V>
+    std::size_t insert_or_assign(Topic const& topic, V&& value) {
+        auto& p = partition_of(topic_of(topic));
+        std::lock_guard<mutex> g{p.mtx};
+        auto hidden = hide(topic_of(topic));
+        touch(p, topic_of(topic));
+        return p.live.insert_or_assign(topic, std::forward<V>(value)) == 1 && !hidden ? 1 : 0;
+    }
+
+    /**
+     * @brief call the callback with each message that matches the topic filter
+     *
+     * The callback is called under the lock of the partition, so it must not
+     * modify the retained messages.
+     */
+    template<typename Output>
+    void find(std::string_view topic_filter, Output&& callback) const {
+        if (topic_filter.find_first_of("+#") == std::string_view::npos) {
+            // Only the partition of the topic can have it.
+            auto const& p = partition_of(topic_filter);
+            std::shared_lock<mutex> g{p.mtx};
+            p.live.find(topic_filter, callback);
+        }
+        else {
+            for (auto const& p : partitions_) {
+                std::shared_lock<mutex> g{p.mtx};
+                p.live.find(topic_filter, callback);
+            }
+        }
+        if (!base_) return;
+        auto now = std::chrono::system_clock::now();
+        if (delta_) {
+            delta_->find(
+                topic_filter,
+                [&](std::uint32_t v) {
+                    if (delta_hidden_.contains(v)) return;
+                    if (auto r = delta_->load(v, now)) {
+                        callback(static_cast<retain_type const&>(*r));
+                    }
+                }
+            );
+        }
+        base_->find(
+            topic_filter,
+            [&](std::uint32_t v) {
+                if (hidden_.contains(v)) return;
+                if (auto r = base_->load(v, now)) {
+                    callback(static_cast<retain_type const&>(*r));
+                }
+            }
+        );
+    }
+
+    template<typename Topic>
+    std::size_t erase(Topic const& topic) {
+        auto& p = partition_of(topic_of(topic));
+        std::lock_guard<mutex> g{p.mtx};
+        return erase(p, topic);
+    }
+
+    /**
+     * @brief erase the message of the live layer if pred returns true for it
+     * @param topic topic
+     * @param pred  called with the message under the lock
+     * @return true if erased
+     */
+    template<typename Pred>
+    bool erase_if(std::string_view topic, Pred&& pred) {
+        auto& p = partition_of(topic);
+        std::lock_guard<mutex> g{p.mtx};
+        bool match = false;
+        p.live.find(
+            topic,
+            [&](retain_type const& r) {
+                if (pred(r)) match = true;
+            }
+        );
+        if (!match) return false;
+        erase(p, topic);
+        return true;
+    }
+
+    /**
+     * @brief get the number of the messages
+     * The expired messages of the snapshots are counted until the next snapshot.
+     */
+    std::size_t size() const {
+        std::size_t ret = snapshot_size_.load(std::memory_order_relaxed);
+        for (auto const& p : partitions_) {
+            std::shared_lock<mutex> g{p.mtx};
+            ret += p.live.size();
+        }
+        return ret;
+    }
+
+    /**
+     * @brief get the generation that is increased by each modification
+     */
+    std::uint64_t generation() const {
+        return generation_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief add all messages to the writer
+     * The messages of the snapshots are read by the writer after the lock is released.
+     * @return generation() when the messages were added
+     */
+    std::uint64_t collect(retained_snapshot_writer& writer) const {
+        auto gs = lock_all<std::shared_lock<mutex>>();
+        collect_no_lock(writer);
+        return generation();
+    }
+
+    /**
+     * @brief add the messages that are written to the next snapshot
+     *
+     * If the topics that are modified after the last full snapshot are a quarter of the
+     * messages or less, they are added as the delta of it. Otherwise, all messages are added.
+     * Call saved() after the writer writes the file.
+     * @param writer writer
+     * @return generation() when the messages were added
+     */
+    std::uint64_t collect_changes(retained_snapshot_writer& writer) const {
+        auto gs = lock_all<std::shared_lock<mutex>>();
+        std::size_t dirty = 0;
+        std::size_t size = snapshot_size_.load(std::memory_order_relaxed);
+        for (auto const& p : partitions_) {
+            dirty += p.dirty.size();
+            size += p.live.size();
+        }
+        if (!full_id_ || dirty > size / 4) {
+            collect_no_lock(writer);
+            return generation();
+        }
+        writer.set_delta(*full_id_);
+        for (auto const& p : partitions_) {
+            for (auto const& [topic, generation] : p.dirty) {
+                bool found = false;
+                p.live.find(
+                    topic,
+                    [&](retain_type const& r) {
+                        writer.add(r);
+                        found = true;
+                    }
+                );
+                if (found) continue;
+                if (delta_) {
+                    // loaded from the delta and not modified after that
+                    auto v = delta_->find_exact(topic);
+                    if (v && !delta_hidden_.contains(*v)) {
+                        auto mv = delta_->view(*v);
+                        if (mv && !mv->erased) {
+                            auto life = std::const_pointer_cast<retained_snapshot>(delta_);
+                            writer.add(
+                                topic,
+                                mv->qos_value,
+                                mv->expire_at,
+                                std::string{mv->props},
+                                std::vector<buffer>{buffer{mv->payload, force_move(life)}}
+                            );
+                            continue;
+                        }
+                    }
+                }
+                writer.add_erased(topic);
+            }
+        }
+        return generation();
+    }
+
+    /**
+     * @brief notify that the writer has written the file
+     * @param writer     writer that collect_changes() added the messages to
+     * @param generation the return value of collect_changes()
+     */
+    void saved(retained_snapshot_writer const& writer, std::uint64_t generation) {
+        if (writer.is_delta()) return;
+        auto gs = lock_all<std::unique_lock<mutex>>();
+        full_id_.emplace(writer.id());
+        for (auto& p : partitions_) {
+            for (auto it = p.dirty.begin(); it != p.dirty.end();) {
+                if (it->second <= generation) {
+                    it = p.dirty.erase(it);
+                }
+                else {
+                    ++it;
+                }
+            }
+        }
+    }
+
+private:
+    struct partition {
+        mutable mutex mtx;
+        retained_topic_map<retain_type> live;
+        std::unordered_map<std::string, std::uint64_t> dirty; ///< modified topic and its generation
+    };
+
+    // Value indexes of the messages of a snapshot that are hidden by the live layer.
+    // They are marked under the lock of the partition of the topic, and read without the lock.
+    class hidden_set {
+    public:
+        void reset(std::size_t size) {
+            words_.reset();
+            size_ = size;
+            if (size == 0) return;
+            words_.reset(new std::atomic<std::uint64_t>[(size + 63) / 64]);
+            for (std::size_t i = 0; i != (size + 63) / 64; ++i) {
+                words_[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        // returns true if v is newly marked
+        bool insert(std::uint32_t v) {
+            BOOST_ASSERT(v < size_);
+            auto bit = std::uint64_t(1) << (v % 64);
+            return (words_[v / 64].fetch_or(bit, std::memory_order_release) & bit) == 0;
+        }
+
+        bool contains(std::uint32_t v) const {
+            if (v >= size_) return false;
+            auto bit = std::uint64_t(1) << (v % 64);
+            return (words_[v / 64].load(std::memory_order_acquire) & bit) != 0;
+        }
+
+        std::size_t count() const {
+            std::size_t ret = 0;
+            for (std::uint32_t v = 0; v != size_; ++v) {
+                if (contains(v)) ++ret;
+            }
+            return ret;
+        }
+
+        std::unordered_set<std::uint32_t> to_set() const {
+            std::unordered_set<std::uint32_t> ret;
+            for (std::uint32_t v = 0; v != size_; ++v) {
+                if (contains(v)) ret.insert(v);
+            }
+            return ret;
+        }
+
+    private:
+        std::unique_ptr<std::atomic<std::uint64_t>[]> words_;
+        std::size_t size_ = 0;
+    };
+
+    static std::string_view topic_of(std::string_view topic) {
+        return topic;
+    }
+
+    static std::string_view topic_of(topic_levels const& topic) {
+        return topic.topic();
+    }
+
+    partition& partition_of(std::string_view topic) {
+        if (partitions_.size() == 1) return partitions_.front();
+        return partitions_[std::hash<std::string_view>{}(topic) % partitions_.size()];
+    }
+
+    partition const& partition_of(std::string_view topic) const {
+        return const_cast<retained_messages&>(*this).partition_of(topic);
+    }
+
+    // Lock all partitions in the order of the index.
+    template <typename Lock>
+    std::vector<Lock> lock_all() const {
+        std::vector<Lock> gs;
+        gs.reserve(partitions_.size());
+        for (auto& p : partitions_) gs.emplace_back(p.mtx);
+        return gs;
+    }
+
+    void collect_no_lock(retained_snapshot_writer& writer) const {
+        for (auto const& p : partitions_) {
+            p.live.for_each(
+                [&](retain_type const& r) {
+                    writer.add(r);
+                }
+            );
+        }
+        if (delta_) writer.add_base(delta_, delta_hidden_.to_set());
+        if (base_) writer.add_base(base_, hidden_.to_set());
+    }
+
+    // called under the lock of p
+    template<typename Topic>
+    std::size_t erase(partition& p, Topic const& topic) {
+        auto hidden = hide(topic_of(topic));
+        auto erased = p.live.erase(topic);
+        if (erased == 0 && !hidden) return 0;
+        touch(p, topic_of(topic));
+        return 1;
+    }
+
+    // Called under the lock of the partition of the topic.
+    // returns true if the message of the snapshots is newly hidden
+    bool hide(std::string_view topic) {
+        if (!base_) return false;
+        bool hidden = false;
+        if (delta_) {
+            if (auto v = delta_->find_exact(topic)) {
+                hidden = delta_hidden_.insert(*v) && !delta_->erased(*v);
+            }
+        }
+        // the message that the delta has is already hidden
+        if (auto v = base_->find_exact(topic)) {
+            if (hidden_.insert(*v)) hidden = true;
+        }
+        if (hidden) snapshot_size_.fetch_sub(1, std::memory_order_relaxed);
+        return hidden;
+    }
+
+    // called under the lock of p
+    void touch(partition& p, std::string_view topic) {
+        auto generation = generation_.fetch_add(1, std::memory_order_acq_rel) + 1;
+        p.dirty.insert_or_assign(std::string{topic}, generation);
+    }
+
+    std::vector<partition> partitions_;
+    // The snapshots are set by set_snapshot() before any concurrent access.
+    std::shared_ptr<retained_snapshot const> delta_;
+    hidden_set delta_hidden_;
+    std::shared_ptr<retained_snapshot const> base_;
+    hidden_set hidden_;
+    std::atomic<std::size_t> snapshot_size_{0}; ///< visible messages of the snapshots
+    std::optional<std::uint64_t> full_id_; ///< id of the last full snapshot. protected by all locks.
+    std::atomic<std::uint64_t> generation_{0};
+};
 
 } // namespace async_mqtt
 
@@ -0,0 +1,889 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_BROKER_RETAINED_SNAPSHOT_HPP)
+#define ASYNC_MQTT_BROKER_RETAINED_SNAPSHOT_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // !defined(_WIN32)
+
+#include <async_mqtt/util/buffer.hpp>
+#include <async_mqtt/util/log.hpp>
+#include <async_mqtt/util/move.hpp>
+#include <async_mqtt/util/overload.hpp>
+#include <async_mqtt/packet/property_variant.hpp>
+#include <async_mqtt/packet/impl/validate_property.hpp>
+
+#include <broker/retain_type.hpp>
+
+namespace async_mqtt {
+
+namespace retained_snapshot_detail {
+
+inline void put_u32(std::string& out, std::uint32_t v) {
+    for (int i = 0; i != 4; ++i) {
+        out.push_back(static_cast<char>(v >> (i * 8)));
+    }
+}
+
+inline void put_u64(std::string& out, std::uint64_t v) {
+    for (int i = 0; i != 8; ++i) {
+        out.push_back(static_cast<char>(v >> (i * 8)));
+    }
+}
+
+inline std::uint32_t get_u32(char const* p) {
+    std::uint32_t v = 0;
+    for (int i = 0; i != 4; ++i) {
+        v |= std::uint32_t(static_cast<std::uint8_t>(p[i])) << (i * 8);
+    }
+    return v;
+}
+
+inline std::uint64_t get_u64(char const* p) {
+    std::uint64_t v = 0;
+    for (int i = 0; i != 8; ++i) {
+        v |= std::uint64_t(static_cast<std::uint8_t>(p[i])) << (i * 8);
+    }
+    return v;
+}
+
+constexpr char const magic[] = "AMQRETN1";
+constexpr std::size_t magic_size = 8;
+constexpr std::uint32_t version = 1;
+constexpr std::size_t header_size = 96;
+constexpr std::size_t level_size = 16;
+constexpr std::size_t node_size = 20;
+constexpr std::size_t value_size = 32;
+constexpr std::uint32_t npos = 0xffffffff;
+
+// kind of the file
+constexpr std::uint32_t kind_full = 0;
+constexpr std::uint32_t kind_delta = 1;
+
+// flags of the value
+constexpr std::uint8_t value_erased = 0x01;
+
+inline std::int64_t to_epoch_seconds(std::chrono::system_clock::time_point tp) {
+    return std::chrono::duration_cast<std::chrono::seconds>(tp.time_since_epoch()).count();
+}
+
+} // namespace retained_snapshot_detail
+
+/**
+ * @brief read-only snapshot of the retained messages
+ *
+ * The file is mapped by mmap() and used in place. Opening it reads only the header,
+ * the pages of the topic tree and the payloads are read by the OS when a subscription
+ * touches them. The payloads of the loaded messages alias the mapping.
+ *
+ * A full snapshot has all messages. A delta has the messages that are published or
+ * erased after the full snapshot that it is based on, and the erased ones are
+ * tombstones. The delta is used over the full snapshot of the same id.
+ *
+ * File layout (integers are little endian):
+ *   - header  : magic, version, kind, the number of the elements, the offset of each
+ *               section, the file size and the id. The id of a full snapshot is unique,
+ *               and the id of a delta is the one of the full snapshot.
+ *   - levels  : {u64 offset, u32 size, u32 reserved} of each unique topic level name
+ *   - nodes   : {u32 level, u32 parent, u32 first_child, u32 num_children, u32 value}
+ *               in breadth-first order. The children of a node are contiguous and
+ *               sorted by name. nodes[0] is the root.
+ *   - values  : {u64 data_offset, i64 expire_at, u32 props_size, u32 payload_size,
+ *               u32 node, u8 qos, u8 flags, u8[2] reserved}
+ *               flags has value_erased for a tombstone.
+ *               expire_at is seconds since the epoch of system_clock, 0 means no expiry.
+ *   - strings : level names
+ *   - data    : encoded properties followed by the payload of each value
+ *
+ * A broken element never causes out of range access. It is treated as not found.
+ */
+class retained_snapshot : public std::enable_shared_from_this<retained_snapshot> {
+public:
+    /**
+     * @brief raw view of a message in the snapshot
+     */
+    struct message_view {
+        qos qos_value;
+        std::int64_t expire_at;
+        std::string_view props;
+        std::string_view payload;
+        bool erased; ///< tombstone of the delta
+    };
+
+    /**
+     * @brief get the path of the delta of the snapshot
+     * @param path file path of the full snapshot
+     */
+    static std::string delta_path(std::string const& path) {
+        return path + ".delta";
+    }
+
+    /**
+     * @brief open the snapshot
+     * @param path file path
+     * @return snapshot. nullptr if the file doesn't exist or is not a valid snapshot.
+     */
+    static std::shared_ptr<retained_snapshot const> open(std::string const& path) {
+        std::shared_ptr<retained_snapshot> snapshot{new retained_snapshot};
+#if !defined(_WIN32)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return nullptr;
+        }
+        auto size = static_cast<std::size_t>(st.st_size);
+        void* p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return nullptr;
+        // subscriptions touch the tree randomly
+        ::madvise(p, size, MADV_RANDOM);
+        snapshot->data_ = static_cast<char const*>(p);
+        snapshot->size_ = size;
+        snapshot->mapped_ = true;
+#else  // !defined(_WIN32)
+        std::ifstream ifs{path, std::ios::binary};
+        if (!ifs) return nullptr;
+        snapshot->storage_.assign(std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{});
+        snapshot->data_ = snapshot->storage_.data();
+        snapshot->size_ = snapshot->storage_.size();
+#endif // !defined(_WIN32)
+        if (!snapshot->parse_header()) {
+            ASYNC_MQTT_LOG("mqtt_broker", warning)
+                << "retained snapshot:" << path << " is not a valid snapshot";
+            return nullptr;
+        }
+        return snapshot;
+    }
+
+    ~retained_snapshot() {
+#if !defined(_WIN32)
+        if (mapped_) ::munmap(const_cast<char*>(data_), size_);
+#endif // !defined(_WIN32)
+    }
+
+    retained_snapshot(retained_snapshot const&) = delete;
+    retained_snapshot& operator=(retained_snapshot const&) = delete;
+
+    /**
+     * @brief get the number of the messages including expired ones and tombstones
+     */
+    std::size_t size() const {
+        return static_cast<std::size_t>(num_values_);
+    }
+
+    /**
+     * @brief get the id of the full snapshot
+     * A delta returns the id of the full snapshot that it is based on.
+     */
+    std::uint64_t id() const {
+        return id_;
+    }
+
+    /**
+     * @brief check whether the file is a delta
+     */
+    bool is_delta() const {
+        return kind_ == retained_snapshot_detail::kind_delta;
+    }
+
+    /**
+     * @brief check whether the value is a tombstone
+     * @param value_index value index
+     */
+    bool erased(std::uint32_t value_index) const {
+        auto p = value_ptr(value_index);
+        return p && (static_cast<std::uint8_t>(p[29]) & retained_snapshot_detail::value_erased);
+    }
+
+    /**
+     * @brief find the messages that match the topic filter
+     * @param topic_filter topic filter
+     * @param callback     called with the value index of each matched message
+     */
+    template <typename Output>
+    void find(std::string_view topic_filter, Output&& callback) const {
+        std::vector<std::uint32_t> entries{0};
+        std::vector<std::uint32_t> new_entries;
+        auto visit_value =
+            [&](std::uint32_t n) {
+                auto v = node_value(n);
+                if (v != retained_snapshot_detail::npos) callback(v);
+            };
+
+        std::size_t pos = 0;
+        while (true) {
+            auto slash = topic_filter.find('/', pos);
+            auto t = topic_filter.substr(pos, slash == std::string_view::npos ? std::string_view::npos : slash - pos);
+            new_entries.clear();
+            for (auto n : entries) {
+                if (t == "+") {
+                    for_each_child(
+                        n,
+                        [&](std::uint32_t c) {
+                            if (n != 0 || !is_system(c)) new_entries.push_back(c);
+                        }
+                    );
+                }
+                else if (t == "#") {
+                    // parent level matches too
+                    if (n != 0) visit_value(n);
+                    match_hash(n, callback);
+                }
+                else if (auto c = find_child(n, t)) {
+                    new_entries.push_back(*c);
+                }
+            }
+            if (t == "#") return;
+            std::swap(entries, new_entries);
+            if (entries.empty()) return;
+            if (slash == std::string_view::npos) break;
+            pos = slash + 1;
+        }
+        for (auto n : entries) visit_value(n);
+    }
+
+    /**
+     * @brief find the message of the topic
+     * @param topic topic name
+     * @return value index. nullopt if not found.
+     */
+    std::optional<std::uint32_t> find_exact(std::string_view topic) const {
+        std::uint32_t n = 0;
+        std::size_t pos = 0;
+        while (true) {
+            auto slash = topic.find('/', pos);
+            auto t = topic.substr(pos, slash == std::string_view::npos ? std::string_view::npos : slash - pos);
+            auto c = find_child(n, t);
+            if (!c) return std::nullopt;
+            n = *c;
+            if (slash == std::string_view::npos) break;
+            pos = slash + 1;
+        }
+        auto v = node_value(n);
+        if (v == retained_snapshot_detail::npos) return std::nullopt;
+        return v;
+    }
+
+    /**
+     * @brief rebuild the topic name of the message from the tree
+     * @param value_index value index
+     */
+    std::string topic(std::uint32_t value_index) const {
+        std::string result;
+        auto p = value_ptr(value_index);
+        if (!p) return result;
+        std::vector<std::string_view> names;
+        auto n = retained_snapshot_detail::get_u32(p + 24);
+        // the depth is never greater than the number of nodes
+        for (std::uint64_t i = 0; n != 0 && n < num_nodes_ && i != num_nodes_; ++i) {
+            auto np = node_ptr(n);
+            names.push_back(level_name(retained_snapshot_detail::get_u32(np)));
+            n = retained_snapshot_detail::get_u32(np + 4);
+        }
+        for (auto it = names.rbegin(); it != names.rend(); ++it) {
+            if (it != names.rbegin()) result.push_back('/');
+            result.append(*it);
+        }
+        return result;
+    }
+
+    /**
+     * @brief get the raw view of the message
+     * @param value_index value index
+     * @return view. nullopt if the element is broken.
+     */
+    std::optional<message_view> view(std::uint32_t value_index) const {
+        auto p = value_ptr(value_index);
+        if (!p) return std::nullopt;
+        auto data_offset = retained_snapshot_detail::get_u64(p);
+        auto expire_at = static_cast<std::int64_t>(retained_snapshot_detail::get_u64(p + 8));
+        auto props_size = retained_snapshot_detail::get_u32(p + 16);
+        auto payload_size = retained_snapshot_detail::get_u32(p + 20);
+        auto qos_value = static_cast<std::uint8_t>(p[28]);
+        auto flags = static_cast<std::uint8_t>(p[29]);
+        if (qos_value > 2) return std::nullopt;
+        if (data_offset < data_offset_ ||
+            data_offset > size_ ||
+            std::uint64_t(props_size) + payload_size > size_ - data_offset) {
+            return std::nullopt;
+        }
+        return message_view{
+            static_cast<qos>(qos_value),
+            expire_at,
+            std::string_view{data_ + data_offset, props_size},
+            std::string_view{data_ + data_offset + props_size, payload_size},
+            (flags & retained_snapshot_detail::value_erased) != 0
+        };
+    }
+
+    /**
+     * @brief load the message
+     *
+     * The MessageExpiryInterval property is updated to the remaining time.
+     * @param value_index value index
+     * @param now         current time
+     * @return message. nullopt if it has expired, is a tombstone or the element is broken.
+     */
+    std::optional<retain_type> load(
+        std::uint32_t value_index,
+        std::chrono::system_clock::time_point now = std::chrono::system_clock::now()
+    ) const {
+        auto mv = view(value_index);
+        if (!mv || mv->erased) return std::nullopt;
+        auto remaining = mv->expire_at - retained_snapshot_detail::to_epoch_seconds(now);
+        if (mv->expire_at != 0 && remaining <= 0) return std::nullopt;
+
+        auto life = std::const_pointer_cast<retained_snapshot>(shared_from_this());
+        error_code ec;
+        auto props = make_properties(buffer{mv->props, life}, property_location::publish, ec);
+        if (ec) return std::nullopt;
+        if (mv->expire_at != 0) {
+            for (auto& prop : props) {
+                prop.visit(
+                    overload {
+                        [&](property::message_expiry_interval& v) {
+                            v = property::message_expiry_interval(static_cast<std::uint32_t>(remaining));
+                        },
+                        [&](auto&) {}
+                    }
+                );
+            }
+        }
+        return retain_type{
+            buffer{topic(value_index)},
+            std::vector<buffer>{buffer{mv->payload, force_move(life)}},
+            force_move(props),
+            mv->qos_value
+        };
+    }
+
+private:
+    retained_snapshot() = default;
+
+    bool parse_header() {
+        using namespace retained_snapshot_detail;
+        if (size_ < header_size) return false;
+        if (std::memcmp(data_, magic, magic_size) != 0) return false;
+        if (get_u32(data_ + 8) != version) return false;
+        kind_ = get_u32(data_ + 12);
+        if (kind_ != kind_full && kind_ != kind_delta) return false;
+        id_ = get_u64(data_ + 88);
+        num_levels_ = get_u64(data_ + 16);
+        num_nodes_ = get_u64(data_ + 24);
+        num_values_ = get_u64(data_ + 32);
+        levels_offset_ = get_u64(data_ + 40);
+        nodes_offset_ = get_u64(data_ + 48);
+        values_offset_ = get_u64(data_ + 56);
+        strings_offset_ = get_u64(data_ + 64);
+        data_offset_ = get_u64(data_ + 72);
+        auto file_size = get_u64(data_ + 80);
+        if (file_size != size_) return false;
+        if (num_nodes_ == 0 || num_nodes_ >= npos || num_levels_ >= npos || num_values_ >= npos) return false;
+        return
+            levels_offset_ == header_size &&
+            nodes_offset_ == levels_offset_ + num_levels_ * level_size &&
+            values_offset_ == nodes_offset_ + num_nodes_ * node_size &&
+            strings_offset_ == values_offset_ + num_values_ * value_size &&
+            strings_offset_ <= data_offset_ &&
+            data_offset_ <= size_;
+    }
+
+    char const* node_ptr(std::uint32_t n) const {
+        return data_ + nodes_offset_ + std::uint64_t(n) * retained_snapshot_detail::node_size;
+    }
+
+    char const* value_ptr(std::uint32_t v) const {
+        if (v >= num_values_) return nullptr;
+        return data_ + values_offset_ + std::uint64_t(v) * retained_snapshot_detail::value_size;
+    }
+
+    std::string_view level_name(std::uint32_t l) const {
+        if (l >= num_levels_) return std::string_view{};
+        auto p = data_ + levels_offset_ + std::uint64_t(l) * retained_snapshot_detail::level_size;
+        auto offset = retained_snapshot_detail::get_u64(p);
+        auto size = retained_snapshot_detail::get_u32(p + 8);
+        if (offset < strings_offset_ || offset > data_offset_ || size > data_offset_ - offset) {
+            return std::string_view{};
+        }
+        return std::string_view{data_ + offset, size};
+    }
+
+    std::string_view node_name(std::uint32_t n) const {
+        return level_name(retained_snapshot_detail::get_u32(node_ptr(n)));
+    }
+
+    std::uint32_t node_value(std::uint32_t n) const {
+        return retained_snapshot_detail::get_u32(node_ptr(n) + 16);
+    }
+
+    bool is_system(std::uint32_t n) const {
+        auto name = node_name(n);
+        return !name.empty() && name.front() == '$';
+    }
+
+    // returns the range of the children. empty if broken.
+    std::pair<std::uint32_t, std::uint32_t> children(std::uint32_t n) const {
+        auto p = node_ptr(n);
+        auto first = retained_snapshot_detail::get_u32(p + 8);
+        auto num = retained_snapshot_detail::get_u32(p + 12);
+        if (std::uint64_t(first) + num > num_nodes_) return {0, 0};
+        return {first, first + num};
+    }
+
+    template <typename Func>
+    void for_each_child(std::uint32_t n, Func&& func) const {
+        auto [first, last] = children(n);
+        for (auto c = first; c != last; ++c) func(c);
+    }
+
+    std::optional<std::uint32_t> find_child(std::uint32_t n, std::string_view name) const {
+        auto [first, last] = children(n);
+        // binary search on the sorted children
+        while (first < last) {
+            auto mid = first + (last - first) / 2;
+            auto mid_name = node_name(mid);
+            if (mid_name == name) return mid;
+            if (mid_name < name) {
+                first = mid + 1;
+            }
+            else {
+                last = mid;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // visit all values below the node in breadth-first order
+    template <typename Output>
+    void match_hash(std::uint32_t n, Output& callback) const {
+        std::deque<std::uint32_t> entries{n};
+        bool ignore_system = n == 0;
+        // children ranges are always forward, so the loop terminates even if the file is broken
+        std::uint64_t visited = 0;
+        while (!entries.empty() && visited != num_nodes_) {
+            auto parent = entries.front();
+            entries.pop_front();
+            auto [first, last] = children(parent);
+            if (first <= parent) continue;
+            for (auto c = first; c != last; ++c) {
+                if (parent == 0 && ignore_system && is_system(c)) continue;
+                auto v = node_value(c);
+                if (v != retained_snapshot_detail::npos) callback(v);
+                entries.push_back(c);
+                ++visited;
+            }
+        }
+    }
+
+    char const* data_ = nullptr;
+    std::size_t size_ = 0;
+    bool mapped_ = false;
+    std::string storage_;
+    std::uint64_t num_levels_ = 0;
+    std::uint64_t num_nodes_ = 0;
+    std::uint64_t num_values_ = 0;
+    std::uint64_t levels_offset_ = 0;
+    std::uint64_t nodes_offset_ = 0;
+    std::uint64_t values_offset_ = 0;
+    std::uint64_t strings_offset_ = 0;
+    std::uint64_t data_offset_ = 0;
+    std::uint32_t kind_ = retained_snapshot_detail::kind_full;
+    std::uint64_t id_ = 0;
+};
+
+/**
+ * @brief writer of the retained messages snapshot
+ *
+ * The messages are added under the lock of the retained messages, and write() builds
+ * the tree and writes the file without the lock.
+ * It writes a full snapshot by default, and a delta if set_delta() is called.
+ */
+class retained_snapshot_writer {
+public:
+    /**
+     * @brief add a message
+     * @param topic     topic name
+     * @param qos_value QoS
+     * @param expire_at seconds since the epoch of system_clock, 0 means no expiry
+     * @param props     encoded properties
+     * @param payload   payload
+     */
+    void add(
+        std::string topic,
+        qos qos_value,
+        std::int64_t expire_at,
+        std::string props,
+        std::vector<buffer> payload
+    ) {
+        entries_.push_back(
+            entry{force_move(topic), qos_value, expire_at, force_move(props), force_move(payload), false}
+        );
+    }
+
+    /**
+     * @brief add a tombstone of the delta
+     * @param topic topic name of the erased message
+     */
+    void add_erased(std::string topic) {
+        entries_.push_back(entry{force_move(topic), qos::at_most_once, 0, {}, {}, true});
+    }
+
+    /**
+     * @brief write a delta instead of a full snapshot
+     * @param base_id id of the full snapshot that the delta is based on
+     */
+    void set_delta(std::uint64_t base_id) {
+        kind_ = retained_snapshot_detail::kind_delta;
+        id_ = base_id;
+    }
+
+    /**
+     * @brief check whether the writer writes a delta
+     */
+    bool is_delta() const {
+        return kind_ == retained_snapshot_detail::kind_delta;
+    }
+
+    /**
+     * @brief get the id that is written to the header
+     * The id of a full snapshot is decided by write().
+     */
+    std::uint64_t id() const {
+        return id_;
+    }
+
+    /**
+     * @brief add a retained message
+     */
+    void add(retain_type const& r) {
+        std::int64_t expire_at = 0;
+        if (auto expiry = r.tim_message_expiry.expiry()) {
+            auto remaining = *expiry - std::chrono::steady_clock::now();
+            expire_at = retained_snapshot_detail::to_epoch_seconds(
+                std::chrono::system_clock::now() +
+                std::chrono::duration_cast<std::chrono::system_clock::duration>(remaining)
+            );
+            // keep 0 for no expiry
+            if (expire_at <= 0) expire_at = 1;
+        }
+        std::string props;
+        for (auto const& cb : const_buffer_sequence(r.props)) {
+            props.append(static_cast<char const*>(cb.data()), cb.size());
+        }
+        add(std::string{r.topic}, r.qos_value, expire_at, force_move(props), r.payload);
+    }
+
+    /**
+     * @brief add the messages of the previous snapshot
+     *
+     * The messages are read in write(), so the caller can release the lock after calling it.
+     * The tombstones are not added.
+     * @param base   previous snapshot
+     * @param hidden value indexes of the messages that are overwritten or erased
+     */
+    void add_base(
+        std::shared_ptr<retained_snapshot const> base,
+        std::unordered_set<std::uint32_t> hidden
+    ) {
+        bases_.emplace_back(force_move(base), force_move(hidden));
+    }
+
+    /**
+     * @brief write the snapshot
+     *
+     * The file is written to path + ".tmp", and renamed to path.
+     * The expired messages are not written.
+     * The path of a delta is retained_snapshot::delta_path() of the full snapshot.
+     * @param path file path
+     * @return true if succeeded
+     */
+    bool write(std::string const& path) {
+        using namespace retained_snapshot_detail;
+        auto now = to_epoch_seconds(std::chrono::system_clock::now());
+        for (auto const& [base, hidden] : bases_) {
+            for (std::uint32_t v = 0; v != base->size(); ++v) {
+                if (hidden.count(v)) continue;
+                auto mv = base->view(v);
+                if (!mv || mv->erased) continue;
+                // the base is alive until write() finishes, so the payload doesn't hold it
+                add(
+                    base->topic(v),
+                    mv->qos_value,
+                    mv->expire_at,
+                    std::string{mv->props},
+                    std::vector<buffer>{buffer{mv->payload}}
+                );
+            }
+        }
+        if (!is_delta()) {
+            // unique enough to tell the full snapshots apart
+            id_ = static_cast<std::uint64_t>(
+                std::chrono::system_clock::now().time_since_epoch().count()
+            );
+        }
+
+        std::vector<std::size_t> order;
+        order.reserve(entries_.size());
+        for (std::size_t i = 0; i != entries_.size(); ++i) {
+            auto& e = entries_[i];
+            if (e.topic.empty()) continue;
+            if (!e.erased && e.expire_at != 0 && e.expire_at <= now) {
+                if (!is_delta()) continue;
+                // not to reveal the message of the full snapshot
+                e = entry{force_move(e.topic), qos::at_most_once, 0, {}, {}, true};
+            }
+            order.push_back(i);
+        }
+        // level by level order. '/' is less than any other characters.
+        std::stable_sort(
+            order.begin(),
+            order.end(),
+            [&](std::size_t lhs, std::size_t rhs) {
+                auto const& l = entries_[lhs].topic;
+                auto const& r = entries_[rhs].topic;
+                auto n = std::min(l.size(), r.size());
+                auto [li, ri] = std::mismatch(l.begin(), l.begin() + std::ptrdiff_t(n), r.begin());
+                if (li == l.begin() + std::ptrdiff_t(n)) return l.size() < r.size();
+                auto key = [](char c) -> unsigned { return c == '/' ? 0 : unsigned(static_cast<unsigned char>(c)) + 1; };
+                return key(*li) < key(*ri);
+            }
+        );
+
+        struct node {
+            std::uint32_t level;
+            std::uint32_t parent;
+            std::uint32_t first_child;
+            std::uint32_t num_children;
+            std::uint32_t value;
+        };
+        struct work {
+            std::uint32_t node;
+            std::size_t first;
+            std::size_t last;
+        };
+        std::vector<node> nodes;
+        std::vector<std::size_t> values; // entry index of each value
+        std::vector<std::uint32_t> value_nodes;
+        std::unordered_map<std::string_view, std::uint32_t> level_ids;
+        std::vector<std::string_view> levels;
+        auto level_of =
+            [&](std::string_view name) {
+                auto [it, inserted] = level_ids.emplace(name, static_cast<std::uint32_t>(levels.size()));
+                if (inserted) levels.push_back(name);
+                return it->second;
+            };
+
+        constexpr auto end_of_topic = std::string::npos;
+        std::vector<std::size_t> pos(entries_.size(), 0);
+        auto level_at =
+            [&](std::size_t e) {
+                auto const& t = entries_[e].topic;
+                auto slash = t.find('/', pos[e]);
+                return std::string_view{t}.substr(pos[e], slash == std::string::npos ? std::string::npos : slash - pos[e]);
+            };
+
+        nodes.push_back(node{level_of(std::string_view{}), npos, 0, 0, npos});
+        std::deque<work> works{work{0, 0, order.size()}};
+        while (!works.empty()) {
+            auto w = works.front();
+            works.pop_front();
+            auto i = w.first;
+            // the topic that ends at this node comes first. duplicated topics are ignored.
+            for (; i != w.last && pos[order[i]] == end_of_topic; ++i) {
+                if (nodes[w.node].value == npos) {
+                    nodes[w.node].value = static_cast<std::uint32_t>(values.size());
+                    values.push_back(order[i]);
+                    value_nodes.push_back(w.node);
+                }
+            }
+            auto first_child = static_cast<std::uint32_t>(nodes.size());
+            while (i != w.last) {
+                auto name = level_at(order[i]);
+                auto j = i;
+                for (; j != w.last && pos[order[j]] != end_of_topic && level_at(order[j]) == name; ++j) {
+                    auto e = order[j];
+                    auto slash = entries_[e].topic.find('/', pos[e]);
+                    pos[e] = slash == std::string::npos ? end_of_topic : slash + 1;
+                }
+                auto child = static_cast<std::uint32_t>(nodes.size());
+                nodes.push_back(node{level_of(name), w.node, 0, 0, npos});
+                works.push_back(work{child, i, j});
+                i = j;
+            }
+            nodes[w.node].first_child = first_child;
+            nodes[w.node].num_children = static_cast<std::uint32_t>(nodes.size()) - first_child;
+        }
+
+        std::uint64_t strings_size = 0;
+        for (auto l : levels) strings_size += l.size();
+        std::uint64_t levels_offset = header_size;
+        std::uint64_t nodes_offset = levels_offset + levels.size() * level_size;
+        std::uint64_t values_offset = nodes_offset + nodes.size() * node_size;
+        std::uint64_t strings_offset = values_offset + values.size() * value_size;
+        std::uint64_t data_offset = strings_offset + strings_size;
+        std::uint64_t file_size = data_offset;
+        for (auto e : values) file_size += entries_[e].props.size() + entries_[e].payload_size();
+
+        auto tmp_path = path + ".tmp";
+        auto fp = std::fopen(tmp_path.c_str(), "wb");
+        if (!fp) {
+            ASYNC_MQTT_LOG("mqtt_broker", error)
+                << "retained snapshot: cannot open " << tmp_path;
+            return false;
+        }
+        bool ok = true;
+        std::string out;
+        auto flush =
+            [&](std::size_t threshold) {
+                if (out.size() < threshold) return;
+                ok = ok && std::fwrite(out.data(), 1, out.size(), fp) == out.size();
+                out.clear();
+            };
+        constexpr std::size_t chunk_size = 1024 * 1024;
+
+        out.append(magic, magic_size);
+        put_u32(out, version);
+        put_u32(out, kind_);
+        put_u64(out, levels.size());
+        put_u64(out, nodes.size());
+        put_u64(out, values.size());
+        put_u64(out, levels_offset);
+        put_u64(out, nodes_offset);
+        put_u64(out, values_offset);
+        put_u64(out, strings_offset);
+        put_u64(out, data_offset);
+        put_u64(out, file_size);
+        put_u64(out, id_);
+        out.resize(header_size, '\0');
+
+        std::uint64_t offset = strings_offset;
+        for (auto l : levels) {
+            put_u64(out, offset);
+            put_u32(out, static_cast<std::uint32_t>(l.size()));
+            put_u32(out, 0);
+            offset += l.size();
+            flush(chunk_size);
+        }
+        for (auto const& n : nodes) {
+            put_u32(out, n.level);
+            put_u32(out, n.parent);
+            put_u32(out, n.first_child);
+            put_u32(out, n.num_children);
+            put_u32(out, n.value);
+            flush(chunk_size);
+        }
+        offset = data_offset;
+        for (std::size_t v = 0; v != values.size(); ++v) {
+            auto const& e = entries_[values[v]];
+            put_u64(out, offset);
+            put_u64(out, static_cast<std::uint64_t>(e.expire_at));
+            put_u32(out, static_cast<std::uint32_t>(e.props.size()));
+            put_u32(out, static_cast<std::uint32_t>(e.payload_size()));
+            put_u32(out, value_nodes[v]);
+            out.push_back(static_cast<char>(e.qos_value));
+            out.push_back(static_cast<char>(e.erased ? value_erased : 0));
+            out.append(2, '\0');
+            offset += e.props.size() + e.payload_size();
+            flush(chunk_size);
+        }
+        for (auto l : levels) {
+            out.append(l);
+            flush(chunk_size);
+        }
+        for (auto e : values) {
+            out.append(entries_[e].props);
+            for (auto const& b : entries_[e].payload) {
+                out.append(b.data(), b.size());
+            }
+            flush(chunk_size);
+        }
+        flush(0);
+        ok = sync_file(fp) && ok;
+        std::fclose(fp);
+        if (!ok) {
+            ASYNC_MQTT_LOG("mqtt_broker", error)
+                << "retained snapshot: cannot write " << tmp_path;
+            remove_file(tmp_path);
+            return false;
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp_path, path, ec);
+        if (ec) {
+            ASYNC_MQTT_LOG("mqtt_broker", error)
+                << "retained snapshot: cannot rename " << tmp_path << " " << ec.message();
+            remove_file(tmp_path);
+            return false;
+        }
+        ASYNC_MQTT_LOG("mqtt_broker", info)
+            << "retained snapshot: wrote " << values.size()
+            << (is_delta() ? " changes to " : " messages to ") << path;
+        return true;
+    }
+
+private:
+    struct entry {
+        std::size_t payload_size() const {
+            std::size_t size = 0;
+            for (auto const& b : payload) size += b.size();
+            return size;
+        }
+
+        std::string topic;
+        qos qos_value;
+        std::int64_t expire_at;
+        std::string props;
+        std::vector<buffer> payload;
+        bool erased;
+    };
+
+    static void remove_file(std::string const& path) {
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+    }
+
+    static bool sync_file(std::FILE* fp) {
+        if (std::fflush(fp) != 0) return false;
+#if !defined(_WIN32)
+        return ::fsync(::fileno(fp)) == 0;
+#else  // !defined(_WIN32)
+        return true;
+#endif // !defined(_WIN32)
+    }
+
+    std::vector<entry> entries_;
+    std::vector<std::pair<std::shared_ptr<retained_snapshot const>, std::unordered_set<std::uint32_t>>> bases_;
+    std::uint32_t kind_ = retained_snapshot_detail::kind_full;
+    std::uint64_t id_ = 0;
+};
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_BROKER_RETAINED_SNAPSHOT_HPP
@@ -105,7 +105,9 @@ class retained_topic_map {
 
     direct_const_iterator root;
 
-    direct_const_iterator create_topic(std::string_view topic) {
+    // Topic is std::string_view or topic_levels
+    template<typename Topic>
+    direct_const_iterator create_topic(Topic const& topic) {
          direct_const_iterator parent = root;
 
         topic_filter_tokenizer(
@@ -138,7 +140,8 @@ class retained_topic_map {
         return parent;
     }
 
-    std::vector<direct_const_iterator> find_topic(std::string_view topic) {
+    template<typename Topic>
+    std::vector<direct_const_iterator> find_topic(Topic const& topic) {
         std::vector<direct_const_iterator> path;
         direct_const_iterator parent = root;
 
@@ -249,7 +252,8 @@ class retained_topic_map {
     }
 
     // Remove a value at the specified topic
-    size_t erase_topic(std::string_view topic) {
+    template<typename Topic>
+    size_t erase_topic(Topic const& topic) {
         auto path = find_topic(topic);
 
         // Reset the value if there is actually something stored
@@ -312,26 +316,12 @@ public:
     // Insert a value at the specified topic
     template<typename V>
     std::size_t insert_or_assign(std::string_view topic, V&& value) {
-        auto& direct_index = map.template get<direct_index_tag>();
-        auto path = this->find_topic(topic);
-
-        if (path.empty()) {
-            auto new_topic = this->create_topic(topic);
-            direct_index.modify(new_topic, [&value](path_entry &entry) mutable { entry.value.emplace(std::forward<V>(value)); });
-            increase_map_size();
-            return 1;
-        }
-
-        if (!path.back()->value) {
-            this->increase_topics(path);
-            direct_index.modify(path.back(), [&value](path_entry &entry) mutable { entry.value.emplace(std::forward<V>(value)); });
-            increase_map_size();
-            return 1;
-        }
-
-        direct_index.modify(path.back(), [&value](path_entry &entry) mutable { entry.value.emplace(std::forward<V>(value)); });
+        return insert_or_assign_impl(topic, std::forward<V>(value));
+    }
 
-        return 0;
+    template<typename V>
+    std::size_t insert_or_assign(topic_levels const& topic, V&& value) {
+        return insert_or_assign_impl(topic, std::forward<V>(value));
     }
 
     // Find all stored topics that math the specified topic_filter
@@ -347,9 +337,26 @@ public:
         return result;
     }
 
+    std::size_t erase(topic_levels const& topic) {
+        auto result = erase_topic(topic);
+        decrease_map_size(result);
+        return result;
+    }
+
     // Get the number of entries stored in the map
     std::size_t size() const { return map_size; }
 
+    // Call the callback for all stored values
+    template<typename Output>
+    void for_each(Output&& callback) const {
+        auto const& direct_index = map.template get<direct_index_tag>();
+        for (auto const& i : direct_index) {
+            if (i.value) {
+                callback(*i.value);
+            }
+        }
+    }
+
     // Get the number of entries in the map (for debugging purpose only)
     std::size_t internal_size() const { return map.size(); }
 
@@ -368,6 +375,31 @@ public:
         }
     }
 
+private:
+    template<typename Topic, typename V>
+    std::size_t insert_or_assign_impl(Topic const& topic, V&& value) {
+        auto& direct_index = map.template get<direct_index_tag>();
+        auto path = this->find_topic(topic);
+
+        if (path.empty()) {
+            auto new_topic = this->create_topic(topic);
+            direct_index.modify(new_topic, [&value](path_entry &entry) mutable { entry.value.emplace(std::forward<V>(value)); });
+            increase_map_size();
+            return 1;
+        }
+
+        if (!path.back()->value) {
+            this->increase_topics(path);
+            direct_index.modify(path.back(), [&value](path_entry &entry) mutable { entry.value.emplace(std::forward<V>(value)); });
+            increase_map_size();
+            return 1;
+        }
+
+        direct_index.modify(path.back(), [&value](path_entry &entry) mutable { entry.value.emplace(std::forward<V>(value)); });
+
+        return 0;
+    }
+
 };
 
 } // namespace async_mqtt
@@ -7,12 +7,19 @@
 #if !defined(ASYNC_MQTT_BROKER_SECURITY_HPP)
 #define ASYNC_MQTT_BROKER_SECURITY_HPP
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
 #include <string>
 #include <string_view>
 #include <map>
 #include <set>
 #include <optional>
 
+#include <boost/container/small_vector.hpp>
+
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/iterator/function_output_iterator.hpp>
@@ -37,7 +44,7 @@
 #include <openssl/evp.h>
 #endif
 
-#include <broker/subscription_map.hpp>
+#include <broker/default_subscription_map.hpp>
 #include <async_mqtt/util/log.hpp>
 #include <async_mqtt/util/string_view_helper.hpp>
 
@@ -70,6 +77,101 @@ inline std::string json_remove_comments(std::istream& input) {
 }
 
 
+/**
+ * @brief thread local cache of authorization decisions
+ *
+ * A decision is keyed by the generation of the security settings, the kind of
+ * the access, the username, and the topic. Updating the security settings
+ * renews the generation, so the old decisions are never hit again.
+ * The cache is direct mapped. A colliding decision overwrites the old one.
+ * Once warmed up, neither find() nor store() allocates memory.
+ *
+ * @tparam Decision type of the decision
+ */
+template <typename Decision>
+class auth_decision_cache {
+public:
+    enum class access : std::uint8_t {
+        pub,
+        sub
+    };
+
+    static constexpr std::size_t size = 1024;
+
+    /**
+     * @brief get the cache of the calling thread
+     */
+    static auth_decision_cache& local() {
+        thread_local auth_decision_cache c;
+        return c;
+    }
+
+    /**
+     * @brief find the decision
+     * @param generation generation of the security settings
+     * @param a          kind of the access
+     * @param username   username
+     * @param topic      topic name
+     * @return the decision if it is cached, otherwise std::nullopt
+     */
+    std::optional<Decision> find(
+        std::uint64_t generation,
+        access a,
+        std::string_view username,
+        std::string_view topic
+    ) const {
+        auto const& e = entries_[index(a, username, topic)];
+        if (e.generation == generation &&
+            e.a == a &&
+            e.username == username &&
+            e.topic == topic) {
+            return e.decision;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief store the decision
+     * @param generation generation of the security settings that made the decision
+     * @param a          kind of the access
+     * @param username   username
+     * @param topic      topic name
+     * @param decision   decision
+     */
+    void store(
+        std::uint64_t generation,
+        access a,
+        std::string_view username,
+        std::string_view topic,
+        Decision decision
+    ) {
+        auto& e = entries_[index(a, username, topic)];
+        e.generation = generation;
+        e.a = a;
+        e.username.assign(username.data(), username.size());
+        e.topic.assign(topic.data(), topic.size());
+        e.decision = decision;
+    }
+
+private:
+    struct entry {
+        std::uint64_t generation = 0; // 0 means empty
+        access a = access::pub;
+        Decision decision{};
+        std::string username;
+        std::string topic;
+    };
+
+    static std::size_t index(access a, std::string_view username, std::string_view topic) {
+        auto h = std::hash<std::string_view>{}(topic);
+        h ^= std::hash<std::string_view>{}(username) + 0x9e3779b9 + (h << 6) + (h >> 2);
+        h += static_cast<std::size_t>(a);
+        return h & (size - 1);
+    }
+
+    std::array<entry, size> entries_;
+};
+
 struct security {
 
     static constexpr char const* any_group_name = "@any";
@@ -132,6 +234,25 @@ struct security {
         std::vector<std::string> members;
     };
 
+    /**
+     * @brief users and groups that have subscription rules of a topic
+     * The first element is the principal id, the second one is the type of the
+     * rule that has the highest priority. Sorted by the principal id.
+     */
+    using authorized_subscribers =
+        boost::container::small_vector<std::pair<std::size_t, authorization::type>, 8>;
+
+    using decision_cache = auth_decision_cache<authorization::type>;
+
+    /**
+     * @brief get the generation of the settings
+     * It is renewed when the settings are updated by the member functions.
+     * Copies of the settings have the same generation.
+     */
+    std::uint64_t generation() const {
+        return generation_;
+    }
+
     /** Return username of anonymous user */
     std::optional<std::string> const& login_anonymous() const {
         return anonymous;
@@ -289,6 +410,7 @@ struct security {
         }
 
         authorization_.push_back(auth);
+        renew_generation();
         return rule_nr;
     }
 
@@ -304,6 +426,7 @@ struct security {
                 }
 
                 authorization_.erase(i);
+                renew_generation();
                 return;
             }
         }
@@ -484,22 +607,12 @@ struct security {
     }
 
     authorization::type auth_pub(std::string_view topic, std::string_view username) const {
-        authorization::type result_type = authorization::type::deny;
-
-        std::set<std::string> username_and_groups;
-        username_and_groups.insert(std::string(username));
+        return auth_pub(topic_levels{topic}, username);
+    }
 
-        for (auto const& i : groups_) {
-            if (i.first == any_group_name ||
-                std::find(
-                    i.second.members.begin(),
-                    i.second.members.end(),
-                    username
-                ) != i.second.members.end()
-            ) {
-                username_and_groups.insert(i.first);
-            }
-        }
+    authorization::type auth_pub(topic_levels const& topic, std::string_view username) const {
+        authorization::type result_type = authorization::type::deny;
+        auto row = user_row(username);
 
         std::size_t priority = 0;
         auth_pub_map.find(
@@ -508,7 +621,7 @@ struct security {
                 std::string const& allowed_username,
                 std::pair<authorization::type, std::size_t> entry
             ) {
-                if (username_and_groups.find(allowed_username) != username_and_groups.end()) {
+                if (is_member(row, principal_id(allowed_username))) {
                     if (entry.second >= priority) {
                         result_type = entry.first;
                         priority = entry.second;
@@ -520,53 +633,70 @@ struct security {
         return result_type;
     }
 
-    std::map<std::string, authorization::type> auth_sub(std::string_view topic) const {
-        std::map<std::string, authorization::type> result;
-        std::map<std::string, std::size_t> priorities;
+    authorized_subscribers auth_sub(std::string_view topic) const {
+        return auth_sub(topic_levels{topic});
+    }
+
+    authorized_subscribers auth_sub(topic_levels const& topic) const {
+        authorized_subscribers result;
+        boost::container::small_vector<std::size_t, 8> priorities;
         auth_sub_map.find(
             topic,
             [&](
                 std::string const &allowed_username,
                 std::pair<authorization::type, std::size_t> entry
             ) {
-                auto rit = result.find(allowed_username);
+                auto id = principal_id(allowed_username);
+                if (id == npos) return;
+                auto rit = std::find_if(
+                    result.begin(),
+                    result.end(),
+                    [&](auto const& e) { return e.first == id; }
+                );
                 if (rit == result.end()) {
-                    result.emplace(allowed_username, entry.first);
-                    priorities.emplace(allowed_username, entry.second);
+                    result.emplace_back(id, entry.first);
+                    priorities.push_back(entry.second);
                 }
                 else {
-                    auto pit = priorities.find(allowed_username);
-                    BOOST_ASSERT(pit != priorities.end());
-                    if (pit->second <= entry.second) {
-                        pit->second = entry.second;
+                    auto& priority = priorities[std::size_t(rit - result.begin())];
+                    if (priority <= entry.second) {
+                        priority = entry.second;
                         rit->second = entry.first;
                     }
                 }
             }
         );
+        std::sort(
+            result.begin(),
+            result.end(),
+            [](auto const& lhs, auto const& rhs) { return lhs.first < rhs.first; }
+        );
 
         return result;
     }
 
+    /**
+     * @brief get the subscription authorization of the user
+     * The rule for the user has precedence over the rules for the groups.
+     * If there are rules for some groups of the user, the first group in the
+     * order of the group name is used.
+     */
     authorization::type auth_sub_user(
-        std::map<std::string, authorization::type> const& result,
-        std::string const& username) const {
-        auto i = result.find(username);
-        if (i != result.end()) return i->second;
-
-        for (auto const& i: groups_) {
-            if (i.first == any_group_name ||
-                std::find(
-                    i.second.members.begin(),
-                    i.second.members.end(),
-                    username
-                ) != i.second.members.end()
-            ) {
-                auto j = result.find(i.first);
-                if (j != result.end()) return j->second;
+        authorized_subscribers const& result,
+        std::string_view username) const {
+        auto row = user_row(username);
+        if (row != num_of_users_) {
+            auto id = num_of_groups_ + row;
+            for (auto const& e : result) {
+                if (e.first == id) return e.second;
             }
         }
 
+        for (auto const& e : result) {
+            if (e.first >= num_of_groups_) break;
+            if (is_member(row, e.first)) return e.second;
+        }
+
         return authorization::type::deny;
     }
 
@@ -765,11 +895,89 @@ struct security {
     std::optional<std::string> anonymous;
     std::optional<std::string> unauthenticated;
 
-    using auth_map_type = multiple_subscription_map<std::string, std::pair<authorization::type, std::size_t>>;
+    using auth_map_type = default_multiple_subscription_map<std::string, std::pair<authorization::type, std::size_t>>;
     auth_map_type auth_pub_map;
     auth_map_type auth_sub_map;
 
 private:
+    static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+    static std::uint64_t next_generation() {
+        static std::atomic<std::uint64_t> generation{0};
+        return ++generation;
+    }
+
+    void renew_generation() {
+        generation_ = next_generation();
+    }
+
+    /**
+     * Intern the users and the groups, and build the group bitmap of each user.
+     * The groups have the principal ids 0 .. num_of_groups_-1 in the order of
+     * groups_, and the users follow them in the order of authentication_.
+     * A user that is not in authentication_ belongs only to @any.
+     */
+    void build_principals() {
+        principal_ids_.clear();
+        std::size_t id = 0;
+        for (auto const& g : groups_) {
+            principal_ids_.emplace(g.first, id++);
+        }
+        num_of_groups_ = groups_.size();
+        for (auto const& a : authentication_) {
+            principal_ids_.emplace(a.first, id++);
+        }
+        num_of_users_ = authentication_.size();
+
+        bitmap_words_ = (num_of_groups_ + 63) / 64;
+        // The last row is for the users that are not in authentication_
+        auto rows = num_of_users_ + 1;
+        group_bitmaps_.assign(bitmap_words_ * rows, 0);
+        auto set_bit =
+            [&](std::size_t row, std::size_t gid) {
+                group_bitmaps_[row * bitmap_words_ + gid / 64] |= std::uint64_t(1) << (gid % 64);
+            };
+        std::size_t gid = 0;
+        for (auto const& g : groups_) {
+            if (g.first == any_group_name) {
+                for (std::size_t row = 0; row != rows; ++row) {
+                    set_bit(row, gid);
+                }
+            }
+            else {
+                for (auto const& m : g.second.members) {
+                    auto it = principal_ids_.find(m);
+                    if (it != principal_ids_.end() && it->second >= num_of_groups_) {
+                        set_bit(it->second - num_of_groups_, gid);
+                    }
+                }
+            }
+            ++gid;
+        }
+    }
+
+    std::size_t principal_id(std::string_view name) const {
+        auto it = principal_ids_.find(name);
+        if (it == principal_ids_.end()) return npos;
+        return it->second;
+    }
+
+    // The row of group_bitmaps_. num_of_users_ if the user is unknown.
+    std::size_t user_row(std::string_view username) const {
+        auto id = principal_id(username);
+        if (id == npos || id < num_of_groups_) return num_of_users_;
+        return id - num_of_groups_;
+    }
+
+    bool is_member(std::size_t row, std::size_t id) const {
+        if (id == npos) return false;
+        if (id < num_of_groups_) {
+            return
+                (group_bitmaps_[row * bitmap_words_ + id / 64] >> (id % 64)) & 1;
+        }
+        return id - num_of_groups_ == row;
+    }
+
     void validate_entry(std::string const& context, std::string const& name) const {
         if (is_valid_group_name(name) && groups_.find(name) == groups_.end()) {
             throw std::runtime_error("An invalid group name was specified for " + context + ": " + name);
@@ -780,6 +988,9 @@ private:
     }
 
     void validate() {
+        build_principals();
+        renew_generation();
+
         for (auto const& i : groups_) {
             for (auto const& j : i.second.members) {
                 auto iter = authentication_.find(j);
@@ -820,6 +1031,12 @@ private:
         }
     }
 
+    std::map<std::string, std::size_t, std::less<>> principal_ids_;
+    std::size_t num_of_groups_ = 0;
+    std::size_t num_of_users_ = 0;
+    std::size_t bitmap_words_ = 0;
+    std::vector<std::uint64_t> group_bitmaps_;
+    std::uint64_t generation_ = next_generation();
 };
 
 } // namespace async_mqtt
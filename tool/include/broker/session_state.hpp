@@ -7,22 +7,29 @@
 #if !defined(ASYNC_MQTT_BROKER_SESSION_STATE_HPP)
 #define ASYNC_MQTT_BROKER_SESSION_STATE_HPP
 
+#include <atomic>
 #include <chrono>
 #include <set>
 
 #include <boost/asio/io_context.hpp>
+#include <boost/asio/bind_executor.hpp>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 #include <boost/multi_index/key.hpp>
 
 #include <async_mqtt/packet/will.hpp>
+#include <async_mqtt/packet/packet_variant.hpp>
+#include <async_mqtt/util/timer_wheel.hpp>
 
 #include <broker/sub_con_map.hpp>
 #include <broker/shared_target.hpp>
 #include <broker/tags.hpp>
 #include <broker/inflight_message.hpp>
 #include <broker/offline_message.hpp>
+#include <broker/publish_fanout.hpp>
+#include <broker/session_store.hpp>
 #include <broker/mutex.hpp>
+#include <broker/rcu.hpp>
 
 namespace async_mqtt {
 
@@ -57,7 +64,7 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
     using will_sender_type = std::function<
         void(
             session_state<epsp_type> const& source_ss,
-            std::string topic,
+            buffer topic,
             std::vector<buffer> payload,
             pub::opts pubopts,
             properties props
@@ -68,7 +75,10 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
         as::io_context& timer_ioc,
         mutex& mtx_subs_map,
         sub_con_map<epsp_type>& subs_map,
+        mutex& mtx_shared_subs_map,
+        sub_con_map<epsp_type>& shared_subs_map,
         shared_target<epsp_type>& shared_targets,
+        offline_quota& quota,
         epsp_type epsp,
         std::string client_id,
         std::string const& username,
@@ -83,7 +93,10 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
                 as::io_context& timer_ioc,
                 mutex& mtx_subs_map,
                 sub_con_map<epsp_type>& subs_map,
+                mutex& mtx_shared_subs_map,
+                sub_con_map<epsp_type>& shared_subs_map,
                 shared_target<epsp_type>& shared_targets,
+                offline_quota& quota,
                 epsp_type epsp,
                 std::string client_id,
                 std::string const& username,
@@ -95,7 +108,10 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
                     timer_ioc,
                     mtx_subs_map,
                     subs_map,
+                    mtx_shared_subs_map,
+                    shared_subs_map,
                     shared_targets,
+                    quota,
                     force_move(epsp),
                     force_move(client_id),
                     username,
@@ -105,22 +121,198 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
                 }
             {}
         };
-        std::shared_ptr<session_state<Sp>> sssp = std::make_shared<impl>(
-            timer_ioc,
-            mtx_subs_map,
-            subs_map,
-            shared_targets,
-            force_move(epsp),
-            force_move(client_id),
-            username,
-            force_move(will_sender),
-            clean_start,
-            force_move(session_expiry_interval)
-        );
+        std::shared_ptr<session_state<Sp>> sssp{
+            new impl{
+                timer_ioc,
+                mtx_subs_map,
+                subs_map,
+                mtx_shared_subs_map,
+                shared_subs_map,
+                shared_targets,
+                quota,
+                force_move(epsp),
+                force_move(client_id),
+                username,
+                force_move(will_sender),
+                clean_start,
+                force_move(session_expiry_interval)
+            },
+            [](impl* p) { retire(p); }
+        };
         sssp->update_will(timer_ioc, will, will_expiry_interval);
         return sssp;
     }
 
+    /**
+     * @brief restore the offline session from the image of the session store
+     * The remaining session expiry and message expiry are calculated from the time
+     * the session became offline and the time the messages were stored.
+     * The messages that have expired are erased from the store.
+     * @param store the store that the image is loaded from
+     * @return nullptr if the session has expired
+     */
+    template <typename SessionExpireHandler>
+    static std::shared_ptr<session_state<Sp>> restore(
+        as::io_context& timer_ioc,
+        mutex& mtx_subs_map,
+        sub_con_map<epsp_type>& subs_map,
+        mutex& mtx_shared_subs_map,
+        sub_con_map<epsp_type>& shared_subs_map,
+        shared_target<epsp_type>& shared_targets,
+        offline_quota& quota,
+        session_image const& image,
+        std::shared_ptr<session_store> store,
+        will_sender_type will_sender,
+        SessionExpireHandler&& session_expire_handler
+    ) {
+        auto now = session_record::now_seconds();
+        std::optional<std::chrono::steady_clock::duration> remaining;
+        if (image.session_expiry_interval &&
+            *image.session_expiry_interval != session_never_expire) {
+            auto offline_at = image.offline_at == 0 ? now : image.offline_at;
+            auto rest = std::int64_t(*image.session_expiry_interval) - (now - offline_at);
+            if (rest <= 0) return nullptr;
+            remaining.emplace(std::chrono::seconds(rest));
+        }
+        // the inflight messages are stored when the session became offline
+        auto offline_elapsed = image.offline_at == 0 ? 0 : now - image.offline_at;
+
+        struct impl : session_state<Sp> {
+            impl(
+                as::io_context& timer_ioc,
+                mutex& mtx_subs_map,
+                sub_con_map<epsp_type>& subs_map,
+                mutex& mtx_shared_subs_map,
+                sub_con_map<epsp_type>& shared_subs_map,
+                shared_target<epsp_type>& shared_targets,
+                offline_quota& quota,
+                session_image const& image,
+                will_sender_type will_sender)
+                :
+                session_state<Sp> {
+                    timer_ioc,
+                    mtx_subs_map,
+                    subs_map,
+                    mtx_shared_subs_map,
+                    shared_subs_map,
+                    shared_targets,
+                    quota,
+                    image,
+                    force_move(will_sender)
+                }
+            {}
+        };
+        std::shared_ptr<session_state<Sp>> sssp{
+            new impl{
+                timer_ioc,
+                mtx_subs_map,
+                subs_map,
+                mtx_shared_subs_map,
+                shared_subs_map,
+                shared_targets,
+                quota,
+                image,
+                force_move(will_sender)
+            },
+            [](impl* p) { retire(p); }
+        };
+
+        for (auto const& [key, si] : image.subscriptions) {
+            sssp->subscribe(
+                key.first,
+                key.second,
+                sub::opts{si.subopts},
+                [] {},
+                si.sid ? std::optional<std::size_t>{*si.sid} : std::nullopt
+            );
+        }
+
+        std::vector<std::uint64_t> expired_ids;
+        for (auto const& [id, msg] : image.offline_messages) {
+            error_code ec;
+            auto pv = buffer_to_packet_variant(buffer{msg.packet}, protocol_version::v5, ec);
+            auto* p = pv.template get_if<v5::publish_packet>();
+            if (ec || !p) continue;
+            property_block props{p->props()};
+            if (auto mei = props.message_expiry_interval()) {
+                // decrease MessageExpiryInterval by the elapsed seconds
+                auto rest = std::int64_t(*mei) - (now - msg.pushed_at);
+                if (rest <= 0) {
+                    expired_ids.push_back(id);
+                    continue;
+                }
+                props = props.with_message_expiry_interval(std::uint32_t(rest));
+            }
+            std::lock_guard<mutex> g(sssp->mtx_offline_messages_);
+            // keep the id that is recorded in the store
+            sssp->next_offline_message_id_ = id;
+            sssp->push_offline_message(
+                timer_ioc,
+                p->topic_as_buffer(),
+                p->payload_as_buffer(),
+                p->opts(),
+                force_move(props)
+            );
+        }
+
+        std::vector<std::uint32_t> expired_pids;
+        for (auto const& [pid, bytes] : image.inflight_messages) {
+            error_code ec;
+            auto pv = buffer_to_packet_variant(buffer{bytes}, image.version, ec);
+            if (ec) continue;
+            pv.visit(
+                overload {
+                    [&](v3_1_1::publish_packet& p) {
+                        sssp->insert_inflight_message(force_move(p), std::nullopt);
+                    },
+                    [&](v3_1_1::pubrel_packet& p) {
+                        sssp->insert_inflight_message(force_move(p), std::nullopt);
+                    },
+                    [&](v5::publish_packet& p) {
+                        std::optional<std::chrono::steady_clock::duration> message_expiry;
+                        if (auto mei = p.message_expiry_interval()) {
+                            // decrease MessageExpiryInterval by the elapsed seconds
+                            auto rest = std::int64_t(*mei) - offline_elapsed;
+                            if (rest <= 0) {
+                                expired_pids.push_back(pid);
+                                return;
+                            }
+                            p.update_message_expiry_interval(std::uint32_t(rest));
+                            message_expiry.emplace(std::chrono::seconds(rest));
+                        }
+                        sssp->insert_inflight_message(force_move(p), message_expiry);
+                    },
+                    [&](v5::pubrel_packet& p) {
+                        sssp->insert_inflight_message(force_move(p), std::nullopt);
+                    },
+                    [](auto&) {}
+                }
+            );
+        }
+
+        // The changes after that are appended to the store.
+        // The expired messages are erased not to be restored again.
+        sssp->set_store(force_move(store));
+        for (auto id : expired_ids) {
+            sssp->persist_offline_erase(id);
+        }
+        for (auto pid : expired_pids) {
+            sssp->persist(
+                [&](std::string& record) {
+                    session_record::inflight_erase(record, sssp->username_, sssp->client_id_, pid);
+                }
+            );
+        }
+
+        if (remaining) {
+            sssp->set_session_expiry_timer(
+                *remaining,
+                std::forward<SessionExpireHandler>(session_expire_handler)
+            );
+        }
+        return sssp;
+    }
+
     ~session_state() {
         ASYNC_MQTT_LOG("mqtt_broker", trace)
             << ASYNC_MQTT_ADD_VALUE(address, this)
@@ -137,35 +329,16 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
         ASYNC_MQTT_LOG("mqtt_broker", trace)
             << ASYNC_MQTT_ADD_VALUE(address, this)
             << "store inflight message";
+        online_.store(false, std::memory_order_relaxed);
+        unacked_publishes_.store(0, std::memory_order_relaxed);
         auto stored = epsp.get_stored_packets();
         for (auto& store : stored) {
-            std::shared_ptr<as::steady_timer> tim_message_expiry;
+            std::optional<std::chrono::steady_clock::duration> message_expiry;
             store.visit(
                 overload {
                     [&](v5::publish_packet const& p) {
-                        for (auto const& prop : p.props()) {
-                            prop.visit(
-                                overload {
-                                    [&](property::message_expiry_interval const& v) {
-                                        tim_message_expiry =
-                                            std::make_shared<as::steady_timer>(
-                                                timer_ioc_,
-                                                std::chrono::seconds(v.val())
-                                            );
-                                        tim_message_expiry->async_wait(
-                                            [this, wp = std::weak_ptr<as::steady_timer>(tim_message_expiry)]
-                                            (error_code ec) {
-                                                if (auto sp = wp.lock()) {
-                                                    if (!ec) {
-                                                        erase_inflight_message_by_expiry(sp);
-                                                    }
-                                                }
-                                            }
-                                        );
-                                    },
-                                    [](auto const&) {}
-                                }
-                            );
+                        if (auto mei = p.message_expiry_interval()) {
+                            message_expiry.emplace(std::chrono::seconds(*mei));
                         }
                     },
                     [&](auto const&) {}
@@ -174,38 +347,50 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
 
             insert_inflight_message(
                 force_move(store),
-                force_move(tim_message_expiry)
+                message_expiry
             );
         }
 
         qos2_publish_handled_ = epsp.get_qos2_publish_handled_pids();
+        persist_session(session_record::now_seconds());
+        persist_inflight_messages();
 
         if (session_expiry_interval_ &&
             *session_expiry_interval_ != std::chrono::seconds(session_never_expire)) {
+            set_session_expiry_timer(
+                *session_expiry_interval_,
+                std::forward<SessionExpireHandler>(session_expire_handler)
+            );
+        }
+    }
 
-            ASYNC_MQTT_LOG("mqtt_broker", trace)
-                << ASYNC_MQTT_ADD_VALUE(address, this)
-                << "session expiry interval timer set";
-
-            tim_session_expiry_ = std::make_shared<as::steady_timer>(timer_ioc_, *session_expiry_interval_);
-            tim_session_expiry_->async_wait(
-                [
-                    this,
-                    wp = std::weak_ptr<as::steady_timer>(tim_session_expiry_),
-                    session_expire_handler = std::forward<SessionExpireHandler>(session_expire_handler)
-                ]
-                (error_code ec) {
-                    if (auto sp = wp.lock()) {
-                        if (!ec) {
-                            ASYNC_MQTT_LOG("mqtt_broker", info)
-                                << ASYNC_MQTT_ADD_VALUE(address, this)
-                                << "session expired";
-                            session_expire_handler(sp);
-                        }
+    template <typename SessionExpireHandler>
+    void set_session_expiry_timer(
+        std::chrono::steady_clock::duration expiry,
+        SessionExpireHandler&& session_expire_handler
+    ) {
+        ASYNC_MQTT_LOG("mqtt_broker", trace)
+            << ASYNC_MQTT_ADD_VALUE(address, this)
+            << "session expiry interval timer set";
+
+        tim_session_expiry_ = std::make_shared<as::steady_timer>(timer_ioc_, expiry);
+        tim_session_expiry_->async_wait(
+            [
+                this,
+                wp = std::weak_ptr<as::steady_timer>(tim_session_expiry_),
+                session_expire_handler = std::forward<SessionExpireHandler>(session_expire_handler)
+            ]
+            (error_code ec) {
+                if (auto sp = wp.lock()) {
+                    if (!ec) {
+                        ASYNC_MQTT_LOG("mqtt_broker", info)
+                            << ASYNC_MQTT_ADD_VALUE(address, this)
+                            << "session expired";
+                        session_expire_handler(sp);
                     }
                 }
-            );
-        }
+            }
+        );
     }
 
     void renew(
@@ -215,8 +400,11 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
         std::optional<std::chrono::steady_clock::duration> will_expiry_interval,
         std::optional<std::chrono::steady_clock::duration> session_expiry_interval
     ) {
+        // the old session is discarded
+        persist_erase();
         clean();
         epwp_ = epsp;
+        online_.store(true, std::memory_order_relaxed);
         auto version = epsp.get_protocol_version();
         if (version == protocol_version::v3_1_1) {
             remain_after_close_= !clean_start;
@@ -229,12 +417,13 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
         }
         update_will(timer_ioc_, force_move(will), will_expiry_interval);
         session_expiry_interval_ = force_move(session_expiry_interval);
+        persist_session();
     }
 
     void publish(
         epsp_type& epsp,
         as::io_context& timer_ioc,
-        std::string pub_topic,
+        buffer pub_topic,
         std::vector<buffer> payload,
         pub::opts pubopts,
         properties props) {
@@ -243,6 +432,7 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
             [this, epsp, pub_topic, payload = payload, pubopts, props, wp = this->weak_from_this()]
             (packet_id_type pid) mutable {
                 if (auto sp = wp.lock()) {
+                    if (pid != 0) unacked_publishes_.fetch_add(1, std::memory_order_relaxed);
                     switch (version_) {
                     case protocol_version::v3_1_1:
                         epsp.async_send(
@@ -311,18 +501,126 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
         }
 
         // offline_messages_ is not empty or packet_id_exhausted
-        offline_messages_.push_back(
+        detach_from_slab(pub_topic, payload);
+        push_offline_message(
             timer_ioc,
             force_move(pub_topic),
             force_move(payload),
             pubopts,
-            force_move(props)
+            property_block{props}
+        );
+    }
+
+    /**
+     * @brief Send a copy of the packet prepared by fanout
+     * Only the packet id is set per session. If the session has offline
+     * messages, the message is queued after them.
+     */
+    void publish(
+        epsp_type& epsp,
+        as::io_context& timer_ioc,
+        publish_fanout& fanout,
+        pub::opts pubopts,
+        std::optional<std::size_t> sid) {
+
+        auto send_publish =
+            [this, epsp, wp = this->weak_from_this()]
+            (auto packet, packet_id_type pid) mutable {
+                if (auto sp = wp.lock()) {
+                    if (pid != 0) {
+                        packet.set_packet_id(pid);
+                        unacked_publishes_.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    epsp.async_send(
+                        force_move(packet),
+                        [this, epsp](error_code const& ec) {
+                            if (ec) {
+                                ASYNC_MQTT_LOG("mqtt_broker", info)
+                                    << ASYNC_MQTT_ADD_VALUE(address, this)
+                                    << "epsp:" << epsp.get_address() << " "
+                                    << ec.message();
+                            }
+                        }
+                    );
+                }
+            };
+
+        auto send =
+            [&](auto const& packet) {
+                auto qos_value = pubopts.get_qos();
+                if (qos_value == qos::at_least_once ||
+                    qos_value == qos::exactly_once) {
+                    epsp.async_acquire_unique_packet_id(
+                        [send_publish = force_move(send_publish), packet]
+                        (error_code const&  ec, auto pid) mutable {
+                            if (!ec) {
+                                send_publish(force_move(packet), pid);
+                                return;
+                            }
+                        }
+                    );
+                }
+                else {
+                    send_publish(packet, 0);
+                }
+            };
+
+        std::lock_guard<mutex> g(mtx_offline_messages_);
+        if (offline_messages_.empty()) {
+            switch (version_) {
+            case protocol_version::v3_1_1:
+                send(fanout.v3_1_1_packet(pubopts));
+                break;
+            case protocol_version::v5:
+                send(fanout.v5_packet(pubopts, sid));
+                break;
+            default:
+                BOOST_ASSERT(false);
+                break;
+            }
+            return;
+        }
+
+        // offline_messages_ is not empty
+        push_offline_message(
+            timer_ioc,
+            fanout.stored_topic(),
+            fanout.stored_payload(),
+            pubopts,
+            fanout.stored_props(sid)
         );
     }
 
     void deliver(
         as::io_context& timer_ioc,
-        std::string pub_topic,
+        publish_fanout& fanout,
+        pub::opts pubopts,
+        std::optional<std::size_t> sid) {
+
+        if (auto epsp = lock()) {
+            publish(
+                epsp,
+                timer_ioc,
+                fanout,
+                pubopts,
+                sid
+            );
+        }
+        else {
+            std::lock_guard<mutex> g(mtx_offline_messages_);
+            push_offline_message(
+                timer_ioc,
+                fanout.stored_topic(),
+                fanout.stored_payload(),
+                pubopts,
+                fanout.stored_props(sid)
+            );
+        }
+    }
+
+    void deliver(
+        as::io_context& timer_ioc,
+        buffer pub_topic,
         std::vector<buffer> payload,
         pub::opts pubopts,
         properties props) {
@@ -338,13 +636,14 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
             );
         }
         else {
+            detach_from_slab(pub_topic, payload);
             std::lock_guard<mutex> g(mtx_offline_messages_);
-            offline_messages_.push_back(
+            push_offline_message(
                 timer_ioc,
                 force_move(pub_topic),
                 force_move(payload),
                 pubopts,
-                force_move(props)
+                property_block{props}
             );
         }
     }
@@ -367,9 +666,13 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
         {
             std::lock_guard<mutex> g(mtx_offline_messages_);
             offline_messages_.clear();
+            store_offline_size();
         }
-        unsubscribe_all();
+        unacked_publishes_.store(0, std::memory_order_relaxed);
+        // Erase from shared_targets_ first. While shared_subs_map_ is locked,
+        // the shared subscription group never chooses the session that is being cleaned.
         shared_targets_.erase(*this);
+        unsubscribe_all();
         tim_will_delay_.cancel();
 
         session_expiry_interval_ = std::nullopt;
@@ -388,7 +691,7 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
     ) {
         subscription<epsp_type> sub {*this, share_name, topic_filter, subopts, sid };
         if (!share_name.empty()) {
-            shared_targets_.insert(share_name, topic_filter, sub, *this);
+            sub.group = shared_targets_.insert(share_name, topic_filter, sub, *this);
         }
         ASYNC_MQTT_LOG("mqtt_broker", trace)
             << ASYNC_MQTT_ADD_VALUE(address, this)
@@ -397,15 +700,31 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
             << " topic_filter:" << topic_filter
             << " qos:" << subopts.get_qos();
 
+        persist(
+            [&](std::string& record) {
+                session_record::subscribe(
+                    record,
+                    username_,
+                    client_id_,
+                    share_name,
+                    topic_filter,
+                    subopts,
+                    sid ? std::optional<std::uint32_t>{std::uint32_t(*sid)} : std::nullopt
+                );
+            }
+        );
+
+        bool shared = !share_name.empty();
         auto handle_ret =
             [&] {
-                std::lock_guard<mutex> g{mtx_subs_map_};
-                return subs_map_.insert_or_assign(
+                std::lock_guard<mutex> g{shared ? mtx_shared_subs_map_ : mtx_subs_map_};
+                return (shared ? shared_subs_map_ : subs_map_).insert_or_assign(
                     force_move(topic_filter),
                     client_id_,
                     force_move(sub)
                 );
             } ();
+        (shared ? shared_subs_map_ : subs_map_).publish(shared ? mtx_shared_subs_map_ : mtx_subs_map_);
 
         auto rh = subopts.get_retain_handling();
 
@@ -414,7 +733,7 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
                 << ASYNC_MQTT_ADD_VALUE(address, this)
                 << "subscription inserted";
 
-            handles_.insert(handle_ret.first);
+            (shared ? shared_handles_ : handles_).insert(handle_ret.first);
             if (rh == sub::retain_handling::send ||
                 rh == sub::retain_handling::send_only_new_subscription) {
                 std::forward<PublishRetainHandler>(h)();
@@ -432,15 +751,26 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
     }
 
     void unsubscribe(std::string const& share_name, std::string const& topic_filter) {
-        if (!share_name.empty()) {
+        persist(
+            [&](std::string& record) {
+                session_record::unsubscribe(record, username_, client_id_, share_name, topic_filter);
+            }
+        );
+        bool shared = !share_name.empty();
+        if (shared) {
             shared_targets_.erase(share_name, topic_filter, *this);
         }
-        std::lock_guard<mutex> g{mtx_subs_map_};
-        auto handle = subs_map_.lookup(topic_filter);
-        if (handle) {
-            handles_.erase(*handle);
-            subs_map_.erase(*handle, client_id_);
+        auto& mtx = shared ? mtx_shared_subs_map_ : mtx_subs_map_;
+        auto& map = shared ? shared_subs_map_ : subs_map_;
+        {
+            std::lock_guard<mutex> g{mtx};
+            auto handle = map.lookup(topic_filter);
+            if (handle) {
+                (shared ? shared_handles_ : handles_).erase(*handle);
+                map.erase(*handle, client_id_);
+            }
         }
+        map.publish(mtx);
     }
 
     void unsubscribe_all() {
@@ -450,7 +780,17 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
                 subs_map_.erase(h, client_id_);
             }
         }
+        // All subscriptions of the session are published as one snapshot.
+        subs_map_.publish(mtx_subs_map_);
         handles_.clear();
+        {
+            std::lock_guard<mutex> g{mtx_shared_subs_map_};
+            for (auto const& h : shared_handles_) {
+                shared_subs_map_.erase(h, client_id_);
+            }
+        }
+        shared_subs_map_.publish(mtx_shared_subs_map_);
+        shared_handles_.clear();
     }
 
     void update_will(
@@ -524,12 +864,15 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
 
     void insert_inflight_message(
         store_packet_variant msg,
-        std::shared_ptr<as::steady_timer> tim_message_expiry
+        std::optional<std::chrono::steady_clock::duration> message_expiry
     ) {
         std::lock_guard<mutex> g(mtx_inflight_messages_);
         inflight_messages_.insert(
             force_move(msg),
-            force_move(tim_message_expiry)
+            message_expiry,
+            use_timer_wheel(timer_ioc_),
+            this->weak_from_this(),
+            &session_state::inflight_message_expired
         );
     }
 
@@ -540,34 +883,67 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
         }
     }
 
-    void erase_inflight_message_by_expiry(std::shared_ptr<as::steady_timer> const& sp) {
-        std::lock_guard<mutex> g(mtx_inflight_messages_);
-        auto& idx = inflight_messages_.get<tag_tim>();
-        auto [b, e] = idx.equal_range(sp);
-        while (b != e) {
-        ASYNC_MQTT_LOG("mqtt_broker", info)
-            << "message expired:" << b->packet();
-            b = idx.erase(b);
+    // expire handlers of timer_wheel. owner is this session.
+    static void inflight_message_expired(void* owner, void*, timer_wheel::handle const* key) {
+        auto& ss = *static_cast<session_state*>(owner);
+        std::lock_guard<mutex> g(ss.mtx_inflight_messages_);
+        auto& idx = ss.inflight_messages_.template get<tag_tim>();
+        auto it = idx.find(key);
+        if (it != idx.end() && it->expired()) {
+            ASYNC_MQTT_LOG("mqtt_broker", info)
+                << "message expired:" << it->packet();
+            idx.erase(it);
+        }
+    }
+
+    static void offline_message_expired(void* owner, void*, timer_wheel::handle const* key) {
+        auto& ss = *static_cast<session_state*>(owner);
+        std::lock_guard<mutex> g(ss.mtx_offline_messages_);
+        if (auto id = ss.offline_messages_.erase_expired(key)) {
+            ss.persist_offline_erase(*id);
         }
+        ss.store_offline_size();
     }
 
     std::size_t erase_inflight_message_by_packet_id(packet_id_type packet_id) {
         std::lock_guard<mutex> g(mtx_inflight_messages_);
         auto& idx = inflight_messages_.get<tag_pid>();
-        return idx.erase(packet_id);
+        auto erased = idx.erase(packet_id);
+        if (erased != 0) {
+            persist(
+                [&](std::string& record) {
+                    session_record::inflight_erase(record, username_, client_id_, packet_id);
+                }
+            );
+        }
+        return erased;
     }
 
     void send_all_offline_messages() {
         if (auto epsp = lock()) {
             std::lock_guard<mutex> g(mtx_offline_messages_);
-            offline_messages_.send_until_fail(epsp, get_protocol_version());
+            offline_messages_.send_until_fail(
+                epsp,
+                get_protocol_version(),
+                [this](std::uint64_t id) {
+                    persist_offline_pop(id);
+                }
+            );
+            store_offline_size();
         }
     }
 
     void send_offline_messages_by_packet_id_release() {
         if (auto epsp = lock()) {
             std::lock_guard<mutex> g(mtx_offline_messages_);
-            offline_messages_.send_until_fail(epsp, get_protocol_version());
+            offline_messages_.send_until_fail(
+                epsp,
+                get_protocol_version(),
+                [this](std::uint64_t id) {
+                    persist_offline_pop(id);
+                }
+            );
+            store_offline_size();
         }
     }
 
@@ -594,6 +970,8 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
             << "inherit";
 
         epwp_ = epsp;
+        online_.store(true, std::memory_order_relaxed);
+        unacked_publishes_.store(0, std::memory_order_relaxed);
         auto version = epsp.get_protocol_version();
         if (version == protocol_version::v3_1_1) {
             remain_after_close_= true;
@@ -612,12 +990,68 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
 
         session_expiry_interval_ = force_move(session_expiry_interval);
         epsp.restore_qos2_publish_handled_pids(qos2_publish_handled_);
+        persist_session();
     }
 
     epsp_type lock() {
         return epwp_.lock();
     }
 
+    /**
+     * @brief set the session store
+     * After that, the changes of the persistent session are appended to the store.
+     */
+    void set_store(std::shared_ptr<session_store> store) {
+        store_ = force_move(store);
+    }
+
+    /**
+     * @brief append the session to the store
+     * If the session doesn't remain after close, it is erased from the store.
+     * @param offline_at the time the session became offline (seconds since the epoch
+     *                   of system_clock). 0 means online.
+     */
+    void persist_session(std::int64_t offline_at = 0) {
+        if (!store_) return;
+        if (!remain_after_close_) {
+            persist_erase();
+            return;
+        }
+        persisted_ = true;
+        persist(
+            [&](std::string& record) {
+                session_record::session(
+                    record,
+                    username_,
+                    client_id_,
+                    version_,
+                    session_expiry_interval_
+                        ? std::optional<std::uint32_t>{
+                            std::uint32_t(
+                                std::chrono::duration_cast<std::chrono::seconds>(
+                                    *session_expiry_interval_
+                                ).count()
+                            )
+                          }
+                        : std::nullopt,
+                    offline_at
+                );
+            }
+        );
+    }
+
+    /**
+     * @brief erase the session from the store
+     */
+    void persist_erase() {
+        if (!store_ || !persisted_) return;
+        persisted_ = false;
+        thread_local std::string record;
+        record.clear();
+        session_record::erase(record, username_, client_id_);
+        store_->append(record);
+    }
+
     std::optional<std::chrono::steady_clock::duration> session_expiry_interval() const {
         return session_expiry_interval_;
     }
@@ -634,13 +1068,59 @@ struct session_state : std::enable_shared_from_this<session_state<Sp>> {
         return remain_after_close_;
     }
 
+    /**
+     * @brief get the number of the offline messages and the sum of their payload sizes
+     */
+    std::pair<std::size_t, std::size_t> offline_queue_usage() const {
+        std::lock_guard<mutex> g(mtx_offline_messages_);
+        return {offline_messages_.size(), offline_messages_.bytes()};
+    }
+
+    /**
+     * @brief check the session is connected
+     * It can be called from any thread.
+     */
+    bool online() const {
+        return online_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief get the number of the offline messages
+     * It can be called from any thread without the lock.
+     */
+    std::size_t offline_size() const {
+        return offline_size_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief get the number of QoS1 and QoS2 PUBLISH packets that are delivered and not acknowledged yet
+     * It is approximate. The packets that are resent on reconnection are not counted.
+     * It can be called from any thread.
+     */
+    std::size_t unacked_publishes() const {
+        return unacked_publishes_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief notify that PUBACK or PUBCOMP is received
+     */
+    void publish_acknowledged() {
+        auto n = unacked_publishes_.load(std::memory_order_relaxed);
+        while (n != 0 &&
+               !unacked_publishes_.compare_exchange_weak(n, n - 1, std::memory_order_relaxed)) {
+        }
+    }
+
 private:
     // constructor
     session_state(
         as::io_context& timer_ioc,
         mutex& mtx_subs_map,
         sub_con_map<epsp_type>& subs_map,
+        mutex& mtx_shared_subs_map,
+        sub_con_map<epsp_type>& shared_subs_map,
         shared_target<epsp_type>& shared_targets,
+        offline_quota& quota,
         epsp_type epsp,
         std::string client_id,
         std::string const& username,
@@ -650,12 +1130,15 @@ private:
         :timer_ioc_(timer_ioc),
          mtx_subs_map_(mtx_subs_map),
          subs_map_(subs_map),
+         mtx_shared_subs_map_(mtx_shared_subs_map),
+         shared_subs_map_(shared_subs_map),
          shared_targets_(shared_targets),
          epwp_(epsp),
          version_(epsp.get_protocol_version()),
          client_id_(force_move(client_id)),
          username_(username),
          session_expiry_interval_(force_move(session_expiry_interval)),
+         offline_messages_(quota),
          tim_will_delay_(timer_ioc_),
          will_sender_(force_move(will_sender)),
          remain_after_close_(
@@ -672,6 +1155,216 @@ private:
             } ()
          )
     {
+        online_.store(true, std::memory_order_relaxed);
+    }
+
+    // constructor for the session that is restored from the session store
+    session_state(
+        as::io_context& timer_ioc,
+        mutex& mtx_subs_map,
+        sub_con_map<epsp_type>& subs_map,
+        mutex& mtx_shared_subs_map,
+        sub_con_map<epsp_type>& shared_subs_map,
+        shared_target<epsp_type>& shared_targets,
+        offline_quota& quota,
+        session_image const& image,
+        will_sender_type will_sender)
+        :timer_ioc_(timer_ioc),
+         mtx_subs_map_(mtx_subs_map),
+         subs_map_(subs_map),
+         mtx_shared_subs_map_(mtx_shared_subs_map),
+         shared_subs_map_(shared_subs_map),
+         shared_targets_(shared_targets),
+         version_(image.version),
+         client_id_(image.client_id),
+         username_(image.username),
+         session_expiry_interval_(
+             image.session_expiry_interval
+                 ? std::optional<std::chrono::steady_clock::duration>{
+                     std::chrono::seconds(*image.session_expiry_interval)
+                   }
+                 : std::nullopt
+         ),
+         offline_messages_(quota),
+         tim_will_delay_(timer_ioc_),
+         will_sender_(force_move(will_sender)),
+         remain_after_close_(true),
+         persisted_(true)
+    {
+    }
+
+    // append the record that is encoded by f if the session is persistent
+    template <typename Func>
+    void persist(Func&& f) {
+        if (!store_ || !remain_after_close_) return;
+        thread_local std::string record;
+        record.clear();
+        std::forward<Func>(f)(record);
+        store_->append(record);
+    }
+
+    template <typename ConstBufferSequence>
+    static void append_bytes(std::string& out, ConstBufferSequence const& cbs) {
+        for (auto const& cb : cbs) {
+            out.append(static_cast<char const*>(cb.data()), cb.size());
+        }
+    }
+
+    void persist_inflight_messages() {
+        persist(
+            [&](std::string& record) {
+                std::vector<std::pair<std::uint32_t, std::string>> messages;
+                std::lock_guard<mutex> g(mtx_inflight_messages_);
+                for (auto const& m : inflight_messages_.template get<tag_seq>()) {
+                    std::string bytes;
+                    append_bytes(bytes, m.packet().const_buffer_sequence());
+                    messages.emplace_back(m.packet().packet_id(), force_move(bytes));
+                }
+                session_record::inflight_set(record, username_, client_id_, messages);
+            }
+        );
+    }
+
+    // called under mtx_offline_messages_
+    void push_offline_message(
+        as::io_context& timer_ioc,
+        buffer pub_topic,
+        std::vector<buffer> payload,
+        pub::opts pubopts,
+        property_block props
+    ) {
+        auto id = next_offline_message_id_++;
+        std::string bytes;
+        if (store_ && remain_after_close_) {
+            // stored as a v5 PUBLISH packet, the packet id is not used
+            auto qos_value = pubopts.get_qos();
+            v5::publish_packet packet {
+                packet_id_type(qos_value == qos::at_most_once ? 0 : 1),
+                pub_topic,
+                payload,
+                pubopts,
+                props
+            };
+            append_bytes(bytes, packet.const_buffer_sequence());
+        }
+        auto result = offline_messages_.push_back(
+            use_timer_wheel(timer_ioc),
+            this->weak_from_this(),
+            &session_state::offline_message_expired,
+            id,
+            force_move(pub_topic),
+            force_move(payload),
+            pubopts,
+            force_move(props),
+            [this](std::uint64_t dropped_id) {
+                persist_offline_erase(dropped_id);
+            }
+        );
+        switch (result) {
+        case offline_push_result::queued:
+            persist(
+                [&](std::string& record) {
+                    session_record::offline_push(
+                        record,
+                        username_,
+                        client_id_,
+                        id,
+                        session_record::now_seconds(),
+                        bytes
+                    );
+                }
+            );
+            break;
+        case offline_push_result::dropped:
+            ASYNC_MQTT_LOG("mqtt_broker", trace)
+                << ASYNC_MQTT_ADD_VALUE(address, this)
+                << "cid:" << client_id_
+                << " offline message dropped by quota";
+            break;
+        case offline_push_result::overflow:
+            ASYNC_MQTT_LOG("mqtt_broker", info)
+                << ASYNC_MQTT_ADD_VALUE(address, this)
+                << "cid:" << client_id_
+                << " offline messages exceeded quota";
+            if (auto epsp = lock()) close_by_quota(force_move(epsp));
+            break;
+        }
+        store_offline_size();
+    }
+
+    // called under mtx_offline_messages_
+    void store_offline_size() {
+        offline_size_.store(offline_messages_.size(), std::memory_order_relaxed);
+    }
+
+    void persist_offline_erase(std::uint64_t id) {
+        persist(
+            [&](std::string& record) {
+                session_record::offline_erase(record, username_, client_id_, id);
+            }
+        );
+    }
+
+    void persist_offline_pop(std::uint64_t id) {
+        persist(
+            [&](std::string& record) {
+                session_record::offline_pop(record, username_, client_id_, id);
+            }
+        );
+    }
+
+    void close_by_quota(epsp_type epsp) {
+        auto close =
+            [epsp]() mutable {
+                epsp.async_close(
+                    as::bind_executor(
+                        epsp.get_executor(),
+                        [epsp] {
+                            ASYNC_MQTT_LOG("mqtt_broker", info)
+                                << ASYNC_MQTT_ADD_VALUE(address, epsp.get_address())
+                                << "closed";
+                        }
+                    )
+                );
+            };
+        if (version_ == protocol_version::v5) {
+            epsp.async_send(
+                v5::disconnect_packet{
+                    disconnect_reason_code::quota_exceeded,
+                    properties{}
+                },
+                [close = force_move(close)](error_code const&) mutable {
+                    close();
+                }
+            );
+        }
+        else {
+            close();
+        }
+    }
+
+    // Destroy the session after the grace period.
+    //
+    // The subscription maps on the snapshot mode and the shared subscription groups
+    // are read without the lock, so a reader could refer to the session after it is
+    // erased from them. The will is sent and the session is erased from them here.
+    // After the snapshots without the session are published, the session is
+    // destroyed when all the readers of the older snapshots leave.
+    // It is the deleter of the shared_ptr that is returned by create() and restore().
+    template <typename Impl>
+    static void retire(Impl* p) {
+        p->send_will_impl();
+        p->shared_targets_.erase(*p);
+        p->unsubscribe_all();
+        p->subs_map_.when_published(
+            [p] {
+                p->shared_subs_map_.when_published(
+                    [p] {
+                        rcu_domain::instance().retire([p] { delete p; });
+                    }
+                );
+            }
+        );
     }
 
     void send_will_impl() {
@@ -681,7 +1374,7 @@ private:
             << ASYNC_MQTT_ADD_VALUE(address, this)
             << "send will. cid:" << client_id_;
 
-        auto topic = force_move(will_value_->topic());
+        auto topic = will_value_->topic_as_buffer();
         auto payload = force_move(will_value_->message_as_buffer());
         auto opts = will_value_->get_qos() | will_value_->get_retain();
         auto props = force_move(will_value_->props());
@@ -745,6 +1438,10 @@ private:
 
     mutex& mtx_subs_map_;
     sub_con_map<epsp_type>& subs_map_;
+    // Shared subscriptions are stored here. It is the same as subs_map_
+    // except the sharded broker. See sharded_broker.
+    mutex& mtx_shared_subs_map_;
+    sub_con_map<epsp_type>& shared_subs_map_;
     shared_target<epsp_type>& shared_targets_;
     epwp_type epwp_;
     protocol_version version_;
@@ -760,9 +1457,16 @@ private:
 
     mutable mutex mtx_offline_messages_;
     offline_messages offline_messages_;
+    std::uint64_t next_offline_message_id_ = 1;
+
+    // They are read by the shared subscription groups on any thread.
+    std::atomic<bool> online_{false};
+    std::atomic<std::size_t> offline_size_{0};
+    std::atomic<std::size_t> unacked_publishes_{0};
 
     using elem_type = typename sub_con_map<epsp_type>::handle;
     std::set<elem_type> handles_; // to efficient remove
+    std::set<elem_type> shared_handles_; // to efficient remove
 
     as::steady_timer tim_will_delay_;
     will_sender_type will_sender_;
@@ -772,6 +1476,8 @@ private:
 
     std::optional<std::string> response_topic_;
     std::function<void()> clean_handler_;
+    std::shared_ptr<session_store> store_;
+    bool persisted_ = false; // the session has been appended to store_
 };
 
 template <typename Sp>
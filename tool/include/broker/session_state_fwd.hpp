@@ -17,6 +17,9 @@ struct session_state;
 template <typename Sp>
 using session_state_ref = std::reference_wrapper<session_state<Sp>>;
 
+template <typename Sp>
+class shared_group;
+
 } // namespace async_mqtt
 
 #endif // ASYNC_MQTT_BROKER_SESSION_STATE_FWD_HPP
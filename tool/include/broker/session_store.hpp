@@ -0,0 +1,539 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_BROKER_SESSION_STORE_HPP)
+#define ASYNC_MQTT_BROKER_SESSION_STORE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <async_mqtt/protocol_version.hpp>
+#include <async_mqtt/util/move.hpp>
+#include <async_mqtt/packet/subopts.hpp>
+
+namespace async_mqtt {
+
+/**
+ * @brief image of a persistent session that is restored from the session store
+ */
+struct session_image {
+    struct subscription {
+        std::uint8_t subopts;
+        std::optional<std::uint32_t> sid;
+    };
+    struct offline_message {
+        std::int64_t pushed_at; // seconds since the epoch of system_clock
+        std::string packet;     // MQTT v5 PUBLISH packet bytes
+    };
+
+    std::string username;
+    std::string client_id;
+    protocol_version version = protocol_version::v5;
+    std::optional<std::uint32_t> session_expiry_interval; // seconds
+    std::int64_t offline_at = 0; // seconds since the epoch of system_clock. 0 means online.
+    // key is (share_name, topic_filter)
+    std::map<std::pair<std::string, std::string>, subscription> subscriptions;
+    // key is the id of the message, that is the order of arrival
+    std::map<std::uint64_t, offline_message> offline_messages;
+    // key is packet_id, value is the packet bytes of the session's protocol version
+    std::map<std::uint32_t, std::string> inflight_messages;
+};
+
+/**
+ * @brief session images keyed by session_images_key()
+ */
+using session_images = std::unordered_map<std::string, session_image>;
+
+inline std::string session_images_key(std::string_view username, std::string_view client_id) {
+    // NUL never appears in MQTT UTF-8 strings
+    std::string key;
+    key.reserve(username.size() + 1 + client_id.size());
+    key.append(username);
+    key.push_back('\0');
+    key.append(client_id);
+    return key;
+}
+
+/**
+ * @brief records of the session store
+ *
+ * A record is a type byte followed by fields. Integers are little endian and
+ * strings are prefixed by 32bit length. The records are idempotent per session,
+ * and a log is replayed from the beginning in order.
+ */
+namespace session_record {
+
+enum class type : std::uint8_t {
+    session = 1,    // username, client_id, version, session_expiry_interval, offline_at
+    erase,          // username, client_id
+    subscribe,      // username, client_id, share_name, topic_filter, subopts, sid
+    unsubscribe,    // username, client_id, share_name, topic_filter
+    offline_push,   // username, client_id, id, pushed_at, PUBLISH packet
+    offline_pop,    // username, client_id, id. The messages up to id are erased.
+    inflight_set,   // username, client_id, number of messages, (packet_id, packet)...
+    inflight_erase, // username, client_id, packet_id
+    offline_erase,  // username, client_id, id
+};
+
+inline std::int64_t now_seconds() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()
+    ).count();
+}
+
+inline std::uint8_t subopts_to_uint8(sub::opts opts) {
+    return
+        static_cast<std::uint8_t>(opts.get_qos()) |
+        static_cast<std::uint8_t>(opts.get_nl()) |
+        static_cast<std::uint8_t>(opts.get_rap()) |
+        static_cast<std::uint8_t>(opts.get_retain_handling());
+}
+
+class writer {
+public:
+    explicit writer(std::string& out)
+        :out_{out}
+    {}
+
+    writer& u8(std::uint8_t v) {
+        out_.push_back(static_cast<char>(v));
+        return *this;
+    }
+
+    writer& u32(std::uint32_t v) {
+        for (int i = 0; i != 4; ++i) {
+            out_.push_back(static_cast<char>(v >> (i * 8)));
+        }
+        return *this;
+    }
+
+    writer& u64(std::uint64_t v) {
+        for (int i = 0; i != 8; ++i) {
+            out_.push_back(static_cast<char>(v >> (i * 8)));
+        }
+        return *this;
+    }
+
+    writer& i64(std::int64_t v) {
+        return u64(static_cast<std::uint64_t>(v));
+    }
+
+    writer& str(std::string_view v) {
+        u32(static_cast<std::uint32_t>(v.size()));
+        out_.append(v);
+        return *this;
+    }
+
+    writer& header(type t, std::string_view username, std::string_view client_id) {
+        u8(static_cast<std::uint8_t>(t));
+        str(username);
+        str(client_id);
+        return *this;
+    }
+
+private:
+    std::string& out_;
+};
+
+class reader {
+public:
+    explicit reader(std::string_view in)
+        :in_{in}
+    {}
+
+    bool ok() const {
+        return ok_;
+    }
+
+    std::uint8_t u8() {
+        if (!require(1)) return 0;
+        auto v = static_cast<std::uint8_t>(in_[0]);
+        in_.remove_prefix(1);
+        return v;
+    }
+
+    std::uint32_t u32() {
+        if (!require(4)) return 0;
+        std::uint32_t v = 0;
+        for (int i = 0; i != 4; ++i) {
+            v |= std::uint32_t(static_cast<std::uint8_t>(in_[std::size_t(i)])) << (i * 8);
+        }
+        in_.remove_prefix(4);
+        return v;
+    }
+
+    std::uint64_t u64() {
+        if (!require(8)) return 0;
+        std::uint64_t v = 0;
+        for (int i = 0; i != 8; ++i) {
+            v |= std::uint64_t(static_cast<std::uint8_t>(in_[std::size_t(i)])) << (i * 8);
+        }
+        in_.remove_prefix(8);
+        return v;
+    }
+
+    std::int64_t i64() {
+        return static_cast<std::int64_t>(u64());
+    }
+
+    std::string_view str() {
+        auto size = u32();
+        if (!require(size)) return {};
+        auto v = in_.substr(0, size);
+        in_.remove_prefix(size);
+        return v;
+    }
+
+private:
+    bool require(std::size_t size) {
+        if (ok_ && in_.size() >= size) return true;
+        ok_ = false;
+        return false;
+    }
+
+    std::string_view in_;
+    bool ok_ = true;
+};
+
+inline void session(
+    std::string& out,
+    std::string_view username,
+    std::string_view client_id,
+    protocol_version version,
+    std::optional<std::uint32_t> session_expiry_interval,
+    std::int64_t offline_at
+) {
+    writer w{out};
+    w.header(type::session, username, client_id)
+        .u8(static_cast<std::uint8_t>(version))
+        .u8(session_expiry_interval ? 1 : 0)
+        .u32(session_expiry_interval.value_or(0))
+        .i64(offline_at);
+}
+
+inline void erase(std::string& out, std::string_view username, std::string_view client_id) {
+    writer{out}.header(type::erase, username, client_id);
+}
+
+inline void subscribe(
+    std::string& out,
+    std::string_view username,
+    std::string_view client_id,
+    std::string_view share_name,
+    std::string_view topic_filter,
+    sub::opts opts,
+    std::optional<std::uint32_t> sid
+) {
+    writer w{out};
+    w.header(type::subscribe, username, client_id)
+        .str(share_name)
+        .str(topic_filter)
+        .u8(subopts_to_uint8(opts))
+        .u8(sid ? 1 : 0)
+        .u32(sid.value_or(0));
+}
+
+inline void unsubscribe(
+    std::string& out,
+    std::string_view username,
+    std::string_view client_id,
+    std::string_view share_name,
+    std::string_view topic_filter
+) {
+    writer w{out};
+    w.header(type::unsubscribe, username, client_id)
+        .str(share_name)
+        .str(topic_filter);
+}
+
+inline void offline_push(
+    std::string& out,
+    std::string_view username,
+    std::string_view client_id,
+    std::uint64_t id,
+    std::int64_t pushed_at,
+    std::string_view packet
+) {
+    writer w{out};
+    w.header(type::offline_push, username, client_id)
+        .u64(id)
+        .i64(pushed_at)
+        .str(packet);
+}
+
+/**
+ * @brief offline_pop record
+ * @param id the id of the last message that is sent
+ */
+inline void offline_pop(
+    std::string& out,
+    std::string_view username,
+    std::string_view client_id,
+    std::uint64_t id
+) {
+    writer w{out};
+    w.header(type::offline_pop, username, client_id)
+        .u64(id);
+}
+
+/**
+ * @brief offline_erase record
+ * @param id the id of the message that is expired or dropped by the quota
+ */
+inline void offline_erase(
+    std::string& out,
+    std::string_view username,
+    std::string_view client_id,
+    std::uint64_t id
+) {
+    writer w{out};
+    w.header(type::offline_erase, username, client_id)
+        .u64(id);
+}
+
+/**
+ * @brief inflight_set record
+ * @param messages range of std::pair<packet_id, packet bytes>
+ */
+template <typename Range>
+inline void inflight_set(
+    std::string& out,
+    std::string_view username,
+    std::string_view client_id,
+    Range const& messages
+) {
+    writer w{out};
+    w.header(type::inflight_set, username, client_id)
+        .u32(static_cast<std::uint32_t>(std::size(messages)));
+    for (auto const& [pid, packet] : messages) {
+        w.u32(pid).str(packet);
+    }
+}
+
+inline void inflight_erase(
+    std::string& out,
+    std::string_view username,
+    std::string_view client_id,
+    std::uint32_t packet_id
+) {
+    writer w{out};
+    w.header(type::inflight_erase, username, client_id)
+        .u32(packet_id);
+}
+
+/**
+ * @brief apply the record to the images
+ * @return false if the record is malformed
+ */
+inline bool apply(session_images& images, std::string_view record) {
+    reader r{record};
+    auto t = static_cast<type>(r.u8());
+    auto username = r.str();
+    auto client_id = r.str();
+    if (!r.ok()) return false;
+    auto key = session_images_key(username, client_id);
+
+    auto image =
+        [&]() -> session_image& {
+            auto& img = images[key];
+            if (img.client_id.empty()) {
+                img.username = std::string{username};
+                img.client_id = std::string{client_id};
+            }
+            return img;
+        };
+
+    switch (t) {
+    case type::session: {
+        auto version = static_cast<protocol_version>(r.u8());
+        auto has_expiry = r.u8();
+        auto expiry = r.u32();
+        auto offline_at = r.i64();
+        if (!r.ok()) return false;
+        auto& img = image();
+        img.version = version;
+        img.session_expiry_interval =
+            has_expiry ? std::optional<std::uint32_t>{expiry} : std::nullopt;
+        img.offline_at = offline_at;
+    } break;
+    case type::erase:
+        images.erase(key);
+        break;
+    case type::subscribe: {
+        auto share_name = r.str();
+        auto topic_filter = r.str();
+        auto subopts = r.u8();
+        auto has_sid = r.u8();
+        auto sid = r.u32();
+        if (!r.ok()) return false;
+        image().subscriptions.insert_or_assign(
+            std::make_pair(std::string{share_name}, std::string{topic_filter}),
+            session_image::subscription{
+                subopts,
+                has_sid ? std::optional<std::uint32_t>{sid} : std::nullopt
+            }
+        );
+    } break;
+    case type::unsubscribe: {
+        auto share_name = r.str();
+        auto topic_filter = r.str();
+        if (!r.ok()) return false;
+        auto it = images.find(key);
+        if (it != images.end()) {
+            it->second.subscriptions.erase(
+                std::make_pair(std::string{share_name}, std::string{topic_filter})
+            );
+        }
+    } break;
+    case type::offline_push: {
+        auto id = r.u64();
+        auto pushed_at = r.i64();
+        auto packet = r.str();
+        if (!r.ok()) return false;
+        image().offline_messages.insert_or_assign(
+            id,
+            session_image::offline_message{pushed_at, std::string{packet}}
+        );
+    } break;
+    case type::offline_pop: {
+        auto id = r.u64();
+        if (!r.ok()) return false;
+        auto it = images.find(key);
+        if (it != images.end()) {
+            auto& msgs = it->second.offline_messages;
+            msgs.erase(msgs.begin(), msgs.upper_bound(id));
+        }
+    } break;
+    case type::offline_erase: {
+        auto id = r.u64();
+        if (!r.ok()) return false;
+        auto it = images.find(key);
+        if (it != images.end()) {
+            it->second.offline_messages.erase(id);
+        }
+    } break;
+    case type::inflight_set: {
+        auto num = r.u32();
+        std::map<std::uint32_t, std::string> msgs;
+        for (std::uint32_t i = 0; i != num && r.ok(); ++i) {
+            auto pid = r.u32();
+            auto packet = r.str();
+            msgs.emplace(pid, std::string{packet});
+        }
+        if (!r.ok()) return false;
+        image().inflight_messages = force_move(msgs);
+    } break;
+    case type::inflight_erase: {
+        auto pid = r.u32();
+        if (!r.ok()) return false;
+        auto it = images.find(key);
+        if (it != images.end()) {
+            it->second.inflight_messages.erase(pid);
+        }
+    } break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief get session_images_key() of the session that the record belongs to
+ * @return std::nullopt if the record is malformed
+ */
+inline std::optional<std::string> key_of(std::string_view record) {
+    reader r{record};
+    r.u8();
+    auto username = r.str();
+    auto client_id = r.str();
+    if (!r.ok()) return std::nullopt;
+    return session_images_key(username, client_id);
+}
+
+/**
+ * @brief encode the image as records
+ * @param image image
+ * @param out   buffer for a record. It is cleared before each record.
+ * @param f     called with each record
+ */
+template <typename Func>
+inline void encode_image(session_image const& image, std::string& out, Func&& f) {
+    out.clear();
+    session(out, image.username, image.client_id, image.version, image.session_expiry_interval, image.offline_at);
+    f(std::string_view{out});
+    for (auto const& [key, sub] : image.subscriptions) {
+        out.clear();
+        writer w{out};
+        w.header(type::subscribe, image.username, image.client_id)
+            .str(key.first)
+            .str(key.second)
+            .u8(sub.subopts)
+            .u8(sub.sid ? 1 : 0)
+            .u32(sub.sid.value_or(0));
+        f(std::string_view{out});
+    }
+    for (auto const& [id, msg] : image.offline_messages) {
+        out.clear();
+        offline_push(out, image.username, image.client_id, id, msg.pushed_at, msg.packet);
+        f(std::string_view{out});
+    }
+    if (!image.inflight_messages.empty()) {
+        out.clear();
+        inflight_set(out, image.username, image.client_id, image.inflight_messages);
+        f(std::string_view{out});
+    }
+}
+
+} // namespace session_record
+
+/**
+ * @brief persistence backend of the broker's sessions
+ *
+ * The broker appends session_record to the store when a persistent session is
+ * updated, and loads the images when the store is set. append() is called
+ * from any threads, so the implementation must be thread safe. It should not
+ * block on I/O, durability can be deferred (group commit).
+ */
+class session_store {
+public:
+    virtual ~session_store() = default;
+
+    /**
+     * @brief append the record
+     * @param record encoded by the functions in session_record namespace
+     */
+    virtual void append(std::string_view record) = 0;
+
+    /**
+     * @brief call the handler after the records that have been appended are durable
+     * It is used to acknowledge a message after the message is stored.
+     * The handler is called on an unspecified thread. The default implementation
+     * calls it immediately.
+     * @param handler handler
+     */
+    virtual void when_committed(std::function<void()> handler) {
+        handler();
+    }
+
+    /**
+     * @brief load the images of the persistent sessions
+     * @param images output
+     */
+    virtual void load(session_images& images) = 0;
+};
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_BROKER_SESSION_STORE_HPP
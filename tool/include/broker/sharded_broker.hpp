@@ -0,0 +1,480 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_BROKER_SHARDED_BROKER_HPP)
+#define ASYNC_MQTT_BROKER_SHARDED_BROKER_HPP
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <string_view>
+
+#include <broker/broker.hpp>
+
+namespace async_mqtt {
+
+/**
+ * @brief broker that partitions sessions, subscriptions and retained messages
+ *        into shards.
+ *
+ * Each shard is a broker that has its own sessions, subscription map and security.
+ * The retained messages are shared by the shards. They are partitioned by the topic,
+ * one partition per shard, so the shards publishing different topics don't contend.
+ * A session belongs to the shard that is decided by the hash of the client id,
+ * so the session takeover is always handled in the same shard. All packets of the session are handled on the executor of the shard.
+ * If each executor is a strand of a different io_context, the shards don't
+ * contend each other's locks.
+ *
+ * Cross-shard delivery is done by message passing:
+ *   - A PUBLISH is delivered to the subscribers of the source shard directly,
+ *     and posted to the other shards that have matching subscriptions. Each shard
+ *     delivers it to its own subscribers. The source shard updates the retained
+ *     messages.
+ *     The subscription maps are always on the snapshot mode, and the source shard
+ *     matches the topic against the snapshots of the other shards without locking.
+ *   - Shared subscriptions are stored in the group. The source shard chooses the
+ *     target and posts the message to the shard that owns the target session.
+ *     If the target session belongs to the source shard, it is delivered directly.
+ *
+ * Limitation: On MQTT v5, the reason code no_matching_subscribers of PUBACK and
+ * PUBREC doesn't take the authorization of the subscribers of the other shards
+ * into account. It is decided only by their topic filters.
+ */
+template <typename Epsp>
+class sharded_broker {
+    using epsp_type = epsp_wrap<Epsp>;
+    using broker_type = broker<Epsp>;
+
+public:
+    /**
+     * @brief constructor
+     * @param timer_ioc  io_context for timers
+     * @param shard_exes executors of the shards. The number of shards is shard_exes.size().
+     * @param recycling_allocator use recycling_allocator for receiving packets
+     */
+    sharded_broker(
+        as::io_context& timer_ioc,
+        std::vector<as::any_io_executor> const& shard_exes,
+        bool recycling_allocator = false
+    ):retains_{shard_exes.size()},
+      recycling_allocator_{recycling_allocator} {
+        BOOST_ASSERT(!shard_exes.empty());
+        // The shards read each other's subscriptions without locking.
+        shared_subs_map_.enable_snapshot(mtx_shared_subs_map_);
+        shards_.reserve(shard_exes.size());
+        for (std::size_t i = 0; i != shard_exes.size(); ++i) {
+            shards_.emplace_back(
+                new broker_type{
+                    timer_ioc,
+                    *this,
+                    i,
+                    shard_exes[i],
+                    mtx_shared_subs_map_,
+                    shared_subs_map_,
+                    shared_targets_,
+                    retains_,
+                    recycling_allocator
+                }
+            );
+            shards_.back()->enable_subscription_snapshot();
+        }
+        shared_targets_.set_shard_of(
+            [this](std::string_view client_id) {
+                return shard_index(client_id);
+            }
+        );
+    }
+
+    /**
+     * @brief read CONNECT packet and pass the endpoint to the owner shard
+     *
+     * If the endpoint runs on the executor of the owner shard, the packets are handled
+     * without hopping the executor. Create the endpoint on shard_executor() of
+     * shard_index() of the client id to do that. See async_peek_client_id().
+     * @param epsp                endpoint
+     * @param preauthed_user_name user name that is authenticated by the underlying layer
+     * @param home                index of the shard whose executor the endpoint runs on.
+     *                            If the client id is empty, the assigned client id is
+     *                            chosen from the ones that belong to the shard.
+     */
+    void handle_accept(
+        epsp_type epsp,
+        std::optional<std::string> preauthed_user_name = {},
+        std::optional<std::size_t> home = {}
+    ) {
+        BOOST_ASSERT(!home || *home < shards_.size());
+        epsp.set_preauthed_user_name(force_move(preauthed_user_name));
+        auto recv_proc =
+            [this, epsp, home]
+            (error_code const& ec, packet_variant pv) mutable {
+                if (ec) {
+                    ASYNC_MQTT_LOG("mqtt_broker", info)
+                        << ASYNC_MQTT_ADD_VALUE(address, epsp.get_address())
+                        << ec.message();
+                    async_close(force_move(epsp));
+                    return;
+                }
+                std::optional<std::string> client_id;
+                pv.visit(
+                    overload {
+                        [&](v3_1_1::connect_packet const& p) {
+                            client_id.emplace(p.client_id());
+                        },
+                        [&](v5::connect_packet const& p) {
+                            client_id.emplace(p.client_id());
+                        },
+                        [&](auto const&) {}
+                    }
+                );
+                if (!client_id) {
+                    ASYNC_MQTT_LOG("mqtt_broker", info)
+                        << ASYNC_MQTT_ADD_VALUE(address, epsp.get_address())
+                        << "the first packet is not CONNECT";
+                    async_close(force_move(epsp));
+                    return;
+                }
+                if (client_id->empty()) {
+                    // Assign the client id here to decide the shard.
+                    // The shard uses it as the assigned client id.
+                    client_id.emplace(create_uuid_string());
+                    if (home) {
+                        // The expected number of tries is the number of shards.
+                        for (std::size_t i = 0; i != shards_.size() * 8; ++i) {
+                            if (shard_index(*client_id) == *home) break;
+                            client_id.emplace(create_uuid_string());
+                        }
+                    }
+                    epsp.set_client_id(*client_id);
+                }
+                auto index = shard_index(*client_id);
+                auto& shard = *shards_[index];
+                if (home && *home == index) {
+                    // already on the executor of the shard
+                    shard.handle_connect(force_move(epsp), force_move(pv));
+                    return;
+                }
+                as::post(
+                    *shard.shard_exe_,
+                    [&shard, epsp = force_move(epsp), pv = force_move(pv)] () mutable {
+                        shard.handle_connect(force_move(epsp), force_move(pv));
+                    }
+                );
+            };
+        if (recycling_allocator_) {
+            epsp.async_recv(
+                as::bind_allocator(
+                    as::recycling_allocator<char>(),
+                    force_move(recv_proc)
+                )
+            );
+        }
+        else {
+            epsp.async_recv(force_move(recv_proc));
+        }
+    }
+
+    /**
+     * @brief get the executor of the shard
+     * @param index index of the shard
+     * @return executor
+     */
+    as::any_io_executor const& shard_executor(std::size_t index) const {
+        BOOST_ASSERT(index < shards_.size());
+        return *shards_[index]->shard_exe_;
+    }
+
+    /**
+     * @brief configure the security settings of all shards
+     */
+    void set_security(security&& sec) {
+        for (std::size_t i = 1; i < shards_.size(); ++i) {
+            shards_[i]->set_security(security(sec));
+        }
+        shards_.front()->set_security(force_move(sec));
+    }
+
+    /**
+     * @brief enable the snapshot mode of the subscription map of all shards
+     *
+     * The subscription maps of the shards and the shared subscriptions of the
+     * group are always on the snapshot mode because the shards read each other's
+     * maps. It is kept for the compatibility with broker.
+     */
+    void enable_subscription_snapshot() {
+    }
+
+    /**
+     * @brief set the persistence backend of the sessions of each shard
+     *
+     * Each shard has its own store because a session always belongs to the same shard.
+     * It must be called before accepting connections.
+     * @param store_of_shard called with the shard index, returns the store of the shard
+     */
+    void set_session_store(std::function<std::shared_ptr<session_store>(std::size_t)> const& store_of_shard) {
+        for (std::size_t i = 0; i != shards_.size(); ++i) {
+            shards_[i]->set_session_store(store_of_shard(i));
+        }
+    }
+
+    /**
+     * @brief set the quota of the offline messages
+     *
+     * The global limits are divided equally among the shards, so the shards never
+     * share the counters.
+     * It must be called before accepting connections.
+     * @param session limits of each session
+     * @param global  limits of the total of all sessions
+     * @param policy  overflow policy
+     */
+    void set_offline_quota(
+        offline_limits session,
+        offline_limits global,
+        offline_overflow_policy policy
+    ) {
+        auto divide =
+            [&](std::size_t v) -> std::size_t {
+                if (v == 0) return 0;
+                return std::max<std::size_t>(v / shards_.size(), 1);
+            };
+        offline_limits shard_global{divide(global.max_messages), divide(global.max_bytes)};
+        for (auto& shard : shards_) {
+            shard->set_offline_quota(session, shard_global, policy);
+        }
+    }
+
+    /**
+     * @brief set how the shared subscription group chooses the member
+     *
+     * shared_strategy::local_shard_first prefers the member of the source shard,
+     * so the message isn't posted to the other shard.
+     * It must be called before accepting connections.
+     * @param strategy     the strategy to choose the member
+     * @param max_inflight the member that has this number of unacknowledged QoS1/QoS2
+     *                     messages is skipped. 0 means no limit.
+     */
+    void set_shared_subscription(shared_strategy strategy, std::size_t max_inflight = 0) {
+        shared_targets_.set_strategy(strategy, max_inflight);
+    }
+
+    /**
+     * @brief get the largest offline queues of all shards
+     * @param num the maximum number of the queues
+     * @return queues in descending order of bytes
+     */
+    std::vector<offline_queue_info> largest_offline_queues(std::size_t num) const {
+        std::vector<offline_queue_info> queues;
+        for (auto const& shard : shards_) {
+            auto q = shard->largest_offline_queues(num);
+            queues.insert(
+                queues.end(),
+                std::make_move_iterator(q.begin()),
+                std::make_move_iterator(q.end())
+            );
+        }
+        keep_largest_offline_queues(queues, num);
+        return queues;
+    }
+
+    /**
+     * @brief set the snapshot of the retained messages
+     *
+     * The retained messages are shared by the shards, so it is set once.
+     * It must be called before accepting connections.
+     * @param snapshot snapshot that is opened by retained_snapshot::open()
+     * @param delta    delta of the snapshot that is opened by retained_snapshot::open()
+     */
+    void set_retained_snapshot(
+        std::shared_ptr<retained_snapshot const> snapshot,
+        std::shared_ptr<retained_snapshot const> delta = nullptr
+    ) {
+        shards_.front()->set_retained_snapshot(force_move(snapshot), force_move(delta));
+    }
+
+    /**
+     * @brief write the snapshot of the retained messages
+     *
+     * See broker::save_retained_snapshot().
+     * @param path file path of the full snapshot
+     * @return true if succeeded or not modified
+     */
+    bool save_retained_snapshot(std::string const& path) {
+        return shards_.front()->save_retained_snapshot(path);
+    }
+
+    /**
+     * @brief set the metrics of all shards
+     *
+     * The shards share the metrics. Each thread records to its own slot, so the
+     * shards don't contend.
+     * It must be called before accepting connections.
+     * @param metrics metrics. nullptr disables recording.
+     */
+    void set_metrics(std::shared_ptr<broker_metrics> const& metrics) {
+        for (auto& shard : shards_) {
+            shard->set_metrics(metrics);
+        }
+    }
+
+    /**
+     * @brief aggregate the metrics and sample the gauges of all shards
+     * It can be called from any threads.
+     */
+    broker_metrics::snapshot collect_metrics() const {
+        auto s = shards_.front()->collect_metrics();
+        for (std::size_t i = 1; i < shards_.size(); ++i) {
+            shards_[i]->sample_gauges(s);
+        }
+        return s;
+    }
+
+    /**
+     * @brief publish the message from the broker itself to all shards
+     *
+     * It is posted to the executor of each shard.
+     * @param topic   topic
+     * @param payload payload
+     * @param opts    publish options
+     */
+    void publish_system(buffer topic, buffer payload, pub::opts opts) {
+        for (auto& shard : shards_) {
+            as::post(
+                *shard->shard_exe_,
+                [&shard = *shard, topic, payload, opts] () mutable {
+                    shard.publish_system(force_move(topic), force_move(payload), opts);
+                }
+            );
+        }
+    }
+
+    /**
+     * @brief get the number of shards
+     */
+    std::size_t size() const {
+        return shards_.size();
+    }
+
+    /**
+     * @brief get the index of the shard that owns the client id
+     */
+    std::size_t shard_index(std::string_view client_id) const {
+        return std::hash<std::string_view>{}(client_id) % shards_.size();
+    }
+
+private:
+    friend class broker<Epsp>;
+
+    static void async_close(epsp_type epsp) {
+        auto exe = epsp.get_executor();
+        epsp.async_close(
+            as::bind_executor(
+                exe,
+                [epsp] {
+                    ASYNC_MQTT_LOG("mqtt_broker", info)
+                        << ASYNC_MQTT_ADD_VALUE(address, epsp.get_address())
+                        << "closed";
+                }
+            )
+        );
+    }
+
+    // Post the message to the other shards that have matching topic filters.
+    // The published snapshot of the subscription map of each shard is its interest
+    // summary, and it is read without the lock. The subscriptions that are not
+    // published yet have not been acknowledged by SUBACK.
+    // The message is built once and shared by the posts.
+    // Returns true if any other shard has a matching topic filter.
+    bool publish_to_peers(
+        std::size_t source_index,
+        std::string const& source_client_id,
+        protocol_version source_version,
+        buffer const& topic,
+        std::vector<buffer> const& payload,
+        pub::opts opts,
+        property_block const& props,
+        std::shared_ptr<void> const& commit_gate
+    ) {
+        topic_levels levels{topic};
+        std::shared_ptr<typename broker_type::peer_publish const> msg;
+        for (std::size_t i = 0; i != shards_.size(); ++i) {
+            if (i == source_index) continue;
+            auto& shard = *shards_[i];
+            if (!shard.subs_map_.any_match(levels)) continue;
+            if (!msg) {
+                msg = std::make_shared<typename broker_type::peer_publish const>(
+                    typename broker_type::peer_publish{
+                        source_client_id,
+                        source_version,
+                        topic,
+                        payload,
+                        opts,
+                        props,
+                        commit_gate
+                    }
+                );
+            }
+            as::post(
+                *shard.shard_exe_,
+                [&shard, msg] {
+                    shard.publish_from_peer(*msg);
+                }
+            );
+        }
+        return bool(msg);
+    }
+
+    void deliver_to_owner(
+        std::string const& username,
+        std::string const& client_id,
+        buffer topic,
+        std::vector<buffer> payload,
+        pub::opts opts,
+        properties props,
+        std::shared_ptr<void> commit_gate
+    ) {
+        auto& shard = *shards_[shard_index(client_id)];
+        as::post(
+            *shard.shard_exe_,
+            [
+                &shard,
+                username = std::string{username},
+                client_id = std::string{client_id},
+                topic = force_move(topic),
+                payload = force_move(payload),
+                opts,
+                props = force_move(props),
+                commit_gate = force_move(commit_gate)
+            ] () mutable {
+                shard.deliver_from_peer(
+                    username,
+                    client_id,
+                    force_move(topic),
+                    force_move(payload),
+                    opts,
+                    force_move(props),
+                    force_move(commit_gate)
+                );
+            }
+        );
+    }
+
+    // Shared subscriptions of all shards.
+    // They are declared before shards_ because sessions refer them.
+    mutable mutex mtx_shared_subs_map_;
+    sub_con_map<epsp_type> shared_subs_map_;
+    shared_target<epsp_type> shared_targets_;
+
+    // Retained messages of all shards.
+    retained_messages retains_;
+
+    std::vector<std::unique_ptr<broker_type>> shards_;
+    bool recycling_allocator_;
+};
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_BROKER_SHARDED_BROKER_HPP
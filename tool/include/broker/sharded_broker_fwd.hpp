@@ -0,0 +1,17 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_BROKER_SHARDED_BROKER_FWD_HPP)
+#define ASYNC_MQTT_BROKER_SHARDED_BROKER_FWD_HPP
+
+namespace async_mqtt {
+
+template <typename Epsp>
+class sharded_broker;
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_BROKER_SHARDED_BROKER_FWD_HPP
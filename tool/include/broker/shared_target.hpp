@@ -7,60 +7,150 @@
 #if !defined(ASYNC_MQTT_BROKER_SHARED_TARGET_HPP)
 #define ASYNC_MQTT_BROKER_SHARED_TARGET_HPP
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <map>
+#include <memory>
 #include <optional>
-#include <chrono>
-
-#include <boost/multi_index_container.hpp>
-#include <boost/multi_index/ordered_index.hpp>
-#include <boost/multi_index/key.hpp>
-
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
 
 #include <broker/session_state_fwd.hpp>
-#include <broker/tags.hpp>
 #include <broker/mutex.hpp>
 #include <broker/subscription.hpp>
 
 namespace async_mqtt {
 
-namespace mi = boost::multi_index;
+/**
+ * @brief how a shared subscription group chooses the member for each message
+ */
+enum class shared_strategy {
+    round_robin,       ///< each member in turn
+    least_inflight,    ///< the member that has the fewest unacknowledged QoS1/QoS2 messages
+    sticky,            ///< the member chosen by the hash of the topic name
+    local_shard_first, ///< each member of the publisher's shard in turn, and then the others
+};
+
+/**
+ * @brief get the shared_strategy from the name
+ * @param name round_robin, least_inflight, sticky, or local_shard_first
+ * @return the strategy. std::nullopt if the name is unknown.
+ */
+inline std::optional<shared_strategy> shared_strategy_from_string(std::string_view name) {
+    if (name == "round_robin") return shared_strategy::round_robin;
+    if (name == "least_inflight") return shared_strategy::least_inflight;
+    if (name == "sticky") return shared_strategy::sticky;
+    if (name == "local_shard_first") return shared_strategy::local_shard_first;
+    return std::nullopt;
+}
+
+/**
+ * @brief the members of one shared subscription (share_name and topic_filter)
+ *
+ * The subscriptions of the members in the subscription map refer to the group,
+ * so a PUBLISH reaches the group without looking up share_name and topic_filter.
+ * select() reads an immutable member list in the rcu_domain's read-side critical
+ * section, and advances the round robin position by an atomic counter. It never
+ * takes a lock. The member list is replaced by shared_target under its lock.
+ *
+ * A member is skipped if the session is offline or backlogged. Backlogged means
+ * that the session has offline messages (it can't send now), or it has max_inflight
+ * or more unacknowledged QoS1/QoS2 messages. If all members are skipped, the least
+ * backlogged one is chosen, and then the message is queued as its offline message.
+ */
+template <typename Sp>
+class shared_group {
+public:
+    struct member {
+        subscription<Sp> sub; // sub.group is empty
+        std::size_t shard;    // index of the shard that owns the session
+    };
+
+    shared_group(
+        shared_strategy strategy,
+        std::size_t max_inflight
+    );
+    ~shared_group();
+    shared_group(shared_group const&) = delete;
+    shared_group& operator=(shared_group const&) = delete;
+
+    /**
+     * @brief choose the member that the message is delivered to
+     * It must be called in the rcu_domain's read-side critical section, and the
+     * returned member is valid until the caller leaves it.
+     * @param topic       topic name of the message. It is used by shared_strategy::sticky.
+     * @param local_shard index of the shard that delivers the message
+     * @return the member. nullptr if the group has no member.
+     */
+    member const* select(std::string_view topic, std::size_t local_shard) const;
+
+    std::size_t size() const;
+
+private:
+    template <typename> friend class shared_target;
+    using members_type = std::vector<member>;
+
+    // They are called under shared_target's lock.
+    members_type const& members() const;
+    void update(members_type members, std::optional<std::size_t> erased_index);
+
+    bool available(member const& m) const;
+
+    shared_strategy strategy_;
+    std::size_t max_inflight_;
+    std::atomic<members_type const*> members_;
+    mutable std::atomic<std::size_t> next_{0}; // round robin position
+};
 
 template <typename Sp>
 class shared_target {
 public:
-    void insert(std::string share_name, std::string topic_filter, subscription<Sp> sub, session_state<Sp>& ss);
+    /**
+     * @brief set the strategy of all groups
+     * It must be called before any subscription is inserted.
+     * @param strategy     the strategy to choose the member
+     * @param max_inflight the member that has this number of unacknowledged QoS1/QoS2
+     *                     messages is skipped. 0 means no limit.
+     */
+    void set_strategy(shared_strategy strategy, std::size_t max_inflight);
+
+    /**
+     * @brief set the function that gets the index of the shard that owns the client id
+     * It is set by sharded_broker. The default function returns 0.
+     */
+    void set_shard_of(std::function<std::size_t(std::string_view)> shard_of);
+
+    /**
+     * @brief add the session to the group
+     * If the session is already a member, its subscription is updated.
+     * @return the group. It should be set to subscription::group in the subscription map.
+     */
+    std::shared_ptr<shared_group<Sp>> insert(
+        std::string share_name,
+        std::string topic_filter,
+        subscription<Sp> sub,
+        session_state<Sp>& ss
+    );
     void erase(std::string share_name, std::string topic_filter, session_state<Sp> const& ss);
     void erase(session_state<Sp> const& ss);
-    std::optional<std::tuple<session_state_ref<Sp>, subscription<Sp>>>
-    get_target(std::string const& share_name, std::string const& topic_filter);
 
 private:
-    struct entry {
-        entry(std::string share_name, session_state<Sp>& ss, std::chrono::time_point<std::chrono::steady_clock> tp);
-
-        std::string const& client_id() const;
-        std::string share_name;
-        session_state_ref<Sp> ssr;
-        std::chrono::time_point<std::chrono::steady_clock> tp;
-        std::map<std::string, subscription<Sp>> tf_subs;
-    };
+    using key_type = std::tuple<std::string, std::string>; // share_name, topic_filter
+    using groups_type = std::map<key_type, std::shared_ptr<shared_group<Sp>>, std::less<>>;
+
+    // called under mtx_targets_
+    void erase_member(typename groups_type::iterator it, session_state<Sp> const& ss);
 
-    using mi_shared_target = mi::multi_index_container<
-        entry,
-        mi::indexed_by<
-            mi::ordered_unique<
-                mi::tag<tag_cid_sn>,
-                mi::key<&entry::client_id, &entry::share_name>
-            >,
-            mi::ordered_non_unique<
-                mi::tag<tag_sn_tp>,
-                mi::key<&entry::share_name, &entry::tp>
-            >
-        >
-    >;
-
-    mutable mutex mtx_targets_;
-    mi_shared_target targets_;
+    mutex mtx_targets_;
+    shared_strategy strategy_ = shared_strategy::round_robin;
+    std::size_t max_inflight_ = 0;
+    std::function<std::size_t(std::string_view)> shard_of_ = [](std::string_view) { return std::size_t(0); };
+    groups_type groups_;
+    // to erase the all groups of the session
+    std::multimap<session_state<Sp> const*, key_type> keys_of_session_;
 };
 
 } // namespace async_mqtt
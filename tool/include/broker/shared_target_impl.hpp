@@ -7,41 +7,194 @@
 #if !defined(ASYNC_MQTT_BROKER_SHARED_TARGET_IMPL_HPP)
 #define ASYNC_MQTT_BROKER_SHARED_TARGET_IMPL_HPP
 
-#include <optional>
+#include <algorithm>
+#include <limits>
+#include <utility>
 
 #include <broker/shared_target.hpp>
 #include <broker/session_state.hpp>
+#include <broker/rcu.hpp>
 
 namespace async_mqtt {
 
 template <typename Sp>
-inline void shared_target<Sp>::insert(
+inline shared_group<Sp>::shared_group(
+    shared_strategy strategy,
+    std::size_t max_inflight
+)
+    :strategy_{strategy},
+     max_inflight_{max_inflight},
+     members_{new members_type}
+{}
+
+template <typename Sp>
+inline shared_group<Sp>::~shared_group() {
+    // No reader can exist here. The readers refer to the group via the subscriptions.
+    delete members_.load(std::memory_order_relaxed);
+}
+
+template <typename Sp>
+inline std::size_t shared_group<Sp>::size() const {
+    rcu_read_guard g;
+    return members_.load(std::memory_order_seq_cst)->size();
+}
+
+template <typename Sp>
+inline bool shared_group<Sp>::available(member const& m) const {
+    auto const& ss = m.sub.ss.get();
+    return
+        ss.online() &&
+        ss.offline_size() == 0 &&
+        (max_inflight_ == 0 || ss.unacked_publishes() < max_inflight_);
+}
+
+template <typename Sp>
+inline typename shared_group<Sp>::member const* shared_group<Sp>::select(
+    std::string_view topic,
+    std::size_t local_shard
+) const {
+    auto const& ms = *members_.load(std::memory_order_seq_cst);
+    auto n = ms.size();
+    if (n == 0) return nullptr;
+    if (n == 1) return &ms.front();
+
+    auto start =
+        [&] {
+            if (strategy_ == shared_strategy::sticky) {
+                return std::hash<std::string_view>{}(topic) % n;
+            }
+            return next_.fetch_add(1, std::memory_order_relaxed) % n;
+        } ();
+
+    switch (strategy_) {
+    case shared_strategy::round_robin:
+    case shared_strategy::sticky:
+        for (std::size_t i = 0; i != n; ++i) {
+            auto const& m = ms[(start + i) % n];
+            if (available(m)) return &m;
+        }
+        break;
+    case shared_strategy::least_inflight: {
+        member const* ret = nullptr;
+        auto least = std::numeric_limits<std::size_t>::max();
+        for (std::size_t i = 0; i != n; ++i) {
+            auto const& m = ms[(start + i) % n];
+            if (!available(m)) continue;
+            auto unacked = m.sub.ss.get().unacked_publishes();
+            if (unacked < least) {
+                ret = &m;
+                least = unacked;
+                if (least == 0) break;
+            }
+        }
+        if (ret) return ret;
+    } break;
+    case shared_strategy::local_shard_first: {
+        member const* other = nullptr;
+        for (std::size_t i = 0; i != n; ++i) {
+            auto const& m = ms[(start + i) % n];
+            if (!available(m)) continue;
+            if (m.shard == local_shard) return &m;
+            if (!other) other = &m;
+        }
+        if (other) return other;
+    } break;
+    }
+
+    // All members are offline or backlogged. The message is queued to the member
+    // that has the fewest offline messages, and then the fewest unacknowledged ones.
+    member const* ret = nullptr;
+    auto least = std::make_pair(
+        std::numeric_limits<std::size_t>::max(),
+        std::numeric_limits<std::size_t>::max()
+    );
+    for (std::size_t i = 0; i != n; ++i) {
+        auto const& m = ms[(start + i) % n];
+        auto const& ss = m.sub.ss.get();
+        auto backlog = std::make_pair(ss.offline_size(), ss.unacked_publishes());
+        if (backlog < least) {
+            ret = &m;
+            least = backlog;
+        }
+    }
+    return ret;
+}
+
+template <typename Sp>
+inline typename shared_group<Sp>::members_type const& shared_group<Sp>::members() const {
+    return *members_.load(std::memory_order_relaxed);
+}
+
+template <typename Sp>
+inline void shared_group<Sp>::update(
+    members_type members,
+    std::optional<std::size_t> erased_index
+) {
+    if (erased_index) {
+        // Keep the order of the rest members. The member that follows the erased one
+        // is the next target.
+        auto prev_size = this->members().size();
+        auto pos = next_.load(std::memory_order_relaxed) % prev_size;
+        if (*erased_index < pos) --pos;
+        next_.store(members.empty() ? 0 : pos % members.size(), std::memory_order_relaxed);
+    }
+    auto prev = members_.exchange(new members_type(force_move(members)), std::memory_order_seq_cst);
+    // The readers in select() could refer to the previous list.
+    rcu_domain::instance().retire([prev] { delete prev; });
+}
+
+template <typename Sp>
+inline void shared_target<Sp>::set_strategy(
+    shared_strategy strategy,
+    std::size_t max_inflight
+) {
+    std::lock_guard<mutex> g{mtx_targets_};
+    strategy_ = strategy;
+    max_inflight_ = max_inflight;
+}
+
+template <typename Sp>
+inline void shared_target<Sp>::set_shard_of(
+    std::function<std::size_t(std::string_view)> shard_of
+) {
+    std::lock_guard<mutex> g{mtx_targets_};
+    shard_of_ = force_move(shard_of);
+}
+
+template <typename Sp>
+inline std::shared_ptr<shared_group<Sp>> shared_target<Sp>::insert(
     std::string share_name,
     std::string topic_filter,
     subscription<Sp> sub,
     session_state<Sp>& ss
 ) {
     std::lock_guard<mutex> g{mtx_targets_};
-    auto& idx = targets_.template get<tag_cid_sn>();
-    auto it = idx.lower_bound(std::make_tuple(ss.client_id(), share_name));
-    if (it == idx.end() || (it->share_name != share_name || it->client_id() != ss.client_id())) {
-        it = idx.emplace_hint(it, force_move(share_name), ss, std::chrono::steady_clock::now());
-
-        // const_cast is appropriate here
-        // See https://github.com/boostorg/multi_index/issues/50
-        auto& st = const_cast<entry&>(*it);
-        bool inserted;
-        std::tie(std::ignore, inserted) = st.tf_subs.emplace(force_move(topic_filter), force_move(sub));
-        BOOST_ASSERT(inserted);
+    auto key = std::make_tuple(force_move(share_name), force_move(topic_filter));
+    auto it = groups_.find(key);
+    if (it == groups_.end()) {
+        it = groups_.emplace(
+            key,
+            std::make_shared<shared_group<Sp>>(strategy_, max_inflight_)
+        ).first;
+    }
+    auto& group = *it->second;
+    auto members = group.members();
+    auto mit = std::find_if(
+        members.begin(),
+        members.end(),
+        [&](auto const& m) { return &m.sub.ss.get() == &ss; }
+    );
+    sub.group.reset();
+    if (mit == members.end()) {
+        members.push_back(typename shared_group<Sp>::member{force_move(sub), shard_of_(ss.client_id())});
+        keys_of_session_.emplace(&ss, force_move(key));
     }
     else {
-        // entry exists
-
-        // const_cast is appropriate here
-        // See https://github.com/boostorg/multi_index/issues/50
-        auto& st = const_cast<entry&>(*it);
-        st.tf_subs.emplace(force_move(topic_filter), force_move(sub)); // ignore overwrite
+        // overwrite subscription options
+        mit->sub = force_move(sub);
     }
+    group.update(force_move(members), std::nullopt);
+    return it->second;
 }
 
 template <typename Sp>
@@ -51,26 +204,21 @@ inline void shared_target<Sp>::erase(
     session_state<Sp> const& ss
 ) {
     std::lock_guard<mutex> g{mtx_targets_};
-    auto& idx = targets_.template get<tag_cid_sn>();
-    auto it = idx.find(std::make_tuple(ss.client_id(), share_name));
-    if (it == idx.end()) {
+    auto key = std::make_tuple(force_move(share_name), force_move(topic_filter));
+    auto r = keys_of_session_.equal_range(&ss);
+    auto kit = std::find_if(r.first, r.second, [&](auto const& e) { return e.second == key; });
+    if (kit == r.second) {
         ASYNC_MQTT_LOG("mqtt_broker", warning)
             << "attempt to erase non exist entry"
-            << " share_name:" << share_name
-            << " topic_filtere:" << topic_filter
+            << " share_name:" << std::get<0>(key)
+            << " topic_filtere:" << std::get<1>(key)
             << " client_id:" << ss.client_id();
         return;
     }
-
-    // entry exists
-
-    // const_cast is appropriate here
-    // See https://github.com/boostorg/multi_index/issues/50
-    auto& st = const_cast<entry&>(*it);
-    st.tf_subs.erase(topic_filter);
-    if (it->tf_subs.empty()) {
-        idx.erase(it);
-    }
+    keys_of_session_.erase(kit);
+    auto it = groups_.find(key);
+    BOOST_ASSERT(it != groups_.end());
+    erase_member(it, ss);
 }
 
 template <typename Sp>
@@ -78,48 +226,34 @@ inline void shared_target<Sp>::erase(
     session_state<Sp> const& ss
 ) {
     std::lock_guard<mutex> g{mtx_targets_};
-    auto& idx = targets_.template get<tag_cid_sn>();
-    auto r = idx.equal_range(ss.client_id());
-    idx.erase(r.first, r.second);
-}
-
-template <typename Sp>
-inline std::optional<std::tuple<session_state_ref<Sp>, subscription<Sp>>> shared_target<Sp>::get_target(
-    std::string const& share_name,
-    std::string const& topic_filter
-) {
-    std::lock_guard<mutex> g{mtx_targets_};
-    // get share_name matched range ordered by timestamp (ascending)
-    auto& idx = targets_.template get<tag_sn_tp>();
-    auto r = idx.equal_range(share_name);
-    for (; r.first != r.second; ++r.first) {
-        auto const& elem = *r.first;
-        auto it = elem.tf_subs.find(topic_filter);
-
-        // no share_name/topic_filter matched
-        if (it == elem.tf_subs.end()) continue;
-
-        // matched
-        // update timestamp (timestamp is key)
-        idx.modify(r.first, [](auto& e) { e.tp = std::chrono::steady_clock::now(); });
-        return std::make_tuple(elem.ssr, it->second);
+    auto r = keys_of_session_.equal_range(&ss);
+    for (auto kit = r.first; kit != r.second; ++kit) {
+        auto it = groups_.find(kit->second);
+        BOOST_ASSERT(it != groups_.end());
+        erase_member(it, ss);
     }
-    return std::nullopt;
+    keys_of_session_.erase(r.first, r.second);
 }
 
 template <typename Sp>
-inline shared_target<Sp>::entry::entry(
-    std::string share_name,
-    session_state<Sp>& ss,
-    std::chrono::time_point<std::chrono::steady_clock> tp)
-    : share_name { force_move(share_name) },
-      ssr { ss },
-      tp { force_move(tp) }
-{}
-
-template <typename Sp>
-inline std::string const& shared_target<Sp>::entry::client_id() const {
-    return ssr.get().client_id();
+inline void shared_target<Sp>::erase_member(
+    typename groups_type::iterator it,
+    session_state<Sp> const& ss
+) {
+    auto& group = *it->second;
+    auto members = group.members();
+    auto mit = std::find_if(
+        members.begin(),
+        members.end(),
+        [&](auto const& m) { return &m.sub.ss.get() == &ss; }
+    );
+    BOOST_ASSERT(mit != members.end());
+    auto index = std::size_t(mit - members.begin());
+    members.erase(mit);
+    group.update(force_move(members), index);
+    // The subscriptions in the subscription map still refer to the empty group
+    // until they are erased. The group is destroyed after that.
+    if (group.members().empty()) groups_.erase(it);
 }
 
 } // namespace async_mqtt
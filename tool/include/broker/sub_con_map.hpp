@@ -7,13 +7,21 @@
 #if !defined(ASYNC_MQTT_BROKER_SUB_CON_MAP_HPP)
 #define ASYNC_MQTT_BROKER_SUB_CON_MAP_HPP
 
-#include <broker/subscription_map.hpp>
+#include <broker/default_subscription_map.hpp>
+#include <broker/rcu_subscription_map.hpp>
 #include <broker/subscription.hpp>
 
 namespace async_mqtt {
 
-template <typename Sp>
-using sub_con_map = multiple_subscription_map<std::string, subscription<Sp>>;
+/**
+ * @tparam Sp  endpoint type
+ * @tparam Map multiple_subscription_map or multiple_subscription_trie
+ */
+template <
+    typename Sp,
+    template <typename...> class Map = default_multiple_subscription_map
+>
+using sub_con_map = rcu_subscription_map<Map<std::string, subscription<Sp>>>;
 
 } // namespace async_mqtt
 
@@ -7,6 +7,7 @@
 #if !defined(ASYNC_MQTT_BROKER_SUBSCRIPTION_HPP)
 #define ASYNC_MQTT_BROKER_SUBSCRIPTION_HPP
 
+#include <memory>
 #include <optional>
 #include <string>
 
@@ -36,6 +37,8 @@ struct subscription {
     std::string topic;
     sub::opts opts;
     std::optional<std::size_t> sid;
+    // the group of the shared subscription. empty if sharename is empty.
+    std::shared_ptr<shared_group<Sp>> group;
 };
 
 template <typename Sp>
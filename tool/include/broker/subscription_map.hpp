@@ -11,6 +11,7 @@
 #include <string_view>
 #include <optional>
 
+#include <boost/container/small_vector.hpp>
 #include <boost/functional/hash.hpp>
 #include <boost/range/adaptor/reversed.hpp>
 
@@ -340,27 +341,38 @@ protected:
         }
     }
 
-    template <typename ThisType, typename Output>
-    static void find_match_impl(ThisType& self, std::string_view topic, Output&& callback) {
+    // Topic is std::string_view or topic_levels
+    template <typename ThisType, typename Topic, typename Output>
+    static void find_match_impl(ThisType& self, Topic const& topic, Output&& callback) {
         using iterator_type = decltype(self.map.end()); // const_iterator or iterator depends on self
 
-        std::vector<iterator_type> entries;
+        boost::container::small_vector<iterator_type, 16> entries;
+        boost::container::small_vector<iterator_type, 16> new_entries;
         entries.push_back(self.get_root());
 
+        // The key is reused for all lookups in order to avoid allocating the level string
+        path_entry_key key;
+        auto find =
+            [&](node_id_type parent, std::string_view t) {
+                key.first = parent;
+                key.second.assign(t.data(), t.size());
+                return self.map.find(key);
+            };
+
         topic_filter_tokenizer(
             topic,
-            [&self, &entries, &callback](std::string_view t) {
-                std::vector<iterator_type> new_entries;
+            [&self, &entries, &new_entries, &find, &callback](std::string_view t) {
+                new_entries.clear();
 
                 for (auto& entry : entries) {
                     auto parent = entry->second.id;
-                    auto i = self.map.find(path_entry_key(parent, t));
+                    auto i = find(parent, t);
                     if (i != self.map.end()) {
                         new_entries.push_back(i);
                     }
 
                     if (entry->second.count .has_plus_child()) {
-                        i = self.map.find(path_entry_key(parent, std::string_view("+")));
+                        i = find(parent, std::string_view("+"));
                         if (i != self.map.end()) {
                             if (parent != self.root_node_id || t.empty() || t[0] != '$') {
                                 new_entries.push_back(i);
@@ -369,7 +381,7 @@ protected:
                     }
 
                     if (entry->second.count.has_hash_child()) {
-                        i = self.map.find(path_entry_key(parent, std::string_view("#")));
+                        i = find(parent, std::string_view("#"));
                         if (i != self.map.end()) {
                             if (parent != self.root_node_id || t.empty() || t[0] != '$'){
                                 callback(i->second.value);
@@ -389,14 +401,14 @@ protected:
     }
 
     // Find all topic filters that match the specified topic
-    template<typename Output>
-    void find_match(std::string_view topic, Output&& callback) const {
+    template<typename Topic, typename Output>
+    void find_match(Topic const& topic, Output&& callback) const {
         find_match_impl(*this, topic, std::forward<Output>(callback));
     }
 
     // Find all topic filters and allow modification
-    template<typename Output>
-    void modify_match(std::string_view topic, Output&& callback) {
+    template<typename Topic, typename Output>
+    void modify_match(Topic const& topic, Output&& callback) {
         find_match_impl(*this, topic, std::forward<Output>(callback));
     }
 
@@ -571,6 +583,17 @@ public:
     // Find all topic filters that match the specified topic
     template<typename Output>
     void find(std::string_view topic, Output&& callback) const {
+        find_impl(topic, std::forward<Output>(callback));
+    }
+
+    template<typename Output>
+    void find(topic_levels const& topic, Output&& callback) const {
+        find_impl(topic, std::forward<Output>(callback));
+    }
+
+private:
+    template<typename Topic, typename Output>
+    void find_impl(Topic const& topic, Output&& callback) const {
         this->find_match(
             topic,
             [&callback](std::optional<Value> const& value) {
@@ -719,14 +742,25 @@ public:
     // Find all topic filters that match the specified topic
     template<typename Output>
     void find(std::string_view topic, Output&& callback) const {
+        find_impl(topic, std::forward<Output>(callback));
+    }
+
+    template<typename Output>
+    void find(topic_levels const& topic, Output&& callback) const {
+        find_impl(topic, std::forward<Output>(callback));
+    }
+
+    // Return true if any topic filter that has a value matches the specified topic
+    template<typename Topic>
+    bool any_match(Topic const& topic) const {
+        bool matched = false;
         this->find_match(
             topic,
-            [&callback]( Cont const &values ) {
-                for (auto const& i : values) {
-                    callback(i.first, i.second);
-                }
+            [&matched]( Cont const &values ) {
+                if (!values.empty()) matched = true;
             }
         );
+        return matched;
     }
 
     // Find all topic filters that match and allow modification
@@ -750,6 +784,19 @@ public:
         }
     }
 
+private:
+    template<typename Topic, typename Output>
+    void find_impl(Topic const& topic, Output&& callback) const {
+        this->find_match(
+            topic,
+            [&callback]( Cont const &values ) {
+                for (auto const& i : values) {
+                    callback(i.first, i.second);
+                }
+            }
+        );
+    }
+
 };
 
 } // namespace async_mqtt
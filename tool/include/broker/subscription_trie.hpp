@@ -0,0 +1,984 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_BROKER_SUBSCRIPTION_TRIE_HPP)
+#define ASYNC_MQTT_BROKER_SUBSCRIPTION_TRIE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <boost/assert.hpp>
+#include <boost/container/small_vector.hpp>
+
+#include <async_mqtt/util/move.hpp>
+
+#include <broker/topic_filter.hpp>
+
+namespace async_mqtt {
+
+/**
+ * Compact alternative of subscription_map.hpp
+ *
+ * subscription_map_base stores each node in one unordered_map keyed by
+ * (parent node id, level string). This trie stores nodes in chunked pools
+ * addressed by 32bit ids, and each level string is stored only once:
+ *
+ *   - level_table interns the topic levels. A level is referred by its 32bit id,
+ *     and the string is stored in a chunked char arena. The level is released
+ *     when no node refers it.
+ *   - Each node has its own child table keyed by the level id. Up to 8 children
+ *     are stored in a sorted array (one cache line), and more children are
+ *     stored in an open addressing hash table.
+ *   - '+' and '#' children are held by the node directly, so matching never
+ *     looks them up.
+ *   - Values are stored in a separate pool. Intermediate nodes have no value.
+ *
+ * The public interface is the same as single_subscription_map and
+ * multiple_subscription_map, except that handle is a node id.
+ */
+namespace subscription_trie_detail {
+
+using id_type = std::uint32_t;
+static constexpr id_type none = std::numeric_limits<id_type>::max();
+
+// Growable array addressed by id. Elements never move, and the storage grows by
+// chunks of 2^ChunkBits elements without copying existing elements.
+template <typename T, std::size_t ChunkBits = 12>
+class chunked_pool {
+    static constexpr std::size_t chunk_size = std::size_t(1) << ChunkBits;
+    static constexpr std::size_t chunk_mask = chunk_size - 1;
+
+public:
+    chunked_pool() = default;
+    chunked_pool(chunked_pool&&) = default;
+    chunked_pool& operator=(chunked_pool&&) = default;
+
+    chunked_pool(chunked_pool const& other)
+        :size_{other.size_},
+         free_{other.free_}
+    {
+        chunks_.reserve(other.chunks_.size());
+        for (auto const& c : other.chunks_) {
+            chunks_.emplace_back(new T[chunk_size]);
+            std::copy(c.get(), c.get() + chunk_size, chunks_.back().get());
+        }
+    }
+    chunked_pool& operator=(chunked_pool const& other) {
+        chunked_pool tmp{other};
+        *this = force_move(tmp);
+        return *this;
+    }
+
+    T& operator[](id_type id) {
+        BOOST_ASSERT(id < size_);
+        return chunks_[id >> ChunkBits][id & chunk_mask];
+    }
+    T const& operator[](id_type id) const {
+        BOOST_ASSERT(id < size_);
+        return chunks_[id >> ChunkBits][id & chunk_mask];
+    }
+
+    id_type allocate() {
+        if (!free_.empty()) {
+            auto id = free_.back();
+            free_.pop_back();
+            return id;
+        }
+        if (size_ == none) throw std::overflow_error("Subscription trie maximum number of nodes reached");
+        if ((size_ & chunk_mask) == 0) chunks_.emplace_back(new T[chunk_size]);
+        return size_++;
+    }
+
+    // The element is reset to T{} in order to release its resources.
+    void deallocate(id_type id) {
+        (*this)[id] = T{};
+        free_.push_back(id);
+    }
+
+    // Number of allocated (used) elements
+    std::size_t size() const {
+        return size_ - free_.size();
+    }
+
+    // Upper bound of the ids. Some of them could be deallocated.
+    id_type end_id() const {
+        return size_;
+    }
+
+private:
+    std::vector<std::unique_ptr<T[]>> chunks_;
+    id_type size_ = 0;
+    std::vector<id_type> free_;
+};
+
+// Interned topic levels
+class level_table {
+    // Level strings are stored in chunks. The location is chunk index << 16 | offset.
+    static constexpr std::size_t chunk_bits = 16;
+    static constexpr std::size_t chunk_size = std::size_t(1) << chunk_bits;
+
+    struct level {
+        id_type loc = none;
+        std::uint32_t size = 0;
+        std::uint32_t refs = 0;
+        std::uint32_t hash = 0;
+    };
+
+    struct slot {
+        id_type id = none;
+        std::uint32_t hash = 0;
+    };
+
+public:
+    level_table() = default;
+    level_table(level_table&&) = default;
+    level_table& operator=(level_table&&) = default;
+
+    level_table(level_table const& other)
+        :levels_{other.levels_},
+         slots_{other.slots_},
+         count_{other.count_},
+         used_{other.used_},
+         free_strings_{other.free_strings_}
+    {
+        chunks_.reserve(other.chunks_.size());
+        for (auto const& c : other.chunks_) {
+            chunks_.emplace_back(new char[chunk_size]);
+            std::memcpy(chunks_.back().get(), c.get(), chunk_size);
+        }
+    }
+    level_table& operator=(level_table const& other) {
+        level_table tmp{other};
+        *this = force_move(tmp);
+        return *this;
+    }
+
+    static std::uint32_t hash_of(std::string_view s) {
+        return fold(std::hash<std::string_view>{}(s));
+    }
+
+    // Convert std::hash<std::string_view> value (e.g. topic_levels::hash()) to the level hash
+    static std::uint32_t fold(std::size_t h) {
+        std::uint64_t h64 = h;
+        return static_cast<std::uint32_t>(h64 ^ (h64 >> 32));
+    }
+
+    // Find the id of the level. If not interned, return none.
+    id_type find(std::string_view s) const {
+        return find(s, hash_of(s));
+    }
+
+    id_type find(std::string_view s, std::uint32_t h) const {
+        if (slots_.empty()) return none;
+        auto mask = slots_.size() - 1;
+        for (auto i = h & mask; ; i = (i + 1) & mask) {
+            auto const& sl = slots_[i];
+            if (sl.id == none) return none;
+            if (sl.hash == h && get(sl.id) == s) return sl.id;
+        }
+    }
+
+    // Intern the level and increase the reference count
+    id_type intern(std::string_view s) {
+        auto h = hash_of(s);
+        auto id = find(s, h);
+        if (id != none) {
+            ++levels_[id].refs;
+            return id;
+        }
+        if ((count_ + 1) * 2 > slots_.size()) rehash(std::max<std::size_t>(16, slots_.size() * 2));
+        id = levels_.allocate();
+        auto& l = levels_[id];
+        l.loc = store(s);
+        l.size = static_cast<std::uint32_t>(s.size());
+        l.refs = 1;
+        l.hash = h;
+        insert_slot(id, h);
+        ++count_;
+        return id;
+    }
+
+    // Decrease the reference count, and erase the level if it reaches 0
+    void release(id_type id) {
+        auto& l = levels_[id];
+        BOOST_ASSERT(l.refs > 0);
+        if (--l.refs != 0) return;
+        erase_slot(id, l.hash);
+        free_strings_[l.size].push_back(l.loc);
+        levels_.deallocate(id);
+        --count_;
+    }
+
+    std::string_view get(id_type id) const {
+        auto const& l = levels_[id];
+        return std::string_view(chunks_[l.loc >> chunk_bits].get() + (l.loc & (chunk_size - 1)), l.size);
+    }
+
+    std::size_t size() const {
+        return count_;
+    }
+
+private:
+    id_type store(std::string_view s) {
+        auto it = free_strings_.find(static_cast<std::uint32_t>(s.size()));
+        if (it != free_strings_.end() && !it->second.empty()) {
+            auto loc = it->second.back();
+            it->second.pop_back();
+            std::memcpy(chunks_[loc >> chunk_bits].get() + (loc & (chunk_size - 1)), s.data(), s.size());
+            return loc;
+        }
+        BOOST_ASSERT(s.size() <= chunk_size);
+        // The offset must be less than chunk_size even if s is empty.
+        if (chunks_.empty() || used_ + s.size() >= chunk_size) {
+            if (chunks_.size() == (std::size_t(1) << (32 - chunk_bits))) {
+                throw std::overflow_error("Subscription trie maximum size of topic levels reached");
+            }
+            chunks_.emplace_back(new char[chunk_size]);
+            used_ = 0;
+        }
+        auto loc = static_cast<id_type>(((chunks_.size() - 1) << chunk_bits) | used_);
+        std::memcpy(chunks_.back().get() + used_, s.data(), s.size());
+        used_ += s.size();
+        return loc;
+    }
+
+    void insert_slot(id_type id, std::uint32_t h) {
+        auto mask = slots_.size() - 1;
+        auto i = h & mask;
+        while (slots_[i].id != none) i = (i + 1) & mask;
+        slots_[i] = slot{id, h};
+    }
+
+    // backward shift deletion of linear probing
+    void erase_slot(id_type id, std::uint32_t h) {
+        auto mask = slots_.size() - 1;
+        auto i = h & mask;
+        while (slots_[i].id != id) i = (i + 1) & mask;
+        for (auto j = (i + 1) & mask; slots_[j].id != none; j = (j + 1) & mask) {
+            auto home = slots_[j].hash & mask;
+            // move slots_[j] to i if its home is not in (i, j]
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                slots_[i] = slots_[j];
+                i = j;
+            }
+        }
+        slots_[i] = slot{};
+    }
+
+    void rehash(std::size_t n) {
+        std::vector<slot> old(n);
+        std::swap(old, slots_);
+        for (auto const& sl : old) {
+            if (sl.id != none) insert_slot(sl.id, sl.hash);
+        }
+    }
+
+    chunked_pool<level> levels_;
+    std::vector<slot> slots_;
+    std::size_t count_ = 0;
+
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    std::size_t used_ = 0;
+    // Freed strings are reused by the string that has the same size.
+    std::unordered_map<std::uint32_t, std::vector<id_type>> free_strings_;
+};
+
+// Children of a node keyed by level id
+class child_table {
+    static constexpr std::uint32_t max_sorted = 8;
+
+    struct entry {
+        id_type level;
+        id_type node;
+    };
+
+public:
+    child_table() = default;
+    child_table(child_table&& other) noexcept
+        :entries_{force_move(other.entries_)},
+         size_{std::exchange(other.size_, 0)},
+         capacity_{std::exchange(other.capacity_, 0)}
+    {}
+    child_table& operator=(child_table&& other) noexcept {
+        entries_ = force_move(other.entries_);
+        size_ = std::exchange(other.size_, 0);
+        capacity_ = std::exchange(other.capacity_, 0);
+        return *this;
+    }
+    child_table(child_table const& other)
+        :entries_{other.capacity_ ? new entry[other.capacity_] : nullptr},
+         size_{other.size_},
+         capacity_{other.capacity_}
+    {
+        std::copy(other.entries_.get(), other.entries_.get() + capacity_, entries_.get());
+    }
+    child_table& operator=(child_table const& other) {
+        child_table tmp{other};
+        *this = force_move(tmp);
+        return *this;
+    }
+
+    std::uint32_t size() const {
+        return size_;
+    }
+
+    id_type find(id_type level) const {
+        if (capacity_ <= max_sorted) {
+            for (std::uint32_t i = 0; i != size_; ++i) {
+                if (entries_[i].level == level) return entries_[i].node;
+                if (entries_[i].level > level) break;
+            }
+            return none;
+        }
+        auto mask = capacity_ - 1;
+        for (auto i = home(level); ; i = (i + 1) & mask) {
+            if (entries_[i].level == level) return entries_[i].node;
+            if (entries_[i].level == none) return none;
+        }
+    }
+
+    void insert(id_type level, id_type node) {
+        BOOST_ASSERT(find(level) == none);
+        if (capacity_ <= max_sorted) {
+            if (size_ == capacity_) {
+                if (capacity_ == max_sorted) {
+                    rehash(max_sorted * 4);
+                    insert_hashed(level, node);
+                    ++size_;
+                    return;
+                }
+                auto next = std::unique_ptr<entry[]>(new entry[capacity_ ? capacity_ * 2 : 1]);
+                std::copy(entries_.get(), entries_.get() + size_, next.get());
+                entries_ = force_move(next);
+                capacity_ = capacity_ ? capacity_ * 2 : 1;
+            }
+            auto it = std::upper_bound(
+                entries_.get(), entries_.get() + size_, level,
+                [](id_type l, entry const& e) { return l < e.level; }
+            );
+            std::copy_backward(it, entries_.get() + size_, entries_.get() + size_ + 1);
+            *it = entry{level, node};
+            ++size_;
+            return;
+        }
+        // keep the load factor under 3/4
+        if ((size_ + 1) * 4 > capacity_ * 3) rehash(capacity_ * 2);
+        insert_hashed(level, node);
+        ++size_;
+    }
+
+    void erase(id_type level) {
+        if (capacity_ <= max_sorted) {
+            auto it = std::find_if(
+                entries_.get(), entries_.get() + size_,
+                [&](entry const& e) { return e.level == level; }
+            );
+            BOOST_ASSERT(it != entries_.get() + size_);
+            std::copy(it + 1, entries_.get() + size_, it);
+            if (--size_ == 0) {
+                entries_.reset();
+                capacity_ = 0;
+            }
+            return;
+        }
+        // backward shift deletion of linear probing
+        auto mask = capacity_ - 1;
+        auto i = home(level);
+        while (entries_[i].level != level) i = (i + 1) & mask;
+        for (auto j = (i + 1) & mask; entries_[j].level != none; j = (j + 1) & mask) {
+            auto h = home(entries_[j].level);
+            if (((j - h) & mask) >= ((j - i) & mask)) {
+                entries_[i] = entries_[j];
+                i = j;
+            }
+        }
+        entries_[i] = entry{none, none};
+        --size_;
+        if (size_ <= max_sorted / 2) shrink_to_sorted();
+    }
+
+    // Approximate heap usage
+    std::size_t heap_bytes() const {
+        return capacity_ * sizeof(entry);
+    }
+
+private:
+    std::uint32_t home(id_type level) const {
+        // Fibonacci hashing. Level ids are dense, so the upper bits are used.
+        return static_cast<std::uint32_t>((std::uint64_t(level) * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity_ - 1);
+    }
+
+    void insert_hashed(id_type level, id_type node) {
+        auto mask = capacity_ - 1;
+        auto i = home(level);
+        while (entries_[i].level != none) i = (i + 1) & mask;
+        entries_[i] = entry{level, node};
+    }
+
+    void rehash(std::uint32_t n) {
+        auto old = force_move(entries_);
+        auto old_capacity = capacity_;
+        entries_.reset(new entry[n]);
+        std::fill(entries_.get(), entries_.get() + n, entry{none, none});
+        capacity_ = n;
+        for (std::uint32_t i = 0; i != old_capacity; ++i) {
+            if (old[i].level != none) insert_hashed(old[i].level, old[i].node);
+        }
+    }
+
+    void shrink_to_sorted() {
+        auto next = std::unique_ptr<entry[]>(new entry[max_sorted]);
+        std::uint32_t n = 0;
+        for (std::uint32_t i = 0; i != capacity_; ++i) {
+            if (entries_[i].level != none) next[n++] = entries_[i];
+        }
+        std::sort(
+            next.get(), next.get() + n,
+            [](entry const& lhs, entry const& rhs) { return lhs.level < rhs.level; }
+        );
+        entries_ = force_move(next);
+        capacity_ = max_sorted;
+    }
+
+    std::unique_ptr<entry[]> entries_;
+    std::uint32_t size_ = 0;
+    std::uint32_t capacity_ = 0;
+};
+
+struct node {
+    id_type level = none;  // level of the edge from the parent. none for the root
+    id_type parent = none;
+    id_type plus = none;   // child '+'
+    id_type hash = none;   // child '#'
+    id_type value = none;
+    std::uint32_t count = 0; // number of the values of this node and its descendants
+    child_table children;
+};
+
+} // namespace subscription_trie_detail
+
+template <typename Value>
+class subscription_trie_base {
+public:
+    using handle = subscription_trie_detail::id_type;
+
+protected:
+    using id_type = subscription_trie_detail::id_type;
+    static constexpr id_type none = subscription_trie_detail::none;
+    using node = subscription_trie_detail::node;
+
+    subscription_trie_base() {
+        root_ = nodes_.allocate();
+        plus_level_ = levels_.intern("+");
+        hash_level_ = levels_.intern("#");
+    }
+
+    node& get(id_type id) { return nodes_[id]; }
+    node const& get(id_type id) const { return nodes_[id]; }
+
+    id_type child(node const& n, id_type level) const {
+        if (level == plus_level_) return n.plus;
+        if (level == hash_level_) return n.hash;
+        return level == none ? none : n.children.find(level);
+    }
+
+    // Return the path of the topic filter. If not found, return an empty vector.
+    std::vector<id_type> find_topic_filter(std::string_view topic_filter) const {
+        std::vector<id_type> path;
+        auto parent = root_;
+        topic_filter_tokenizer(
+            topic_filter,
+            [&](std::string_view t) {
+                auto c = child(get(parent), levels_.find(t));
+                if (c == none) {
+                    path.clear();
+                    return false;
+                }
+                path.push_back(c);
+                parent = c;
+                return true;
+            }
+        );
+        return path;
+    }
+
+    // Create the path of the topic filter. The count of the existing nodes is increased.
+    std::vector<id_type> create_topic_filter(std::string_view topic_filter) {
+        std::vector<id_type> path;
+        auto parent = root_;
+        topic_filter_tokenizer(
+            topic_filter,
+            [&](std::string_view t) {
+                auto c = child(get(parent), levels_.find(t));
+                if (c == none) {
+                    c = nodes_.allocate();
+                    auto level = levels_.intern(t);
+                    auto& n = get(c);
+                    n.level = level;
+                    n.parent = parent;
+                    n.count = 1;
+                    auto& p = get(parent);
+                    if (level == plus_level_) p.plus = c;
+                    else if (level == hash_level_) p.hash = c;
+                    else p.children.insert(level, c);
+                }
+                else {
+                    increase_count(get(c));
+                }
+                path.push_back(c);
+                parent = c;
+                return true;
+            }
+        );
+        return path;
+    }
+
+    // Decrease the count of the path, and remove the nodes that the count reaches 0
+    void remove_topic_filter(std::vector<id_type> const& path) {
+        for (auto it = path.rbegin(); it != path.rend(); ++it) {
+            auto id = *it;
+            auto& n = get(id);
+            BOOST_ASSERT(n.count > 0);
+            if (--n.count != 0) continue;
+            auto& p = get(n.parent);
+            if (n.level == plus_level_) p.plus = none;
+            else if (n.level == hash_level_) p.hash = none;
+            else p.children.erase(n.level);
+            levels_.release(n.level);
+            if (n.value != none) values_.deallocate(n.value);
+            nodes_.deallocate(id);
+        }
+    }
+
+    // Get the path from the handle
+    std::vector<id_type> handle_to_path(handle h) const {
+        if (!is_valid(h)) throw_invalid_handle();
+        std::vector<id_type> path;
+        for (auto i = h; i != root_; i = get(i).parent) {
+            path.push_back(i);
+        }
+        std::reverse(path.begin(), path.end());
+        return path;
+    }
+
+    void increase_path(std::vector<id_type> const& path) {
+        for (auto i : path) increase_count(get(i));
+    }
+
+    bool is_valid(handle h) const {
+        return h < nodes_.end_id() && h != root_ && get(h).count != 0;
+    }
+
+    // Get the value storage of the node. Allocate it if it doesn't exist.
+    Value& value_of(id_type id) {
+        auto& n = get(id);
+        if (n.value == none) {
+            // allocate() could add a chunk, but node references are not invalidated.
+            n.value = values_.allocate();
+        }
+        return values_[n.value];
+    }
+
+    Value* find_value(id_type id) {
+        auto v = get(id).value;
+        return v == none ? nullptr : &values_[v];
+    }
+
+    // Release the value storage of the node
+    void release_value(id_type id) {
+        auto& n = get(id);
+        if (n.value == none) return;
+        values_.deallocate(n.value);
+        n.value = none;
+    }
+
+    // Decrease the count of the path whose last node has no value anymore.
+    // If the last node still has descendants, only its value storage is released.
+    void remove_value_path(std::vector<id_type> const& path) {
+        if (get(path.back()).count > 1) release_value(path.back());
+        remove_topic_filter(path);
+    }
+
+    // Call f(level, hash) for each level of the topic
+    template <typename Output>
+    static void for_each_level(std::string_view topic, Output&& f) {
+        topic_filter_tokenizer(
+            topic,
+            [&](std::string_view t) {
+                return f(t, subscription_trie_detail::level_table::hash_of(t));
+            }
+        );
+    }
+
+    // The hash values computed by topic_levels are reused
+    template <typename Output>
+    static void for_each_level(topic_levels const& topic, Output&& f) {
+        for (std::size_t i = 0; i != topic.size(); ++i) {
+            if (!f(topic[i], subscription_trie_detail::level_table::fold(topic.hash(i)))) break;
+        }
+    }
+
+    // Topic is std::string_view or topic_levels
+    template <typename ThisType, typename Topic, typename Output>
+    static void find_match_impl(ThisType& self, Topic const& topic, Output&& callback) {
+        boost::container::small_vector<id_type, 32> entries;
+        boost::container::small_vector<id_type, 32> new_entries;
+        entries.push_back(self.root_);
+
+        for_each_level(
+            topic,
+            [&](std::string_view t, std::uint32_t h) {
+                auto level = self.levels_.find(t, h);
+                auto dollar = !t.empty() && t[0] == '$';
+                new_entries.clear();
+                for (auto id : entries) {
+                    auto const& n = self.get(id);
+                    auto c = self.child(n, level);
+                    if (c != none) new_entries.push_back(c);
+                    if (id == self.root_ && dollar) continue;
+                    if (n.plus != none) new_entries.push_back(n.plus);
+                    if (n.hash != none) {
+                        auto v = self.get(n.hash).value;
+                        if (v != none) callback(self.values_[v]);
+                    }
+                }
+                std::swap(entries, new_entries);
+                return !entries.empty();
+            }
+        );
+
+        for (auto id : entries) {
+            auto v = self.get(id).value;
+            if (v != none) callback(self.values_[v]);
+        }
+    }
+
+    void increase_map_size() {
+        if (map_size_ == std::numeric_limits<decltype(map_size_)>::max()) {
+            throw_max_stored_topics();
+        }
+        ++map_size_;
+    }
+
+    void decrease_map_size() {
+        BOOST_ASSERT(map_size_ > 0);
+        --map_size_;
+    }
+
+    static void increase_count(node& n) {
+        if (n.count == std::numeric_limits<std::uint32_t>::max()) {
+            throw_max_stored_topics();
+        }
+        ++n.count;
+    }
+
+    static void throw_invalid_topic_filter() { throw std::runtime_error("Subscription trie invalid topic filter was specified"); }
+    static void throw_invalid_handle() { throw std::runtime_error("Subscription trie invalid handle was specified"); }
+    static void throw_max_stored_topics() { throw std::overflow_error("Subscription trie maximum number of stored topic filters reached"); }
+
+public:
+    // Return the number of nodes in the trie (including the root)
+    std::size_t internal_size() const { return nodes_.size(); }
+
+    // Return the number of registered topic filters
+    std::size_t size() const { return map_size_; }
+
+    // Return the number of interned topic levels
+    std::size_t level_size() const { return levels_.size(); }
+
+    // Lookup a topic filter
+    std::optional<handle> lookup(std::string_view topic_filter) const {
+        auto path = find_topic_filter(topic_filter);
+        if (path.empty()) return std::nullopt;
+        return path.back();
+    }
+
+    // Get path of topic_filter
+    std::string handle_to_topic_filter(handle const& h) const {
+        std::string result;
+        bool first = true;
+        for (auto i : handle_to_path(h)) {
+            if (!first) result += '/';
+            first = false;
+            result += levels_.get(get(i).level);
+        }
+        return result;
+    }
+
+private:
+    subscription_trie_detail::level_table levels_;
+    subscription_trie_detail::chunked_pool<node> nodes_;
+    subscription_trie_detail::chunked_pool<Value> values_;
+    id_type root_;
+    id_type plus_level_;
+    id_type hash_level_;
+    std::size_t map_size_ = 0;
+};
+
+template <typename Value>
+class single_subscription_trie
+    : public subscription_trie_base<std::optional<Value>> {
+    using base = subscription_trie_base<std::optional<Value>>;
+
+public:
+    using handle = typename base::handle;
+
+    // Insert a value at the specified topic_filter
+    template <typename V>
+    std::pair<handle, bool> insert(std::string_view topic_filter, V&& value) {
+        auto path = this->find_topic_filter(topic_filter);
+        if (!path.empty()) {
+            auto& v = this->value_of(path.back());
+            if (v) return std::make_pair(path.back(), false);
+            v.emplace(std::forward<V>(value));
+            this->increase_path(path);
+            this->increase_map_size();
+            return std::make_pair(path.back(), true);
+        }
+        path = this->create_topic_filter(topic_filter);
+        this->value_of(path.back()).emplace(std::forward<V>(value));
+        this->increase_map_size();
+        return std::make_pair(path.back(), true);
+    }
+
+    // Update a value at the specified topic filter
+    template <typename V>
+    void update(std::string_view topic_filter, V&& value) {
+        auto path = this->find_topic_filter(topic_filter);
+        if (path.empty()) {
+            this->throw_invalid_topic_filter();
+        }
+        auto v = this->find_value(path.back());
+        if (!v || !*v) {
+            this->throw_invalid_topic_filter();
+        }
+        v->emplace(std::forward<V>(value));
+    }
+
+    template <typename V>
+    void update(handle const& h, V&& value) {
+        if (!this->is_valid(h)) {
+            this->throw_invalid_topic_filter();
+        }
+        auto v = this->find_value(h);
+        if (!v || !*v) {
+            this->throw_invalid_topic_filter();
+        }
+        v->emplace(std::forward<V>(value));
+    }
+
+    // Remove a value at the specified topic filter
+    std::size_t erase(std::string_view topic_filter) {
+        auto path = this->find_topic_filter(topic_filter);
+        if (path.empty()) return 0;
+        return erase_path(path);
+    }
+
+    // Remove a value using a handle
+    std::size_t erase(handle const& h) {
+        return erase_path(this->handle_to_path(h));
+    }
+
+    // Find all topic filters that match the specified topic
+    template <typename Output>
+    void find(std::string_view topic, Output&& callback) const {
+        find_impl(topic, std::forward<Output>(callback));
+    }
+
+    template <typename Output>
+    void find(topic_levels const& topic, Output&& callback) const {
+        find_impl(topic, std::forward<Output>(callback));
+    }
+
+private:
+    template <typename Topic, typename Output>
+    void find_impl(Topic const& topic, Output&& callback) const {
+        base::find_match_impl(
+            *this,
+            topic,
+            [&callback](std::optional<Value> const& value) {
+                if (value) {
+                    callback(*value);
+                }
+            }
+        );
+    }
+
+    std::size_t erase_path(std::vector<typename base::id_type> const& path) {
+        auto v = this->find_value(path.back());
+        if (!v || !*v) return 0;
+        v->reset();
+        this->remove_value_path(path);
+        this->decrease_map_size();
+        return 1;
+    }
+};
+
+template <
+    typename Key,
+    typename Value,
+    class Hash = std::hash<Key>,
+    class Pred = std::equal_to<Key>,
+    class Cont = std::unordered_map<
+        Key,
+        Value,
+        Hash,
+        Pred,
+        std::allocator<
+            std::pair<
+                const Key,
+                Value
+            >
+        >
+    >
+>
+class multiple_subscription_trie
+    : public subscription_trie_base<Cont> {
+    using base = subscription_trie_base<Cont>;
+
+public:
+    using container_t = Cont;
+
+    // Handle of an entry
+    using handle = typename base::handle;
+
+    // Insert a key => value at the specified topic filter
+    // returns the handle and true if key was inserted, false if key was updated
+    template <typename K, typename V>
+    std::pair<handle, bool> insert_or_assign(std::string_view topic_filter, K&& key, V&& value) {
+        auto path = this->find_topic_filter(topic_filter);
+        if (path.empty()) {
+            path = this->create_topic_filter(topic_filter);
+            this->value_of(path.back()).emplace(std::forward<K>(key), std::forward<V>(value));
+            this->increase_map_size();
+            return std::make_pair(path.back(), true);
+        }
+        return insert_or_assign_path(path, std::forward<K>(key), std::forward<V>(value));
+    }
+
+    // Insert a key => value with a handle to the topic filter
+    // returns the handle and true if key was inserted, false if key was updated
+    template <typename K, typename V>
+    std::pair<handle, bool> insert_or_assign(handle const& h, K&& key, V&& value) {
+        return insert_or_assign_path(this->handle_to_path(h), std::forward<K>(key), std::forward<V>(value));
+    }
+
+    // Remove a value at the specified handle
+    // returns the number of removed elements
+    std::size_t erase(handle const& h, Key const& key) {
+        return erase_path(this->handle_to_path(h), key);
+    }
+
+    // Remove a value at the specified topic filter
+    // returns the number of removed elements
+    std::size_t erase(std::string_view topic_filter, Key const& key) {
+        auto path = this->find_topic_filter(topic_filter);
+        if (path.empty()) return 0;
+        return erase_path(path, key);
+    }
+
+    // Find all topic filters that match the specified topic
+    template <typename Output>
+    void find(std::string_view topic, Output&& callback) const {
+        find_impl(topic, std::forward<Output>(callback));
+    }
+
+    template <typename Output>
+    void find(topic_levels const& topic, Output&& callback) const {
+        find_impl(topic, std::forward<Output>(callback));
+    }
+
+    // Return true if any topic filter that has a value matches the specified topic
+    template <typename Topic>
+    bool any_match(Topic const& topic) const {
+        bool matched = false;
+        base::find_match_impl(
+            *this,
+            topic,
+            [&matched](Cont const& values) {
+                if (!values.empty()) matched = true;
+            }
+        );
+        return matched;
+    }
+
+    // Find all topic filters that match and allow modification
+    template <typename Output>
+    void modify(std::string_view topic, Output&& callback) {
+        base::find_match_impl(
+            *this,
+            topic,
+            [&callback](Cont& values) {
+                for (auto& i : values) {
+                    callback(i.first, i.second);
+                }
+            }
+        );
+    }
+
+    template <typename Output>
+    void dump(Output& out) {
+        out << "nodes: " << this->internal_size() << " levels: " << this->level_size() << std::endl;
+    }
+
+private:
+    template <typename Topic, typename Output>
+    void find_impl(Topic const& topic, Output&& callback) const {
+        base::find_match_impl(
+            *this,
+            topic,
+            [&callback](Cont const& values) {
+                for (auto const& i : values) {
+                    callback(i.first, i.second);
+                }
+            }
+        );
+    }
+
+    template <typename K, typename V>
+    std::pair<handle, bool> insert_or_assign_path(std::vector<typename base::id_type> const& path, K&& key, V&& value) {
+        auto& values = this->value_of(path.back());
+        auto it = values.find(key);
+        if (it != values.end()) {
+            it->second = std::forward<V>(value);
+            return std::make_pair(path.back(), false);
+        }
+        values.emplace(std::forward<K>(key), std::forward<V>(value));
+        this->increase_path(path);
+        this->increase_map_size();
+        return std::make_pair(path.back(), true);
+    }
+
+    std::size_t erase_path(std::vector<typename base::id_type> const& path, Key const& key) {
+        auto values = this->find_value(path.back());
+        if (!values) return 0;
+        auto result = values->erase(key);
+        if (result) {
+            if (values->empty()) {
+                this->remove_value_path(path);
+            }
+            else {
+                this->remove_topic_filter(path);
+            }
+            this->decrease_map_size();
+        }
+        return result;
+    }
+};
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_BROKER_SUBSCRIPTION_TRIE_HPP
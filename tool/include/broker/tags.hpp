@@ -18,8 +18,7 @@ struct tag_cid {};
 struct tag_cid_topic_filter {};
 struct tag_tim {};
 struct tag_pid {};
-struct tag_sn_tp {};
-struct tag_cid_sn {};
+struct tag_qos {};
 
 } // namespace async_mqtt
 
@@ -11,20 +11,83 @@
 #include <string_view>
 #include <limits>
 #include <cstdint>
+#include <functional>
+#include <optional>
 
 #include <boost/assert.hpp>
+#include <boost/container/small_vector.hpp>
 
 #include <async_mqtt/util/string_view_helper.hpp>
 
+#if defined(__AVX2__)
+#define ASYNC_MQTT_TOPIC_FILTER_USE_AVX2
+#include <immintrin.h>
+#endif // defined(__AVX2__)
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ASYNC_MQTT_TOPIC_FILTER_USE_SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif // defined(_MSC_VER)
+#endif // defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
 namespace async_mqtt {
 
 static constexpr char topic_filter_separator = '/';
 
+namespace detail {
+
+#if defined(ASYNC_MQTT_TOPIC_FILTER_USE_SSE2)
+
+// mask must not be 0
+inline std::size_t topic_filter_count_trailing_zeros(std::uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward(&idx, mask);
+    return idx;
+#else  // defined(_MSC_VER)
+    return static_cast<std::size_t>(__builtin_ctz(mask));
+#endif // defined(_MSC_VER)
+}
+
+#endif // defined(ASYNC_MQTT_TOPIC_FILTER_USE_SSE2)
+
+} // namespace detail
+
+// Find the first separator in [first, last). If not found, return last.
+// 32 or 16 bytes are compared at once if AVX2 or SSE2 is available.
+inline char const* topic_filter_find_separator(char const* first, char const* last) {
+#if defined(ASYNC_MQTT_TOPIC_FILTER_USE_AVX2)
+    auto const sep32 = _mm256_set1_epi8(topic_filter_separator);
+    while (last - first >= 32) {
+        auto block = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(first));
+        auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, sep32)));
+        if (mask != 0) return first + detail::topic_filter_count_trailing_zeros(mask);
+        first += 32;
+    }
+#endif // defined(ASYNC_MQTT_TOPIC_FILTER_USE_AVX2)
+#if defined(ASYNC_MQTT_TOPIC_FILTER_USE_SSE2)
+    auto const sep16 = _mm_set1_epi8(topic_filter_separator);
+    while (last - first >= 16) {
+        auto block = _mm_loadu_si128(reinterpret_cast<__m128i const*>(first));
+        auto mask = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, sep16)));
+        if (mask != 0) return first + detail::topic_filter_count_trailing_zeros(mask);
+        first += 16;
+    }
+#endif // defined(ASYNC_MQTT_TOPIC_FILTER_USE_SSE2)
+    return std::find(first, last, topic_filter_separator);
+}
+
 template<typename Iterator>
 inline Iterator topic_filter_tokenizer_next(Iterator first, Iterator last) {
     return std::find(first, last, topic_filter_separator);
 }
 
+inline char const* topic_filter_tokenizer_next(char const* first, char const* last) {
+    return topic_filter_find_separator(first, last);
+}
+
 template<typename Iterator, typename Output>
 inline std::size_t topic_filter_tokenizer(Iterator first, Iterator last, Output write) {
     std::size_t count = 1;
@@ -41,19 +104,105 @@ inline std::size_t topic_filter_tokenizer(Iterator first, Iterator last, Output
 template<typename Output>
 inline std::size_t topic_filter_tokenizer(std::string_view str, Output write) {
     return topic_filter_tokenizer(
-        std::begin(str),
-        std::end(str),
-        [&write](std::string_view::const_iterator token_begin, std::string_view::const_iterator token_end) {
+        str.data(),
+        str.data() + str.size(),
+        [&write](char const* token_begin, char const* token_end) {
             return write(
-                make_string_view(
+                std::string_view(
                     token_begin,
-                    token_end
+                    static_cast<std::size_t>(token_end - token_begin)
                 )
             );
         }
     );
 }
 
+/**
+ * @brief Tokenized topic
+ *
+ * The levels of a topic are computed once, and then referred by all lookups of
+ * the topic (subscription maps, retained map, and authorization maps).
+ * The hash value of a level is computed at the first call of hash(), because
+ * only subscription_trie uses it.
+ * It refers the topic, so the topic must outlive this object.
+ * Up to 16 levels are stored without allocation.
+ * It is not thread safe even if it is const.
+ */
+class topic_levels {
+    struct level {
+        std::uint32_t offset;
+        std::uint32_t size;
+        mutable std::optional<std::size_t> hash;
+    };
+
+public:
+    explicit topic_levels(std::string_view topic)
+        :topic_{topic}
+    {
+        auto first = topic.data();
+        auto last = topic.data() + topic.size();
+        while (true) {
+            auto pos = topic_filter_find_separator(first, last);
+            std::string_view l(first, static_cast<std::size_t>(pos - first));
+            levels_.push_back(
+                level{
+                    static_cast<std::uint32_t>(first - topic.data()),
+                    static_cast<std::uint32_t>(l.size()),
+                    std::nullopt
+                }
+            );
+            if (pos == last) break;
+            first = pos + 1;
+        }
+    }
+
+    /**
+     * @brief get the original topic
+     */
+    std::string_view topic() const {
+        return topic_;
+    }
+
+    /**
+     * @brief get the number of levels
+     */
+    std::size_t size() const {
+        return levels_.size();
+    }
+
+    /**
+     * @brief get the level
+     * @param idx index of the level
+     */
+    std::string_view operator[](std::size_t idx) const {
+        auto const& l = levels_[idx];
+        return topic_.substr(l.offset, l.size);
+    }
+
+    /**
+     * @brief get std::hash<std::string_view> value of the level
+     * @param idx index of the level
+     */
+    std::size_t hash(std::size_t idx) const {
+        auto const& l = levels_[idx];
+        if (!l.hash) l.hash.emplace(std::hash<std::string_view>{}((*this)[idx]));
+        return *l.hash;
+    }
+
+private:
+    std::string_view topic_;
+    boost::container::small_vector<level, 16> levels_;
+};
+
+template<typename Output>
+inline std::size_t topic_filter_tokenizer(topic_levels const& levels, Output write) {
+    std::size_t count = 0;
+    while (count != levels.size()) {
+        if (!write(levels[count++])) break;
+    }
+    return count;
+}
+
 // TODO: Technically this function is simply wrong, since it's treating the
 // topic pattern as if it were an ASCII sequence.
 // To make this function correct per the standard, it would be necessary
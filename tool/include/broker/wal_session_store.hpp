@@ -0,0 +1,613 @@
+// Copyright Takatoshi Kondo 2023
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ASYNC_MQTT_BROKER_WAL_SESSION_STORE_HPP)
+#define ASYNC_MQTT_BROKER_WAL_SESSION_STORE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/crc.hpp>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // !defined(_WIN32)
+
+#include <async_mqtt/util/log.hpp>
+
+#include <broker/session_store.hpp>
+
+namespace async_mqtt {
+
+/**
+ * @brief configuration of wal_session_store
+ */
+struct wal_session_store_config {
+    std::string dir;                                  ///< directory of the log files
+    std::size_t segment_size = 64 * 1024 * 1024;      ///< a new segment is started beyond it
+    std::chrono::microseconds commit_interval{1000};  ///< group commit interval
+    std::size_t commit_bytes = 1024 * 1024;           ///< commit early if appended bytes exceed it
+    bool fsync = true;                                ///< fsync() after each group commit
+    std::chrono::milliseconds retry_interval{100};    ///< retry interval after a write failure
+    std::size_t compaction_segments = 4;              ///< compact when closed segments reach it
+    std::size_t compaction_memory = 64 * 1024 * 1024; ///< approximate memory for the images on compaction
+};
+
+/**
+ * @brief session store that is an append-only segmented log
+ *
+ * The directory contains segments `<seq>.log` and at most one snapshot `<seq>.snap`.
+ * The snapshot contains the images of all sessions in the segments up to seq.
+ * Each frame in the files is a 32bit length, a 32bit CRC-32 of the record and the
+ * record.
+ *
+ * append() only copies the framed record into the pending buffer. A writer thread
+ * writes the pending buffer to the current segment and calls fsync() every
+ * commit_interval (group commit). The handlers of when_committed() are called by the
+ * writer thread after the commit.
+ * If the write or fsync() fails, the written part is truncated and the segment is
+ * closed. The records are kept pending and written to a new segment after
+ * retry_interval, and the handlers are not called until then.
+ * When the closed segments reach compaction_segments, a compaction thread replays
+ * them onto the snapshot and writes a new snapshot, then removes them. The writer
+ * thread keeps writing to the current segment in the meantime. The images are built
+ * for a part of the sessions at a time, so the memory is bounded by
+ * compaction_memory.
+ * The files are read via mmap() on recovery. A torn frame at the end of a file is
+ * ignored.
+ */
+class wal_session_store : public session_store {
+public:
+    explicit wal_session_store(wal_session_store_config config)
+        :config_{force_move(config)}
+    {
+        std::filesystem::create_directories(config_.dir);
+        for (auto const& e : std::filesystem::directory_iterator(config_.dir)) {
+            auto path = e.path();
+            auto seq = parse_seq(path);
+            if (!seq) continue;
+            if (path.extension() == ".log") {
+                closed_segments_.push_back(*seq);
+            }
+            else if (path.extension() == ".snap") {
+                if (snapshot_seq_) {
+                    // a crash during the compaction left the old one
+                    remove_file(snapshot_path(std::min(*snapshot_seq_, *seq)));
+                    snapshot_seq_ = std::max(*snapshot_seq_, *seq);
+                }
+                else {
+                    snapshot_seq_ = *seq;
+                }
+            }
+        }
+        std::sort(closed_segments_.begin(), closed_segments_.end());
+        if (snapshot_seq_) {
+            // the segments in the snapshot that were not removed by the crash
+            while (!closed_segments_.empty() && closed_segments_.front() <= *snapshot_seq_) {
+                remove_file(segment_path(closed_segments_.front()));
+                closed_segments_.erase(closed_segments_.begin());
+            }
+        }
+        // Never append to the existing segment, it could end with a torn frame.
+        next_seq_ = std::max(
+            closed_segments_.empty() ? 0 : closed_segments_.back(),
+            snapshot_seq_.value_or(0)
+        ) + 1;
+        open_segment();
+        writer_ = std::thread{[this] { run(); }};
+        compactor_ = std::thread{[this] { run_compaction(); }};
+    }
+
+    ~wal_session_store() override {
+        {
+            std::lock_guard<std::mutex> g{mtx_};
+            stop_ = true;
+        }
+        cv_append_.notify_one();
+        cv_compact_.notify_one();
+        writer_.join();
+        compactor_.join();
+        if (fp_) std::fclose(fp_);
+        // The remaining handlers are of the records that could not be written.
+        // They are not called, so the messages are never acknowledged.
+    }
+
+    wal_session_store(wal_session_store const&) = delete;
+    wal_session_store& operator=(wal_session_store const&) = delete;
+
+    void append(std::string_view record) override {
+        boost::crc_32_type crc;
+        crc.process_bytes(record.data(), record.size());
+        bool notify;
+        {
+            std::lock_guard<std::mutex> g{mtx_};
+            notify = pending_.empty();
+            put_u32(pending_, static_cast<std::uint32_t>(record.size()));
+            put_u32(pending_, crc.checksum());
+            pending_.append(record);
+            ++appended_;
+            notify = notify || pending_.size() >= config_.commit_bytes;
+        }
+        if (notify) cv_append_.notify_one();
+    }
+
+    void when_committed(std::function<void()> handler) override {
+        {
+            std::lock_guard<std::mutex> g{mtx_};
+            if (committed_ < appended_) {
+                commit_handlers_.emplace_back(appended_, force_move(handler));
+                return;
+            }
+        }
+        handler();
+    }
+
+    /**
+     * @brief load the images from the files that exist at the construction
+     * Call it before append().
+     */
+    void load(session_images& images) override {
+        std::vector<std::uint64_t> segments;
+        std::optional<std::uint64_t> snapshot_seq;
+        {
+            std::lock_guard<std::mutex> g{mtx_};
+            segments = closed_segments_;
+            snapshot_seq = snapshot_seq_;
+        }
+        if (snapshot_seq) replay(snapshot_path(*snapshot_seq), images);
+        for (auto seq : segments) {
+            replay(segment_path(seq), images);
+        }
+    }
+
+    /**
+     * @brief wait until all appended records are written (and fsync-ed if configured)
+     */
+    void flush() {
+        std::unique_lock<std::mutex> g{mtx_};
+        auto target = appended_;
+        flush_requested_ = true;
+        cv_append_.notify_one();
+        cv_committed_.wait(g, [&] { return committed_ >= target || stop_; });
+    }
+
+    /**
+     * @brief get the number of the group commits
+     */
+    std::uint64_t num_of_commits() const {
+        std::lock_guard<std::mutex> g{mtx_};
+        return num_of_commits_;
+    }
+
+    /**
+     * @brief get the number of the failed group commits that are retried
+     */
+    std::uint64_t num_of_failures() const {
+        std::lock_guard<std::mutex> g{mtx_};
+        return num_of_failures_;
+    }
+
+    /**
+     * @brief compact the closed segments now
+     * The current segment is closed before the compaction.
+     */
+    void compact() {
+        flush();
+        {
+            std::lock_guard<std::mutex> g{mtx_writer_};
+            rotate();
+        }
+        std::lock_guard<std::mutex> g{mtx_compaction_};
+        compact_closed_segments();
+    }
+
+private:
+    static void put_u32(std::string& out, std::uint32_t v) {
+        for (int i = 0; i != 4; ++i) {
+            out.push_back(static_cast<char>(v >> (i * 8)));
+        }
+    }
+
+    static std::uint32_t get_u32(char const* p) {
+        std::uint32_t v = 0;
+        for (int i = 0; i != 4; ++i) {
+            v |= std::uint32_t(static_cast<std::uint8_t>(p[i])) << (i * 8);
+        }
+        return v;
+    }
+
+    static std::optional<std::uint64_t> parse_seq(std::filesystem::path const& path) {
+        auto stem = path.stem().string();
+        if (stem.empty() || stem.find_first_not_of("0123456789") != std::string::npos) {
+            return std::nullopt;
+        }
+        return std::stoull(stem);
+    }
+
+    std::string file_path(std::uint64_t seq, char const* ext) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%020llu%s", static_cast<unsigned long long>(seq), ext);
+        return (std::filesystem::path{config_.dir} / name).string();
+    }
+
+    std::string segment_path(std::uint64_t seq) const {
+        return file_path(seq, ".log");
+    }
+
+    std::string snapshot_path(std::uint64_t seq) const {
+        return file_path(seq, ".snap");
+    }
+
+    static void remove_file(std::string const& path) {
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+    }
+
+    static bool sync_file(std::FILE* fp) {
+        if (std::fflush(fp) != 0) return false;
+#if !defined(_WIN32)
+        return ::fsync(::fileno(fp)) == 0;
+#else  // !defined(_WIN32)
+        return true;
+#endif // !defined(_WIN32)
+    }
+
+    // make the rename and the creation of the files in the directory durable
+    void sync_dir() const {
+#if !defined(_WIN32)
+        int fd = ::open(config_.dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd < 0) return;
+        ::fsync(fd);
+        ::close(fd);
+#endif // !defined(_WIN32)
+    }
+
+    static std::size_t file_size(std::string const& path) {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(path, ec);
+        return ec ? 0 : std::size_t(size);
+    }
+
+    // replay the frames in the file onto images
+    static void replay(std::string const& path, session_images& images) {
+        replay(path, images, [](std::string_view) { return true; });
+    }
+
+    // replay the frames that match the filter in the file onto images
+    template <typename Filter>
+    static void replay(std::string const& path, session_images& images, Filter const& filter) {
+        auto apply_frames =
+            [&](char const* data, std::size_t size) {
+                std::size_t pos = 0;
+                while (size - pos >= 8) {
+                    auto len = get_u32(data + pos);
+                    auto sum = get_u32(data + pos + 4);
+                    if (len > size - pos - 8) break; // torn frame
+                    boost::crc_32_type crc;
+                    crc.process_bytes(data + pos + 8, len);
+                    if (crc.checksum() != sum) break;
+                    std::string_view record{data + pos + 8, len};
+                    if (filter(record) && !session_record::apply(images, record)) break;
+                    pos += 8 + len;
+                }
+                if (pos != size) {
+                    ASYNC_MQTT_LOG("mqtt_broker", warning)
+                        << "session store:" << path << " ignored from offset:" << pos;
+                }
+            };
+#if !defined(_WIN32)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return;
+        }
+        auto size = static_cast<std::size_t>(st.st_size);
+        void* p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return;
+        ::madvise(p, size, MADV_SEQUENTIAL);
+        apply_frames(static_cast<char const*>(p), size);
+        ::munmap(p, size);
+#else  // !defined(_WIN32)
+        std::ifstream ifs{path, std::ios::binary};
+        std::string data{std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{}};
+        apply_frames(data.data(), data.size());
+#endif // !defined(_WIN32)
+    }
+
+    // called under mtx_writer_, or in the constructor
+    void open_segment() {
+        fp_ = std::fopen(segment_path(next_seq_).c_str(), "wb");
+        if (!fp_) {
+            ASYNC_MQTT_LOG("mqtt_broker", error)
+                << "session store: cannot open " << segment_path(next_seq_);
+        }
+        segment_bytes_ = 0;
+        ++next_seq_;
+    }
+
+    // Write the frames to the current segment. Called under mtx_writer_.
+    // On failure, the written part is truncated and the segment is closed, so the
+    // frames are written again to a new segment after the committed ones.
+    bool write_segment(std::string const& frames) {
+        if (!fp_) open_segment();
+        if (!fp_) return false;
+        auto written = std::fwrite(frames.data(), 1, frames.size(), fp_);
+        bool ok = written == frames.size();
+        ok = (config_.fsync ? sync_file(fp_) : std::fflush(fp_) == 0) && ok;
+        if (ok) {
+            segment_bytes_ += written;
+            return true;
+        }
+        auto path = segment_path(next_seq_ - 1);
+        std::fclose(fp_);
+        fp_ = nullptr;
+        std::error_code ec;
+        std::filesystem::resize_file(path, segment_bytes_, ec);
+        if (ec) {
+            ASYNC_MQTT_LOG("mqtt_broker", error)
+                << "session store: cannot truncate " << path;
+        }
+        {
+            std::lock_guard<std::mutex> g{mtx_};
+            closed_segments_.push_back(next_seq_ - 1);
+        }
+        return false;
+    }
+
+    // called under mtx_writer_
+    void rotate() {
+        if (!fp_) return;
+        sync_file(fp_);
+        std::fclose(fp_);
+        fp_ = nullptr;
+        {
+            std::lock_guard<std::mutex> g{mtx_};
+            closed_segments_.push_back(next_seq_ - 1);
+        }
+        open_segment();
+    }
+
+    // called under mtx_compaction_
+    void compact_closed_segments() {
+        std::vector<std::uint64_t> segments;
+        std::optional<std::uint64_t> snapshot_seq;
+        {
+            std::lock_guard<std::mutex> g{mtx_};
+            segments = closed_segments_;
+            snapshot_seq = snapshot_seq_;
+        }
+        if (segments.empty()) return;
+
+        std::vector<std::string> inputs;
+        if (snapshot_seq) inputs.push_back(snapshot_path(*snapshot_seq));
+        for (auto seq : segments) {
+            inputs.push_back(segment_path(seq));
+        }
+        // The images are never larger than the input files. The sessions are split into
+        // the parts by the hash of the key, and each part is replayed and written in turn.
+        std::size_t input_bytes = 0;
+        for (auto const& path : inputs) input_bytes += file_size(path);
+        auto parts = std::max<std::size_t>(
+            1,
+            (input_bytes + config_.compaction_memory - 1) / std::max<std::size_t>(config_.compaction_memory, 1)
+        );
+
+        auto new_seq = segments.back();
+        auto tmp_path = snapshot_path(new_seq) + ".tmp";
+        auto* fp = std::fopen(tmp_path.c_str(), "wb");
+        if (!fp) {
+            ASYNC_MQTT_LOG("mqtt_broker", error)
+                << "session store: cannot open " << tmp_path;
+            return;
+        }
+        std::string frames;
+        std::string record;
+        bool ok = true;
+        for (std::size_t part = 0; part != parts && ok; ++part) {
+            session_images images;
+            auto filter =
+                [&](std::string_view r) {
+                    if (parts == 1) return true;
+                    auto key = session_record::key_of(r);
+                    // a malformed record is passed to stop the replay
+                    return !key || std::hash<std::string>{}(*key) % parts == part;
+                };
+            for (auto const& path : inputs) {
+                replay(path, images, filter);
+            }
+            for (auto const& [key, image] : images) {
+                session_record::encode_image(
+                    image,
+                    record,
+                    [&](std::string_view r) {
+                        boost::crc_32_type crc;
+                        crc.process_bytes(r.data(), r.size());
+                        put_u32(frames, static_cast<std::uint32_t>(r.size()));
+                        put_u32(frames, crc.checksum());
+                        frames.append(r);
+                    }
+                );
+                if (frames.size() >= config_.commit_bytes) {
+                    ok = ok && std::fwrite(frames.data(), 1, frames.size(), fp) == frames.size();
+                    frames.clear();
+                }
+            }
+        }
+        ok = ok && std::fwrite(frames.data(), 1, frames.size(), fp) == frames.size();
+        ok = sync_file(fp) && ok;
+        std::fclose(fp);
+        if (!ok) {
+            ASYNC_MQTT_LOG("mqtt_broker", error)
+                << "session store: cannot write " << tmp_path;
+            remove_file(tmp_path);
+            return;
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp_path, snapshot_path(new_seq), ec);
+        if (ec) {
+            remove_file(tmp_path);
+            return;
+        }
+        // The new snapshot must survive a crash before the inputs are removed.
+        sync_dir();
+        if (snapshot_seq) remove_file(snapshot_path(*snapshot_seq));
+        for (auto seq : segments) {
+            remove_file(segment_path(seq));
+        }
+        std::lock_guard<std::mutex> g{mtx_};
+        snapshot_seq_ = new_seq;
+        closed_segments_.erase(
+            closed_segments_.begin(),
+            closed_segments_.begin() + std::ptrdiff_t(segments.size())
+        );
+    }
+
+    void run_compaction() {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> g{mtx_};
+                cv_compact_.wait(g, [&] { return stop_ || compact_requested_; });
+                if (stop_) break;
+                compact_requested_ = false;
+            }
+            std::lock_guard<std::mutex> g{mtx_compaction_};
+            compact_closed_segments();
+        }
+    }
+
+    void run() {
+        std::string writing;
+        std::vector<std::function<void()>> ready_handlers;
+        while (true) {
+            std::uint64_t target;
+            bool stop;
+            {
+                std::unique_lock<std::mutex> g{mtx_};
+                cv_append_.wait(g, [&] { return stop_ || !pending_.empty(); });
+                // gather the following records into the group
+                cv_append_.wait_for(
+                    g,
+                    config_.commit_interval,
+                    [&] {
+                        return
+                            stop_ ||
+                            flush_requested_ ||
+                            pending_.size() >= config_.commit_bytes;
+                    }
+                );
+                flush_requested_ = false;
+                writing.swap(pending_);
+                target = appended_;
+                stop = stop_;
+            }
+            if (!writing.empty()) {
+                std::unique_lock<std::mutex> g_writer{mtx_writer_};
+                if (!write_segment(writing)) {
+                    g_writer.unlock();
+                    ASYNC_MQTT_LOG("mqtt_broker", error)
+                        << "session store: write failed, retry after "
+                        << config_.retry_interval.count() << "ms";
+                    std::unique_lock<std::mutex> g{mtx_};
+                    ++num_of_failures_;
+                    // The records are kept in front of the ones appended in the meantime.
+                    pending_.insert(0, writing);
+                    writing.clear();
+                    if (stop) {
+                        ASYNC_MQTT_LOG("mqtt_broker", error)
+                            << "session store: "
+                            << appended_ - committed_ << " records are not written";
+                        break;
+                    }
+                    cv_append_.wait_for(g, config_.retry_interval, [&] { return stop_; });
+                    continue;
+                }
+                {
+                    std::lock_guard<std::mutex> g{mtx_};
+                    ++num_of_commits_;
+                }
+                writing.clear();
+                if (segment_bytes_ >= config_.segment_size) {
+                    rotate();
+                    bool compact;
+                    {
+                        std::lock_guard<std::mutex> g{mtx_};
+                        compact = closed_segments_.size() >= config_.compaction_segments;
+                        compact_requested_ = compact_requested_ || compact;
+                    }
+                    if (compact) cv_compact_.notify_one();
+                }
+            }
+            {
+                std::lock_guard<std::mutex> g{mtx_};
+                committed_ = target;
+                while (!commit_handlers_.empty() && commit_handlers_.front().first <= target) {
+                    ready_handlers.push_back(force_move(commit_handlers_.front().second));
+                    commit_handlers_.pop_front();
+                }
+            }
+            cv_committed_.notify_all();
+            for (auto& h : ready_handlers) h();
+            ready_handlers.clear();
+            if (stop) break;
+        }
+    }
+
+    wal_session_store_config config_;
+
+    mutable std::mutex mtx_;
+    std::condition_variable cv_append_;
+    std::condition_variable cv_committed_;
+    std::string pending_;
+    std::uint64_t appended_ = 0;
+    std::uint64_t committed_ = 0;
+    std::uint64_t num_of_commits_ = 0;
+    std::uint64_t num_of_failures_ = 0;
+    std::vector<std::uint64_t> closed_segments_;
+    std::optional<std::uint64_t> snapshot_seq_;
+    // (the number of the appended records to be committed, handler)
+    std::deque<std::pair<std::uint64_t, std::function<void()>>> commit_handlers_;
+    std::condition_variable cv_compact_;
+    bool flush_requested_ = false;
+    bool compact_requested_ = false;
+    bool stop_ = false;
+
+    // files are accessed under mtx_writer_
+    std::mutex mtx_writer_;
+    std::FILE* fp_ = nullptr;
+    std::size_t segment_bytes_ = 0;
+    std::uint64_t next_seq_ = 1;
+
+    // the snapshot and the closed segments are compacted under mtx_compaction_
+    std::mutex mtx_compaction_;
+
+    std::thread writer_;
+    std::thread compactor_;
+};
+
+} // namespace async_mqtt
+
+#endif // ASYNC_MQTT_BROKER_WAL_SESSION_STORE_HPP